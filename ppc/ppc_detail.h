@@ -7,6 +7,12 @@
 #include <cstdio>
 #include <cstdint>
 
+// Native x86 replacements for hot SIMDE-emulated VMX128 ops (opt-in, see
+// ppc_vmx_overrides.h). Pulls in SIMDE, so it goes before the __rdtsc macro.
+#ifdef PPC_VMX_OVERRIDES
+#include "ppc_vmx_overrides.h"
+#endif
+
 // ============================================================================
 // Timebase fix: XenonRecomp generates __rdtsc() for mftb instructions,
 // but the host TSC runs at ~3-4 GHz while the Xbox 360 timebase is 49.875 MHz.
@@ -0,0 +1,25 @@
+#pragma once
+
+// Timebase for the standalone build: XenonRecomp generates __rdtsc() for
+// mftb, which would read the host TSC (~3-4 GHz) instead of the Xbox 360's
+// 50 MHz timebase. Force-included ahead of ppc_context.h (see CMakeLists.txt)
+// to send those reads to the runtime, which scales timer_now() and logs the
+// value while recording (see src/replay.h). ppc_detail.h does the same for
+// the SDK build.
+//
+// The intrinsic headers that declare __rdtsc go first; their include guards
+// make the later includes in ppc_context.h no-ops, so the macro only ever
+// meets the generated calls.
+
+#include <x86/avx.h>
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include <cstdint>
+
+uint64_t ppc_guest_timebase();
+
+#define __rdtsc() ppc_guest_timebase()
@@ -0,0 +1,115 @@
+#pragma once
+
+// Native x86 overrides for hot SIMDE-emulated VMX128 operations.
+// Included via ppc_detail.h (PPC_VMX_OVERRIDES) or force-included by the
+// standalone build, so it must come BEFORE ppc_context.h. SIMDE is pulled in
+// here first; its include guard makes the later include in ppc_context.h a
+// no-op, and the macros below then redirect the generated code's calls.
+//
+// Every override must be bit-exact against the SIMDE path it replaces under
+// the same compile flags. tools/vmx_override_bench.cpp checks that, reports
+// whether results also match the default build's portable SIMDE path, and
+// times each op against both. tools/profile_vmx_ops.py ranks which VMX ops
+// are worth overriding.
+
+#include <x86/avx.h>
+
+#include <cstdint>
+#include <cstdio>
+
+#if defined(SIMDE_X86_SSE4_1_NATIVE)
+#include <immintrin.h>
+
+// ============================================================================
+// vmsum3fp128 / vmsum4fp128: XenonRecomp emits simde_mm_dp_ps(a, b, 0xEF/0xFF).
+// DPPS is 4 uops / ~11 cycles on Intel and 8 uops / ~15 cycles on Zen 2+.
+// mul + shuffle + add + two shuffles + add keeps the same association as
+// DPPS ((p0 + p1) + (p2 + p3)) with the same operand order per lane, so results
+// (including NaN payload selection and signed zeros) match bit for bit.
+// ============================================================================
+// addps/mulps with the operand order pinned. The compiler treats FP add and
+// mul as commutative and may swap operands, which changes which NaN payload
+// wins when both inputs are NaN.
+#if defined(__AVX__)
+#define PPC_VMX_ORDERED_OP(name, insn) \
+    inline __m128 name(__m128 a, __m128 b) \
+    { \
+        __m128 r; \
+        __asm__("v" insn " %2, %1, %0" : "=x"(r) : "x"(a), "x"(b)); \
+        return r; \
+    }
+#else
+#define PPC_VMX_ORDERED_OP(name, insn) \
+    inline __m128 name(__m128 a, __m128 b) \
+    { \
+        __asm__(insn " %1, %0" : "+x"(a) : "x"(b)); \
+        return a; \
+    }
+#endif
+
+PPC_VMX_ORDERED_OP(ppc_vmx_add_ps_ordered, "addps")
+PPC_VMX_ORDERED_OP(ppc_vmx_mul_ps_ordered, "mulps")
+#undef PPC_VMX_ORDERED_OP
+
+template <int imm>
+inline simde__m128 ppc_vmx_dp_ps(simde__m128 a, simde__m128 b)
+{
+    constexpr int mul_mask = (imm >> 4) & 0xF;
+    constexpr int dst_mask = imm & 0xF;
+
+    __m128 prod = ppc_vmx_mul_ps_ordered(a, b);
+    if constexpr (mul_mask != 0xF)
+        prod = _mm_blend_ps(_mm_setzero_ps(), prod, mul_mask);
+
+    // DPPS does not use one summation order for every lane: each lane adds
+    // the pairs with a different operand order, which only shows up as the
+    // NaN payload that wins when several products are NaN. Measured on Intel
+    // (the bench re-checks it on every host):
+    //   lane0 = (p1+p0)+(p3+p2)  lane1 = (p0+p1)+(p2+p3)
+    //   lane2 = (p3+p2)+(p1+p0)  lane3 = (p2+p3)+(p0+p1)
+    __m128 pair = ppc_vmx_add_ps_ordered(prod, _mm_shuffle_ps(prod, prod, 0xB1)); // [p0+p1, p1+p0, p2+p3, p3+p2]
+    __m128 sum = ppc_vmx_add_ps_ordered(_mm_shuffle_ps(pair, pair, 0xB1),
+                                        _mm_shuffle_ps(pair, pair, 0x1B));
+
+    if constexpr (dst_mask != 0xF)
+        sum = _mm_blend_ps(_mm_setzero_ps(), sum, dst_mask);
+    return sum;
+}
+
+#undef simde_mm_dp_ps
+#define simde_mm_dp_ps(a, b, imm) ppc_vmx_dp_ps<(imm)>((a), (b))
+
+#endif // SIMDE_X86_SSE4_1_NATIVE
+
+// ============================================================================
+// Execution profile (PPC_VMX_PROFILE=1)
+// tools/profile_vmx_ops.py --instrument inserts PPC_VMX_COUNT(id) after every
+// VMX instruction in a copy of the generated sources and writes the matching
+// ppc_vmx_profile_ids.h. Counts are dumped to vmx_profile.csv at exit.
+// ============================================================================
+#if defined(PPC_VMX_PROFILE) && PPC_VMX_PROFILE
+#include "ppc_vmx_profile_ids.h"
+
+inline uint64_t g_ppc_vmx_counts[PPC_VMX_OP_COUNT] = {};
+
+#define PPC_VMX_COUNT(id) (++g_ppc_vmx_counts[(id)])
+
+inline struct PpcVmxProfileDump
+{
+    ~PpcVmxProfileDump()
+    {
+        FILE* f = fopen("vmx_profile.csv", "w");
+        if (!f) return;
+        fprintf(f, "op,count\n");
+        for (int i = 0; i < PPC_VMX_OP_COUNT; i++)
+        {
+            if (g_ppc_vmx_counts[i])
+                fprintf(f, "%s,%llu\n", kPpcVmxOpNames[i], (unsigned long long)g_ppc_vmx_counts[i]);
+        }
+        fclose(f);
+        fprintf(stderr, "[VMX] Profile written to vmx_profile.csv\n");
+    }
+} g_ppc_vmx_profile_dump;
+#else
+#define PPC_VMX_COUNT(id) ((void)0)
+#endif
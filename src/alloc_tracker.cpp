@@ -0,0 +1,352 @@
+#include "alloc_tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Tables
+// ============================================================================
+
+struct LiveBlock
+{
+    uint32_t addr; // 0 = empty slot (the heap never hands out 0)
+    uint32_t size;
+    uint32_t frame;
+    uint32_t site;
+};
+
+struct Site
+{
+    uint32_t lr;
+    AllocSource source;
+    uint64_t live_blocks;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+    uint64_t allocs;        // whole run
+    uint64_t bytes;
+    uint64_t dump_allocs;   // since the previous dump
+    uint64_t dump_live_bytes; // live bytes at the previous dump
+};
+
+struct FrameCounts
+{
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t alloc_bytes;
+    uint64_t free_bytes;
+};
+
+static const char* SOURCE_NAMES[ALLOC_SOURCE_COUNT] = {"virtual", "physical", "pool", "xam"};
+
+static std::atomic<bool> g_enabled{false};
+static std::atomic<bool> g_dump_requested{false};
+static std::mutex g_track_lock;
+
+// Everything below is guarded by g_track_lock
+static FILE* g_out = nullptr;
+static std::vector<LiveBlock> g_live; // power-of-two size, linear probing
+static size_t g_live_count = 0;
+static std::vector<Site> g_sites;
+static std::unordered_map<uint64_t, uint32_t> g_site_index; // lr | source << 32
+static uint32_t g_frame = 0;
+static FrameCounts g_current = {};    // this frame so far
+static FrameCounts g_window = {};     // frames since the previous dump
+static FrameCounts g_window_max = {}; // the busiest of those frames, by allocs
+static uint32_t g_window_max_frame = 0;
+static uint32_t g_window_start = 0;   // frame of the previous dump
+static uint32_t g_dumps = 0;
+
+static size_t slot_of(uint32_t addr)
+{
+    // Blocks are at least 16-byte aligned
+    return ((addr >> 4) * 0x9E3779B1u) & (g_live.size() - 1);
+}
+
+static LiveBlock* live_find(uint32_t addr)
+{
+    if (g_live.empty())
+        return nullptr;
+    for (size_t i = slot_of(addr);; i = (i + 1) & (g_live.size() - 1))
+    {
+        if (g_live[i].addr == addr)
+            return &g_live[i];
+        if (g_live[i].addr == 0)
+            return nullptr;
+    }
+}
+
+static void live_insert(const LiveBlock& block);
+
+static void live_grow()
+{
+    std::vector<LiveBlock> old;
+    old.swap(g_live);
+    g_live.assign(std::max<size_t>(old.size() * 2, 4096), LiveBlock{});
+    for (const LiveBlock& b : old)
+    {
+        if (b.addr)
+            live_insert(b);
+    }
+}
+
+static void live_insert(const LiveBlock& block)
+{
+    size_t i = slot_of(block.addr);
+    while (g_live[i].addr)
+        i = (i + 1) & (g_live.size() - 1);
+    g_live[i] = block;
+}
+
+// Backward-shift deletion: no tombstones, so lookups stay short
+static void live_erase(LiveBlock* block)
+{
+    size_t mask = g_live.size() - 1;
+    size_t hole = block - g_live.data();
+    for (size_t i = (hole + 1) & mask; g_live[i].addr; i = (i + 1) & mask)
+    {
+        size_t home = slot_of(g_live[i].addr);
+        // Move the entry back if its home isn't in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            g_live[hole] = g_live[i];
+            hole = i;
+        }
+    }
+    g_live[hole].addr = 0;
+    g_live_count--;
+}
+
+static uint32_t site_for(uint32_t lr, AllocSource source)
+{
+    uint64_t key = lr | ((uint64_t)source << 32);
+    auto it = g_site_index.find(key);
+    if (it != g_site_index.end())
+        return it->second;
+    uint32_t index = (uint32_t)g_sites.size();
+    Site site = {};
+    site.lr = lr;
+    site.source = source;
+    g_sites.push_back(site);
+    g_site_index.emplace(key, index);
+    return index;
+}
+
+static void site_release(Site& site, uint32_t bytes, bool whole)
+{
+    site.live_bytes -= bytes;
+    if (whole)
+        site.live_blocks--;
+    g_current.frees += whole;
+    g_current.free_bytes += bytes;
+}
+
+static void on_dump_signal(int)
+{
+    g_dump_requested.store(true, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// Dump
+// ============================================================================
+
+static void write_dump()
+{
+    FILE* out = g_out;
+    uint32_t frames = std::max<uint32_t>(g_frame - g_window_start, 1);
+    g_dumps++;
+
+    uint64_t live_bytes = 0;
+    uint64_t by_source[ALLOC_SOURCE_COUNT] = {};
+    for (const Site& s : g_sites)
+    {
+        live_bytes += s.live_bytes;
+        by_source[s.source] += s.live_bytes;
+    }
+    fprintf(out, "=== Allocation dump %u, frame %u ===\n", g_dumps, g_frame);
+    fprintf(out, "live: %zu blocks, %.1f KB (", g_live_count, live_bytes / 1024.0);
+    for (int i = 0; i < ALLOC_SOURCE_COUNT; i++)
+        fprintf(out, "%s%s %.1f KB", i ? ", " : "", SOURCE_NAMES[i], by_source[i] / 1024.0);
+    fprintf(out, ")\n");
+
+    // Rates over the frames since the previous dump
+    fprintf(out, "\nframes %u-%u: %.2f allocs (%.1f KB) and %.2f frees (%.1f KB) per frame; "
+                 "busiest frame %u with %llu allocs (%.1f KB)\n",
+            g_window_start, g_frame, (double)g_window.allocs / frames,
+            g_window.alloc_bytes / 1024.0 / frames, (double)g_window.frees / frames,
+            g_window.free_bytes / 1024.0 / frames, g_window_max_frame,
+            (unsigned long long)g_window_max.allocs, g_window_max.alloc_bytes / 1024.0);
+
+    // The oldest live block of each site, for the leak report
+    std::vector<uint32_t> oldest(g_sites.size(), UINT32_MAX);
+    std::vector<uint64_t> old_blocks(g_sites.size(), 0);
+    for (const LiveBlock& b : g_live)
+    {
+        if (!b.addr)
+            continue;
+        oldest[b.site] = std::min(oldest[b.site], b.frame);
+        if (g_frame - b.frame >= ALLOC_LEAK_AGE_FRAMES)
+            old_blocks[b.site]++;
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < g_sites.size(); i++)
+    {
+        if (g_sites[i].live_blocks || g_sites[i].dump_allocs)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [](uint32_t a, uint32_t b) {
+        return g_sites[a].live_bytes > g_sites[b].live_bytes;
+    });
+    fprintf(out, "\nby call site (live bytes first):\n");
+    fprintf(out, "  %-10s  %-8s  %8s  %10s  %10s  %10s  %9s  %s\n",
+            "lr", "source", "live", "live KB", "peak KB", "allocs", "per frame", "oldest frame");
+    for (uint32_t i : order)
+    {
+        const Site& s = g_sites[i];
+        char age[16] = "-";
+        if (oldest[i] != UINT32_MAX)
+            snprintf(age, sizeof(age), "%u", oldest[i]);
+        fprintf(out, "  0x%08X  %-8s  %8llu  %10.1f  %10.1f  %10llu  %9.2f  %s\n",
+                s.lr, SOURCE_NAMES[s.source], (unsigned long long)s.live_blocks,
+                s.live_bytes / 1024.0, s.peak_bytes / 1024.0, (unsigned long long)s.allocs,
+                (double)s.dump_allocs / frames, age);
+    }
+
+    fprintf(out, "\nsuspected leaks (live bytes grew since frame %u, blocks older than %u frames):\n",
+            g_window_start, ALLOC_LEAK_AGE_FRAMES);
+    int leaks = 0;
+    for (uint32_t i : order)
+    {
+        const Site& s = g_sites[i];
+        if (s.live_bytes <= s.dump_live_bytes || !old_blocks[i])
+            continue;
+        fprintf(out, "  0x%08X  %-8s  +%.1f KB to %.1f KB, %llu of %llu blocks old, oldest from frame %u\n",
+                s.lr, SOURCE_NAMES[s.source], (s.live_bytes - s.dump_live_bytes) / 1024.0,
+                s.live_bytes / 1024.0, (unsigned long long)old_blocks[i],
+                (unsigned long long)s.live_blocks, oldest[i]);
+        leaks++;
+    }
+    if (!leaks)
+        fprintf(out, "  none\n");
+    fprintf(out, "\n");
+    fflush(out);
+
+    for (Site& s : g_sites)
+    {
+        s.dump_allocs = 0;
+        s.dump_live_bytes = s.live_bytes;
+    }
+    g_window = {};
+    g_window_max = {};
+    g_window_max_frame = g_frame;
+    g_window_start = g_frame;
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+bool alloc_tracker_open(const char* path)
+{
+    std::lock_guard<std::mutex> lock(g_track_lock);
+    g_out = fopen(path, "w");
+    if (!g_out)
+        return false;
+    g_live.assign(4096, LiveBlock{});
+#ifdef _WIN32
+    std::signal(SIGBREAK, on_dump_signal);
+#else
+    std::signal(SIGUSR1, on_dump_signal);
+#endif
+    atexit(alloc_tracker_dump);
+    g_enabled.store(true, std::memory_order_relaxed);
+    fprintf(stderr, "[MEM] Tracking guest allocations, dumps go to %s\n", path);
+    return true;
+}
+
+void alloc_tracker_add(uint32_t addr, uint32_t size, uint32_t lr, AllocSource source)
+{
+    if (!g_enabled.load(std::memory_order_relaxed) || !addr)
+        return;
+    std::lock_guard<std::mutex> lock(g_track_lock);
+    if (LiveBlock* stale = live_find(addr))
+    {
+        // Freed through a path we don't see; count it gone
+        site_release(g_sites[stale->site], stale->size, true);
+        live_erase(stale);
+    }
+    if ((g_live_count + 1) * 2 > g_live.size())
+        live_grow();
+    uint32_t index = site_for(lr, source);
+    live_insert({addr, size, g_frame, index});
+    g_live_count++;
+
+    Site& site = g_sites[index];
+    site.live_blocks++;
+    site.live_bytes += size;
+    site.peak_bytes = std::max(site.peak_bytes, site.live_bytes);
+    site.allocs++;
+    site.bytes += size;
+    site.dump_allocs++;
+    g_current.allocs++;
+    g_current.alloc_bytes += size;
+}
+
+void alloc_tracker_free(uint32_t addr, uint32_t bytes)
+{
+    if (!g_enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(g_track_lock);
+    LiveBlock* block = live_find(addr);
+    if (!block)
+        return;
+    Site& site = g_sites[block->site];
+    if (bytes == 0 || bytes >= block->size)
+    {
+        site_release(site, block->size, true);
+        live_erase(block);
+        return;
+    }
+    // The front of the block went; it now starts after it
+    site_release(site, bytes, false);
+    LiveBlock rest = *block;
+    rest.addr += bytes;
+    rest.size -= bytes;
+    live_erase(block);
+    live_insert(rest);
+    g_live_count++;
+}
+
+void alloc_tracker_frame()
+{
+    if (!g_enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(g_track_lock);
+    g_window.allocs += g_current.allocs;
+    g_window.frees += g_current.frees;
+    g_window.alloc_bytes += g_current.alloc_bytes;
+    g_window.free_bytes += g_current.free_bytes;
+    if (g_current.allocs > g_window_max.allocs)
+    {
+        g_window_max = g_current;
+        g_window_max_frame = g_frame;
+    }
+    g_current = {};
+    g_frame++;
+    if (g_dump_requested.exchange(false, std::memory_order_relaxed))
+        write_dump();
+}
+
+void alloc_tracker_dump()
+{
+    if (!g_enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(g_track_lock);
+    write_dump();
+}
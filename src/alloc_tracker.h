@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// Guest allocation tracker (--alloc-track=path), for finding which call sites
+// hold the heap and whether that grows over a long session.
+//
+// Every allocation stub (NtAllocateVirtualMemory, MmAllocatePhysicalMemoryEx,
+// ExAllocatePool*, XamAlloc) reports the block with the guest LR it was
+// called from and the frame number (VdSwap count), and the matching frees
+// remove it. Live blocks sit in an open-addressing table keyed by address
+// (16 bytes a block); per call site totals and per frame counts are kept as
+// blocks come and go, so a dump only has to sort.
+//
+// A dump is written to the path when the process gets SIGUSR1 (SIGBREAK,
+// Ctrl+Break, on Windows), at the next frame boundary, and at exit. It holds
+// the live blocks and bytes by call site, allocation and free rates over the
+// frames since the previous dump, and a leak report: call sites whose live
+// bytes grew since the previous dump and that still hold blocks older than
+// ALLOC_LEAK_AGE_FRAMES.
+//
+// The LR is the instruction after the call to the import, so allocations
+// through a game wrapper (operator new and the like) group under the
+// wrapper.
+//
+// Disabled, each hook is one relaxed load.
+
+enum AllocSource : uint8_t
+{
+    ALLOC_SOURCE_VIRTUAL,  // NtAllocateVirtualMemory
+    ALLOC_SOURCE_PHYSICAL, // MmAllocatePhysicalMemoryEx
+    ALLOC_SOURCE_POOL,     // ExAllocatePool*
+    ALLOC_SOURCE_XAM,      // XamAlloc
+    ALLOC_SOURCE_COUNT,
+};
+
+// Blocks at least this old count towards the leak report (30 s at 60 Hz)
+constexpr uint32_t ALLOC_LEAK_AGE_FRAMES = 1800;
+
+// Start tracking and write dumps to `path`. Call before the guest starts.
+// Returns false if the file can't be created.
+bool alloc_tracker_open(const char* path);
+
+// A block of `size` bytes was allocated at `addr` from guest address `lr`.
+void alloc_tracker_add(uint32_t addr, uint32_t size, uint32_t lr, AllocSource source);
+
+// `bytes` were freed from the start of the block at `addr`; 0 = all of it.
+void alloc_tracker_free(uint32_t addr, uint32_t bytes);
+
+// Frame boundary (VdSwap): advance the frame number and write a requested dump.
+void alloc_tracker_frame();
+
+// Write a dump now.
+void alloc_tracker_dump();
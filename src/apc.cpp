@@ -0,0 +1,263 @@
+#include "ppc_config.h"
+#include "ppc_context.h"
+#include "apc.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Guest layout and queues
+// ============================================================================
+
+static constexpr uint32_t KAPC_TYPE            = 0x00;
+static constexpr uint32_t KAPC_MODE            = 0x02;
+static constexpr uint32_t KAPC_INSERTED        = 0x03;
+static constexpr uint32_t KAPC_THREAD          = 0x04;
+static constexpr uint32_t KAPC_LIST_ENTRY      = 0x08;
+static constexpr uint32_t KAPC_KERNEL_ROUTINE  = 0x10;
+static constexpr uint32_t KAPC_RUNDOWN_ROUTINE = 0x14;
+static constexpr uint32_t KAPC_NORMAL_ROUTINE  = 0x18;
+static constexpr uint32_t KAPC_NORMAL_CONTEXT  = 0x1C;
+static constexpr uint32_t KAPC_ARG1            = 0x20;
+static constexpr uint32_t KAPC_ARG2            = 0x24;
+
+static constexpr uint16_t KAPC_TYPE_APC = 18;
+
+// Routines run this far below the caller's stack pointer, with the kernel
+// routine's out-parameters in between
+static constexpr uint32_t APC_SCRATCH_OFFSET = 0x80;
+static constexpr uint32_t APC_FRAME_OFFSET   = 0x100;
+
+struct ApcEntry
+{
+    uint32_t apc; // guest KAPC, or 0 for a bare routine
+    uint32_t routine;
+    uint32_t context;
+    uint32_t arg1;
+    uint32_t arg2;
+};
+
+struct ApcQueue
+{
+    std::deque<ApcEntry> entries;
+    GuestThread* alert_waiter = nullptr; // in an alertable wait
+};
+
+struct DpcEntry
+{
+    uint32_t routine;
+    uint32_t arg1;
+    uint32_t arg2;
+};
+
+// Keyed by KTHREAD address
+static std::mutex g_apc_lock;
+static std::unordered_map<uint32_t, ApcQueue> g_apc_queues;
+
+static std::mutex g_dpc_lock;
+static std::vector<DpcEntry> g_dpcs;
+
+// Caller holds g_apc_lock
+static void apc_push(uint32_t thread, const ApcEntry& entry)
+{
+    ApcQueue& queue = g_apc_queues[thread];
+    queue.entries.push_back(entry);
+    if (queue.alert_waiter)
+        scheduler_unpark(queue.alert_waiter);
+}
+
+static bool apc_pop(uint32_t thread, ApcEntry* entry)
+{
+    std::lock_guard<std::mutex> lock(g_apc_lock);
+    auto it = g_apc_queues.find(thread);
+    if (it == g_apc_queues.end() || it->second.entries.empty())
+        return false;
+    *entry = it->second.entries.front();
+    it->second.entries.pop_front();
+    return true;
+}
+
+// Call a guest routine with up to five arguments on a copy of the caller's
+// context, `sp` as its stack pointer
+static void apc_call(PPCContext& ctx, uint8_t* base, uint32_t sp, uint32_t routine,
+                     uint32_t r3, uint32_t r4, uint32_t r5, uint32_t r6 = 0, uint32_t r7 = 0)
+{
+    if (routine < (uint32_t)PPC_CODE_BASE || routine >= (uint32_t)(PPC_CODE_BASE + PPC_CODE_SIZE))
+    {
+        static std::atomic<bool> logged{false};
+        if (!logged.exchange(true))
+            fprintf(stderr, "[APC] Routine 0x%08X is outside the recompiled code (skipped)\n", routine);
+        return;
+    }
+    PPCFunc* fn = PPC_LOOKUP_FUNC(base, routine);
+    if (!fn)
+    {
+        fprintf(stderr, "[APC] No function at 0x%08X\n", routine);
+        return;
+    }
+    PPCContext call = ctx;
+    call.r1.u32 = sp;
+    call.r3.u64 = r3;
+    call.r4.u64 = r4;
+    call.r5.u64 = r5;
+    call.r6.u64 = r6;
+    call.r7.u64 = r7;
+    fn(call, base);
+}
+
+// ============================================================================
+// APCs
+// ============================================================================
+
+void apc_init(uint8_t* base, uint32_t apc, uint32_t thread, uint32_t kernel_routine,
+              uint32_t rundown_routine, uint32_t normal_routine, uint8_t mode,
+              uint32_t normal_context)
+{
+    if (!thread)
+        thread = scheduler_thread_object();
+    base[apc + KAPC_TYPE] = (uint8_t)(KAPC_TYPE_APC >> 8);
+    base[apc + KAPC_TYPE + 1] = (uint8_t)KAPC_TYPE_APC;
+    base[apc + KAPC_MODE] = mode;
+    base[apc + KAPC_INSERTED] = 0;
+    PPC_STORE_U32(apc + KAPC_THREAD, thread);
+    PPC_STORE_U32(apc + KAPC_LIST_ENTRY, 0);
+    PPC_STORE_U32(apc + KAPC_LIST_ENTRY + 4, 0);
+    PPC_STORE_U32(apc + KAPC_KERNEL_ROUTINE, kernel_routine);
+    PPC_STORE_U32(apc + KAPC_RUNDOWN_ROUTINE, rundown_routine);
+    PPC_STORE_U32(apc + KAPC_NORMAL_ROUTINE, normal_routine);
+    // A kernel-only APC has no normal context
+    PPC_STORE_U32(apc + KAPC_NORMAL_CONTEXT, normal_routine ? normal_context : 0);
+    PPC_STORE_U32(apc + KAPC_ARG1, 0);
+    PPC_STORE_U32(apc + KAPC_ARG2, 0);
+}
+
+bool apc_insert(uint8_t* base, uint32_t apc, uint32_t arg1, uint32_t arg2)
+{
+    std::lock_guard<std::mutex> lock(g_apc_lock);
+    if (base[apc + KAPC_INSERTED])
+        return false;
+    PPC_STORE_U32(apc + KAPC_ARG1, arg1);
+    PPC_STORE_U32(apc + KAPC_ARG2, arg2);
+    base[apc + KAPC_INSERTED] = 1;
+    apc_push(PPC_LOAD_U32(apc + KAPC_THREAD), {apc, 0, 0, 0, 0});
+    return true;
+}
+
+void apc_queue_routine(uint32_t thread, uint32_t routine, uint32_t context,
+                       uint32_t arg1, uint32_t arg2)
+{
+    std::lock_guard<std::mutex> lock(g_apc_lock);
+    apc_push(thread, {0, routine, context, arg1, arg2});
+}
+
+bool apc_alert_begin(GuestThread* waiter)
+{
+    std::lock_guard<std::mutex> lock(g_apc_lock);
+    ApcQueue& queue = g_apc_queues[scheduler_thread_object()];
+    if (!queue.entries.empty())
+        return true;
+    queue.alert_waiter = waiter;
+    return false;
+}
+
+bool apc_alert_pending()
+{
+    std::lock_guard<std::mutex> lock(g_apc_lock);
+    auto it = g_apc_queues.find(scheduler_thread_object());
+    return it != g_apc_queues.end() && !it->second.entries.empty();
+}
+
+void apc_alert_end()
+{
+    std::lock_guard<std::mutex> lock(g_apc_lock);
+    auto it = g_apc_queues.find(scheduler_thread_object());
+    if (it != g_apc_queues.end())
+        it->second.alert_waiter = nullptr;
+}
+
+int apc_deliver(PPCContext& ctx, uint8_t* base)
+{
+    uint32_t thread = scheduler_thread_object();
+    uint32_t scratch = (ctx.r1.u32 - APC_SCRATCH_OFFSET) & ~0xFu;
+    uint32_t sp = (ctx.r1.u32 - APC_FRAME_OFFSET) & ~0xFu;
+    int delivered = 0;
+    ApcEntry entry;
+    // One at a time: routines may queue more, or wait alertably themselves
+    while (apc_pop(thread, &entry))
+    {
+        delivered++;
+        if (!entry.apc)
+        {
+            apc_call(ctx, base, sp, entry.routine, entry.context, entry.arg1, entry.arg2);
+            continue;
+        }
+        // Read everything first: the kernel routine may free the KAPC
+        uint32_t apc = entry.apc;
+        uint32_t kernel_routine = PPC_LOAD_U32(apc + KAPC_KERNEL_ROUTINE);
+        PPC_STORE_U32(scratch + 0x0, PPC_LOAD_U32(apc + KAPC_NORMAL_ROUTINE));
+        PPC_STORE_U32(scratch + 0x4, PPC_LOAD_U32(apc + KAPC_NORMAL_CONTEXT));
+        PPC_STORE_U32(scratch + 0x8, PPC_LOAD_U32(apc + KAPC_ARG1));
+        PPC_STORE_U32(scratch + 0xC, PPC_LOAD_U32(apc + KAPC_ARG2));
+        base[apc + KAPC_INSERTED] = 0;
+        if (kernel_routine)
+        {
+            apc_call(ctx, base, sp, kernel_routine, apc,
+                     scratch + 0x0, scratch + 0x4, scratch + 0x8, scratch + 0xC);
+        }
+        // The kernel routine may have changed or cleared the normal routine
+        uint32_t normal_routine = PPC_LOAD_U32(scratch + 0x0);
+        if (normal_routine)
+        {
+            apc_call(ctx, base, sp, normal_routine, PPC_LOAD_U32(scratch + 0x4),
+                     PPC_LOAD_U32(scratch + 0x8), PPC_LOAD_U32(scratch + 0xC));
+        }
+    }
+    return delivered;
+}
+
+void apc_thread_exit(uint8_t* base, uint32_t thread)
+{
+    std::lock_guard<std::mutex> lock(g_apc_lock);
+    auto it = g_apc_queues.find(thread);
+    if (it == g_apc_queues.end())
+        return;
+    if (!it->second.entries.empty())
+    {
+        fprintf(stderr, "[APC] Thread 0x%08X ended with %zu APCs queued (dropped)\n",
+                thread, it->second.entries.size());
+        for (const ApcEntry& entry : it->second.entries)
+        {
+            if (entry.apc)
+                base[entry.apc + KAPC_INSERTED] = 0;
+        }
+    }
+    g_apc_queues.erase(it);
+}
+
+// ============================================================================
+// DPCs
+// ============================================================================
+
+void dpc_queue(uint32_t routine, uint32_t arg1, uint32_t arg2)
+{
+    std::lock_guard<std::mutex> lock(g_dpc_lock);
+    g_dpcs.push_back({routine, arg1, arg2});
+}
+
+int dpc_run(PPCContext& ctx, uint8_t* base)
+{
+    std::vector<DpcEntry> dpcs;
+    {
+        std::lock_guard<std::mutex> lock(g_dpc_lock);
+        dpcs.swap(g_dpcs);
+    }
+    uint32_t sp = (ctx.r1.u32 - APC_FRAME_OFFSET) & ~0xFu;
+    for (const DpcEntry& dpc : dpcs)
+        apc_call(ctx, base, sp, dpc.routine, dpc.arg1, dpc.arg2, 0);
+    return (int)dpcs.size();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+struct PPCContext;
+struct GuestThread;
+
+// Asynchronous procedure calls and deferred procedure calls.
+//
+// APCs are queued to a thread (its KTHREAD address, see
+// scheduler_thread_object) and run on that thread the next time it enters an
+// alertable wait: KeWaitFor* / NtWaitFor*Ex / KeDelayExecutionThread with
+// Alertable set. A wait that finds APCs queued, or is woken by one, runs
+// them all in FIFO order and returns STATUS_USER_APC instead of waiting
+// (see kobj_wait). Non-alertable waits leave them queued.
+//
+// Guest KAPCs use the Xbox 360 layout:
+//
+//   +0x00  Type = 18, +0x02 ApcMode, +0x03 Inserted
+//   +0x04  Thread          KTHREAD the APC is queued to
+//   +0x08  ApcListEntry
+//   +0x10  KernelRoutine   (Apc, &NormalRoutine, &NormalContext, &Arg1, &Arg2)
+//   +0x14  RundownRoutine
+//   +0x18  NormalRoutine   (NormalContext, Arg1, Arg2)
+//   +0x1C  NormalContext
+//   +0x20  SystemArgument1
+//   +0x24  SystemArgument2
+//
+// The runtime queues bare routines the same way for I/O completion
+// (NtReadFile's ApcRoutine) and timer APCs (NtSetTimerEx).
+//
+// DPCs are routines queued from any thread and run at the next frame
+// boundary (VdSwap) on the thread that swaps; the vblank graphics interrupt
+// callback is delivered through them.
+//
+// Routines are called on the current guest stack, below the caller's frame.
+// Addresses outside the recompiled code (import thunks such as
+// KiApcNormalRoutineNop) are skipped.
+//
+// Record / replay: queueing is only deterministic from the thread the guest
+// runs on or from a replay sync point (replay_post). Everything queued today
+// is (guest calls, kernel timers, VdSwap).
+
+constexpr uint32_t APC_STATUS_USER_APC = 0x000000C0;
+
+// KeInitializeApc: fill in the guest KAPC. thread 0 = the calling thread.
+void apc_init(uint8_t* base, uint32_t apc, uint32_t thread, uint32_t kernel_routine,
+              uint32_t rundown_routine, uint32_t normal_routine, uint8_t mode,
+              uint32_t normal_context);
+
+// KeInsertQueueApc: queue a guest KAPC to its thread with the two system
+// arguments. Returns false if it is already queued.
+bool apc_insert(uint8_t* base, uint32_t apc, uint32_t arg1, uint32_t arg2);
+
+// Queue routine(context, arg1, arg2) to the thread whose KTHREAD is `thread`.
+void apc_queue_routine(uint32_t thread, uint32_t routine, uint32_t context,
+                       uint32_t arg1, uint32_t arg2);
+
+// Alertable waits (kobj_wait). apc_alert_begin returns true if the calling
+// thread has APCs queued; otherwise queueing one unparks `waiter` until
+// apc_alert_end.
+bool apc_alert_begin(GuestThread* waiter);
+bool apc_alert_pending();
+void apc_alert_end();
+
+// Run the calling thread's queued APCs. Returns how many ran.
+int apc_deliver(PPCContext& ctx, uint8_t* base);
+
+// The thread ended: drop what is still queued to it, as its KTHREAD may be
+// reused by the next thread.
+void apc_thread_exit(uint8_t* base, uint32_t thread);
+
+// Queue routine(arg1, arg2) for the next dpc_run. Any thread.
+void dpc_queue(uint32_t routine, uint32_t arg1, uint32_t arg2);
+
+// Frame boundary: run the queued DPCs. Returns how many ran.
+int dpc_run(PPCContext& ctx, uint8_t* base);
@@ -0,0 +1,190 @@
+#include "asset_pack.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t asset_pack_hash(const char* key, size_t length)
+{
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (size_t i = 0; i < length; i++)
+        h = (h ^ (uint8_t)key[i]) * 1099511628211ull;
+    return h;
+}
+
+// ============================================================================
+// Mapping
+// ============================================================================
+
+#ifdef _WIN32
+
+static bool map_pack(const char* path, AssetPack* pack)
+{
+    HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    const void* view = nullptr;
+    if (GetFileSizeEx(h, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(h);
+        return false;
+    }
+    pack->file = h;
+    pack->mapping = mapping;
+    pack->base = (const uint8_t*)view;
+    pack->size = (uint64_t)size.QuadPart;
+    return true;
+}
+
+static void unmap_pack(AssetPack* pack)
+{
+    UnmapViewOfFile(pack->base);
+    CloseHandle(pack->mapping);
+    CloseHandle(pack->file);
+}
+
+#else
+
+static bool map_pack(const char* path, AssetPack* pack)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file
+    if (view == MAP_FAILED)
+        return false;
+    pack->base = (const uint8_t*)view;
+    pack->size = (uint64_t)st.st_size;
+    return true;
+}
+
+static void unmap_pack(AssetPack* pack)
+{
+    munmap((void*)pack->base, (size_t)pack->size);
+}
+
+#endif
+
+// ============================================================================
+// API
+// ============================================================================
+
+// Every table and range inside the mapping, so lookups and reads can trust it
+static bool validate(const AssetPack& pack)
+{
+    uint64_t size = pack.size;
+    if (size < sizeof(AssetPackHeader))
+        return false;
+    const AssetPackHeader& h = *pack.header;
+    if (memcmp(h.magic, ASSET_PACK_MAGIC, sizeof(h.magic)) != 0 || h.version != ASSET_PACK_VERSION ||
+        h.total_size != size || h.entry_count == 0)
+        return false;
+    if (h.entries_offset > size || (size - h.entries_offset) / sizeof(AssetPackEntry) < h.entry_count ||
+        h.entries_offset % alignof(AssetPackEntry) != 0)
+        return false;
+    if (h.children_offset > size || (size - h.children_offset) / sizeof(uint32_t) < h.child_count ||
+        h.children_offset % alignof(uint32_t) != 0)
+        return false;
+    if (h.strings_offset > h.data_offset || h.data_offset > size)
+        return false;
+
+    uint64_t strings_size = h.data_offset - h.strings_offset;
+    for (uint32_t i = 0; i < h.entry_count; i++)
+    {
+        const AssetPackEntry& e = pack.entries[i];
+        if ((uint64_t)e.key_offset + e.key_length > strings_size ||
+            (uint64_t)e.name_offset + e.name_length > strings_size)
+            return false;
+        if (i > 0 && e.hash < pack.entries[i - 1].hash)
+            return false;
+        if (e.flags & ASSET_PACK_DIRECTORY)
+        {
+            if ((uint64_t)e.first_child + e.child_count > h.child_count)
+                return false;
+        }
+        else if (e.data_offset > size || e.size > size - e.data_offset)
+        {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < h.child_count; i++)
+    {
+        if (pack.children[i] >= h.entry_count)
+            return false;
+    }
+    return true;
+}
+
+bool asset_pack_open(const char* path, AssetPack* pack)
+{
+    *pack = AssetPack{};
+    if (!map_pack(path, pack))
+        return false;
+    pack->header = (const AssetPackHeader*)pack->base;
+    if (pack->size >= sizeof(AssetPackHeader))
+    {
+        const AssetPackHeader& h = *pack->header;
+        pack->entries = (const AssetPackEntry*)(pack->base + h.entries_offset);
+        pack->children = (const uint32_t*)(pack->base + h.children_offset);
+        pack->strings = (const char*)pack->base + h.strings_offset;
+    }
+    if (!validate(*pack))
+    {
+        fprintf(stderr, "[FILE] %s is not a valid asset pack\n", path);
+        asset_pack_close(pack);
+        return false;
+    }
+    return true;
+}
+
+void asset_pack_close(AssetPack* pack)
+{
+    if (pack->base)
+        unmap_pack(pack);
+    *pack = AssetPack{};
+}
+
+int64_t asset_pack_find(const AssetPack& pack, const char* key, size_t length)
+{
+    uint64_t hash = asset_pack_hash(key, length);
+    uint32_t lo = 0, hi = pack.header->entry_count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (pack.entries[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (uint32_t i = lo; i < pack.header->entry_count && pack.entries[i].hash == hash; i++)
+    {
+        const AssetPackEntry& e = pack.entries[i];
+        if (e.key_length == length && memcmp(pack.strings + e.key_offset, key, length) == 0)
+            return i;
+    }
+    return -1;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Asset packs: the extracted/ tree in one file (tools/pack_assets.cpp), for
+// the game: device (path_index_mount_pack).
+//
+// Layout, little-endian:
+//
+//   AssetPackHeader
+//   AssetPackEntry[entry_count]  sorted by hash, then key
+//   uint32_t[child_count]        children of each directory, by name
+//   strings                      keys and names, not terminated
+//   payloads                     each file at a page boundary, in the order
+//                                the game first reads them
+//
+// A key is the guest path under the device as path_index.h folds it: lower
+// case, '/' separators, none leading or trailing; the root is "". Its hash
+// is FNV-1a 64, so a lookup is a binary search of the entries with no
+// strings touched until the hash matches.
+//
+// The pack is mapped whole and read only. Files opened from it read out of
+// the mapping (host_file_open_memory): no open, stat, read or close per
+// file, and the page cache sees one file laid out in load order.
+
+constexpr char     ASSET_PACK_MAGIC[8] = {'S', 'A', 'P', 'A', 'C', 'K', '\r', '\n'};
+constexpr uint32_t ASSET_PACK_VERSION = 1;
+constexpr uint32_t ASSET_PACK_ALIGN = 4096;
+
+constexpr uint32_t ASSET_PACK_DIRECTORY = 1; // AssetPackEntry::flags
+
+struct AssetPackHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t child_count;
+    uint32_t reserved;
+    uint64_t entries_offset;
+    uint64_t children_offset;
+    uint64_t strings_offset;
+    uint64_t data_offset;  // first payload
+    uint64_t total_size;   // the whole pack
+};
+
+struct AssetPackEntry
+{
+    uint64_t hash;
+    uint64_t data_offset;  // files: from the start of the pack
+    uint64_t size;
+    uint32_t key_offset;   // in the strings
+    uint32_t key_length;
+    uint32_t name_offset;  // last component as on the host
+    uint32_t name_length;
+    uint32_t first_child;  // directories: into the child table
+    uint32_t child_count;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(AssetPackHeader) == 64, "pack header layout");
+static_assert(sizeof(AssetPackEntry) == 56, "pack entry layout");
+
+struct AssetPack
+{
+    const uint8_t* base = nullptr; // the mapping
+    uint64_t size = 0;
+    const AssetPackHeader* header = nullptr;
+    const AssetPackEntry* entries = nullptr;
+    const uint32_t* children = nullptr;
+    const char* strings = nullptr;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+uint64_t asset_pack_hash(const char* key, size_t length);
+
+// Map a pack and check its header and tables. Returns false if it can't be
+// read or isn't a valid pack.
+bool asset_pack_open(const char* path, AssetPack* pack);
+void asset_pack_close(AssetPack* pack);
+
+// Entry index of a folded key, -1 if it isn't in the pack.
+int64_t asset_pack_find(const AssetPack& pack, const char* key, size_t length);
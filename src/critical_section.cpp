@@ -0,0 +1,352 @@
+#include "ppc_config.h"
+#include "ppc_context.h"
+#include "critical_section.h"
+#include "guest_atomic.h"
+#include "kernel_objects.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ============================================================================
+// Guest layout
+// ============================================================================
+
+static constexpr uint32_t CS_HEADER_TYPE     = 0x00;
+static constexpr uint32_t CS_HEADER_SPIN     = 0x01; // spin count / 256
+static constexpr uint32_t CS_HEADER_SIGNAL   = 0x04;
+static constexpr uint32_t CS_HEADER_WAITLIST = 0x08;
+static constexpr uint32_t CS_LOCK_COUNT      = 0x10;
+static constexpr uint32_t CS_RECURSION_COUNT = 0x14;
+static constexpr uint32_t CS_OWNING_THREAD   = 0x18;
+
+static constexpr uint8_t CS_TYPE = 1; // synchronization (auto reset) event
+
+// LockCount states
+static constexpr uint32_t CS_FREE    = (uint32_t)-1;
+static constexpr uint32_t CS_HELD    = 0;
+static constexpr uint32_t CS_WAITERS = 1; // held, and someone may be waiting
+
+// Take a free section
+static inline bool cs_try_take(uint8_t* base, uint32_t cs)
+{
+    uint32_t expected = CS_FREE;
+    return guest_atomic_cas(base, cs + CS_LOCK_COUNT, expected, CS_HELD);
+}
+
+// ============================================================================
+// Statistics
+// ============================================================================
+
+// Cheap timestamps for hold times, converted to ns at report time
+static inline uint64_t cs_clock()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return __builtin_ia32_rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static uint64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct CsStats
+{
+    std::atomic<uint32_t> addr{0};          // 0 = free entry
+    std::atomic<uint32_t> spin_estimate{0}; // spins recent contended acquires needed
+    std::atomic<uint64_t> acquires{0};
+    std::atomic<uint64_t> contentions{0};   // not free on the first try
+    std::atomic<uint64_t> parks{0};         // gave up spinning and waited
+    std::atomic<uint64_t> hold_sum{0};      // cs_clock ticks
+    std::atomic<uint64_t> hold_max{0};
+    uint64_t acquired_at = 0;               // written by the owner only
+};
+
+// Open addressing on the guest address; entries are never removed. Sections
+// that don't fit share the overflow entry (address 0), which doesn't time
+// holds.
+static constexpr uint32_t CS_STATS_SIZE = 4096;
+static constexpr uint32_t CS_STATS_PROBE = 32;
+static CsStats g_cs_stats[CS_STATS_SIZE];
+static CsStats g_cs_overflow;
+
+static uint64_t g_calib_clock = cs_clock();
+static uint64_t g_calib_ns = steady_ns();
+
+static CsStats& cs_stats(uint32_t cs)
+{
+    uint32_t idx = (cs >> 2) * 0x9E3779B1u;
+    for (uint32_t i = 0; i < CS_STATS_PROBE; i++)
+    {
+        CsStats& st = g_cs_stats[(idx + i) & (CS_STATS_SIZE - 1)];
+        uint32_t addr = st.addr.load(std::memory_order_acquire);
+        if (addr == cs)
+            return st;
+        if (addr == 0)
+        {
+            if (st.addr.compare_exchange_strong(addr, cs) || addr == cs)
+                return st;
+        }
+    }
+    return g_cs_overflow;
+}
+
+static void cs_hold_begin(CsStats& st)
+{
+    if (&st != &g_cs_overflow)
+        st.acquired_at = cs_clock();
+}
+
+static void cs_hold_end(CsStats& st)
+{
+    if (&st == &g_cs_overflow)
+        return;
+    uint64_t held = cs_clock() - st.acquired_at;
+    st.hold_sum.fetch_add(held, std::memory_order_relaxed);
+    uint64_t max = st.hold_max.load(std::memory_order_relaxed);
+    while (held > max && !st.hold_max.compare_exchange_weak(max, held, std::memory_order_relaxed))
+        ;
+}
+
+// ============================================================================
+// Spinning
+// ============================================================================
+
+static constexpr uint32_t CS_MIN_SPIN = 16;
+static constexpr uint32_t CS_MAX_SPIN = 4096;
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// Spin while the section is held, for up to twice what recent acquires
+// needed. Returns true with the section taken. In Fiber mode
+// the owner can't run while we spin, so go straight to waiting.
+static bool cs_spin(uint8_t* base, uint32_t cs, CsStats& st)
+{
+    if (scheduler_mode() == ThreadMode::Fiber)
+        return false;
+    uint32_t guest_limit = base[cs + CS_HEADER_SPIN] * 256u;
+    uint32_t estimate = st.spin_estimate.load(std::memory_order_relaxed);
+    uint32_t limit = std::min({guest_limit ? guest_limit : CS_MAX_SPIN, CS_MAX_SPIN,
+                               2 * estimate + CS_MIN_SPIN});
+    for (uint32_t n = 1; n <= limit; n++)
+    {
+        cpu_relax();
+        if (guest_atomic_load(base, cs + CS_LOCK_COUNT) == CS_FREE && cs_try_take(base, cs))
+        {
+            st.spin_estimate.store(estimate + ((int32_t)(n - estimate) / 8), std::memory_order_relaxed);
+            return true;
+        }
+    }
+    st.spin_estimate.store(estimate / 2, std::memory_order_relaxed);
+    return false;
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+static std::mutex g_cs_init_lock;
+
+static void cs_write_header(uint8_t* base, uint32_t cs, uint32_t spin_count)
+{
+    base[cs + CS_HEADER_SPIN] = (uint8_t)std::min((spin_count + 255) / 256, 255u);
+    PPC_STORE_U32(cs + CS_HEADER_SIGNAL, 0);
+    PPC_STORE_U32(cs + CS_HEADER_WAITLIST, cs + CS_HEADER_WAITLIST);
+    PPC_STORE_U32(cs + CS_HEADER_WAITLIST + 4, cs + CS_HEADER_WAITLIST);
+    PPC_STORE_U32(cs + CS_LOCK_COUNT, CS_FREE);
+    PPC_STORE_U32(cs + CS_RECURSION_COUNT, 0);
+    PPC_STORE_U32(cs + CS_OWNING_THREAD, 0);
+    kobj_create_event(cs, false, false);
+    std::atomic_ref<uint8_t>(base[cs + CS_HEADER_TYPE]).store(CS_TYPE, std::memory_order_release);
+}
+
+static inline void cs_ensure_init(uint8_t* base, uint32_t cs)
+{
+    if (std::atomic_ref<uint8_t>(base[cs + CS_HEADER_TYPE]).load(std::memory_order_acquire) == CS_TYPE)
+        return;
+    std::lock_guard<std::mutex> lock(g_cs_init_lock);
+    if (base[cs + CS_HEADER_TYPE] != CS_TYPE)
+        cs_write_header(base, cs, 0);
+}
+
+void cs_init(uint8_t* base, uint32_t cs, uint32_t spin_count)
+{
+    std::lock_guard<std::mutex> lock(g_cs_init_lock);
+    cs_write_header(base, cs, spin_count);
+}
+
+void cs_enter(uint8_t* base, uint32_t cs)
+{
+    cs_ensure_init(base, cs);
+    uint32_t self = scheduler_thread_object();
+    if (guest_atomic_load(base, cs + CS_OWNING_THREAD) == self)
+    {
+        PPC_STORE_U32(cs + CS_RECURSION_COUNT, PPC_LOAD_U32(cs + CS_RECURSION_COUNT) + 1);
+        return;
+    }
+
+    CsStats& st = cs_stats(cs);
+    st.acquires.fetch_add(1, std::memory_order_relaxed);
+    if (!cs_try_take(base, cs))
+    {
+        st.contentions.fetch_add(1, std::memory_order_relaxed);
+        // Mark the section as having waiters and wait for a leave to signal
+        // it. Whoever takes it this way keeps the mark, so its own leave
+        // wakes the next waiter. A leave doesn't hand the section over: the
+        // woken thread competes for it again, which keeps a thread that
+        // re-enters in a loop from forcing a switch per acquire.
+        if (!cs_spin(base, cs, st))
+        {
+            while (guest_atomic_exchange(base, cs + CS_LOCK_COUNT, CS_WAITERS) != CS_FREE)
+            {
+                st.parks.fetch_add(1, std::memory_order_relaxed);
+                kobj_wait(base, &cs, 1, false, nullptr);
+            }
+        }
+    }
+    guest_atomic_store(base, cs + CS_OWNING_THREAD, self);
+    PPC_STORE_U32(cs + CS_RECURSION_COUNT, 1);
+    cs_hold_begin(st);
+}
+
+bool cs_try_enter(uint8_t* base, uint32_t cs)
+{
+    cs_ensure_init(base, cs);
+    uint32_t self = scheduler_thread_object();
+    if (cs_try_take(base, cs))
+    {
+        CsStats& st = cs_stats(cs);
+        st.acquires.fetch_add(1, std::memory_order_relaxed);
+        guest_atomic_store(base, cs + CS_OWNING_THREAD, self);
+        PPC_STORE_U32(cs + CS_RECURSION_COUNT, 1);
+        cs_hold_begin(st);
+        return true;
+    }
+    if (guest_atomic_load(base, cs + CS_OWNING_THREAD) != self)
+        return false;
+    PPC_STORE_U32(cs + CS_RECURSION_COUNT, PPC_LOAD_U32(cs + CS_RECURSION_COUNT) + 1);
+    return true;
+}
+
+void cs_leave(uint8_t* base, uint32_t cs)
+{
+    cs_ensure_init(base, cs);
+    if (guest_atomic_load(base, cs + CS_OWNING_THREAD) != scheduler_thread_object())
+    {
+        static std::atomic<bool> logged{false};
+        if (!logged.exchange(true))
+            fprintf(stderr, "[LOCK] Leave of critical section 0x%08X by a thread that doesn't own it (ignored)\n", cs);
+        return;
+    }
+    uint32_t recursion = PPC_LOAD_U32(cs + CS_RECURSION_COUNT) - 1;
+    PPC_STORE_U32(cs + CS_RECURSION_COUNT, recursion);
+    if (recursion != 0)
+        return;
+    cs_hold_end(cs_stats(cs));
+    guest_atomic_store(base, cs + CS_OWNING_THREAD, 0);
+    if (guest_atomic_exchange(base, cs + CS_LOCK_COUNT, CS_FREE) == CS_WAITERS)
+        kobj_set_event(base, cs); // wake one waiter to try again
+}
+
+// ============================================================================
+// Report
+// ============================================================================
+
+static constexpr int CS_REPORT_TOP = 5;
+
+struct CsReportEntry
+{
+    uint32_t addr;
+    uint32_t spin;
+    uint64_t acquires, contentions, parks, hold_sum, hold_max;
+};
+
+void cs_stats_report()
+{
+    uint64_t clock_now = cs_clock();
+    uint64_t ns_now = steady_ns();
+    double ns_per_tick = ns_now > g_calib_ns && clock_now > g_calib_clock
+                             ? (double)(ns_now - g_calib_ns) / (double)(clock_now - g_calib_clock)
+                             : 1.0;
+
+    std::vector<CsReportEntry> entries;
+    uint64_t acquires = 0, contentions = 0, parks = 0;
+    auto collect = [&](CsStats& st) {
+        CsReportEntry e;
+        e.addr = st.addr.load(std::memory_order_relaxed);
+        e.spin = st.spin_estimate.load(std::memory_order_relaxed);
+        e.acquires = st.acquires.exchange(0);
+        e.contentions = st.contentions.exchange(0);
+        e.parks = st.parks.exchange(0);
+        e.hold_sum = st.hold_sum.exchange(0);
+        e.hold_max = st.hold_max.exchange(0);
+        if (!e.acquires)
+            return;
+        acquires += e.acquires;
+        contentions += e.contentions;
+        parks += e.parks;
+        entries.push_back(e);
+    };
+    for (CsStats& st : g_cs_stats)
+    {
+        if (st.addr.load(std::memory_order_relaxed))
+            collect(st);
+    }
+    collect(g_cs_overflow);
+    if (entries.empty())
+        return;
+
+    fprintf(stderr, "[LOCK] %zu critical sections: %llu acquires, %llu contended (%.1f%%), %llu parked\n",
+            entries.size(), (unsigned long long)acquires, (unsigned long long)contentions,
+            100.0 * contentions / acquires, (unsigned long long)parks);
+
+    auto print = [ns_per_tick](const CsReportEntry& e) {
+        if (e.addr == 0)
+            fprintf(stderr, "[LOCK]   (others):   %llu acquires, %llu contended, %llu parked\n",
+                    (unsigned long long)e.acquires, (unsigned long long)e.contentions,
+                    (unsigned long long)e.parks);
+        else
+            fprintf(stderr, "[LOCK]   0x%08X: %llu acquires, %llu contended, %llu parked, "
+                            "held %.2f us avg / %.1f us max, spin %u\n",
+                    e.addr, (unsigned long long)e.acquires, (unsigned long long)e.contentions,
+                    (unsigned long long)e.parks, e.hold_sum * ns_per_tick / 1000.0 / e.acquires,
+                    e.hold_max * ns_per_tick / 1000.0, e.spin);
+    };
+
+    // Most contended, then the ones held longest overall (which contention
+    // would hit first once more threads run at once)
+    size_t top = std::min(entries.size(), (size_t)CS_REPORT_TOP);
+    std::partial_sort(entries.begin(), entries.begin() + top, entries.end(),
+                      [](const CsReportEntry& a, const CsReportEntry& b) {
+                          return a.contentions != b.contentions ? a.contentions > b.contentions
+                                                                : a.hold_sum > b.hold_sum;
+                      });
+    if (entries[0].contentions)
+    {
+        fprintf(stderr, "[LOCK] most contended:\n");
+        for (size_t i = 0; i < top && entries[i].contentions; i++)
+            print(entries[i]);
+    }
+    std::partial_sort(entries.begin(), entries.begin() + top, entries.end(),
+                      [](const CsReportEntry& a, const CsReportEntry& b) { return a.hold_sum > b.hold_sum; });
+    fprintf(stderr, "[LOCK] longest held:\n");
+    for (size_t i = 0; i < top && entries[i].hold_sum; i++)
+        print(entries[i]);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// RTL_CRITICAL_SECTION, kept in guest memory in the Xbox 360 layout:
+//
+//   +0x00  DISPATCHER_HEADER  Type = 1 (synchronization event), +0x01 spin
+//                             count / 256, +0x04 SignalState, +0x08 WaitList
+//   +0x10  LockCount          -1 = free, 0 = held, 1 = held with waiters
+//   +0x14  RecursionCount
+//   +0x18  OwningThread       KTHREAD of the owner (scheduler_thread_object)
+//
+// Acquiring tries to take a free section (LockCount -1 -> 0) and, in the
+// modes where guest threads run in parallel, spins for a while before
+// marking it as having waiters and parking on the section's own header
+// through kobj_wait. Leaving with waiters signals that event to wake one of
+// them, which then competes for the section again (as NT does since Vista:
+// handing it over would make every acquire of a busy section a switch). How
+// long to spin is learned per section: it tracks how many spins recent
+// contended acquires needed, up to the guest's spin count. Recursion is
+// counted in RecursionCount only.
+//
+// Sections that were never initialized (zeroed statics) are initialized on
+// first use.
+
+// RtlInitializeCriticalSection(AndSpinCount)
+void cs_init(uint8_t* base, uint32_t cs, uint32_t spin_count);
+
+void cs_enter(uint8_t* base, uint32_t cs);
+bool cs_try_enter(uint8_t* base, uint32_t cs);
+
+// Leaving a section the caller doesn't own is ignored (logged once).
+void cs_leave(uint8_t* base, uint32_t cs);
+
+// Per-section statistics, keyed by guest address: acquires, contended
+// acquires, parks and hold time. Prints the sections with the most
+// contention and hold time, then resets ([LOCK], in the [SCHED] frame report).
+void cs_stats_report();
@@ -0,0 +1,191 @@
+#include "dir_listing.h"
+
+#include <algorithm>
+#include <cstring>
+
+static constexpr uint32_t DIR_RECORD_HEADER = 0x40;
+
+static void store_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void store_be64(uint8_t* p, uint64_t v)
+{
+    store_be32(p, (uint32_t)(v >> 32));
+    store_be32(p + 4, (uint32_t)v);
+}
+
+static char fold_char(char c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+// '*' and '?' against a folded name
+static bool wildcard_match(const char* pattern, size_t plen, const std::string& name)
+{
+    size_t p = 0, n = 0;
+    size_t star = SIZE_MAX, star_n = 0;
+    while (n < name.size())
+    {
+        if (p < plen && (pattern[p] == '?' || pattern[p] == name[n]))
+        {
+            p++;
+            n++;
+        }
+        else if (p < plen && pattern[p] == '*')
+        {
+            star = p++;
+            star_n = n;
+        }
+        else if (star != SIZE_MAX)
+        {
+            p = star + 1;
+            n = ++star_n;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (p < plen && pattern[p] == '*')
+        p++;
+    return p == plen;
+}
+
+// Entry `i`'s record without the alignment padding
+static uint32_t record_size(const DirListing& listing, uint32_t i)
+{
+    return DIR_RECORD_HEADER + (uint32_t)listing.folded[i].size();
+}
+
+void dir_listing_build(const std::vector<DirEntry>& entries, DirListing* listing)
+{
+    listing->records.clear();
+    listing->offsets.clear();
+    listing->folded.clear();
+    for (uint32_t i = 0; i < entries.size(); i++)
+    {
+        const DirEntry& de = entries[i];
+        uint32_t name_len = (uint32_t)de.name.size();
+        uint32_t aligned = (DIR_RECORD_HEADER + name_len + 7) & ~7u;
+        uint32_t at = (uint32_t)listing->records.size();
+        listing->offsets.push_back(at);
+        listing->records.resize(at + aligned, 0);
+        uint8_t* r = listing->records.data() + at;
+        // The last record of every copy gets 0 here instead
+        store_be32(r + 0x00, aligned);
+        store_be32(r + 0x04, i);
+        store_be64(r + 0x28, (uint64_t)de.size);
+        store_be64(r + 0x30, (uint64_t)de.size);
+        store_be32(r + 0x38, de.is_directory ? 0x10 : 0x80); // DIRECTORY or NORMAL
+        store_be32(r + 0x3C, name_len);
+        memcpy(r + DIR_RECORD_HEADER, de.name.data(), name_len);
+
+        std::string folded = de.name;
+        for (char& c : folded)
+            c = fold_char(c);
+        listing->folded.push_back(std::move(folded));
+    }
+    listing->offsets.push_back((uint32_t)listing->records.size());
+
+    listing->by_name.resize(entries.size());
+    for (uint32_t i = 0; i < entries.size(); i++)
+        listing->by_name[i] = i;
+    const std::vector<std::string>& folded = listing->folded;
+    std::stable_sort(listing->by_name.begin(), listing->by_name.end(),
+                     [&folded](uint32_t a, uint32_t b) { return folded[a] < folded[b]; });
+}
+
+size_t dir_listing_count(const DirListing& listing)
+{
+    return listing.folded.size();
+}
+
+void dir_listing_match(const DirListing& listing, const char* filter, size_t length,
+                       std::vector<uint32_t>* matches)
+{
+    matches->clear();
+    std::string pattern(filter, length);
+    for (char& c : pattern)
+        c = fold_char(c);
+    if (pattern == "*" || pattern == "*.*")
+    {
+        for (uint32_t i = 0; i < dir_listing_count(listing); i++)
+            matches->push_back(i);
+        return;
+    }
+
+    size_t wild = pattern.find_first_of("*?");
+    if (wild == std::string::npos || (wild == pattern.size() - 1 && pattern[wild] == '*'))
+    {
+        // Exact name, or a prefix: a range of the name index
+        std::string prefix = pattern.substr(0, wild);
+        const std::vector<std::string>& folded = listing.folded;
+        auto it = std::lower_bound(listing.by_name.begin(), listing.by_name.end(), prefix,
+                                   [&folded](uint32_t e, const std::string& key) { return folded[e] < key; });
+        for (; it != listing.by_name.end(); ++it)
+        {
+            const std::string& name = folded[*it];
+            if (wild == std::string::npos ? name != prefix : name.compare(0, prefix.size(), prefix) != 0)
+                break;
+            matches->push_back(*it);
+        }
+        std::sort(matches->begin(), matches->end());
+        return;
+    }
+
+    for (uint32_t i = 0; i < dir_listing_count(listing); i++)
+    {
+        if (wildcard_match(pattern.data(), pattern.size(), listing.folded[i]))
+            matches->push_back(i);
+    }
+}
+
+uint32_t dir_listing_copy(const DirListing& listing, const uint32_t* order, size_t count, size_t* next,
+                          uint8_t* dst, uint32_t capacity)
+{
+    size_t first = *next;
+    if (first >= count)
+        return 0;
+
+    if (!order)
+    {
+        // Consecutive records: one span
+        uint32_t start = listing.offsets[first];
+        size_t last = first;
+        if (record_size(listing, (uint32_t)first) > capacity)
+            return 0;
+        while (last + 1 < count &&
+               listing.offsets[last + 1] - start + record_size(listing, (uint32_t)last + 1) <= capacity)
+            last++;
+        uint32_t bytes = std::min(listing.offsets[last + 1] - start, capacity);
+        memcpy(dst, listing.records.data() + start, bytes);
+        store_be32(dst + (listing.offsets[last] - start), 0);
+        *next = last + 1;
+        return bytes;
+    }
+
+    // Filtered: record by record, each already linked to the one after it
+    uint32_t pos = 0;
+    uint32_t prev = 0;
+    size_t i = first;
+    for (; i < count; i++)
+    {
+        uint32_t e = order[i];
+        if (pos + record_size(listing, e) > capacity)
+            break;
+        uint32_t n = std::min(listing.offsets[e + 1] - listing.offsets[e], capacity - pos);
+        memcpy(dst + pos, listing.records.data() + listing.offsets[e], n);
+        prev = pos;
+        pos += n;
+    }
+    if (i == first)
+        return 0;
+    store_be32(dst + prev, 0);
+    *next = i;
+    return pos;
+}
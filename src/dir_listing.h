@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Directory contents for NtQueryDirectoryFile, encoded once.
+//
+// A listing holds every entry of a directory as an X_FILE_DIRECTORY_INFORMATION
+// record, already in guest byte order, 8-byte aligned and chained through
+// NextEntryOffset, so a query is a memcpy of a span of records plus one
+// store to end the chain:
+//
+//   +0x00  NextEntryOffset   +0x28  EndOfFile
+//   +0x04  FileIndex         +0x30  AllocationSize
+//   +0x08  times (zero)      +0x38  FileAttributes
+//                            +0x3C  FileNameLength
+//                            +0x40  FileName (ANSI, not terminated)
+//
+// Filters (the ANSI FileName of the first query) are matched without regard
+// to case through a name-sorted index: exact names and "prefix*" patterns by
+// binary search, anything else with '*' / '?' against the folded names.
+// The stubs share listings between handles; they're never modified.
+
+struct DirEntry
+{
+    std::string name;
+    int64_t     size;
+    bool        is_directory;
+};
+
+struct DirListing
+{
+    std::vector<uint8_t> records;    // guest format
+    std::vector<uint32_t> offsets;   // record start by entry, and the end
+    std::vector<std::string> folded; // lower-case names by entry
+    std::vector<uint32_t> by_name;   // entries sorted by folded name
+};
+
+void dir_listing_build(const std::vector<DirEntry>& entries, DirListing* listing);
+
+size_t dir_listing_count(const DirListing& listing);
+
+// Entries matching `filter` (length bytes, not terminated), in listing order.
+// "*" and "*.*" match everything.
+void dir_listing_match(const DirListing& listing, const char* filter, size_t length,
+                       std::vector<uint32_t>* matches);
+
+// Copy records into `dst` (guest memory, `capacity` bytes) from position
+// *next of `order` (entry indices, or nullptr for every entry in order,
+// `count` of them), as many as fit, and advance *next. Returns the bytes
+// written, 0 if not even one record fits.
+uint32_t dir_listing_copy(const DirListing& listing, const uint32_t* order, size_t count, size_t* next,
+                          uint8_t* dst, uint32_t capacity);
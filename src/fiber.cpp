@@ -0,0 +1,339 @@
+#include "fiber.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#define FIBER_BACKEND_WIN32 1
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__x86_64__) && !defined(FIBER_USE_UCONTEXT)
+#define FIBER_BACKEND_ASM 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define FIBER_BACKEND_UCONTEXT 1
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+struct Fiber
+{
+    void*      sp;          // saved stack pointer (asm backend)
+    FiberEntry entry;
+    void*      param;
+    uint8_t*   stack_map;   // mapping incl. guard page (null for converted threads)
+    size_t     stack_map_size;
+#if defined(FIBER_BACKEND_WIN32)
+    LPVOID     handle;      // Win32 fiber
+#elif defined(FIBER_BACKEND_UCONTEXT)
+    ucontext_t uc;
+#endif
+};
+
+static thread_local Fiber* t_current_fiber = nullptr;
+
+const char* fiber_backend_name()
+{
+#if defined(FIBER_BACKEND_WIN32)
+    return "win32";
+#elif defined(FIBER_BACKEND_ASM)
+    return "x86-64 asm";
+#else
+    return "ucontext";
+#endif
+}
+
+// Entry functions must switch away instead of returning: there is nothing to
+// return to, just like a Win32 fiber whose proc returns (which exits the thread).
+[[noreturn]] static void fiber_entry_returned()
+{
+    fprintf(stderr, "[FIBER] Fiber entry function returned, aborting\n");
+    fflush(stderr);
+    abort();
+}
+
+static std::atomic<uint64_t> g_stacks_created{0};
+static std::atomic<uint64_t> g_stacks_reused{0};
+
+// ============================================================================
+// POSIX stacks: mmap'd with a PROT_NONE guard page below the stack so an
+// overflow faults instead of silently corrupting the neighbouring mapping.
+// MAP_NORESERVE keeps untouched stack pages free.
+//
+// Deleted fibers leave their mapping in a small pool that fiber_create takes
+// from first, so threads that come and go don't mmap / munmap every time.
+// ============================================================================
+#if !defined(FIBER_BACKEND_WIN32)
+static constexpr size_t FIBER_STACK_POOL_MAX = 16;
+
+struct PooledStack
+{
+    uint8_t* map;
+    size_t   size;
+};
+
+static std::mutex g_stack_pool_lock;
+static std::vector<PooledStack> g_stack_pool; // most recently freed last
+
+static bool fiber_alloc_stack(Fiber* f, size_t stack_size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    stack_size = (stack_size + page - 1) & ~(page - 1);
+    size_t total = stack_size + page;
+
+    {
+        std::lock_guard<std::mutex> lock(g_stack_pool_lock);
+        for (size_t i = g_stack_pool.size(); i-- > 0;)
+        {
+            if (g_stack_pool[i].size == total)
+            {
+                f->stack_map = g_stack_pool[i].map;
+                f->stack_map_size = total;
+                g_stack_pool.erase(g_stack_pool.begin() + i);
+                g_stacks_reused++;
+                return true;
+            }
+        }
+    }
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    void* map = mmap(nullptr, total, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "[FIBER] mmap of %zu byte stack failed\n", total);
+        return false;
+    }
+    if (mprotect(map, page, PROT_NONE) != 0)
+    {
+        munmap(map, total);
+        fprintf(stderr, "[FIBER] mprotect of stack guard page failed\n");
+        return false;
+    }
+    f->stack_map = (uint8_t*)map;
+    f->stack_map_size = total;
+    g_stacks_created++;
+    return true;
+}
+
+static void fiber_free_stack(Fiber* f)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_stack_pool_lock);
+        if (g_stack_pool.size() < FIBER_STACK_POOL_MAX)
+        {
+            g_stack_pool.push_back({f->stack_map, f->stack_map_size});
+            return;
+        }
+    }
+    munmap(f->stack_map, f->stack_map_size);
+}
+#endif
+
+// ============================================================================
+// x86-64 SysV context switch
+// Saves rbp, rbx, r12-r15 and the MXCSR / x87 control words (callee-saved
+// per the ABI) on the old stack, stores rsp, loads the new rsp and pops the
+// same frame. Caller-saved registers are already spilled by the compiler
+// around the call, so nothing else needs saving.
+//
+// Frame layout, low to high: [mxcsr|fpucw] r15 r14 r13 r12 rbx rbp ret
+// ============================================================================
+#if defined(FIBER_BACKEND_ASM)
+__attribute__((naked, noinline)) static void fiber_switch_context(void** /*save_sp*/, void* /*load_sp*/)
+{
+    __asm__ volatile(
+        "pushq %rbp\n\t"
+        "pushq %rbx\n\t"
+        "pushq %r12\n\t"
+        "pushq %r13\n\t"
+        "pushq %r14\n\t"
+        "pushq %r15\n\t"
+        "subq $8, %rsp\n\t"
+        "stmxcsr (%rsp)\n\t"
+        "fnstcw 4(%rsp)\n\t"
+        "movq %rsp, (%rdi)\n\t"
+        "movq %rsi, %rsp\n\t"
+        "ldmxcsr (%rsp)\n\t"
+        "fldcw 4(%rsp)\n\t"
+        "addq $8, %rsp\n\t"
+        "popq %r15\n\t"
+        "popq %r14\n\t"
+        "popq %r13\n\t"
+        "popq %r12\n\t"
+        "popq %rbx\n\t"
+        "popq %rbp\n\t"
+        "ret\n\t");
+}
+
+// First switch into a new fiber "returns" here with r12 = Fiber*, rbx =
+// fiber_start and rsp 16-byte aligned, so the call sees a normal ABI frame.
+__attribute__((naked, noinline)) static void fiber_trampoline()
+{
+    __asm__ volatile(
+        "movq %r12, %rdi\n\t"
+        "callq *%rbx\n\t"
+        "ud2\n\t");
+}
+
+static void fiber_start(Fiber* f)
+{
+    f->entry(f->param);
+    fiber_entry_returned();
+}
+#endif
+
+// ============================================================================
+// ucontext / Win32 entry thunks
+// ============================================================================
+#if defined(FIBER_BACKEND_UCONTEXT)
+static void fiber_uc_start()
+{
+    // makecontext only passes ints; the target is already t_current_fiber.
+    Fiber* f = t_current_fiber;
+    f->entry(f->param);
+    fiber_entry_returned();
+}
+#endif
+
+#if defined(FIBER_BACKEND_WIN32)
+static void CALLBACK fiber_win32_start(LPVOID param)
+{
+    Fiber* f = (Fiber*)param;
+    f->entry(f->param);
+    fiber_entry_returned();
+}
+#endif
+
+// ============================================================================
+// API
+// ============================================================================
+
+Fiber* fiber_convert_thread()
+{
+    if (t_current_fiber)
+        return t_current_fiber;
+
+    Fiber* f = (Fiber*)calloc(1, sizeof(Fiber));
+    if (!f) return nullptr;
+#if defined(FIBER_BACKEND_WIN32)
+    f->handle = ConvertThreadToFiber(f);
+    if (!f->handle && GetLastError() == ERROR_ALREADY_FIBER)
+        f->handle = GetCurrentFiber();
+    if (!f->handle)
+    {
+        fprintf(stderr, "[FIBER] ConvertThreadToFiber failed (error %lu)\n", GetLastError());
+        free(f);
+        return nullptr;
+    }
+#endif
+    t_current_fiber = f;
+    return f;
+}
+
+Fiber* fiber_create(size_t stack_size, FiberEntry entry, void* param)
+{
+    if (stack_size == 0)
+        stack_size = FIBER_DEFAULT_STACK_SIZE;
+
+    Fiber* f = (Fiber*)calloc(1, sizeof(Fiber));
+    if (!f) return nullptr;
+    f->entry = entry;
+    f->param = param;
+
+#if defined(FIBER_BACKEND_WIN32)
+    f->handle = CreateFiber(stack_size, fiber_win32_start, f);
+    if (!f->handle)
+    {
+        fprintf(stderr, "[FIBER] CreateFiber failed (error %lu)\n", GetLastError());
+        free(f);
+        return nullptr;
+    }
+    g_stacks_created++;
+#else
+    if (!fiber_alloc_stack(f, stack_size))
+    {
+        free(f);
+        return nullptr;
+    }
+#if defined(FIBER_BACKEND_ASM)
+    uint64_t* top = (uint64_t*)(f->stack_map + f->stack_map_size);
+    uint32_t mxcsr;
+    uint16_t fpucw;
+    __asm__ volatile("stmxcsr %0" : "=m"(mxcsr));
+    __asm__ volatile("fnstcw %0" : "=m"(fpucw));
+    top[-1] = 0;                          // padding: keeps the trampoline's call aligned
+    top[-2] = 0;
+    top[-3] = (uint64_t)&fiber_trampoline; // ret
+    top[-4] = 0;                          // rbp
+    top[-5] = (uint64_t)&fiber_start;     // rbx
+    top[-6] = (uint64_t)f;                // r12
+    top[-7] = 0;                          // r13
+    top[-8] = 0;                          // r14
+    top[-9] = 0;                          // r15
+    top[-10] = uint64_t(mxcsr) | (uint64_t(fpucw) << 32); // inherit the creator's FP control state
+    f->sp = &top[-10];
+#else
+    getcontext(&f->uc);
+    f->uc.uc_stack.ss_sp = f->stack_map + (size_t)sysconf(_SC_PAGESIZE);
+    f->uc.uc_stack.ss_size = f->stack_map_size - (size_t)sysconf(_SC_PAGESIZE);
+    f->uc.uc_link = nullptr;
+    makecontext(&f->uc, fiber_uc_start, 0);
+#endif
+#endif
+    return f;
+}
+
+void fiber_switch(Fiber* to)
+{
+    Fiber* from = t_current_fiber;
+    if (!from || from == to)
+        return;
+    t_current_fiber = to;
+#if defined(FIBER_BACKEND_WIN32)
+    SwitchToFiber(to->handle);
+#elif defined(FIBER_BACKEND_ASM)
+    fiber_switch_context(&from->sp, to->sp);
+#else
+    swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+void fiber_delete(Fiber* fiber)
+{
+    if (!fiber || fiber == t_current_fiber)
+        return;
+#if defined(FIBER_BACKEND_WIN32)
+    if (fiber->handle && fiber->entry) // converted threads are not ours to delete
+        DeleteFiber(fiber->handle);
+#else
+    if (fiber->stack_map)
+        fiber_free_stack(fiber);
+#endif
+    free(fiber);
+}
+
+void fiber_stack_stats(FiberStackStats* stats)
+{
+    stats->created = g_stacks_created.load();
+    stats->reused = g_stacks_reused.load();
+#if defined(FIBER_BACKEND_WIN32)
+    stats->pooled = 0;
+#else
+    std::lock_guard<std::mutex> lock(g_stack_pool_lock);
+    stats->pooled = g_stack_pool.size();
+#endif
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Portable cooperative fibers for the guest thread scheduler.
+//
+// Backends:
+//   x86-64 SysV (Linux, macOS) - hand-written context switch that saves only
+//                                the callee-saved registers plus MXCSR / x87
+//                                control word, on mmap'd stacks with a guard page,
+//                                reused through a small pool
+//   Windows                    - Win32 CreateFiber / SwitchToFiber
+//   other POSIX                - ucontext (makecontext / swapcontext), also
+//                                selectable with -DFIBER_USE_UCONTEXT
+//
+// Semantics match Win32 fibers: a fiber runs until it explicitly switches to
+// another one, and a fiber's entry function must never return.
+
+struct Fiber;
+
+typedef void (*FiberEntry)(void* param);
+
+// Default host stack size (same as CreateFiber(0, ...) with the default /STACK).
+constexpr size_t FIBER_DEFAULT_STACK_SIZE = 1 * 1024 * 1024;
+
+// Turn the calling thread into a fiber so it can switch to others.
+// Returns nullptr on failure.
+Fiber* fiber_convert_thread();
+
+// Create a fiber that runs entry(param) on its own stack the first time it is
+// switched to. stack_size 0 uses FIBER_DEFAULT_STACK_SIZE. Returns nullptr on failure.
+Fiber* fiber_create(size_t stack_size, FiberEntry entry, void* param);
+
+// Switch from the currently running fiber to `to`.
+void fiber_switch(Fiber* to);
+
+// Free a fiber that is not currently running. Its stack is kept for reuse by
+// a later fiber_create of the same size (POSIX backends; Win32 fibers own
+// their stacks).
+void fiber_delete(Fiber* fiber);
+
+struct FiberStackStats
+{
+    uint64_t created; // stacks mapped (or Win32 fibers created)
+    uint64_t reused;  // fiber_create calls served from the pool
+    size_t   pooled;  // stacks currently waiting in the pool
+};
+void fiber_stack_stats(FiberStackStats* stats);
+
+// Name of the compiled-in backend ("x86-64 asm", "win32", "ucontext").
+const char* fiber_backend_name();
@@ -0,0 +1,164 @@
+#include "file_io.h"
+#include "host_file.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct FileIoRequest
+{
+    HostFile* file;
+    void* dst;
+    uint32_t size;
+    std::vector<HostIoSegment> segments; // scattered reads, instead of dst / size
+    int64_t offset;
+    FileIoDone done;
+    void* user;
+    std::chrono::steady_clock::time_point submitted;
+};
+
+struct FileIoStats
+{
+    uint64_t sync_reads;
+    uint64_t sync_bytes;
+    double sync_us;        // guest threads blocked in synchronous reads
+    double frame_sync_us;  // this frame so far
+    double frame_sync_max; // worst frame
+    uint64_t async_reads;
+    uint64_t async_bytes;
+    double async_us;       // submit to done
+    double async_max_us;
+    size_t queue_max;
+};
+
+static std::mutex g_io_lock;
+// Never destroyed: the workers are still waiting on it at exit
+static std::condition_variable& g_io_work = *new std::condition_variable; // queue not empty
+static std::deque<FileIoRequest> g_io_queue;
+static std::vector<std::thread> g_io_workers;
+static FileIoStats g_io_stats;
+
+static double since_us(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ============================================================================
+// Workers
+// ============================================================================
+
+static void io_worker()
+{
+    std::unique_lock<std::mutex> lock(g_io_lock);
+    for (;;)
+    {
+        g_io_work.wait(lock, [] { return !g_io_queue.empty(); });
+        FileIoRequest req = std::move(g_io_queue.front());
+        g_io_queue.pop_front();
+        lock.unlock();
+
+        int64_t bytes = req.segments.empty()
+                            ? host_file_read(req.file, req.dst, req.size, req.offset)
+                            : host_file_read_scatter(req.file, req.segments.data(),
+                                                     (int)req.segments.size(), req.offset);
+        double us = since_us(req.submitted);
+
+        lock.lock();
+        FileIoStats& st = g_io_stats;
+        st.async_reads++;
+        st.async_bytes += bytes > 0 ? bytes : 0;
+        st.async_us += us;
+        if (us > st.async_max_us)
+            st.async_max_us = us;
+
+        // The callback may reach the scheduler and kernel objects
+        lock.unlock();
+        req.done(req.user, bytes);
+        lock.lock();
+    }
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+void file_io_init(int workers)
+{
+    std::lock_guard<std::mutex> lock(g_io_lock);
+    for (int i = 0; i < workers; i++)
+    {
+        g_io_workers.emplace_back(io_worker);
+        g_io_workers.back().detach();
+    }
+}
+
+bool file_io_async()
+{
+    return !g_io_workers.empty();
+}
+
+static void submit(FileIoRequest req)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_io_lock);
+        g_io_queue.push_back(std::move(req));
+        if (g_io_queue.size() > g_io_stats.queue_max)
+            g_io_stats.queue_max = g_io_queue.size();
+    }
+    g_io_work.notify_one();
+}
+
+void file_io_submit(HostFile* file, void* dst, uint32_t size, int64_t offset,
+                    FileIoDone done, void* user)
+{
+    submit({file, dst, size, {}, offset, done, user, std::chrono::steady_clock::now()});
+}
+
+void file_io_submit_scatter(HostFile* file, const HostIoSegment* segments, int count, int64_t offset,
+                            FileIoDone done, void* user)
+{
+    submit({file, nullptr, 0, std::vector<HostIoSegment>(segments, segments + count), offset, done, user,
+            std::chrono::steady_clock::now()});
+}
+
+void file_io_note_sync(int64_t bytes, double us)
+{
+    std::lock_guard<std::mutex> lock(g_io_lock);
+    FileIoStats& st = g_io_stats;
+    st.sync_reads++;
+    st.sync_bytes += bytes > 0 ? bytes : 0;
+    st.sync_us += us;
+    st.frame_sync_us += us;
+}
+
+void file_io_frame()
+{
+    std::lock_guard<std::mutex> lock(g_io_lock);
+    FileIoStats& st = g_io_stats;
+    if (st.frame_sync_us > st.frame_sync_max)
+        st.frame_sync_max = st.frame_sync_us;
+    st.frame_sync_us = 0.0;
+}
+
+void file_io_stats_report()
+{
+    std::lock_guard<std::mutex> lock(g_io_lock);
+    FileIoStats& st = g_io_stats;
+    if (st.sync_reads || st.async_reads)
+    {
+        fprintf(stderr, "[FILE] reads: %llu sync (%.1f MB, %.2f ms blocked, %.2f ms worst frame), "
+                        "%llu overlapped (%.1f MB, %.2f ms avg / %.2f ms max, queue %zu)\n",
+                (unsigned long long)st.sync_reads, st.sync_bytes / (1024.0 * 1024.0),
+                st.sync_us / 1000.0, st.frame_sync_max / 1000.0,
+                (unsigned long long)st.async_reads, st.async_bytes / (1024.0 * 1024.0),
+                st.async_reads ? st.async_us / st.async_reads / 1000.0 : 0.0,
+                st.async_max_us / 1000.0, st.queue_max);
+    }
+    double frame_sync_us = st.frame_sync_us;
+    st = FileIoStats{};
+    st.frame_sync_us = frame_sync_us;
+}
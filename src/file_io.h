@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+struct HostFile;
+struct HostIoSegment;
+
+// Overlapped reads for NtReadFile.
+//
+// A read (NtReadFile, or NtReadFileScatter) that names an event or an APC
+// returns STATUS_PENDING and is done by a small pool of host worker threads
+// (--io-workers=N, 0 keeps every read synchronous); the stub's callback then
+// fills the IO_STATUS_BLOCK, sets the event and queues the APC. The guest
+// thread goes on running its frame instead of waiting for the disk. Reads
+// without either still happen on the calling thread, as the guest waits for
+// those right away.
+//
+// Requests are taken in submission order. The caller keeps the file open
+// until its reads complete (NtReadFile holds a reference on the handle).
+//
+// Statistics for the [SCHED] frame report: bytes and reads each way, the
+// time guest threads spent blocked in synchronous reads (the worst single
+// frame too, for hitches during level loads), and the submit-to-done
+// latency of overlapped reads.
+
+// Runs on a worker thread once the read is done; bytes is -1 on error.
+typedef void (*FileIoDone)(void* user, int64_t bytes);
+
+// Start the workers. Call once, before the first read.
+void file_io_init(int workers);
+
+// False with --io-workers=0.
+bool file_io_async();
+
+// Queue a read of `size` bytes at `offset` into `dst`. `file` must stay open
+// until it completes.
+void file_io_submit(HostFile* file, void* dst, uint32_t size, int64_t offset,
+                    FileIoDone done, void* user);
+
+// The same for a scattered read (host_file_read_scatter); the segments are
+// copied, their destinations must stay valid.
+void file_io_submit_scatter(HostFile* file, const HostIoSegment* segments, int count, int64_t offset,
+                            FileIoDone done, void* user);
+
+// A synchronous read the calling guest thread waited `us` for.
+void file_io_note_sync(int64_t bytes, double us);
+
+// End of a frame (VdSwap).
+void file_io_frame();
+
+// Print and reset the statistics ([SCHED] frame report).
+void file_io_stats_report();
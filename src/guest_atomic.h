@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Atomic operations on big-endian 32-bit words in guest memory, for lock
+// state the guest sees (critical sections, read/write locks). They work on
+// the raw word and swap the values, so a read-modify-write is a CAS loop
+// rather than a fetch_add. Addresses must be 4-byte aligned.
+
+static inline std::atomic_ref<uint32_t> guest_atomic_word(uint8_t* base, uint32_t addr)
+{
+    return std::atomic_ref<uint32_t>(*(uint32_t*)(base + addr));
+}
+
+static inline uint32_t guest_atomic_load(uint8_t* base, uint32_t addr)
+{
+    return __builtin_bswap32(guest_atomic_word(base, addr).load(std::memory_order_acquire));
+}
+
+static inline void guest_atomic_store(uint8_t* base, uint32_t addr, uint32_t value)
+{
+    guest_atomic_word(base, addr).store(__builtin_bswap32(value), std::memory_order_release);
+}
+
+// On failure `expected` is updated to the current value
+static inline bool guest_atomic_cas(uint8_t* base, uint32_t addr, uint32_t& expected, uint32_t desired)
+{
+    uint32_t raw = __builtin_bswap32(expected);
+    if (guest_atomic_word(base, addr).compare_exchange_strong(raw, __builtin_bswap32(desired)))
+        return true;
+    expected = __builtin_bswap32(raw);
+    return false;
+}
+
+// Returns the old value
+static inline uint32_t guest_atomic_exchange(uint8_t* base, uint32_t addr, uint32_t value)
+{
+    return __builtin_bswap32(guest_atomic_word(base, addr).exchange(__builtin_bswap32(value)));
+}
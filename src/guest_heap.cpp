@@ -0,0 +1,473 @@
+#include "guest_heap.h"
+#include "memory.h"
+#include "vm_regions.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// ============================================================================
+// Page state
+// ============================================================================
+
+static constexpr uint32_t HEAP_PAGES = PPC_HEAP_SIZE / HEAP_PAGE_SIZE;
+static constexpr uint32_t HEAP_WORDS = HEAP_PAGES / 64;
+static constexpr uint32_t NO_PAGE = UINT32_MAX;
+static_assert(HEAP_PAGES % 64 == 0 && HEAP_PAGES <= 0x10000, "page index must fit g_owner");
+
+// Runs of dirty pages at least this large are given back to the host instead
+// of being cleared with memset
+static constexpr uint32_t HEAP_DISCARD_MIN = 256 * 1024;
+
+enum PageState : uint8_t
+{
+    PAGE_FREE,
+    PAGE_RESERVED,
+    PAGE_COMMITTED,
+};
+
+static uint8_t* g_base = nullptr;
+static std::mutex g_heap_lock;
+
+// Everything below is guarded by g_heap_lock
+static uint64_t g_free_map[HEAP_WORDS];  // 1 = free
+static uint64_t g_dirty_map[HEAP_WORDS]; // 1 = may hold nonzero data
+static uint8_t  g_state[HEAP_PAGES];
+static uint16_t g_owner[HEAP_PAGES];     // first page of the page's allocation
+static uint32_t g_length[HEAP_PAGES];    // at an allocation's first page: its pages
+
+struct HeapStats
+{
+    uint32_t committed;      // pages
+    uint32_t reserved;       // pages, committed ones included
+    uint32_t peak_committed; // pages, whole run
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t alloc_ns_sum;
+    uint64_t alloc_ns_max;
+    uint64_t failed;
+    uint64_t zeroed;         // pages cleared with memset
+    uint64_t discarded;      // pages given back to the host
+};
+static HeapStats g_stats = {};
+
+static uint32_t page_of(uint32_t addr)
+{
+    return (addr - PPC_HEAP_BASE) / HEAP_PAGE_SIZE;
+}
+
+static uint32_t addr_of(uint32_t page)
+{
+    return PPC_HEAP_BASE + page * HEAP_PAGE_SIZE;
+}
+
+static uint32_t pages_for(uint64_t bytes)
+{
+    return (uint32_t)((bytes + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE);
+}
+
+static uint64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================================
+// Bitmaps
+// ============================================================================
+
+static void set_bits(uint64_t* map, uint32_t first, uint32_t count, bool value)
+{
+    uint32_t end = first + count;
+    while (first < end)
+    {
+        uint32_t bit = first & 63;
+        uint32_t n = std::min(64 - bit, end - first);
+        uint64_t mask = (n == 64 ? ~0ull : ((1ull << n) - 1)) << bit;
+        if (value)
+            map[first >> 6] |= mask;
+        else
+            map[first >> 6] &= ~mask;
+        first += n;
+    }
+}
+
+// First page in [from, to) whose bit is `value`, or `to`
+static uint32_t find_bit(const uint64_t* map, uint32_t from, uint32_t to, bool value)
+{
+    uint32_t i = from;
+    while (i < to)
+    {
+        uint64_t word = value ? map[i >> 6] : ~map[i >> 6];
+        word &= ~0ull << (i & 63);
+        if (word)
+            return std::min(to, (i & ~63u) + (uint32_t)std::countr_zero(word));
+        i = (i & ~63u) + 64;
+    }
+    return to;
+}
+
+// Last page in [from, to) whose bit is `value`, or NO_PAGE
+static uint32_t find_last_bit(const uint64_t* map, uint32_t from, uint32_t to, bool value)
+{
+    uint32_t i = to;
+    while (i > from)
+    {
+        uint32_t last = i - 1;
+        uint64_t word = value ? map[last >> 6] : ~map[last >> 6];
+        word &= ~0ull >> (63 - (last & 63));
+        if (word)
+        {
+            uint32_t found = (last & ~63u) + 63 - (uint32_t)std::countl_zero(word);
+            return found >= from ? found : NO_PAGE;
+        }
+        i = last & ~63u;
+    }
+    return NO_PAGE;
+}
+
+// First page of `count` free pages, `align` pages aligned, in [lo, hi)
+static uint32_t find_run(uint32_t count, uint32_t align, uint32_t lo, uint32_t hi, bool top_down)
+{
+    if (count == 0 || hi < lo || hi - lo < count)
+        return NO_PAGE;
+    if (!top_down)
+    {
+        uint32_t p = (lo + align - 1) & ~(align - 1);
+        while (p + count <= hi)
+        {
+            uint32_t used = find_bit(g_free_map, p, p + count, false);
+            if (used == p + count)
+                return p;
+            p = find_bit(g_free_map, used + 1, hi, true);
+            p = (p + align - 1) & ~(align - 1);
+        }
+        return NO_PAGE;
+    }
+    uint32_t p = (hi - count) & ~(align - 1);
+    while (p >= lo)
+    {
+        uint32_t used = find_last_bit(g_free_map, p, p + count, false);
+        if (used == NO_PAGE)
+            return p;
+        // The next window has to end at the last free page below `used`
+        uint32_t free_end = find_last_bit(g_free_map, lo, used, true);
+        if (free_end == NO_PAGE || free_end + 1 < lo + count)
+            return NO_PAGE;
+        p = (free_end + 1 - count) & ~(align - 1);
+    }
+    return NO_PAGE;
+}
+
+// ============================================================================
+// Zeroing
+// ============================================================================
+
+// Zero the range by handing its whole host pages back (they read as zero on
+// the next touch) and clearing what is left over at the ends
+static void discard_range(uint32_t addr, uint32_t size)
+{
+    uint8_t* p = g_base + addr;
+#ifdef _WIN32
+    // Guest pages are host pages on Windows
+    if (VirtualFree(p, size, MEM_DECOMMIT) && VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE))
+        return;
+    memset(p, 0, size);
+#else
+    static const uintptr_t host_page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)p + host_page - 1) & ~(host_page - 1);
+    uintptr_t end = ((uintptr_t)p + size) & ~(host_page - 1);
+    if (start >= end || madvise((void*)start, end - start, MADV_DONTNEED) != 0)
+    {
+        memset(p, 0, size);
+        return;
+    }
+    memset(p, 0, start - (uintptr_t)p);
+    memset((void*)end, 0, (uintptr_t)p + size - end);
+#endif
+}
+
+// Clear the dirty pages in [first, first + count); large runs are given back
+// to the host, small ones cleared only if `now`
+static void zero_pages(uint32_t first, uint32_t count, bool now)
+{
+    uint32_t end = first + count;
+    uint32_t p = find_bit(g_dirty_map, first, end, true);
+    while (p < end)
+    {
+        uint32_t run_end = find_bit(g_dirty_map, p, end, false);
+        uint32_t bytes = (run_end - p) * HEAP_PAGE_SIZE;
+        if (bytes >= HEAP_DISCARD_MIN)
+        {
+            discard_range(addr_of(p), bytes);
+            g_stats.discarded += run_end - p;
+            set_bits(g_dirty_map, p, run_end - p, false);
+        }
+        else if (now)
+        {
+            memset(g_base + addr_of(p), 0, bytes);
+            g_stats.zeroed += run_end - p;
+            set_bits(g_dirty_map, p, run_end - p, false);
+        }
+        p = find_bit(g_dirty_map, run_end, end, true);
+    }
+}
+
+// ============================================================================
+// Page transitions (g_heap_lock held)
+// ============================================================================
+
+static void reserve_pages(uint32_t first, uint32_t count)
+{
+    set_bits(g_free_map, first, count, false);
+    memset(g_state + first, PAGE_RESERVED, count);
+    for (uint32_t p = first; p < first + count; p++)
+        g_owner[p] = (uint16_t)first;
+    g_length[first] = count;
+    g_stats.reserved += count;
+    vm_region_reserve(addr_of(first), count * HEAP_PAGE_SIZE, X_PAGE_READWRITE);
+}
+
+// Committed pages keep their contents; the others are zeroed
+static void commit_pages(uint32_t first, uint32_t count)
+{
+    uint32_t end = first + count;
+    uint32_t p = first;
+    while (p < end)
+    {
+        if (g_state[p] == PAGE_COMMITTED)
+        {
+            p++;
+            continue;
+        }
+        uint32_t run = p;
+        while (p < end && g_state[p] != PAGE_COMMITTED)
+            g_state[p++] = PAGE_COMMITTED;
+        zero_pages(run, p - run, true);
+        set_bits(g_dirty_map, run, p - run, true);
+        g_stats.committed += p - run;
+    }
+    vm_region_commit(addr_of(first), count * HEAP_PAGE_SIZE, X_PAGE_READWRITE);
+    g_stats.peak_committed = std::max(g_stats.peak_committed, g_stats.committed);
+}
+
+static void decommit_pages(uint32_t first, uint32_t count)
+{
+    // Host access comes back before the pages are cleared
+    vm_region_decommit(addr_of(first), count * HEAP_PAGE_SIZE);
+    for (uint32_t p = first; p < first + count; p++)
+    {
+        if (g_state[p] == PAGE_COMMITTED)
+        {
+            g_state[p] = PAGE_RESERVED;
+            g_stats.committed--;
+        }
+    }
+    zero_pages(first, count, false);
+}
+
+// [first, first + count) lies within the allocation starting at `owner`
+static void release_pages(uint32_t owner, uint32_t first, uint32_t count)
+{
+    decommit_pages(first, count);
+    uint32_t end = owner + g_length[owner];
+    uint32_t tail = first + count;
+    g_length[owner] = 0;
+    if (first > owner)
+        g_length[owner] = first - owner;
+    if (tail < end)
+    {
+        g_length[tail] = end - tail;
+        for (uint32_t p = tail; p < end; p++)
+            g_owner[p] = (uint16_t)tail;
+    }
+    memset(g_state + first, PAGE_FREE, count);
+    set_bits(g_free_map, first, count, true);
+    vm_region_release(addr_of(first), count * HEAP_PAGE_SIZE);
+    g_stats.reserved -= count;
+    g_stats.frees++;
+}
+
+// Pages of [addr, addr + size), rounded out to whole pages. False if that
+// isn't inside the window.
+static bool page_range(uint32_t addr, uint32_t size, uint32_t* first, uint32_t* count)
+{
+    if (!heap_contains(addr) || size > PPC_HEAP_BASE + PPC_HEAP_SIZE - addr)
+        return false;
+    *first = page_of(addr);
+    *count = pages_for((uint64_t)(addr - PPC_HEAP_BASE) + size) - *first;
+    return true;
+}
+
+// Allocation the pages belong to, or NO_PAGE if they span more than one or
+// any is free
+static uint32_t owner_of(uint32_t first, uint32_t count)
+{
+    if (g_state[first] == PAGE_FREE)
+        return NO_PAGE;
+    uint32_t owner = g_owner[first];
+    return first + count <= owner + g_length[owner] ? owner : NO_PAGE;
+}
+
+static void note_alloc(uint64_t start_ns, bool ok)
+{
+    uint64_t ns = steady_ns() - start_ns;
+    if (!ok)
+    {
+        g_stats.failed++;
+        return;
+    }
+    g_stats.allocs++;
+    g_stats.alloc_ns_sum += ns;
+    g_stats.alloc_ns_max = std::max(g_stats.alloc_ns_max, ns);
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+void heap_init(uint8_t* base)
+{
+    std::lock_guard<std::mutex> lock(g_heap_lock);
+    g_base = base;
+    memset(g_free_map, 0xFF, sizeof(g_free_map));
+    memset(g_dirty_map, 0, sizeof(g_dirty_map));
+    memset(g_state, PAGE_FREE, sizeof(g_state));
+    memset(g_length, 0, sizeof(g_length));
+    g_stats = {};
+}
+
+bool heap_contains(uint32_t addr)
+{
+    return addr >= PPC_HEAP_BASE && addr - PPC_HEAP_BASE < PPC_HEAP_SIZE;
+}
+
+uint32_t heap_alloc(uint32_t size, uint32_t align, uint32_t lo, uint32_t hi, uint32_t flags)
+{
+    uint64_t start = steady_ns();
+    uint32_t count = pages_for(size);
+    uint32_t align_pages = std::max<uint32_t>(1, std::bit_ceil(align) / HEAP_PAGE_SIZE);
+    uint32_t lo_page = pages_for(lo);
+    uint32_t hi_page = std::min(hi, PPC_HEAP_SIZE) / HEAP_PAGE_SIZE;
+
+    std::lock_guard<std::mutex> lock(g_heap_lock);
+    uint32_t first = find_run(count, align_pages, lo_page, hi_page, (flags & HEAP_TOP_DOWN) != 0);
+    if (first == NO_PAGE)
+    {
+        note_alloc(start, false);
+        return 0;
+    }
+    reserve_pages(first, count);
+    if (flags & HEAP_COMMIT)
+        commit_pages(first, count);
+    note_alloc(start, true);
+    return addr_of(first);
+}
+
+bool heap_reserve_at(uint32_t addr, uint32_t size, uint32_t flags)
+{
+    uint64_t start = steady_ns();
+    uint32_t first, count;
+    if (!size || !page_range(addr, size, &first, &count))
+        return false;
+    std::lock_guard<std::mutex> lock(g_heap_lock);
+    bool ok = find_bit(g_free_map, first, first + count, false) == first + count;
+    if (ok)
+    {
+        reserve_pages(first, count);
+        if (flags & HEAP_COMMIT)
+            commit_pages(first, count);
+    }
+    note_alloc(start, ok);
+    return ok;
+}
+
+bool heap_commit(uint32_t addr, uint32_t size)
+{
+    uint64_t start = steady_ns();
+    uint32_t first, count;
+    if (!size || !page_range(addr, size, &first, &count))
+        return false;
+    std::lock_guard<std::mutex> lock(g_heap_lock);
+    bool ok = find_bit(g_free_map, first, first + count, true) == first + count;
+    if (ok)
+        commit_pages(first, count);
+    note_alloc(start, ok);
+    return ok;
+}
+
+uint32_t heap_decommit(uint32_t addr, uint32_t size)
+{
+    uint32_t first, count;
+    if (!page_range(addr, size, &first, &count))
+        return 0;
+    std::lock_guard<std::mutex> lock(g_heap_lock);
+    if (g_state[first] == PAGE_FREE)
+        return 0;
+    if (!size)
+        count = g_owner[first] + g_length[g_owner[first]] - first;
+    if (owner_of(first, count) == NO_PAGE)
+        return 0;
+    decommit_pages(first, count);
+    return count * HEAP_PAGE_SIZE;
+}
+
+uint32_t heap_release(uint32_t addr, uint32_t size)
+{
+    uint32_t first, count;
+    if (!page_range(addr, size, &first, &count))
+        return 0;
+    std::lock_guard<std::mutex> lock(g_heap_lock);
+    if (!size)
+    {
+        // The whole allocation, from its base
+        if (g_state[first] == PAGE_FREE || g_owner[first] != first || addr % HEAP_PAGE_SIZE)
+            return 0;
+        count = g_length[first];
+    }
+    uint32_t owner = owner_of(first, count);
+    if (owner == NO_PAGE)
+        return 0;
+    release_pages(owner, first, count);
+    return count * HEAP_PAGE_SIZE;
+}
+
+void heap_stats_report()
+{
+    std::lock_guard<std::mutex> lock(g_heap_lock);
+    HeapStats& st = g_stats;
+    if (!st.allocs && !st.frees && !st.failed)
+        return;
+    uint32_t largest = 0;
+    for (uint32_t p = find_bit(g_free_map, 0, HEAP_PAGES, true); p < HEAP_PAGES;)
+    {
+        uint32_t end = find_bit(g_free_map, p, HEAP_PAGES, false);
+        largest = std::max(largest, end - p);
+        p = find_bit(g_free_map, end, HEAP_PAGES, true);
+    }
+    auto mb = [](uint64_t pages) { return pages * HEAP_PAGE_SIZE / (1024.0 * 1024.0); };
+    fprintf(stderr, "[MEM] heap: %.1f MB committed (peak %.1f), %.1f MB reserved, "
+                    "largest free %.1f MB of %.0f\n",
+            mb(st.committed), mb(st.peak_committed), mb(st.reserved), mb(largest), mb(HEAP_PAGES));
+    fprintf(stderr, "[MEM] heap: %llu allocs (%.2f us avg / %.2f us max), %llu failed, %llu frees, "
+                    "%.1f MB cleared, %.1f MB returned to the host\n",
+            (unsigned long long)st.allocs, st.allocs ? st.alloc_ns_sum / 1000.0 / st.allocs : 0.0,
+            st.alloc_ns_max / 1000.0, (unsigned long long)st.failed, (unsigned long long)st.frees,
+            mb(st.zeroed), mb(st.discarded));
+    st.allocs = st.frees = st.failed = 0;
+    st.alloc_ns_sum = st.alloc_ns_max = 0;
+    st.zeroed = st.discarded = 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+// Page allocator for the guest heap window (PPC_HEAP_BASE, PPC_HEAP_SIZE):
+// NtAllocateVirtualMemory / NtFreeVirtualMemory, MmAllocatePhysicalMemoryEx /
+// MmFreePhysicalMemory, and the pool and XAM allocators on top of it.
+//
+// Pages are 4 KB and each one is free, reserved or committed. An allocation
+// is a run of pages reserved together; it can be committed and decommitted
+// in parts, and released whole or in parts. Free runs are found first-fit in
+// a bitmap (bottom-up, or top-down for physical memory), honouring
+// alignment and an address range.
+//
+// Committed pages read as zero. Nothing is zeroed when it is handed out
+// unless it was used since it was last zeroed: large frees give their pages
+// back to the host (madvise(MADV_DONTNEED) / decommit), which reads back as
+// zero, and small ones leave their pages dirty to be cleared if they are
+// reused.
+//
+// Addresses and sizes are guest addresses and bytes; sizes are rounded up to
+// whole pages. The heap window stands in for physical memory, so physical
+// addresses (MmAllocatePhysicalMemoryEx ranges) are offsets into it.
+
+constexpr uint32_t HEAP_PAGE_SIZE = 0x1000;
+
+enum HeapFlags : uint32_t
+{
+    HEAP_COMMIT   = 1 << 0, // commit as well as reserve
+    HEAP_TOP_DOWN = 1 << 1, // highest fitting address
+};
+
+// Call once with the guest memory base, before the first allocation.
+void heap_init(uint8_t* base);
+
+// Reserve `size` bytes at an `align`-aligned address (a power of two, at
+// least a page) within [lo, hi) of the window. Returns 0 if nothing fits.
+uint32_t heap_alloc(uint32_t size, uint32_t align, uint32_t lo, uint32_t hi, uint32_t flags);
+
+// Reserve at a given address. Fails if any of the pages is in use.
+bool heap_reserve_at(uint32_t addr, uint32_t size, uint32_t flags);
+
+// Commit pages of existing allocations. Fails if any of them is free.
+bool heap_commit(uint32_t addr, uint32_t size);
+
+// Decommit / release pages of one allocation; size 0 means from `addr` to
+// the end of the allocation, and releasing with size 0 needs the
+// allocation's base. Return the bytes affected, 0 on failure.
+uint32_t heap_decommit(uint32_t addr, uint32_t size);
+uint32_t heap_release(uint32_t addr, uint32_t size);
+
+// The window holds `addr`
+bool heap_contains(uint32_t addr);
+
+// Print and reset the allocation statistics ([SCHED] frame report).
+void heap_stats_report();
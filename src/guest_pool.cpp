@@ -0,0 +1,355 @@
+#include "guest_pool.h"
+#include "guest_heap.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Size classes and spans
+// ============================================================================
+
+static constexpr uint32_t POOL_SPAN_SIZE = 64 * 1024;
+static constexpr uint32_t POOL_SPANS = PPC_HEAP_SIZE / POOL_SPAN_SIZE;
+
+// At most 25% apart, so at most 20% of a block is padding
+static constexpr uint32_t POOL_CLASS_SIZES[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+static constexpr int POOL_CLASSES = sizeof(POOL_CLASS_SIZES) / sizeof(POOL_CLASS_SIZES[0]);
+static_assert(POOL_CLASS_SIZES[POOL_CLASSES - 1] == POOL_MAX_SMALL, "last class is the small limit");
+
+struct BlockInfo
+{
+    uint32_t tag;
+    uint32_t size; // requested bytes, 0 = free slot
+};
+
+struct Span
+{
+    uint32_t addr;
+    int      cls;
+    uint32_t used = 0;
+    uint32_t fresh = 0;               // slots from here on were never handed out (still zero)
+    bool     in_partial = false;
+    std::vector<uint16_t> free_slots; // freed slots, reused last in first out
+    std::vector<BlockInfo> blocks;
+};
+
+struct SizeClass
+{
+    uint32_t size;
+    uint32_t slots;               // per span
+    std::vector<Span*> partial;   // spans that may have free slots
+    uint32_t empty = 0;           // spans with nothing in use, kept for reuse
+};
+
+struct TagStats
+{
+    uint64_t allocs;     // this report period
+    uint64_t frees;
+    uint64_t live_blocks;
+    uint64_t live_bytes; // requested
+    uint64_t peak_bytes;
+};
+
+static uint8_t* g_base = nullptr;
+static std::mutex g_pool_lock;
+
+// Everything below is guarded by g_pool_lock
+static SizeClass g_classes[POOL_CLASSES];
+static uint8_t g_class_of[POOL_MAX_SMALL / 16 + 1]; // by (size + 15) / 16
+static Span* g_spans[POOL_SPANS];                   // by span index in the heap window
+static uint32_t g_span_count = 0;
+static std::unordered_map<uint32_t, BlockInfo> g_large; // whole-page blocks
+static std::unordered_map<uint32_t, TagStats> g_tags;
+static uint64_t g_live_requested = 0; // bytes asked for, small and large
+static uint64_t g_live_slab = 0;      // class-sized bytes handed out of spans
+static uint64_t g_live_large = 0;     // page-rounded bytes of large blocks
+static uint64_t g_failed = 0;
+static FILE* g_trace = nullptr;
+
+static Span* span_create(int cls)
+{
+    uint32_t addr = heap_alloc(POOL_SPAN_SIZE, POOL_SPAN_SIZE, 0, PPC_HEAP_SIZE, HEAP_COMMIT);
+    if (!addr)
+        return nullptr;
+    Span* span = new Span();
+    span->addr = addr;
+    span->cls = cls;
+    span->blocks.resize(g_classes[cls].slots);
+    g_spans[(addr - PPC_HEAP_BASE) / POOL_SPAN_SIZE] = span;
+    g_span_count++;
+    g_classes[cls].empty++;
+    return span;
+}
+
+static void span_destroy(Span* span)
+{
+    SizeClass& sc = g_classes[span->cls];
+    sc.partial.erase(std::remove(sc.partial.begin(), sc.partial.end(), span), sc.partial.end());
+    sc.empty--;
+    g_spans[(span->addr - PPC_HEAP_BASE) / POOL_SPAN_SIZE] = nullptr;
+    g_span_count--;
+    heap_release(span->addr, 0);
+    delete span;
+}
+
+// A span of the class with a free slot, the most recently used first
+static Span* span_with_room(int cls)
+{
+    SizeClass& sc = g_classes[cls];
+    while (!sc.partial.empty())
+    {
+        Span* span = sc.partial.back();
+        if (!span->free_slots.empty() || span->fresh < sc.slots)
+            return span;
+        span->in_partial = false;
+        sc.partial.pop_back();
+    }
+    Span* span = span_create(cls);
+    if (span)
+    {
+        span->in_partial = true;
+        sc.partial.push_back(span);
+    }
+    return span;
+}
+
+static uint32_t slab_alloc(uint32_t size, uint32_t tag)
+{
+    int cls = g_class_of[(size + 15) / 16];
+    SizeClass& sc = g_classes[cls];
+    Span* span = span_with_room(cls);
+    if (!span)
+        return 0;
+    uint32_t slot;
+    bool dirty = !span->free_slots.empty();
+    if (dirty)
+    {
+        slot = span->free_slots.back();
+        span->free_slots.pop_back();
+    }
+    else
+    {
+        slot = span->fresh++;
+    }
+    if (span->used++ == 0)
+        sc.empty--;
+    span->blocks[slot] = {tag, size};
+    uint32_t addr = span->addr + slot * sc.size;
+    if (dirty)
+        memset(g_base + addr, 0, sc.size);
+    g_live_slab += sc.size;
+    return addr;
+}
+
+// Returns false if `addr` isn't a live block of the span
+static bool slab_free(Span* span, uint32_t addr, BlockInfo* info)
+{
+    SizeClass& sc = g_classes[span->cls];
+    uint32_t offset = addr - span->addr;
+    uint32_t slot = offset / sc.size;
+    if (offset % sc.size || slot >= span->fresh || !span->blocks[slot].size)
+        return false;
+    *info = span->blocks[slot];
+    span->blocks[slot].size = 0;
+    span->free_slots.push_back((uint16_t)slot);
+    g_live_slab -= sc.size;
+    if (!span->in_partial)
+    {
+        span->in_partial = true;
+        sc.partial.push_back(span);
+    }
+    if (--span->used == 0)
+    {
+        // Keep one empty span per class to absorb alloc / free churn
+        sc.empty++;
+        if (sc.empty > 1)
+            span_destroy(span);
+    }
+    return true;
+}
+
+static void tag_alloc(uint32_t tag, uint32_t size)
+{
+    TagStats& ts = g_tags[tag];
+    ts.allocs++;
+    ts.live_blocks++;
+    ts.live_bytes += size;
+    ts.peak_bytes = std::max(ts.peak_bytes, ts.live_bytes);
+    g_live_requested += size;
+}
+
+static void tag_free(const BlockInfo& info)
+{
+    TagStats& ts = g_tags[info.tag];
+    ts.frees++;
+    ts.live_blocks--;
+    ts.live_bytes -= info.size;
+    g_live_requested -= info.size;
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+void pool_init(uint8_t* base)
+{
+    std::lock_guard<std::mutex> lock(g_pool_lock);
+    g_base = base;
+    int cls = 0;
+    for (uint32_t i = 0; i <= POOL_MAX_SMALL / 16; i++)
+    {
+        while (POOL_CLASS_SIZES[cls] < std::max<uint32_t>(i, 1) * 16)
+            cls++;
+        g_class_of[i] = (uint8_t)cls;
+    }
+    for (int c = 0; c < POOL_CLASSES; c++)
+    {
+        g_classes[c].size = POOL_CLASS_SIZES[c];
+        g_classes[c].slots = POOL_SPAN_SIZE / POOL_CLASS_SIZES[c];
+    }
+}
+
+uint32_t pool_alloc(uint32_t size, uint32_t tag)
+{
+    size = std::max<uint32_t>(size, 1);
+    std::lock_guard<std::mutex> lock(g_pool_lock);
+    uint32_t addr;
+    if (size <= POOL_MAX_SMALL)
+    {
+        addr = slab_alloc(size, tag);
+    }
+    else
+    {
+        // Fresh committed pages are already zero
+        addr = heap_alloc(size, HEAP_PAGE_SIZE, 0, PPC_HEAP_SIZE, HEAP_COMMIT);
+        if (addr)
+        {
+            g_large[addr] = {tag, size};
+            g_live_large += (size + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1);
+        }
+    }
+    if (!addr)
+    {
+        g_failed++;
+        return 0;
+    }
+    tag_alloc(tag, size);
+    if (g_trace)
+        fprintf(g_trace, "A %x %x %x\n", addr, size, tag);
+    return addr;
+}
+
+bool pool_free(uint32_t addr)
+{
+    if (!heap_contains(addr))
+        return false;
+    std::lock_guard<std::mutex> lock(g_pool_lock);
+    BlockInfo info;
+    if (Span* span = g_spans[(addr - PPC_HEAP_BASE) / POOL_SPAN_SIZE])
+    {
+        if (!slab_free(span, addr, &info))
+            return false;
+    }
+    else
+    {
+        auto it = g_large.find(addr);
+        if (it == g_large.end())
+            return false;
+        info = it->second;
+        g_large.erase(it);
+        g_live_large -= (info.size + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1);
+        heap_release(addr, 0);
+    }
+    tag_free(info);
+    if (g_trace)
+        fprintf(g_trace, "F %x\n", addr);
+    return true;
+}
+
+uint64_t pool_footprint()
+{
+    std::lock_guard<std::mutex> lock(g_pool_lock);
+    return (uint64_t)g_span_count * POOL_SPAN_SIZE + g_live_large;
+}
+
+bool pool_open_trace(const char* path)
+{
+    std::lock_guard<std::mutex> lock(g_pool_lock);
+    g_trace = fopen(path, "w");
+    if (!g_trace)
+    {
+        fprintf(stderr, "[MEM] Can't create pool trace %s\n", path);
+        return false;
+    }
+    setvbuf(g_trace, nullptr, _IOFBF, 1 << 16);
+    fprintf(stderr, "[MEM] Tracing pool allocations to %s\n", path);
+    return true;
+}
+
+// Up to this many tags in the report, the most live bytes first
+static constexpr size_t POOL_REPORT_TOP = 8;
+
+void pool_alloc_stats_report()
+{
+    std::lock_guard<std::mutex> lock(g_pool_lock);
+    if (g_trace)
+        fflush(g_trace);
+    struct Entry
+    {
+        uint32_t tag;
+        TagStats stats;
+    };
+    std::vector<Entry> entries;
+    uint64_t allocs = 0, frees = 0;
+    for (auto& [tag, ts] : g_tags)
+    {
+        allocs += ts.allocs;
+        frees += ts.frees;
+        if (ts.allocs || ts.frees || ts.live_blocks)
+            entries.push_back({tag, ts});
+        ts.allocs = ts.frees = 0;
+    }
+    if (!allocs && !frees && !g_failed)
+        return;
+
+    uint64_t span_bytes = (uint64_t)g_span_count * POOL_SPAN_SIZE;
+    uint64_t slab_requested = g_live_requested;
+    for (auto& [addr, info] : g_large)
+        slab_requested -= info.size;
+    // Padding inside blocks, and span space not handed out
+    double internal = g_live_slab ? 100.0 * (g_live_slab - slab_requested) / g_live_slab : 0.0;
+    double external = span_bytes ? 100.0 * (span_bytes - g_live_slab) / span_bytes : 0.0;
+    fprintf(stderr, "[MEM] pool: %llu allocs, %llu frees, %llu failed; %.1f KB live in %u spans "
+                    "(%.0f%% padding, %.0f%% unused), %.1f KB in %zu page blocks\n",
+            (unsigned long long)allocs, (unsigned long long)frees, (unsigned long long)g_failed,
+            slab_requested / 1024.0, g_span_count, internal, external,
+            g_live_large / 1024.0, g_large.size());
+    g_failed = 0;
+
+    size_t top = std::min(entries.size(), POOL_REPORT_TOP);
+    std::partial_sort(entries.begin(), entries.begin() + top, entries.end(),
+                      [](const Entry& a, const Entry& b) { return a.stats.live_bytes > b.stats.live_bytes; });
+    for (size_t i = 0; i < top; i++)
+    {
+        const Entry& e = entries[i];
+        char name[5];
+        for (int c = 0; c < 4; c++)
+        {
+            char ch = (char)(e.tag >> (24 - c * 8));
+            name[c] = ch >= 0x20 && ch < 0x7F ? ch : '.';
+        }
+        name[4] = 0;
+        fprintf(stderr, "[MEM]   '%s' (0x%08X): %llu live, %.1f KB (peak %.1f KB), +%llu / -%llu\n",
+                name, e.tag, (unsigned long long)e.stats.live_blocks, e.stats.live_bytes / 1024.0,
+                e.stats.peak_bytes / 1024.0, (unsigned long long)e.stats.allocs,
+                (unsigned long long)e.stats.frees);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Small-block allocator for ExAllocatePool(Type)WithTag and XamAlloc.
+//
+// Requests up to POOL_MAX_SMALL bytes are rounded up to a size class and
+// served from 64 KB spans of the page heap (guest_heap.h), one class per
+// span, so same-sized objects sit next to each other. Freed blocks go back
+// to their span and are reused most recently freed first; a span that
+// empties is returned to the heap unless it is its class's only empty one.
+// Bookkeeping lives on the host, so guest writes past a block can't corrupt
+// it. Larger requests get whole pages.
+//
+// Blocks are zeroed. Live and peak bytes are kept per pool tag (XamAlloc
+// counts as POOL_TAG_XAM).
+//
+// --pool-trace=path logs every allocation and free as text lines
+// ("A addr size tag" / "F addr", hex) for tools/pool_bench.cpp to replay.
+
+constexpr uint32_t POOL_MAX_SMALL = 2048;
+constexpr uint32_t POOL_TAG_XAM = 0x58414D20; // 'XAM '
+
+// Call once with the guest memory base, after heap_init.
+void pool_init(uint8_t* base);
+
+// Returns 0 if the heap is exhausted.
+uint32_t pool_alloc(uint32_t size, uint32_t tag);
+
+// Returns false if `addr` isn't a live pool block.
+bool pool_free(uint32_t addr);
+
+// Heap bytes the pool holds: its spans and page blocks.
+uint64_t pool_footprint();
+
+// Returns false if the trace file can't be created.
+bool pool_open_trace(const char* path);
+
+// Print and reset the per-tag statistics ([SCHED] frame report).
+void pool_alloc_stats_report();
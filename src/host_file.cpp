@@ -0,0 +1,274 @@
+#include "host_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// preadv batch; longer segment lists take several calls
+static constexpr int HOST_FILE_MAX_IOV = 64;
+
+static std::atomic<bool> g_mmap_reads{false};
+
+static bool map_whole(HostFile* file);
+
+void host_file_set_mmap(bool enabled)
+{
+    g_mmap_reads = enabled;
+}
+
+// ============================================================================
+// Platform
+// ============================================================================
+
+#ifdef _WIN32
+
+bool host_file_open(const char* path, HostFile* file)
+{
+    HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size))
+    {
+        CloseHandle(h);
+        return false;
+    }
+    *file = HostFile{};
+    file->handle = h;
+    file->size = size.QuadPart;
+    if (g_mmap_reads && file->size >= HOST_FILE_MAP_MIN)
+        map_whole(file);
+    return true;
+}
+
+void host_file_close(HostFile* file)
+{
+    if (file->view && !file->borrowed)
+        UnmapViewOfFile(file->view);
+    if (file->mapping)
+        CloseHandle(file->mapping);
+    if (file->handle)
+        CloseHandle(file->handle);
+    *file = HostFile{};
+}
+
+static int64_t read_at(HostFile* file, void* dst, uint32_t size, int64_t offset)
+{
+    OVERLAPPED ov = {};
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD read = 0;
+    if (!ReadFile(file->handle, dst, size, &read, &ov))
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    return read;
+}
+
+static int64_t read_scatter_at(HostFile* file, const HostIoSegment* segments, int count, int64_t offset)
+{
+    // ReadFileScatter wants unbuffered handles and whole pages: one read each
+    int64_t done = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int64_t n = read_at(file, segments[i].dst, segments[i].size, offset + done);
+        if (n < 0)
+            return done ? done : -1;
+        done += n;
+        if (n < segments[i].size)
+            break;
+    }
+    return done;
+}
+
+static bool map_whole(HostFile* file)
+{
+    file->mapping = CreateFileMappingA(file->handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file->mapping)
+        return false;
+    file->view = (const uint8_t*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+    return file->view != nullptr;
+}
+
+static void will_need(HostFile* file, int64_t offset, uint32_t size)
+{
+    WIN32_MEMORY_RANGE_ENTRY range = {(void*)(file->view + offset), size};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+bool host_file_open(const char* path, HostFile* file)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    *file = HostFile{};
+    file->fd = fd;
+    file->size = st.st_size;
+    if (g_mmap_reads && file->size >= HOST_FILE_MAP_MIN)
+        map_whole(file);
+    return true;
+}
+
+void host_file_close(HostFile* file)
+{
+    if (file->view && !file->borrowed)
+        munmap((void*)file->view, (size_t)file->size);
+    if (file->fd >= 0)
+        close(file->fd);
+    *file = HostFile{};
+}
+
+static int64_t read_at(HostFile* file, void* dst, uint32_t size, int64_t offset)
+{
+    uint32_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(file->fd, (uint8_t*)dst + done, size - done, offset + done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return done ? (int64_t)done : -1;
+        }
+        if (n == 0)
+            break;
+        done += (uint32_t)n;
+    }
+    return done;
+}
+
+static int64_t read_scatter_at(HostFile* file, const HostIoSegment* segments, int count, int64_t offset)
+{
+    struct iovec iov[HOST_FILE_MAX_IOV];
+    int64_t done = 0;
+    int first = 0;
+    uint32_t skip = 0; // into segments[first], after a short read
+    while (first < count)
+    {
+        int n = 0;
+        for (int i = first; i < count && n < HOST_FILE_MAX_IOV; i++, n++)
+        {
+            uint32_t from = i == first ? skip : 0;
+            iov[n].iov_base = (uint8_t*)segments[i].dst + from;
+            iov[n].iov_len = segments[i].size - from;
+        }
+        ssize_t got = preadv(file->fd, iov, n, offset + done);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return done ? done : -1;
+        }
+        if (got == 0)
+            break;
+        done += got;
+        // Step past what was filled
+        while (first < count && got > 0)
+        {
+            uint32_t left = segments[first].size - skip;
+            if ((size_t)got < left)
+            {
+                skip += (uint32_t)got;
+                break;
+            }
+            got -= left;
+            first++;
+            skip = 0;
+        }
+    }
+    return done;
+}
+
+static bool map_whole(HostFile* file)
+{
+    void* view = mmap(nullptr, (size_t)file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (view == MAP_FAILED)
+        return false;
+    file->view = (const uint8_t*)view;
+    return true;
+}
+
+static void will_need(HostFile* file, int64_t offset, uint32_t size)
+{
+    static const int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t start = offset & ~(page - 1);
+    madvise((void*)(file->view + start), (size_t)(offset + size - start), MADV_WILLNEED);
+}
+
+#endif
+
+// ============================================================================
+// Reads
+// ============================================================================
+
+void host_file_open_memory(const uint8_t* data, int64_t size, HostFile* file)
+{
+    *file = HostFile{};
+    file->size = size;
+    file->view = data;
+    file->borrowed = true;
+}
+
+int64_t host_file_read(HostFile* file, void* dst, uint32_t size, int64_t offset)
+{
+    if (offset < 0)
+        return -1;
+    if (offset >= file->size || size == 0)
+        return 0;
+    if ((size >= HOST_FILE_MAP_MIN || file->borrowed) && file->view)
+    {
+        uint32_t n = (uint32_t)std::min<int64_t>(size, file->size - offset);
+        if (size >= HOST_FILE_MAP_MIN)
+            will_need(file, offset, n);
+        memcpy(dst, file->view + offset, n);
+        return n;
+    }
+    return read_at(file, dst, size, offset);
+}
+
+int64_t host_file_read_scatter(HostFile* file, const HostIoSegment* segments, int count, int64_t offset)
+{
+    if (offset < 0)
+        return -1;
+    if (offset >= file->size || count <= 0)
+        return 0;
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += segments[i].size;
+    if ((total >= HOST_FILE_MAP_MIN || file->borrowed) && file->view)
+    {
+        int64_t end = std::min<int64_t>(offset + total, file->size);
+        if (total >= HOST_FILE_MAP_MIN)
+            will_need(file, offset, (uint32_t)(end - offset));
+        int64_t pos = offset;
+        for (int i = 0; i < count && pos < end; i++)
+        {
+            uint32_t n = (uint32_t)std::min<int64_t>(segments[i].size, end - pos);
+            memcpy(segments[i].dst, file->view + pos, n);
+            pos += n;
+        }
+        return pos - offset;
+    }
+    return read_scatter_at(file, segments, count, offset);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only host files for the game: file stubs.
+//
+// Reads are positional (pread, or ReadFile with an OVERLAPPED offset on
+// Windows) straight into the destination, so there is no stdio lock, no
+// stdio buffer to copy through and no separate seek; handles can be read
+// from several threads at once.
+//
+// With mapping enabled (--file-reads=mmap), files of HOST_FILE_MAP_MIN bytes
+// or more are mapped read-only when opened, and reads of at least that size
+// are copied out of the mapping; the range is madvise(MADV_WILLNEED)d first
+// so the kernel reads it in large requests. Smaller reads stay on pread.
+//
+// Files in an asset pack (asset_pack.h) are views of the pack's mapping
+// (host_file_open_memory), and every read is a copy out of it.
+
+constexpr uint32_t HOST_FILE_MAP_MIN = 256 * 1024;
+
+struct HostFile
+{
+#ifdef _WIN32
+    void* handle = nullptr; // HANDLE, nullptr if closed
+    void* mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    int64_t size = 0;
+    const uint8_t* view = nullptr; // whole-file mapping, if made
+    bool borrowed = false;         // view belongs to someone else: no file behind it
+};
+
+// Open for reading. Returns false if the file can't be opened.
+bool host_file_open(const char* path, HostFile* file);
+void host_file_close(HostFile* file);
+
+// A file that is `size` bytes of memory at `data`, which must outlive it.
+void host_file_open_memory(const uint8_t* data, int64_t size, HostFile* file);
+
+// Read up to `size` bytes at `offset` into `dst`. Returns the bytes read
+// (short at the end of the file), or -1 on error.
+int64_t host_file_read(HostFile* file, void* dst, uint32_t size, int64_t offset);
+
+// One destination of a scattered read
+struct HostIoSegment
+{
+    void* dst;
+    uint32_t size;
+};
+
+// Read consecutive bytes from `offset` into each segment in turn: one
+// preadv where available. Returns the bytes read in all (short at the end
+// of the file), or -1 on error.
+int64_t host_file_read_scatter(HostFile* file, const HostIoSegment* segments, int count, int64_t offset);
+
+// Serve large reads from a mapping (see above). Off by default; affects
+// files opened afterwards.
+void host_file_set_mmap(bool enabled);
@@ -0,0 +1,501 @@
+#include "ppc_config.h"
+#include "ppc_context.h"
+#include "kernel_objects.h"
+#include "scheduler.h"
+#include "timer_wheel.h"
+#include "replay.h"
+#include "apc.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Object table
+// ============================================================================
+
+// Xbox 360 DISPATCHER_HEADER: +0x00 Type(u8), +0x04 SignalState(s32),
+// +0x08 WaitListHead. KSEMAPHORE adds +0x10 Limit(s32).
+enum KObjType : uint8_t
+{
+    KOBJ_NOTIFICATION_EVENT    = 0, // manual reset
+    KOBJ_SYNCHRONIZATION_EVENT = 1, // auto reset
+    KOBJ_SEMAPHORE             = 5,
+    KOBJ_THREAD                = 6, // signaled (for good) when the thread ends
+    KOBJ_TIMER_NOTIFICATION    = 8, // manual reset
+    KOBJ_TIMER_SYNCHRONIZATION = 9, // auto reset
+};
+
+// One thread blocked in kobj_wait, queued on every object it waits for.
+// Lives on the waiter's stack for the duration of the wait.
+struct KWaitBlock
+{
+    GuestThread*    waiter;
+    const uint32_t* keys;
+    int             count;
+    bool            wait_all;
+    bool            satisfied; // set by a signaler, together with status
+    uint32_t        status;
+};
+
+// Timer objects: the wheel entry and the period to re-arm with
+struct KTimer
+{
+    WheelTimer wheel;
+    uint64_t   period;  // guest timebase, 0 = one-shot
+    uint32_t   seq;     // bumped by every set / cancel; fires with an old seq are stale
+    uint32_t   apc_routine; // NtSetTimerEx, queued to apc_thread; 0 = none
+    uint32_t   apc_context;
+    uint32_t   apc_thread;
+};
+
+struct KObject
+{
+    KObjType type;
+    int32_t  signal_state; // event / thread / timer: 0/1, semaphore: count
+    int32_t  limit;        // semaphore only
+    std::vector<KWaitBlock*> waiters; // FIFO
+    std::unique_ptr<KTimer> timer;    // timers only
+};
+
+// One lock for all objects: waits can span several objects (WaitAll), and
+// signals are rare next to guest work.
+static std::mutex g_obj_lock;
+static std::unordered_map<uint32_t, KObject> g_objects;
+
+static bool g_yield_waits = false;
+
+// Type, SignalState and Limit from a guest DISPATCHER_HEADER. Returns false
+// for types we don't model.
+static bool kobj_read_header(uint8_t* base, uint32_t key, KObject* obj)
+{
+    uint8_t type = *(base + key);
+    switch (type)
+    {
+    case KOBJ_NOTIFICATION_EVENT:
+    case KOBJ_SYNCHRONIZATION_EVENT:
+        obj->type = (KObjType)type;
+        obj->signal_state = PPC_LOAD_U32(key + 4) ? 1 : 0;
+        obj->limit = 0;
+        return true;
+    case KOBJ_SEMAPHORE:
+        obj->type = KOBJ_SEMAPHORE;
+        obj->signal_state = (int32_t)PPC_LOAD_U32(key + 4);
+        obj->limit = (int32_t)PPC_LOAD_U32(key + 0x10);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Look up an object, creating guest-address objects from their header.
+// Returns nullptr for keys we don't model. Caller holds g_obj_lock.
+//
+// The guest initializes KEVENTs and KSEMAPHOREs inline (there is no
+// KeInitializeEvent import), and reuses stack and heap addresses for new
+// ones, so a guest-address object nobody is waiting on is re-read from its
+// header every time: the header matches our state (kobj_sync_guest) unless
+// the guest has written a new object there.
+static KObject* kobj_lookup(uint8_t* base, uint32_t key)
+{
+    auto it = g_objects.find(key);
+    if (it != g_objects.end())
+    {
+        KObject& obj = it->second;
+        if (key < KOBJ_MIN_GUEST_ADDR || !base || !obj.waiters.empty())
+            return &obj;
+        if (kobj_read_header(base, key, &obj))
+            return &obj;
+        g_objects.erase(it);
+        return nullptr;
+    }
+    if (key < KOBJ_MIN_GUEST_ADDR || !base)
+        return nullptr;
+
+    KObject obj = {};
+    if (!kobj_read_header(base, key, &obj))
+        return nullptr;
+    return &g_objects.emplace(key, std::move(obj)).first->second;
+}
+
+// Mirror the signal state into the guest header for address-keyed objects
+static void kobj_sync_guest(uint8_t* base, uint32_t key, const KObject& obj)
+{
+    if (key >= KOBJ_MIN_GUEST_ADDR && base)
+        PPC_STORE_U32(key + 4, (uint32_t)obj.signal_state);
+}
+
+static bool kobj_is_signaled(const KObject* obj)
+{
+    return !obj || obj->signal_state > 0;
+}
+
+static void kobj_consume(uint8_t* base, uint32_t key, KObject* obj)
+{
+    if (!obj) return;
+    if (obj->type == KOBJ_SYNCHRONIZATION_EVENT || obj->type == KOBJ_TIMER_SYNCHRONIZATION)
+        obj->signal_state = 0;
+    else if (obj->type == KOBJ_SEMAPHORE)
+        obj->signal_state--;
+    else
+        return;
+    kobj_sync_guest(base, key, *obj);
+}
+
+// Try to satisfy the wait without blocking. Caller holds g_obj_lock.
+static bool kobj_try_wait(uint8_t* base, const uint32_t* keys, int count, bool wait_all,
+                          uint32_t* status)
+{
+    if (wait_all)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (!kobj_is_signaled(kobj_lookup(base, keys[i])))
+                return false;
+        }
+        for (int i = 0; i < count; i++)
+            kobj_consume(base, keys[i], kobj_lookup(base, keys[i]));
+        *status = KOBJ_STATUS_WAIT_0;
+        return true;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        KObject* obj = kobj_lookup(base, keys[i]);
+        if (kobj_is_signaled(obj))
+        {
+            kobj_consume(base, keys[i], obj);
+            *status = KOBJ_STATUS_WAIT_0 + i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// `obj` became signaled: satisfy queued waits in FIFO order until it isn't
+// any more (an auto-reset event wakes one waiter, a notification event all).
+// Caller holds g_obj_lock.
+static void kobj_wake_waiters(uint8_t* base, KObject* obj)
+{
+    for (KWaitBlock* wb : obj->waiters)
+    {
+        if (!kobj_is_signaled(obj))
+            break;
+        if (wb->satisfied)
+            continue;
+        if (kobj_try_wait(base, wb->keys, wb->count, wb->wait_all, &wb->status))
+        {
+            wb->satisfied = true;
+            scheduler_unpark(wb->waiter);
+        }
+    }
+}
+
+// ============================================================================
+// Events / semaphores / threads
+// ============================================================================
+
+void kobj_create_event(uint32_t key, bool manual_reset, bool signaled)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject& obj = g_objects[key];
+    obj.type = manual_reset ? KOBJ_NOTIFICATION_EVENT : KOBJ_SYNCHRONIZATION_EVENT;
+    obj.signal_state = signaled ? 1 : 0;
+    obj.limit = 0;
+}
+
+int32_t kobj_set_event(uint8_t* base, uint32_t key)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject* obj = kobj_lookup(base, key);
+    if (!obj) return 0;
+    int32_t prev = obj->signal_state;
+    obj->signal_state = 1;
+    kobj_wake_waiters(base, obj);
+    kobj_sync_guest(base, key, *obj);
+    return prev;
+}
+
+int32_t kobj_reset_event(uint8_t* base, uint32_t key)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject* obj = kobj_lookup(base, key);
+    if (!obj) return 0;
+    int32_t prev = obj->signal_state;
+    obj->signal_state = 0;
+    kobj_sync_guest(base, key, *obj);
+    return prev;
+}
+
+void kobj_init_semaphore(uint8_t* base, uint32_t key, int32_t count, int32_t limit)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject& obj = g_objects[key];
+    obj.type = KOBJ_SEMAPHORE;
+    obj.signal_state = count;
+    obj.limit = limit;
+    kobj_sync_guest(base, key, obj);
+}
+
+int32_t kobj_release_semaphore(uint8_t* base, uint32_t key, int32_t increment)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject* obj = kobj_lookup(base, key);
+    if (!obj || obj->type != KOBJ_SEMAPHORE) return 0;
+    int32_t prev = obj->signal_state;
+    obj->signal_state += increment;
+    if (obj->limit > 0 && obj->signal_state > obj->limit)
+        obj->signal_state = obj->limit;
+    kobj_wake_waiters(base, obj);
+    kobj_sync_guest(base, key, *obj);
+    return prev;
+}
+
+void kobj_create_thread(uint32_t key)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject& obj = g_objects[key];
+    obj.type = KOBJ_THREAD;
+    obj.signal_state = 0;
+    obj.limit = 0;
+}
+
+void kobj_signal_thread(uint32_t key)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    auto it = g_objects.find(key);
+    if (it == g_objects.end() || it->second.type != KOBJ_THREAD) return;
+    it->second.signal_state = 1;
+    kobj_wake_waiters(nullptr, &it->second);
+}
+
+void kobj_close(uint32_t key)
+{
+    if (key >= KOBJ_MIN_GUEST_ADDR) return;
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    auto it = g_objects.find(key);
+    if (it == g_objects.end()) return;
+    // A fire already taken off the wheel finds the key gone
+    if (it->second.timer)
+        timer_cancel(&it->second.timer->wheel);
+    // Closed under a waiter: the key is no longer modeled, which counts as
+    // signaled, so let the waiters re-check
+    for (KWaitBlock* wb : it->second.waiters)
+        scheduler_unpark(wb->waiter);
+    g_objects.erase(it);
+}
+
+// ============================================================================
+// Timers
+// ============================================================================
+
+// Signal the timer and queue its APC
+static void kobj_timer_signal(KObject& obj)
+{
+    obj.signal_state = 1;
+    kobj_wake_waiters(nullptr, &obj);
+    const KTimer& timer = *obj.timer;
+    if (timer.apc_routine)
+        apc_queue_routine(timer.apc_thread, timer.apc_routine, timer.apc_context, 0, 0);
+}
+
+// Timer thread: signal the timer and re-arm it if periodic. While recording
+// the signal waits for the main thread's next sync point (replay_post).
+static void kobj_timer_fire(void* param, uint32_t seq)
+{
+    uint32_t key = (uint32_t)(uintptr_t)param;
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    auto it = g_objects.find(key);
+    if (it == g_objects.end() || !it->second.timer || it->second.timer->seq != seq)
+        return;
+    KObject& obj = it->second;
+    KTimer& timer = *obj.timer;
+    if (!replay_post(REPLAY_EVENT_KTIMER, key, seq))
+        kobj_timer_signal(obj);
+    if (timer.period)
+    {
+        // From the due time, not from now, so lateness doesn't accumulate
+        uint64_t next = timer.wheel.expires + timer.period;
+        uint64_t now = timer_now();
+        if (next < now)
+            next = now;
+        timer_arm(&timer.wheel, next, seq);
+    }
+}
+
+// A recorded fire, at a sync point. Dropped if the timer was set or
+// cancelled since.
+static void kobj_timer_replay(uint32_t key, uint32_t seq)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    auto it = g_objects.find(key);
+    if (it != g_objects.end() && it->second.timer && it->second.timer->seq == seq)
+        kobj_timer_signal(it->second);
+}
+
+void kobj_create_timer(uint32_t key, bool synchronization)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject& obj = g_objects[key];
+    obj.type = synchronization ? KOBJ_TIMER_SYNCHRONIZATION : KOBJ_TIMER_NOTIFICATION;
+    obj.signal_state = 0;
+    obj.limit = 0;
+    obj.timer.reset(new KTimer{});
+    timer_init(&obj.timer->wheel, kobj_timer_fire, (void*)(uintptr_t)key);
+    replay_set_handler(REPLAY_EVENT_KTIMER, kobj_timer_replay);
+}
+
+// Timer object for `key`, or nullptr. Caller holds g_obj_lock.
+static KObject* kobj_lookup_timer(uint32_t key)
+{
+    auto it = g_objects.find(key);
+    if (it == g_objects.end() || !it->second.timer)
+        return nullptr;
+    return &it->second;
+}
+
+int32_t kobj_set_timer(uint32_t key, int64_t due_time, int32_t period_ms,
+                       uint32_t apc_routine, uint32_t apc_context)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject* obj = kobj_lookup_timer(key);
+    if (!obj) return 0;
+    int32_t prev = obj->signal_state;
+    KTimer& timer = *obj->timer;
+    obj->signal_state = 0;
+    timer.period = period_ms > 0 ? (uint64_t)period_ms * (GUEST_TIMEBASE_HZ / 1000) : 0;
+    timer.apc_routine = apc_routine;
+    timer.apc_context = apc_context;
+    timer.apc_thread = scheduler_thread_object();
+    // Relative due times are negative. Absolute ones are system times we
+    // don't track, so they are already due.
+    uint64_t now = timer_now();
+    uint64_t due = due_time < 0 ? now + timer_from_100ns((uint64_t)-due_time) : now;
+    timer_arm(&timer.wheel, due, ++timer.seq);
+    return prev;
+}
+
+int32_t kobj_cancel_timer(uint32_t key)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    KObject* obj = kobj_lookup_timer(key);
+    if (!obj) return 0;
+    obj->timer->seq++;
+    timer_cancel(&obj->timer->wheel);
+    return obj->signal_state;
+}
+
+// ============================================================================
+// Waits
+// ============================================================================
+
+void kobj_set_yield_waits(bool enable)
+{
+    g_yield_waits = enable;
+}
+
+bool kobj_yield_waits()
+{
+    return g_yield_waits;
+}
+
+const int64_t* kobj_read_timeout(uint8_t* base, uint32_t addr, int64_t* storage)
+{
+    if (!addr) return nullptr;
+    uint64_t hi = PPC_LOAD_U32(addr);
+    uint64_t lo = PPC_LOAD_U32(addr + 4);
+    *storage = (int64_t)((hi << 32) | lo);
+    return storage;
+}
+
+bool kobj_poll(uint8_t* base, const uint32_t* keys, int count, bool wait_all)
+{
+    std::lock_guard<std::mutex> lock(g_obj_lock);
+    for (int i = 0; i < count; i++)
+    {
+        bool signaled = kobj_is_signaled(kobj_lookup(base, keys[i]));
+        if (signaled != wait_all)
+            return signaled;
+    }
+    return wait_all;
+}
+
+uint32_t kobj_wait(uint8_t* base, const uint32_t* keys, int count, bool wait_all,
+                   const int64_t* timeout, bool alertable)
+{
+    std::unique_lock<std::mutex> lock(g_obj_lock);
+    uint32_t status;
+    if (kobj_try_wait(base, keys, count, wait_all, &status))
+        return status;
+
+    GuestThread* waiter = scheduler_current_waiter();
+    // From here on a queued APC unparks us
+    if (alertable && apc_alert_begin(waiter))
+    {
+        apc_alert_end();
+        return APC_STATUS_USER_APC;
+    }
+
+    // Relative timeouts are negative. Absolute ones (positive) are system
+    // times we don't track, so they count as already expired.
+    int64_t deadline = INT64_MAX;
+    if (timeout)
+    {
+        int64_t ticks = *timeout < 0 ? -*timeout : 0;
+        if (ticks == 0)
+        {
+            if (alertable)
+                apc_alert_end();
+            return KOBJ_STATUS_TIMEOUT;
+        }
+        deadline = scheduler_now_ns() + ticks * 100;
+    }
+
+    KWaitBlock wb = {waiter, keys, count, wait_all, false, 0};
+    bool alerted = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (KObject* obj = kobj_lookup(base, keys[i]))
+            obj->waiters.push_back(&wb);
+    }
+
+    for (;;)
+    {
+        lock.unlock();
+        scheduler_park(wb.waiter, deadline);
+        lock.lock();
+        if (wb.satisfied)
+            break;
+        // A WaitAll can become satisfiable through objects that were
+        // signaled while another waiter held one of them, and closed keys
+        // count as signaled: re-check before parking again
+        if (kobj_try_wait(base, keys, count, wait_all, &wb.status))
+        {
+            wb.satisfied = true;
+            break;
+        }
+        if (alertable && apc_alert_pending())
+        {
+            alerted = true;
+            break;
+        }
+        if (scheduler_now_ns() >= deadline)
+            break;
+        scheduler_note_wasted_slice();
+    }
+    if (alertable)
+        apc_alert_end();
+
+    for (int i = 0; i < count; i++)
+    {
+        auto it = g_objects.find(keys[i]);
+        if (it == g_objects.end())
+            continue;
+        auto& waiters = it->second.waiters;
+        waiters.erase(std::remove(waiters.begin(), waiters.end(), &wb), waiters.end());
+    }
+    if (wb.satisfied)
+        return wb.status;
+    return alerted ? APC_STATUS_USER_APC : KOBJ_STATUS_TIMEOUT;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+
+// Kernel dispatcher objects (events, semaphores, threads, timers) and waits on
+// them.
+//
+// Objects are keyed by whatever value the guest uses to name them: a handle
+// (NtCreateEvent, or ObReferenceObjectByHandle, which hands the handle back
+// as the "object pointer"), or the guest address of a KEVENT / KSEMAPHORE
+// for Ke* calls. Keys at or above KOBJ_MIN_GUEST_ADDR are guest addresses;
+// unknown ones are created lazily from their DISPATCHER_HEADER, and their
+// SignalState field is kept in sync for guest code that reads it directly.
+// Waiting on a key that is not modeled (files) succeeds at once.
+//
+// A wait that can't be satisfied at once queues itself on every object it
+// waits for and parks (see scheduler_park). Signaling an object satisfies the
+// queued waits in FIFO order and unparks those threads, so the scheduler only
+// runs threads whose wait has completed.
+
+// Handles (object_table.h) are below this; guest memory starts well above it
+constexpr uint32_t KOBJ_MIN_GUEST_ADDR = 0x01000000;
+
+// NTSTATUS values returned by kobj_wait
+constexpr uint32_t KOBJ_STATUS_WAIT_0  = 0x00000000;
+constexpr uint32_t KOBJ_STATUS_TIMEOUT = 0x00000102;
+
+void kobj_create_event(uint32_t key, bool manual_reset, bool signaled);
+
+// Both return the previous signal state.
+int32_t kobj_set_event(uint8_t* base, uint32_t key);
+int32_t kobj_reset_event(uint8_t* base, uint32_t key);
+
+void kobj_init_semaphore(uint8_t* base, uint32_t key, int32_t count, int32_t limit);
+
+// Returns the previous count.
+int32_t kobj_release_semaphore(uint8_t* base, uint32_t key, int32_t increment);
+
+// ExCreateThread registers the thread handle; the scheduler signals it when
+// the thread returns or calls ExTerminateThread.
+void kobj_create_thread(uint32_t key);
+void kobj_signal_thread(uint32_t key);
+
+// NtCreateTimer / NtSetTimerEx / NtCancelTimer. A timer is signaled at its
+// due time (100 ns units, negative = relative; absolute times are due at once)
+// and then every period_ms if nonzero. Synchronization timers reset when a
+// wait consumes them. Setting a timer resets it. Set / cancel return the
+// previous signal state. A nonzero apc_routine is queued as an APC to the
+// setting thread on every signal: apc_routine(apc_context, 0, 0), as the
+// system time it would get isn't kept.
+void kobj_create_timer(uint32_t key, bool synchronization);
+int32_t kobj_set_timer(uint32_t key, int64_t due_time, int32_t period_ms,
+                       uint32_t apc_routine = 0, uint32_t apc_context = 0);
+int32_t kobj_cancel_timer(uint32_t key);
+
+// Wait until one (wait_all = false) or all of the objects are signaled and
+// consume them (auto-reset events reset, semaphores decrement). timeout is an
+// NT LARGE_INTEGER in 100 ns units (negative = relative) or nullptr for
+// infinite. Returns KOBJ_STATUS_WAIT_0 + index or KOBJ_STATUS_TIMEOUT.
+// An alertable wait also ends when the thread has APCs queued, returning
+// APC_STATUS_USER_APC (see apc.h; the caller delivers them). A wait on no
+// objects is an alertable delay.
+uint32_t kobj_wait(uint8_t* base, const uint32_t* keys, int count, bool wait_all,
+                   const int64_t* timeout, bool alertable = false);
+
+// NtClose: forget a handle-keyed object.
+void kobj_close(uint32_t key);
+
+// True if the wait would be satisfied now. Doesn't consume anything.
+bool kobj_poll(uint8_t* base, const uint32_t* keys, int count, bool wait_all);
+
+// --waits=yield: fibers don't wait at all, they yield and report success and
+// the guest's own loop re-checks (the behaviour before wait queues). Kept to
+// compare wasted slices per frame against.
+void kobj_set_yield_waits(bool enable);
+bool kobj_yield_waits();
+
+// Read an NT timeout argument (LARGE_INTEGER* in guest memory, 0 = infinite).
+// Returns nullptr for infinite, otherwise points at `storage`.
+const int64_t* kobj_read_timeout(uint8_t* base, uint32_t addr, int64_t* storage);
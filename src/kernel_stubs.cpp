@@ -1,12 +1,36 @@
 #include "ppc_config.h"
 #include "ppc_context.h"
 #include "memory.h"
-
+#include "scheduler.h"
+#include "kernel_objects.h"
+#include "critical_section.h"
+#include "rw_lock.h"
+#include "replay.h"
+#include "apc.h"
+#include "guest_heap.h"
+#include "guest_pool.h"
+#include "alloc_tracker.h"
+#include "vm_regions.h"
+#include "timer_wheel.h"
+#include "host_file.h"
+#include "file_io.h"
+#include "read_ahead.h"
+#include "path_index.h"
+#include "object_table.h"
+#include "dir_listing.h"
+
+#include <algorithm>
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
 #include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <memory>
 #include <vector>
 
 #ifdef _WIN32
@@ -17,6 +41,9 @@
 #else
 #include <chrono>
 #include <thread>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
 #endif
 
 // ============================================================================
@@ -66,13 +93,13 @@
 #endif
 
 // Heartbeat: track total stub calls to show the game is alive
-static uint64_t g_stub_call_count = 0;
-static uint64_t g_last_heartbeat = 0;
+static std::atomic<uint64_t> g_stub_call_count{0};
+static std::atomic<uint64_t> g_last_heartbeat{0};
 #define STUB_HEARTBEAT() do { \
-    g_stub_call_count++; \
-    if (g_stub_call_count - g_last_heartbeat >= 10000) { \
-        fprintf(stderr, "[HEARTBEAT] %llu stub calls\n", (unsigned long long)g_stub_call_count); \
-        g_last_heartbeat = g_stub_call_count; \
+    uint64_t calls = ++g_stub_call_count; \
+    if (calls - g_last_heartbeat >= 10000) { \
+        fprintf(stderr, "[HEARTBEAT] %llu stub calls\n", (unsigned long long)calls); \
+        g_last_heartbeat = calls; \
     } \
 } while(0)
 
@@ -115,120 +142,68 @@ static inline void ppc_write_u64(uint8_t* base, uint32_t addr, uint64_t val)
 }
 
 // ============================================================================
-// Thread management (cooperative fiber-based model)
+// Thread management: see scheduler.cpp (Fiber / Host / Pool modes)
 // ============================================================================
 
-// PPC thread state — each thread has its own PPCContext and PPC stack
-struct PendingThread
-{
-    uint32_t handle;        // handle assigned to this thread
-    uint32_t start_routine; // PPC address
-    uint32_t start_context; // PPC address passed as r3
-    uint32_t api_startup;   // PPC address of ApiThreadStartup wrapper
-    bool     suspended;     // created in suspended state
-    bool     finished;      // thread function has returned
-    bool     started;       // fiber has been created and started
-    uint32_t ppc_stack_top; // PPC stack address for this thread
-    LPVOID   fiber;         // Windows fiber handle
-    PPCContext thread_ctx;  // thread's own PPC register state
-    uint8_t* base;          // shared PPC memory base
-};
-
-static constexpr int MAX_PENDING_THREADS = 16;
-static PendingThread g_pending_threads[MAX_PENDING_THREADS] = {};
-static int g_pending_thread_count = 0;
-
-// Fiber globals
-LPVOID g_main_fiber = nullptr;                 // main thread's fiber (set in main.cpp)
-static PendingThread* g_current_thread = nullptr; // currently running PPC thread (NULL = main)
-static int g_current_thread_idx = -1;
-
-// Allocate a PPC stack for a child thread (from the heap region)
-static uint32_t g_thread_stack_next = 0x8E000000; // separate region for thread stacks
-static constexpr uint32_t THREAD_STACK_SIZE = 256 * 1024; // 256 KB per thread
-
-static uint32_t alloc_thread_stack()
-{
-    uint32_t top = g_thread_stack_next;
-    g_thread_stack_next -= THREAD_STACK_SIZE;
-    return top;
-}
-
-// Fiber entry point for PPC threads
-static void CALLBACK ppc_thread_fiber_proc(LPVOID param)
+// Host and Pool mode run guest threads in parallel, so guest spinlocks need
+// real locks behind them. Ownership is per guest thread rather than per host
+// thread: a Pool mode fiber can take a lock on one worker and release it on
+// another. A contended acquire yields, which in Pool mode lets the owner run
+// if it is queued on the same worker.
+struct GuestMutex
 {
-    PendingThread* pt = (PendingThread*)param;
-    PPCContext& ctx = pt->thread_ctx;
-    uint8_t* base = pt->base;
-    int idx = (int)(pt - g_pending_threads);
+    std::atomic<uint32_t> owner{0}; // scheduler_thread_id(), 0 = free
+    uint32_t recursion = 0;         // only touched by the owner
 
-    uint32_t func_addr = pt->start_routine;
-    typedef void (*PPCFuncPtr)(PPCContext& __restrict, uint8_t*);
-    PPCFuncPtr fn = PPC_LOOKUP_FUNC(base, func_addr);
-    if (fn)
+    bool try_lock()
     {
-        fprintf(stderr, "[THREAD] Fiber %d starting: routine=0x%08X, context=0x%08X, r1=0x%08X\n",
-                idx, func_addr, pt->start_context, ctx.r1.u32);
-        fn(ctx, base);
-        fprintf(stderr, "[THREAD] Fiber %d returned normally\n", idx);
+        uint32_t self = scheduler_thread_id();
+        uint32_t expected = 0;
+        if (owner.compare_exchange_strong(expected, self, std::memory_order_acquire))
+        {
+            recursion = 1;
+            return true;
+        }
+        if (expected != self)
+            return false;
+        recursion++;
+        return true;
     }
-    else
+
+    void lock()
     {
-        fprintf(stderr, "[THREAD] Fiber %d: no function at 0x%08X\n", idx, func_addr);
+        while (!try_lock())
+            scheduler_yield();
     }
 
-    pt->finished = true;
-    // Switch back to main fiber (thread is done)
-    SwitchToFiber(g_main_fiber);
-}
-
-// Initialize a thread's PPCContext from the main context template
-static void init_thread_ctx(PendingThread& pt, PPCContext& main_ctx)
-{
-    memset(&pt.thread_ctx, 0, sizeof(PPCContext));
-    // Copy key registers from main context
-    pt.thread_ctx.r13 = main_ctx.r13;   // KPCR pointer
-    pt.thread_ctx.r2 = main_ctx.r2;     // TOC (unused but copy anyway)
-    pt.thread_ctx.fpscr.csr = 0x1F80;   // mask FP exceptions
-    // Set thread-specific registers
-    pt.thread_ctx.r1.u32 = pt.ppc_stack_top - 16; // stack pointer with headroom
-    pt.thread_ctx.r3.u32 = pt.start_context;       // first argument
-}
-
-// Give a thread a time slice by switching to its fiber
-static void thread_give_timeslice(PendingThread& pt, int idx)
-{
-    if (pt.finished || pt.suspended) return;
-
-    if (!pt.started)
+    void unlock()
     {
-        // First run: create the fiber (context already initialized in ExCreateThread)
-        pt.fiber = CreateFiber(0, ppc_thread_fiber_proc, &pt);
-        if (!pt.fiber)
-        {
-            fprintf(stderr, "[THREAD] Failed to create fiber for thread %d\n", idx);
-            pt.finished = true;
+        // Ignore releases by a non-owner (lock taken before the mode mattered)
+        if (owner.load(std::memory_order_relaxed) != scheduler_thread_id())
             return;
-        }
-        pt.started = true;
-        fprintf(stderr, "[THREAD] Created fiber for thread %d (handle=0x%X, stack=0x%08X)\n",
-                idx, pt.handle, pt.ppc_stack_top);
+        if (--recursion == 0)
+            owner.store(0, std::memory_order_release);
     }
+};
+
+// Keyed by the guest address of the spinlock; entries are
+// never freed so the pointers stay valid.
+static std::mutex g_guest_lock_table_lock;
+static std::unordered_map<uint32_t, std::unique_ptr<GuestMutex>> g_guest_locks;
 
-    g_current_thread = &pt;
-    g_current_thread_idx = idx;
-    SwitchToFiber(pt.fiber);
-    g_current_thread = nullptr;
-    g_current_thread_idx = -1;
+static GuestMutex& guest_lock(uint32_t addr)
+{
+    std::lock_guard<std::mutex> lock(g_guest_lock_table_lock);
+    auto& m = g_guest_locks[addr];
+    if (!m)
+        m = std::make_unique<GuestMutex>();
+    return *m;
 }
 
-// Called from yield stubs (KeDelayExecutionThread, etc.) to return to main
-static void thread_yield()
+// Guest threads can run at the same time as each other (Host / Pool mode)
+static inline bool parallel_threads()
 {
-    if (g_current_thread && g_main_fiber)
-    {
-        SwitchToFiber(g_main_fiber);
-    }
+    return scheduler_mode() != ThreadMode::Fiber;
 }
 
 
@@ -282,21 +257,22 @@ PPC_FUNC(__imp__DbgPrint)
 // Thread-Local Storage (KeTls*)
 // ============================================================================
 
-// Simple TLS emulation using a fixed-size array.
-// Xbox 360 TLS slots are per-thread; we only support single-threaded for now.
-static constexpr int MAX_TLS_SLOTS = 64;
-static void* g_tls_slots[MAX_TLS_SLOTS] = {};
+// Slot indices are allocated here; the values are per guest thread and live
+// in the scheduler (see scheduler_tls_get), mirrored into the thread's KTHREAD.
+static constexpr int MAX_TLS_SLOTS = SCHEDULER_TLS_SLOTS;
 static bool g_tls_used[MAX_TLS_SLOTS] = {};
+static std::mutex g_tls_lock; // slot allocation
 
 PPC_FUNC(__imp__KeTlsAlloc)
 {
     STUB_LOG_ONCE("KeTlsAlloc");
+    std::lock_guard<std::mutex> lock(g_tls_lock);
     for (int i = 0; i < MAX_TLS_SLOTS; i++)
     {
         if (!g_tls_used[i])
         {
             g_tls_used[i] = true;
-            g_tls_slots[i] = nullptr;
+            scheduler_tls_reset(base, i);
             ctx.r3.u32 = i;
             return;
         }
@@ -310,7 +286,7 @@ PPC_FUNC(__imp__KeTlsSetValue)
     uint32_t index = ctx.r3.u32;
     if (index < MAX_TLS_SLOTS)
     {
-        g_tls_slots[index] = reinterpret_cast<void*>(static_cast<uintptr_t>(ctx.r4.u32));
+        scheduler_tls_set(base, index, ctx.r4.u32);
         ctx.r3.u32 = 1; // TRUE
     }
     else
@@ -324,7 +300,7 @@ PPC_FUNC(__imp__KeTlsGetValue)
     // r3 = index, returns value in r3
     uint32_t index = ctx.r3.u32;
     if (index < MAX_TLS_SLOTS)
-        ctx.r3.u32 = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(g_tls_slots[index]));
+        ctx.r3.u32 = scheduler_tls_get(index);
     else
         ctx.r3.u32 = 0;
 }
@@ -335,8 +311,9 @@ PPC_FUNC(__imp__KeTlsFree)
     uint32_t index = ctx.r3.u32;
     if (index < MAX_TLS_SLOTS)
     {
+        std::lock_guard<std::mutex> lock(g_tls_lock);
         g_tls_used[index] = false;
-        g_tls_slots[index] = nullptr;
+        scheduler_tls_reset(base, index);
         ctx.r3.u32 = 1; // TRUE
     }
     else
@@ -376,22 +353,17 @@ PPC_FUNC(__imp__KeQueryPerformanceFrequency)
     ctx.r3.u32 = 50000000;
 }
 
+// mftb in the recompiled code (ppc/ppc_timebase.h redirects __rdtsc here)
+uint64_t ppc_guest_timebase()
+{
+    return replay_clock(REPLAY_CLOCK_TIMEBASE, timer_now());
+}
+
 PPC_FUNC(__imp__KeDelayExecutionThread)
 {
     // r3 = processor mode, r4 = alertable, r5 = interval (ptr to LARGE_INTEGER, 100ns units)
     STUB_LOG_ONCE("KeDelayExecutionThread");
 
-    // If we're running in a fiber thread, yield back to main
-    if (g_current_thread)
-    {
-        fprintf(stderr, "[THREAD] Fiber %d yielding via KeDelayExecutionThread\n", g_current_thread_idx);
-        thread_yield();
-        fprintf(stderr, "[THREAD] Fiber %d resumed from KeDelayExecutionThread\n", g_current_thread_idx);
-        ctx.r3.u32 = 0;
-        return;
-    }
-
-    // Main thread: actually sleep
     uint32_t interval_addr = ctx.r5.u32;
     int64_t interval = 0;
     if (interval_addr)
@@ -400,31 +372,46 @@ PPC_FUNC(__imp__KeDelayExecutionThread)
         uint32_t lo = ppc_read_u32(base, interval_addr + 4);
         interval = (int64_t(hi) << 32) | lo;
     }
-    if (interval < 0)
+    if (ctx.r4.u32)
     {
-        int ms = (int)(-interval / 10000);
-        if (ms > 0)
+        // Alertable: queued APCs end the delay early
+        uint32_t status = interval < 0
+            ? kobj_wait(base, nullptr, 0, false, &interval, true)
+            : (apc_alert_pending() ? APC_STATUS_USER_APC : KOBJ_STATUS_TIMEOUT);
+        if (status == APC_STATUS_USER_APC)
         {
-#ifdef _WIN32
-            Sleep(ms);
-#else
-            usleep(ms * 1000);
-#endif
+            apc_deliver(ctx, base);
+            ctx.r3.u32 = APC_STATUS_USER_APC;
+            return;
+        }
+        if (interval < 0)
+        {
+            ctx.r3.u32 = 0; // STATUS_SUCCESS
+            return;
         }
     }
+    // Parks until the deadline in every mode (see scheduler_delay)
+    scheduler_delay(interval);
     ctx.r3.u32 = 0; // STATUS_SUCCESS
 }
 
 PPC_FUNC(__imp__KeSetAffinityThread)
 {
+    // r3 = PKTHREAD (our handle, see KeResumeThread), r4 = Affinity,
+    // r5 = PreviousAffinity* (optional). Pool mode uses it as a hint.
     STUB_LOG_ONCE("KeSetAffinityThread");
-    ctx.r3.u32 = 0;
+    uint32_t prev = scheduler_set_affinity(ctx.r3.u32, ctx.r4.u32);
+    if (ctx.r5.u32)
+        ppc_write_u32(base, ctx.r5.u32, prev);
+    ctx.r3.u32 = 0; // STATUS_SUCCESS
 }
 
 PPC_FUNC(__imp__KeSetBasePriorityThread)
 {
+    // r3 = PKTHREAD, r4 = Increment; returns the previous base priority.
+    // Pool mode uses it as a hint.
     STUB_LOG_ONCE("KeSetBasePriorityThread");
-    ctx.r3.u32 = 0;
+    ctx.r3.s32 = scheduler_set_priority(ctx.r3.u32, ctx.r4.s32);
 }
 
 PPC_FUNC(__imp__KeResumeThread)
@@ -435,19 +422,11 @@ PPC_FUNC(__imp__KeResumeThread)
     uint32_t thread_ref = ctx.r3.u32;
     fprintf(stderr, "[THREAD] KeResumeThread: ref=0x%08X\n", thread_ref);
 
-    // Search pending threads - try matching by handle
-    for (int i = 0; i < g_pending_thread_count; i++)
+    // Try matching by handle
+    if (scheduler_resume_thread(thread_ref))
     {
-        PendingThread& pt = g_pending_threads[i];
-        if (pt.handle == thread_ref && pt.suspended && !pt.finished)
-        {
-            fprintf(stderr, "[THREAD] Resuming thread %d (handle=0x%X) via KeResumeThread — giving timeslice\n", i, pt.handle);
-            pt.suspended = false;
-            if (g_main_fiber)
-                thread_give_timeslice(pt, i);
-            ctx.r3.u32 = 1; // previous suspend count
-            return;
-        }
+        ctx.r3.u32 = 1; // previous suspend count
+        return;
     }
 
     // Not found by handle - maybe the game passed something else.
@@ -458,52 +437,113 @@ PPC_FUNC(__imp__KeResumeThread)
 
 PPC_FUNC(__imp__KeSetEvent)
 {
+    // r3 = KEVENT*, r4 = increment, r5 = wait; returns previous state
     STUB_LOG_ONCE("KeSetEvent");
-    ctx.r3.u32 = 0;
+    ctx.r3.s32 = kobj_set_event(base, ctx.r3.u32);
 }
 
 PPC_FUNC(__imp__KeResetEvent)
 {
+    // r3 = KEVENT*; returns previous state
     STUB_LOG_ONCE("KeResetEvent");
-    ctx.r3.u32 = 0;
+    ctx.r3.s32 = kobj_reset_event(base, ctx.r3.u32);
 }
 
+// Waits park the thread on the objects' wait queues (see kernel_objects.h).
+// With --waits=yield, fibers (and the Fiber mode main thread) instead yield
+// and report success, and the guest's own wait loop re-checks; each such
+// slice that finds the objects still unsignaled is counted as wasted.
+// Alertable waits run the thread's queued APCs and return STATUS_USER_APC
+// instead (see apc.h).
+static uint32_t wait_objects(PPCContext& ctx, uint8_t* base, const uint32_t* keys, int count,
+                             bool wait_all, bool alertable, uint32_t timeout_addr)
+{
+    if (alertable && apc_alert_pending())
+    {
+        apc_deliver(ctx, base);
+        return APC_STATUS_USER_APC;
+    }
+    if (kobj_yield_waits() &&
+        (!parallel_threads() ||
+         (scheduler_mode() == ThreadMode::Pool && scheduler_in_guest_thread())))
+    {
+        if (scheduler_in_guest_thread())
+        {
+            scheduler_yield();
+            if (!kobj_poll(base, keys, count, wait_all))
+                scheduler_note_wasted_slice();
+        }
+        return KOBJ_STATUS_WAIT_0;
+    }
+    int64_t timeout_storage;
+    const int64_t* timeout = kobj_read_timeout(base, timeout_addr, &timeout_storage);
+    uint32_t status = kobj_wait(base, keys, count, wait_all, timeout, alertable);
+    if (status == APC_STATUS_USER_APC)
+        apc_deliver(ctx, base);
+    return status;
+}
+
+// Maximum object count for the WaitForMultiple stubs (MAXIMUM_WAIT_OBJECTS);
+// more, or none, is STATUS_INVALID_PARAMETER
+static constexpr int MAX_WAIT_OBJECTS = 64;
+
 PPC_FUNC(__imp__KeWaitForSingleObject)
 {
+    // r3 = Object*, r4 = WaitReason, r5 = WaitMode, r6 = Alertable, r7 = Timeout*
     STUB_LOG_ONCE("KeWaitForSingleObject");
     STUB_HEARTBEAT();
-    if (g_current_thread) thread_yield();
-    ctx.r3.u32 = 0; // STATUS_WAIT_0
+    uint32_t key = ctx.r3.u32;
+    ctx.r3.u32 = wait_objects(ctx, base, &key, 1, false, ctx.r6.u32 != 0, ctx.r7.u32);
 }
 
 PPC_FUNC(__imp__KeWaitForMultipleObjects)
 {
+    // r3 = Count, r4 = Object*[], r5 = WaitType (0 = all, 1 = any), r6 = WaitReason,
+    // r7 = WaitMode, r8 = Alertable, r9 = Timeout*, r10 = WaitBlockArray
     STUB_LOG_ONCE("KeWaitForMultipleObjects");
-    if (g_current_thread) thread_yield();
-    ctx.r3.u32 = 0; // STATUS_WAIT_0
+    if (ctx.r3.u32 == 0 || ctx.r3.u32 > (uint32_t)MAX_WAIT_OBJECTS)
+    {
+        ctx.r3.u32 = 0xC000000D; // STATUS_INVALID_PARAMETER
+        return;
+    }
+    uint32_t keys[MAX_WAIT_OBJECTS];
+    int count = (int)ctx.r3.u32;
+    for (int i = 0; i < count; i++)
+        keys[i] = ppc_read_u32(base, ctx.r4.u32 + i * 4);
+    ctx.r3.u32 = wait_objects(ctx, base, keys, count, ctx.r5.u32 == 0, ctx.r8.u32 != 0, ctx.r9.u32);
 }
 
 PPC_FUNC(__imp__KeInitializeSemaphore)
 {
+    // r3 = KSEMAPHORE*, r4 = Count, r5 = Limit
     STUB_LOG_ONCE("KeInitializeSemaphore");
+    kobj_init_semaphore(base, ctx.r3.u32, ctx.r4.s32, ctx.r5.s32);
 }
 
 PPC_FUNC(__imp__KeReleaseSemaphore)
 {
+    // r3 = KSEMAPHORE*, r4 = Increment, r5 = Adjustment, r6 = Wait; returns previous count
     STUB_LOG_ONCE("KeReleaseSemaphore");
-    if (g_current_thread) thread_yield();
-    ctx.r3.u32 = 0;
+    int32_t prev = kobj_release_semaphore(base, ctx.r3.u32, ctx.r5.s32);
+    if (kobj_yield_waits() && !parallel_threads() && scheduler_in_guest_thread()) scheduler_yield();
+    ctx.r3.s32 = prev;
 }
 
 PPC_FUNC(__imp__KeInitializeApc)
 {
+    // r3 = KAPC*, r4 = Thread, r5 = KernelRoutine, r6 = RundownRoutine,
+    // r7 = NormalRoutine, r8 = ApcMode, r9 = NormalContext
     STUB_LOG_ONCE("KeInitializeApc");
+    apc_init(base, ctx.r3.u32, ctx.r4.u32, ctx.r5.u32, ctx.r6.u32, ctx.r7.u32,
+             (uint8_t)ctx.r8.u32, ctx.r9.u32);
 }
 
 PPC_FUNC(__imp__KeInsertQueueApc)
 {
+    // r3 = KAPC*, r4 = SystemArgument1, r5 = SystemArgument2, r6 = Increment;
+    // returns FALSE if the APC is already queued
     STUB_LOG_ONCE("KeInsertQueueApc");
-    ctx.r3.u32 = 1; // TRUE
+    ctx.r3.u32 = apc_insert(base, ctx.r3.u32, ctx.r4.u32, ctx.r5.u32) ? 1 : 0;
 }
 
 PPC_FUNC(__imp__KeEnterCriticalRegion)
@@ -545,6 +585,8 @@ PPC_FUNC(__imp__KeUnlockL2)
 PPC_FUNC(__imp__KfAcquireSpinLock)
 {
     // r3 = spinlock addr, returns old IRQL in r3
+    if (parallel_threads())
+        guest_lock(ctx.r3.u32).lock();
     ctx.r3.u32 = 0; // Old IRQL = PASSIVE_LEVEL
 }
 
@@ -552,58 +594,65 @@ PPC_FUNC(__imp__KfReleaseSpinLock)
 {
     // r3 = spinlock addr, r4 = old IRQL
     // No-op in single-threaded mode
+    if (parallel_threads())
+        guest_lock(ctx.r3.u32).unlock();
 }
 
 PPC_FUNC(__imp__KeAcquireSpinLockAtRaisedIrql)
 {
-    // No-op in single-threaded mode
+    // r3 = spinlock addr
+    if (parallel_threads())
+        guest_lock(ctx.r3.u32).lock();
 }
 
 PPC_FUNC(__imp__KeReleaseSpinLockFromRaisedIrql)
 {
-    // No-op in single-threaded mode
+    // r3 = spinlock addr
+    if (parallel_threads())
+        guest_lock(ctx.r3.u32).unlock();
 }
 
 PPC_FUNC(__imp__KiApcNormalRoutineNop)
 {
-    // No-op APC routine
+    // No-op APC routine (apc_deliver skips it: it is an import thunk)
 }
 
 
 // ============================================================================
-// Critical Sections (Rtl*)
+// Critical Sections (Rtl*): see critical_section.cpp
 // ============================================================================
 
 PPC_FUNC(__imp__RtlInitializeCriticalSection)
 {
-    STUB_LOG_ONCE("RtlInitializeCriticalSection");
     // r3 = pointer to CRITICAL_SECTION in PPC memory
-    // Zero-init is enough for our single-threaded stub
+    cs_init(base, ctx.r3.u32, 0);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__RtlInitializeCriticalSectionAndSpinCount)
 {
-    STUB_LOG_ONCE("RtlInitializeCriticalSectionAndSpinCount");
+    // r3 = CRITICAL_SECTION*, r4 = spin count
+    cs_init(base, ctx.r3.u32, ctx.r4.u32);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__RtlEnterCriticalSection)
 {
+    // r3 = pointer to CRITICAL_SECTION
     STUB_HEARTBEAT();
-    // No-op in single-threaded mode
+    cs_enter(base, ctx.r3.u32);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__RtlLeaveCriticalSection)
 {
-    // No-op in single-threaded mode
+    cs_leave(base, ctx.r3.u32);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__RtlTryEnterCriticalSection)
 {
-    ctx.r3.u32 = 1; // TRUE = acquired
+    ctx.r3.u32 = cs_try_enter(base, ctx.r3.u32) ? 1 : 0; // TRUE = acquired
 }
 
 
@@ -786,10 +835,37 @@ static void check_watchpoint(uint8_t* base, const char* where)
     }
 }
 
-// Simple bump allocator for NtAllocateVirtualMemory
-// Allocations start at 0xA0000000 in the PPC address space
-static uint32_t g_heap_next = 0xA0000000;
-static constexpr uint32_t g_heap_end = 0xB0000000; // 256 MB heap space
+// Guest memory allocation: see guest_heap.h
+
+// AllocationType / FreeType / Protect flags
+static constexpr uint32_t X_MEM_COMMIT      = 0x00001000;
+static constexpr uint32_t X_MEM_RESERVE     = 0x00002000;
+static constexpr uint32_t X_MEM_DECOMMIT    = 0x00004000;
+static constexpr uint32_t X_MEM_RELEASE     = 0x00008000;
+static constexpr uint32_t X_MEM_TOP_DOWN    = 0x00100000;
+static constexpr uint32_t X_MEM_LARGE_PAGES = 0x20000000; // 64 KB pages
+static constexpr uint32_t X_MEM_16MB_PAGES  = 0x80000000;
+
+static constexpr uint32_t STATUS_NO_MEMORY              = 0xC0000017;
+static constexpr uint32_t STATUS_CONFLICTING_ADDRESSES  = 0xC0000018;
+static constexpr uint32_t STATUS_INVALID_PARAMETER      = 0xC000000D;
+static constexpr uint32_t STATUS_MEMORY_NOT_ALLOCATED   = 0xC00000A0;
+
+// Page size the allocation flags (or protect bits) ask for
+static uint32_t x_page_size(uint32_t flags)
+{
+    if (flags & X_MEM_16MB_PAGES)
+        return 16 * 1024 * 1024;
+    if (flags & X_MEM_LARGE_PAGES)
+        return 64 * 1024;
+    return HEAP_PAGE_SIZE;
+}
+
+// Small runtime-owned blocks (committed, zeroed)
+static uint32_t heap_alloc_block(uint32_t size)
+{
+    return heap_alloc(std::max<uint32_t>(size, 1), HEAP_PAGE_SIZE, 0, PPC_HEAP_SIZE, HEAP_COMMIT);
+}
 
 PPC_FUNC(__imp__NtAllocateVirtualMemory)
 {
@@ -798,66 +874,152 @@ PPC_FUNC(__imp__NtAllocateVirtualMemory)
     check_watchpoint(base, "NtAllocateVirtualMemory:entry");
     uint32_t base_ptr = ctx.r3.u32;
     uint32_t size_ptr = ctx.r4.u32;
+    uint32_t type = ctx.r5.u32;
+    uint32_t addr = ppc_read_u32(base, base_ptr);
     uint32_t size = ppc_read_u32(base, size_ptr);
-    // Align to 4K page
-    size = (size + 0xFFF) & ~0xFFFu;
+    uint32_t page = x_page_size(type);
+    uint32_t flags = (type & X_MEM_COMMIT) ? HEAP_COMMIT : 0;
+    if (!size || !(type & (X_MEM_COMMIT | X_MEM_RESERVE)))
+    {
+        ctx.r3.u32 = STATUS_INVALID_PARAMETER;
+        return;
+    }
 
-    if (g_heap_next + size <= g_heap_end)
+    uint32_t status = 0; // STATUS_SUCCESS
+    bool new_block = true;
+    if (addr && heap_contains(addr))
+    {
+        // At a given address: a new reservation there, or committing part
+        // of an existing one
+        new_block = (type & X_MEM_RESERVE) != 0;
+        uint32_t end = (uint32_t)std::min<uint64_t>((uint64_t)addr + size + page - 1, 0xFFFFFFFFull) & ~(page - 1);
+        addr &= ~(page - 1);
+        size = end - addr;
+        bool ok = (type & X_MEM_RESERVE) ? heap_reserve_at(addr, size, flags) : heap_commit(addr, size);
+        if (!ok)
+            status = (type & X_MEM_RESERVE) ? STATUS_CONFLICTING_ADDRESSES : STATUS_MEMORY_NOT_ALLOCATED;
+    }
+    else
+    {
+        if (addr)
+            fprintf(stderr, "[MEM] NtAllocateVirtualMemory: 0x%08X is outside the heap, allocating anywhere\n", addr);
+        size = (uint32_t)(((uint64_t)size + page - 1) & ~(uint64_t)(page - 1));
+        if (type & X_MEM_TOP_DOWN)
+            flags |= HEAP_TOP_DOWN;
+        addr = heap_alloc(size, page, 0, PPC_HEAP_SIZE, flags);
+        if (!addr)
+            status = STATUS_NO_MEMORY;
+    }
+
+    if (status == 0)
     {
-        uint32_t addr = g_heap_next;
-        g_heap_next += size;
         ppc_write_u32(base, base_ptr, addr);
         ppc_write_u32(base, size_ptr, size);
-        // Zero the allocated memory (it's already committed via VirtualAlloc on first touch)
-        memset(base + addr, 0, size);
-        fprintf(stderr, "[MEM] NtAllocateVirtualMemory: 0x%08X (%u bytes)\n", addr, size);
-        ctx.r3.u32 = 0; // STATUS_SUCCESS
+        fprintf(stderr, "[MEM] NtAllocateVirtualMemory: 0x%08X (%u bytes, type 0x%X)\n", addr, size, type);
+        // The heap commits read / write; apply anything else asked for
+        uint32_t protect = ctx.r6.u32 & X_PAGE_PROTECT_MASK;
+        if (new_block && protect)
+            vm_region_set_alloc_protect(addr, size, protect);
+        if ((type & X_MEM_COMMIT) && protect && protect != X_PAGE_READWRITE)
+            vm_region_protect(addr, size, protect);
+        if (new_block)
+            alloc_tracker_add(addr, size, (uint32_t)ctx.lr, ALLOC_SOURCE_VIRTUAL);
     }
     else
     {
-        fprintf(stderr, "[MEM] NtAllocateVirtualMemory: FAILED (out of heap space)\n");
-        ctx.r3.u32 = 0xC0000017; // STATUS_NO_MEMORY
+        fprintf(stderr, "[MEM] NtAllocateVirtualMemory: FAILED (0x%08X, %u bytes, type 0x%X): 0x%08X\n",
+                addr, size, type, status);
     }
+    ctx.r3.u32 = status;
 }
 
 PPC_FUNC(__imp__NtFreeVirtualMemory)
 {
+    // r3 = BaseAddress* (in/out), r4 = RegionSize* (in/out), r5 = FreeType
     STUB_LOG_ONCE("NtFreeVirtualMemory");
-    // Can't easily free from bump allocator - just succeed
+    uint32_t addr = ppc_read_u32(base, ctx.r3.u32);
+    uint32_t size = ctx.r4.u32 ? ppc_read_u32(base, ctx.r4.u32) : 0;
+    uint32_t type = ctx.r5.u32;
+    uint32_t freed = 0;
+    if (type & X_MEM_RELEASE)
+    {
+        freed = heap_release(addr, size);
+        if (freed)
+            alloc_tracker_free(addr & ~(HEAP_PAGE_SIZE - 1), freed);
+    }
+    else if (type & X_MEM_DECOMMIT)
+        freed = heap_decommit(addr, size);
+    if (!freed)
+    {
+        fprintf(stderr, "[MEM] NtFreeVirtualMemory: 0x%08X (%u bytes, type 0x%X) isn't allocated\n",
+                addr, size, type);
+        ctx.r3.u32 = STATUS_MEMORY_NOT_ALLOCATED;
+        return;
+    }
+    ppc_write_u32(base, ctx.r3.u32, addr & ~(HEAP_PAGE_SIZE - 1));
+    if (ctx.r4.u32)
+        ppc_write_u32(base, ctx.r4.u32, freed);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtQueryVirtualMemory)
 {
-    STUB_LOG("NtQueryVirtualMemory");
+    // r3 = BaseAddress, r4 = MEMORY_BASIC_INFORMATION* (out), r5 = region type
+    STUB_LOG_ONCE("NtQueryVirtualMemory");
+    VmRegionInfo info;
+    vm_region_query(ctx.r3.u32, &info);
+    uint32_t out = ctx.r4.u32;
+    ppc_write_u32(base, out + 0x00, info.base);
+    ppc_write_u32(base, out + 0x04, info.alloc_base);
+    ppc_write_u32(base, out + 0x08, info.alloc_protect);
+    ppc_write_u32(base, out + 0x0C, info.size);
+    ppc_write_u32(base, out + 0x10, info.state);
+    ppc_write_u32(base, out + 0x14, info.protect);
+    ppc_write_u32(base, out + 0x18, info.type);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__MmAllocatePhysicalMemoryEx)
 {
-    // r3 = type, r4 = size, r5 = protect, r6 = min addr, r7 = max addr, r8 = alignment
+    // r3 = flags, r4 = size, r5 = protect (page size bits), r6 = min physical
+    // address, r7 = max physical address (inclusive), r8 = alignment.
+    // Allocated top-down like the kernel does, away from the virtual ones.
     STUB_LOG("MmAllocatePhysicalMemoryEx");
     check_watchpoint(base, "MmAllocatePhysicalMemoryEx:entry");
-    uint32_t size = ctx.r4.u32;
-    size = (size + 0xFFF) & ~0xFFFu;
-    if (g_heap_next + size <= g_heap_end)
+    uint32_t page = x_page_size(ctx.r5.u32);
+    uint32_t size = (uint32_t)(((uint64_t)ctx.r4.u32 + page - 1) & ~(uint64_t)(page - 1));
+    uint32_t align = std::max(page, ctx.r8.u32);
+    uint32_t lo = ctx.r6.u32;
+    uint32_t hi = ctx.r7.u32 && ctx.r7.u32 < PPC_HEAP_SIZE ? ctx.r7.u32 + 1 : PPC_HEAP_SIZE;
+    uint32_t addr = size ? heap_alloc(size, align, lo, hi, HEAP_COMMIT | HEAP_TOP_DOWN) : 0;
+    if (addr)
     {
-        uint32_t addr = g_heap_next;
-        g_heap_next += size;
-        memset(base + addr, 0, size);
         fprintf(stderr, "[MEM] MmAllocatePhysicalMemoryEx: 0x%08X (%u bytes)\n", addr, size);
+        uint32_t protect = ctx.r5.u32 & X_PAGE_PROTECT_MASK;
+        if (protect && protect != X_PAGE_READWRITE)
+        {
+            vm_region_set_alloc_protect(addr, size, protect);
+            vm_region_protect(addr, size, protect);
+        }
+        alloc_tracker_add(addr, size, (uint32_t)ctx.lr, ALLOC_SOURCE_PHYSICAL);
         ctx.r3.u32 = addr;
     }
     else
     {
+        fprintf(stderr, "[MEM] MmAllocatePhysicalMemoryEx: FAILED (%u bytes, 0x%X-0x%X, align 0x%X)\n",
+                size, lo, hi, align);
         ctx.r3.u32 = 0; // NULL = failure
     }
 }
 
 PPC_FUNC(__imp__MmFreePhysicalMemory)
 {
+    // r3 = type, r4 = address
     STUB_LOG_ONCE("MmFreePhysicalMemory");
-    // Can't reclaim from bump allocator
+    if (heap_release(ctx.r4.u32, 0))
+        alloc_tracker_free(ctx.r4.u32, 0);
+    else
+        fprintf(stderr, "[MEM] MmFreePhysicalMemory: 0x%08X isn't allocated\n", ctx.r4.u32);
 }
 
 PPC_FUNC(__imp__MmGetPhysicalAddress)
@@ -873,8 +1035,9 @@ PPC_FUNC(__imp__MmGetPhysicalAddress)
 
 PPC_FUNC(__imp__MmQueryAddressProtect)
 {
+    // r3 = virtual address; 0 if it isn't committed
     STUB_LOG_ONCE("MmQueryAddressProtect");
-    ctx.r3.u32 = 0x04; // PAGE_READWRITE
+    ctx.r3.u32 = vm_region_protect_of(ctx.r3.u32);
 }
 
 
@@ -884,80 +1047,74 @@ PPC_FUNC(__imp__MmQueryAddressProtect)
 
 enum HandleType { HANDLE_NONE = 0, HANDLE_FILE, HANDLE_DIRECTORY };
 
-struct DirEntry
-{
-    std::string name;
-    int64_t     size;
-    bool        is_directory;
-};
-
+// A file or directory handle's object (object_table.h, OB_TYPE_FILE). The
+// handle's references keep it alive, including those of overlapped reads
+// still in flight after NtClose.
 struct HandleEntry
 {
     HandleType type;
-    FILE*      fp;
+    HostFile   file;
+    std::atomic<int64_t> position; // for reads without a ByteOffset
     std::string host_path;
     int64_t    file_size;
-    // Directory enumeration state
-    std::vector<DirEntry> dir_entries;
-    size_t dir_index;
+    // Directory enumeration state, under g_file_lock
+    std::shared_ptr<const DirListing> listing;
+    std::vector<uint32_t> matches; // entries passing the filter, if any
+    bool filtered;
+    size_t dir_index; // into matches if filtered, else the listing
 };
 
-static constexpr int    MAX_FILE_HANDLES = 128;
-static constexpr uint32_t FILE_HANDLE_BASE = 0x1000;
-static HandleEntry g_file_handles[MAX_FILE_HANDLES] = {};
+// Held by NtOpenFile (path index results, listings) and NtQueryDirectoryFile
+static std::mutex g_file_lock;
+
+// Listings of indexed directories by host path, shared by their handles
+// until the index is rebuilt
+static std::unordered_map<std::string, std::shared_ptr<const DirListing>> g_dir_listings;
+static uint32_t g_dir_listings_generation = 0;
 
-static int handle_alloc(HandleType type, FILE* fp, const std::string& path, int64_t size)
+static void file_destroy(void* object, uint32_t)
 {
-    for (int i = 0; i < MAX_FILE_HANDLES; i++)
-    {
-        if (g_file_handles[i].type == HANDLE_NONE)
-        {
-            g_file_handles[i].type = type;
-            g_file_handles[i].fp = fp;
-            g_file_handles[i].host_path = path;
-            g_file_handles[i].file_size = size;
-            g_file_handles[i].dir_entries.clear();
-            g_file_handles[i].dir_index = 0;
-            return i;
-        }
-    }
-    return -1; // no free slots
+    HandleEntry* entry = (HandleEntry*)object;
+    host_file_close(&entry->file);
+    delete entry;
 }
 
-static HandleEntry* handle_lookup(uint32_t handle)
+// New handle for an open file or directory, 0 if the table is full
+static uint32_t file_handle_create(HandleType type, const HostFile& file, const std::string& path,
+                                   int64_t size, HandleEntry** out)
 {
-    if (handle < FILE_HANDLE_BASE) return nullptr;
-    int idx = (int)(handle - FILE_HANDLE_BASE);
-    if (idx < 0 || idx >= MAX_FILE_HANDLES) return nullptr;
-    if (g_file_handles[idx].type == HANDLE_NONE) return nullptr;
-    return &g_file_handles[idx];
+    HandleEntry* entry = new HandleEntry{type, file, {0}, path, size, nullptr, {}, false, 0};
+    uint32_t handle = ob_create(OB_TYPE_FILE, entry, file_destroy);
+    if (!handle)
+    {
+        delete entry;
+        return 0;
+    }
+    *out = entry;
+    return handle;
 }
 
-static void handle_free(uint32_t handle)
+// Reference a file handle; ob_dereference it when done
+static HandleEntry* file_reference(uint32_t handle)
 {
-    if (handle < FILE_HANDLE_BASE) return;
-    int idx = (int)(handle - FILE_HANDLE_BASE);
-    if (idx < 0 || idx >= MAX_FILE_HANDLES) return;
-    g_file_handles[idx].type = HANDLE_NONE;
-    g_file_handles[idx].fp = nullptr;
-    g_file_handles[idx].host_path.clear();
-    g_file_handles[idx].file_size = 0;
-    g_file_handles[idx].dir_entries.clear();
-    g_file_handles[idx].dir_index = 0;
+    void* object;
+    return ob_reference(handle, OB_TYPE_FILE, &object) ? (HandleEntry*)object : nullptr;
 }
 
-// Parse ANSI_STRING from Xbox 360 OBJECT_ATTRIBUTES
+// ANSI_STRING name from Xbox 360 OBJECT_ATTRIBUTES, in place in guest memory
 // X_OBJECT_ATTRIBUTES: +0x00 RootDirectory(u32), +0x04 ObjectName*(u32), +0x08 Attributes(u32)
 // ANSI_STRING: +0x00 Length(u16), +0x02 MaxLength(u16), +0x04 Buffer(u32)
-static std::string parse_object_name(uint8_t* base, uint32_t oa_addr)
+static bool object_name_view(uint8_t* base, uint32_t oa_addr, const char** name, uint16_t* length)
 {
-    if (!oa_addr) return "";
+    if (!oa_addr) return false;
     uint32_t name_str_ptr = ppc_read_u32(base, oa_addr + 0x04);
-    if (!name_str_ptr) return "";
+    if (!name_str_ptr) return false;
     uint16_t name_len = ppc_read_u16(base, name_str_ptr);
     uint32_t buf_addr = ppc_read_u32(base, name_str_ptr + 0x04);
-    if (!buf_addr || name_len == 0 || name_len >= 512) return "";
-    return std::string(reinterpret_cast<const char*>(base + buf_addr), name_len);
+    if (!buf_addr || name_len == 0 || name_len >= 512) return false;
+    *name = reinterpret_cast<const char*>(base + buf_addr);
+    *length = name_len;
+    return true;
 }
 
 // Map Xbox 360 paths to host filesystem paths
@@ -984,68 +1141,171 @@ static std::string xbox_path_to_host(const std::string& xbox_path)
 }
 
 
-// ============================================================================
-// NT Kernel - File I/O
-// ============================================================================
-
-// Shared implementation for NtOpenFile and NtCreateFile
-// r3=FileHandle*, r4=DesiredAccess, r5=ObjectAttributes*, r6=IoStatusBlock*
-static void NtOpenFile_impl(PPCContext& __restrict ctx, uint8_t* base)
+// Resolve a path the index doesn't cover on the host. Returns false if it
+// doesn't exist.
+static bool resolve_on_host(const std::string& xbox_name, std::string* host_path, bool* is_dir)
 {
-    check_watchpoint(base, "NtOpenFile:entry");
-    uint32_t handle_out_addr = ctx.r3.u32;
-    uint32_t oa_addr = ctx.r5.u32;
-    uint32_t iosb_addr = ctx.r6.u32;
-
-    std::string xbox_name = parse_object_name(base, oa_addr);
-    if (xbox_name.empty())
-    {
-        fprintf(stderr, "[FILE] NtOpenFile: (empty name)\n");
-        ctx.r3.u32 = 0xC0000034; // STATUS_OBJECT_NAME_NOT_FOUND
-        return;
-    }
-
-    std::string host_path = xbox_path_to_host(xbox_name);
-    fprintf(stderr, "[FILE] NtOpenFile: \"%s\" -> \"%s\"\n", xbox_name.c_str(), host_path.c_str());
+    *host_path = xbox_path_to_host(xbox_name);
 
     // Detect directory open: trailing slash or host path is a directory
-    bool is_dir = false;
-    if (!host_path.empty() && host_path.back() == '/')
-        is_dir = true;
+    *is_dir = !host_path->empty() && host_path->back() == '/';
 
 #ifdef _WIN32
-    DWORD attrs = GetFileAttributesA(host_path.c_str());
+    DWORD attrs = GetFileAttributesA(host_path->c_str());
     if (attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY))
-        is_dir = true;
+        *is_dir = true;
     bool exists = (attrs != INVALID_FILE_ATTRIBUTES);
 #else
     struct stat st;
-    bool exists = (stat(host_path.c_str(), &st) == 0);
+    bool exists = (stat(host_path->c_str(), &st) == 0);
     if (exists && S_ISDIR(st.st_mode))
-        is_dir = true;
+        *is_dir = true;
 #endif
 
     if (!exists)
     {
         // Try without trailing slash for directories
-        std::string trimmed = host_path;
+        std::string trimmed = *host_path;
         while (!trimmed.empty() && trimmed.back() == '/')
             trimmed.pop_back();
-        if (!trimmed.empty() && trimmed != host_path)
+        if (!trimmed.empty() && trimmed != *host_path)
         {
 #ifdef _WIN32
             attrs = GetFileAttributesA(trimmed.c_str());
             exists = (attrs != INVALID_FILE_ATTRIBUTES);
             if (exists && (attrs & FILE_ATTRIBUTE_DIRECTORY))
-                is_dir = true;
+                *is_dir = true;
 #else
             exists = (stat(trimmed.c_str(), &st) == 0);
             if (exists && S_ISDIR(st.st_mode))
-                is_dir = true;
+                *is_dir = true;
+#endif
+            if (exists) *host_path = trimmed;
+        }
+    }
+    return exists;
+}
+
+// Directory contents from the host, for directories the index doesn't cover
+static void enumerate_on_host(const std::string& host_path, std::vector<DirEntry>* entries)
+{
+#ifdef _WIN32
+    // Ensure path doesn't end with slash for FindFirstFile
+    std::string search = host_path;
+    while (!search.empty() && search.back() == '/')
+        search.pop_back();
+    search += "/*";
+    WIN32_FIND_DATAA fd;
+    HANDLE hFind = FindFirstFileA(search.c_str(), &fd);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do {
+            if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+                continue;
+            DirEntry de;
+            de.name = fd.cFileName;
+            de.size = ((int64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+            de.is_directory = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            entries->push_back(de);
+        } while (FindNextFileA(hFind, &fd));
+        FindClose(hFind);
+    }
+#else
+    DIR* d = opendir(host_path.c_str());
+    if (d)
+    {
+        struct dirent* ent;
+        while ((ent = readdir(d)) != nullptr)
+        {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+            DirEntry de;
+            de.name = ent->d_name;
+            de.is_directory = (ent->d_type == DT_DIR);
+            // Get file size
+            std::string full = host_path + "/" + de.name;
+            struct stat st;
+            if (stat(full.c_str(), &st) == 0)
+                de.size = st.st_size;
+            else
+                de.size = 0;
+            entries->push_back(de);
+        }
+        closedir(d);
+    }
 #endif
-            if (exists) host_path = trimmed;
+}
+
+// Contents of a directory being opened. Caller holds g_file_lock.
+static std::shared_ptr<const DirListing> directory_listing(const PathEntry* indexed,
+                                                           const std::string& host_path)
+{
+    std::vector<DirEntry> entries;
+    if (!indexed)
+    {
+        enumerate_on_host(host_path, &entries);
+        auto listing = std::make_shared<DirListing>();
+        dir_listing_build(entries, listing.get());
+        return listing;
+    }
+
+    uint32_t generation = path_index_generation();
+    if (generation != g_dir_listings_generation)
+    {
+        g_dir_listings.clear();
+        g_dir_listings_generation = generation;
+    }
+    std::shared_ptr<const DirListing>& cached = g_dir_listings[host_path];
+    if (!cached)
+    {
+        for (uint32_t child : indexed->children)
+        {
+            const PathEntry* pe = path_index_entry(child);
+            entries.push_back({pe->name, pe->size, pe->is_directory});
         }
+        auto listing = std::make_shared<DirListing>();
+        dir_listing_build(entries, listing.get());
+        cached = listing;
     }
+    return cached;
+}
+
+// ============================================================================
+// NT Kernel - File I/O
+// ============================================================================
+
+// Shared implementation for NtOpenFile and NtCreateFile
+// r3=FileHandle*, r4=DesiredAccess, r5=ObjectAttributes*, r6=IoStatusBlock*
+static void NtOpenFile_impl(PPCContext& __restrict ctx, uint8_t* base)
+{
+    std::lock_guard<std::mutex> file_lock(g_file_lock);
+    check_watchpoint(base, "NtOpenFile:entry");
+    uint32_t handle_out_addr = ctx.r3.u32;
+    uint32_t oa_addr = ctx.r5.u32;
+    uint32_t iosb_addr = ctx.r6.u32;
+
+    const char* name;
+    uint16_t name_len;
+    if (!object_name_view(base, oa_addr, &name, &name_len))
+    {
+        fprintf(stderr, "[FILE] NtOpenFile: (empty name)\n");
+        ctx.r3.u32 = 0xC0000034; // STATUS_OBJECT_NAME_NOT_FOUND
+        return;
+    }
+
+    // game: paths resolve through the index (path_index.h). Other paths, and
+    // index misses while it can't watch for changes, go to the host.
+    const PathEntry* indexed = path_index_lookup(name, name_len);
+    std::string host_path_storage;
+    bool is_dir = false;
+    bool exists = indexed != nullptr;
+    if (indexed)
+        is_dir = indexed->is_directory;
+    else if (!path_index_authoritative() || !path_index_covers(name, name_len))
+        exists = resolve_on_host(std::string(name, name_len), &host_path_storage, &is_dir);
+    const std::string& host_path = indexed ? indexed->host_path : host_path_storage;
+    fprintf(stderr, "[FILE] NtOpenFile: \"%.*s\" -> \"%s\"\n", (int)name_len, name,
+            exists ? host_path.c_str() : "");
 
     if (!exists)
     {
@@ -1056,65 +1316,19 @@ static void NtOpenFile_impl(PPCContext& __restrict ctx, uint8_t* base)
 
     if (is_dir)
     {
-        int slot = handle_alloc(HANDLE_DIRECTORY, nullptr, host_path, 0);
-        if (slot < 0)
+        HandleEntry* dir;
+        uint32_t handle = file_handle_create(HANDLE_DIRECTORY, HostFile{}, host_path, 0, &dir);
+        if (!handle)
         {
             fprintf(stderr, "[FILE]   -> no free handle slots!\n");
             ctx.r3.u32 = 0xC000009A; // STATUS_INSUFFICIENT_RESOURCES
             return;
         }
 
-        // Enumerate directory contents at open time
-        HandleEntry& he = g_file_handles[slot];
-#ifdef _WIN32
-        // Ensure path doesn't end with slash for FindFirstFile
-        std::string search = host_path;
-        while (!search.empty() && search.back() == '/')
-            search.pop_back();
-        search += "/*";
-        WIN32_FIND_DATAA fd;
-        HANDLE hFind = FindFirstFileA(search.c_str(), &fd);
-        if (hFind != INVALID_HANDLE_VALUE)
-        {
-            do {
-                if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
-                    continue;
-                DirEntry de;
-                de.name = fd.cFileName;
-                de.size = ((int64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
-                de.is_directory = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-                he.dir_entries.push_back(de);
-            } while (FindNextFileA(hFind, &fd));
-            FindClose(hFind);
-        }
-#else
-        DIR* d = opendir(host_path.c_str());
-        if (d)
-        {
-            struct dirent* ent;
-            while ((ent = readdir(d)) != nullptr)
-            {
-                if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
-                    continue;
-                DirEntry de;
-                de.name = ent->d_name;
-                de.is_directory = (ent->d_type == DT_DIR);
-                // Get file size
-                std::string full = host_path + "/" + de.name;
-                struct stat st;
-                if (stat(full.c_str(), &st) == 0)
-                    de.size = st.st_size;
-                else
-                    de.size = 0;
-                he.dir_entries.push_back(de);
-            }
-            closedir(d);
-        }
-#endif
+        dir->listing = directory_listing(indexed, host_path);
         fprintf(stderr, "[FILE]   -> directory handle 0x%X (%zu entries)\n",
-                FILE_HANDLE_BASE + (uint32_t)slot, he.dir_entries.size());
+                handle, dir_listing_count(*dir->listing));
 
-        uint32_t handle = FILE_HANDLE_BASE + (uint32_t)slot;
         ppc_write_u32(base, handle_out_addr, handle);
         if (iosb_addr)
         {
@@ -1125,29 +1339,29 @@ static void NtOpenFile_impl(PPCContext& __restrict ctx, uint8_t* base)
         return;
     }
 
-    // Regular file
-    FILE* fp = fopen(host_path.c_str(), "rb");
-    if (!fp)
+    // Regular file; packed ones are views of the pack's mapping
+    HostFile file;
+    if (indexed && indexed->data)
     {
-        fprintf(stderr, "[FILE]   -> fopen failed\n");
+        host_file_open_memory(indexed->data, indexed->size, &file);
+    }
+    else if (!host_file_open(host_path.c_str(), &file))
+    {
+        fprintf(stderr, "[FILE]   -> open failed\n");
         ctx.r3.u32 = 0xC0000034;
         return;
     }
+    int64_t fsize = file.size;
 
-    // Get file size
-    _fseeki64(fp, 0, SEEK_END);
-    int64_t fsize = _ftelli64(fp);
-    _fseeki64(fp, 0, SEEK_SET);
-
-    int slot = handle_alloc(HANDLE_FILE, fp, host_path, fsize);
-    if (slot < 0)
+    HandleEntry* entry;
+    uint32_t handle = file_handle_create(HANDLE_FILE, file, host_path, fsize, &entry);
+    if (!handle)
     {
-        fclose(fp);
+        host_file_close(&file);
         fprintf(stderr, "[FILE]   -> no free handle slots!\n");
         ctx.r3.u32 = 0xC000009A;
         return;
     }
-    uint32_t handle = FILE_HANDLE_BASE + (uint32_t)slot;
     ppc_write_u32(base, handle_out_addr, handle);
     if (iosb_addr)
     {
@@ -1155,6 +1369,7 @@ static void NtOpenFile_impl(PPCContext& __restrict ctx, uint8_t* base)
         ppc_write_u32(base, iosb_addr + 4, 1); // FILE_OPENED
     }
     fprintf(stderr, "[FILE]   -> file handle 0x%X (size=%lld)\n", handle, (long long)fsize);
+    read_ahead_note_open(host_path.c_str());
     ctx.r3.u32 = 0; // STATUS_SUCCESS
 }
 
@@ -1169,68 +1384,273 @@ PPC_FUNC(__imp__NtCreateFile)
     NtOpenFile_impl(ctx, base);
 }
 
-PPC_FUNC(__imp__NtReadFile)
+// A read or write finished with its IO_STATUS_BLOCK filled in: signal the
+// caller's event and queue its APC routine, ApcRoutine(ApcContext,
+// IoStatusBlock, 0), which runs at the next alertable wait of `thread` (the
+// one that issued the request).
+static void io_complete(uint8_t* base, uint32_t thread, uint32_t event, uint32_t apc_routine,
+                        uint32_t apc_context, uint32_t iosb_addr)
+{
+    if (event)
+        kobj_set_event(base, event);
+    if (apc_routine)
+        apc_queue_routine(thread, apc_routine, apc_context, iosb_addr, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Overlapped reads (file_io.h). A worker does the host read, then the guest
+// side (IO_STATUS_BLOCK, event, APC) is applied right away, or while
+// recording / replaying at the main thread's next sync point. Ids are handed
+// out in guest order, so a replay matches each logged completion to the
+// same read; the handler waits for that read if it hasn't finished yet.
+// The read holds a reference on the file handle until then.
+// ----------------------------------------------------------------------------
+
+struct PendingRead
+{
+    uint8_t* base;
+    uint32_t id;
+    uint32_t handle;
+    uint32_t thread;
+    uint32_t event;
+    uint32_t apc_routine;
+    uint32_t apc_context;
+    uint32_t iosb_addr;
+    int64_t bytes;
+    bool done;
+    std::chrono::steady_clock::time_point submitted;
+};
+
+static std::mutex g_read_lock; // g_pending_reads and PendingRead::done
+static std::condition_variable g_read_done;
+static std::unordered_map<uint32_t, PendingRead*> g_pending_reads; // only while recording / replaying
+static uint32_t g_next_read_id = 1;
+
+static void read_finish(PendingRead* pr)
+{
+    uint32_t status = 0; // STATUS_SUCCESS
+    if (pr->bytes < 0)
+    {
+        status = 0xC0000185; // STATUS_IO_DEVICE_ERROR
+        pr->bytes = 0;
+    }
+    if (pr->iosb_addr)
+    {
+        ppc_write_u32(pr->base, pr->iosb_addr, status);
+        ppc_write_u32(pr->base, pr->iosb_addr + 4, (uint32_t)pr->bytes);
+    }
+    io_complete(pr->base, pr->thread, pr->event, pr->apc_routine, pr->apc_context, pr->iosb_addr);
+    ob_dereference(pr->handle);
+    delete pr;
+}
+
+// Worker thread
+static void read_done(void* user, int64_t bytes)
+{
+    PendingRead* pr = (PendingRead*)user;
+    read_ahead_note_stall(std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - pr->submitted).count());
+    if (replay_mode() == ReplayMode::Off)
+    {
+        pr->bytes = bytes;
+        read_finish(pr);
+        return;
+    }
+    uint32_t id = pr->id;
+    {
+        std::lock_guard<std::mutex> lock(g_read_lock);
+        pr->bytes = bytes;
+        pr->done = true;
+    }
+    g_read_done.notify_all();
+    replay_post(REPLAY_EVENT_FILE_READ, id, 0);
+}
+
+// Sync point: the recorded completion of read `id`
+static void read_replay(uint32_t id, uint32_t)
+{
+    PendingRead* pr;
+    {
+        std::unique_lock<std::mutex> lock(g_read_lock);
+        auto it = g_pending_reads.find(id);
+        if (it == g_pending_reads.end())
+        {
+            fprintf(stderr, "[REPLAY] completion of unknown read %u\n", id);
+            return;
+        }
+        pr = it->second;
+        g_read_done.wait(lock, [pr] { return pr->done; });
+        g_pending_reads.erase(it);
+    }
+    read_finish(pr);
+}
+
+// Shared by NtReadFile and NtReadFileScatter, which differ only in r8 / r9:
+// r3=FileHandle, r4=Event, r5=ApcRoutine, r6=ApcContext, r7=IoStatusBlock*,
+// r10=ByteOffset*. `segments` are the guest destinations in file order,
+// `length` bytes in all; `buf_addr` is the first one, for the log.
+static void read_file(PPCContext& __restrict ctx, uint8_t* base, const char* stub,
+                      const HostIoSegment* segments, int count, uint32_t length, uint32_t buf_addr)
 {
-    // r3=FileHandle, r4=Event, r5=ApcRoutine, r6=ApcContext,
-    // r7=IoStatusBlock*, r8=Buffer(PPC addr), r9=Length, r10=ByteOffset*
     uint32_t handle_val = ctx.r3.u32;
     uint32_t iosb_addr = ctx.r7.u32;
-    uint32_t buf_addr = ctx.r8.u32;
-    uint32_t length = ctx.r9.u32;
     uint32_t offset_ptr = ctx.r10.u32;
 
-    HandleEntry* entry = handle_lookup(handle_val);
-    if (!entry || entry->type != HANDLE_FILE || !entry->fp)
+    HandleEntry* entry = file_reference(handle_val);
+    if (!entry || entry->type != HANDLE_FILE)
     {
-        fprintf(stderr, "[FILE] NtReadFile: invalid handle 0x%X\n", handle_val);
+        fprintf(stderr, "[FILE] %s: invalid handle 0x%X\n", stub, handle_val);
+        if (entry)
+            ob_dereference(handle_val);
         ctx.r3.u32 = 0xC0000008; // STATUS_INVALID_HANDLE
         return;
     }
 
-    // Seek if ByteOffset provided
+    // ByteOffset if provided, else where the last read ended
+    int64_t offset = entry->position;
     if (offset_ptr)
     {
         uint32_t off_hi = ppc_read_u32(base, offset_ptr);
         uint32_t off_lo = ppc_read_u32(base, offset_ptr + 4);
-        int64_t offset = ((int64_t)off_hi << 32) | off_lo;
-        _fseeki64(entry->fp, offset, SEEK_SET);
+        offset = ((int64_t)off_hi << 32) | off_lo;
     }
 
-    // Check if the read would overwrite .rdata or other PE sections
-    if (buf_addr >= 0x82000000 && buf_addr < 0x82090000)
+    read_ahead_note_read(entry->host_path.c_str(), offset, length);
+
+    // With an event or APC to complete through, hand the read to a worker
+    uint32_t event = ctx.r4.u32;
+    uint32_t apc_routine = ctx.r5.u32;
+    if ((event || apc_routine) && file_io_async())
     {
-        fprintf(stderr, "[FILE] NtReadFile: WARNING: buffer 0x%08X is in PE data section!\n", buf_addr);
+        PendingRead* pr = new PendingRead{base, 0, handle_val, scheduler_thread_object(), event,
+                                          apc_routine, ctx.r6.u32, iosb_addr, 0, false,
+                                          std::chrono::steady_clock::now()};
+        if (replay_mode() != ReplayMode::Off)
+        {
+            replay_set_handler(REPLAY_EVENT_FILE_READ, read_replay);
+            std::lock_guard<std::mutex> lock(g_read_lock);
+            pr->id = g_next_read_id++;
+            g_pending_reads[pr->id] = pr;
+        }
+        if (event)
+            kobj_reset_event(base, event);
+        if (iosb_addr)
+        {
+            ppc_write_u32(base, iosb_addr, 0x103); // STATUS_PENDING
+            ppc_write_u32(base, iosb_addr + 4, 0);
+        }
+        int64_t left = std::max<int64_t>(entry->file.size - offset, 0);
+        entry->position = offset + std::min<int64_t>(length, left);
+        fprintf(stderr, "[FILE] %s: handle=0x%X, buf=0x%08X, requested=%u at %lld, pending\n",
+                stub, handle_val, buf_addr, length, (long long)offset);
+        if (count == 1)
+            file_io_submit(&entry->file, segments[0].dst, segments[0].size, offset, read_done, pr);
+        else
+            file_io_submit_scatter(&entry->file, segments, count, offset, read_done, pr);
+        ctx.r3.u32 = 0x103; // STATUS_PENDING
+        return;
     }
 
     // Read directly into PPC memory (raw bytes, no endian swap needed for file data)
     // Snapshot the watchpoint before the read
     uint32_t watch_addr = 0x8200185C;
     uint32_t watch_before = ppc_read_u32(base, watch_addr);
-    size_t bytes_read = fread(base + buf_addr, 1, length, entry->fp);
+    auto read_start = std::chrono::steady_clock::now();
+    int64_t bytes_read = count == 1
+                             ? host_file_read(&entry->file, segments[0].dst, segments[0].size, offset)
+                             : host_file_read_scatter(&entry->file, segments, count, offset);
+    double read_us = std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - read_start).count();
+    file_io_note_sync(bytes_read, read_us);
+    read_ahead_note_stall(read_us);
     uint32_t watch_after = ppc_read_u32(base, watch_addr);
     if (watch_before != watch_after)
     {
-        fprintf(stderr, "[WATCHPOINT] 0x%08X changed from 0x%08X to 0x%08X during NtReadFile "
+        fprintf(stderr, "[WATCHPOINT] 0x%08X changed from 0x%08X to 0x%08X during %s "
                 "(buf=0x%08X, len=%u, file=%s)\n",
-                watch_addr, watch_before, watch_after, buf_addr, length, entry->host_path.c_str());
+                watch_addr, watch_before, watch_after, stub, buf_addr, length, entry->host_path.c_str());
     }
 
+    uint32_t status = 0; // STATUS_SUCCESS
+    if (bytes_read < 0)
+    {
+        fprintf(stderr, "[FILE] %s: read of %s failed at %lld\n", stub, entry->host_path.c_str(),
+                (long long)offset);
+        status = 0xC0000185; // STATUS_IO_DEVICE_ERROR
+        bytes_read = 0;
+    }
+    entry->position = offset + bytes_read;
+
     // Fill IO_STATUS_BLOCK
     if (iosb_addr)
     {
-        ppc_write_u32(base, iosb_addr, 0); // Status = SUCCESS
+        ppc_write_u32(base, iosb_addr, status);
         ppc_write_u32(base, iosb_addr + 4, (uint32_t)bytes_read);
     }
 
-    fprintf(stderr, "[FILE] NtReadFile: handle=0x%X, buf=0x%08X, requested=%u, read=%zu\n",
-            handle_val, buf_addr, length, bytes_read);
-    ctx.r3.u32 = 0; // STATUS_SUCCESS
+    fprintf(stderr, "[FILE] %s: handle=0x%X, buf=0x%08X, requested=%u, read=%lld\n",
+            stub, handle_val, buf_addr, length, (long long)bytes_read);
+    io_complete(base, scheduler_thread_object(), event, apc_routine, ctx.r6.u32, iosb_addr);
+    ob_dereference(handle_val);
+    ctx.r3.u32 = status;
 }
 
+PPC_FUNC(__imp__NtReadFile)
+{
+    // r8=Buffer(PPC addr), r9=Length; the rest as read_file
+    uint32_t buf_addr = ctx.r8.u32;
+    uint32_t length = ctx.r9.u32;
+
+    // Check if the read would overwrite .rdata or other PE sections
+    if (buf_addr >= 0x82000000 && buf_addr < 0x82090000)
+    {
+        fprintf(stderr, "[FILE] NtReadFile: WARNING: buffer 0x%08X is in PE data section!\n", buf_addr);
+    }
+
+    HostIoSegment segment = {base + buf_addr, length};
+    read_file(ctx, base, "NtReadFile", &segment, 1, length, buf_addr);
+}
+
+// NtReadFileScatter fills one 4 KB page per FILE_SEGMENT_ELEMENT. Elements
+// are 64-bit pointers (PVOID64); the guest address is the low word.
+static constexpr uint32_t SCATTER_PAGE_SIZE = 0x1000;
+static constexpr uint32_t SCATTER_ELEMENT_SIZE = 8;
+
 PPC_FUNC(__imp__NtReadFileScatter)
 {
-    STUB_LOG("NtReadFileScatter");
-    ctx.r3.u32 = 0xC0000008;
+    // r8=SegmentArray* (FILE_SEGMENT_ELEMENT[]), r9=Length; the rest as read_file
+    uint32_t array_addr = ctx.r8.u32;
+    uint32_t length = ctx.r9.u32;
+    uint32_t count = (length + SCATTER_PAGE_SIZE - 1) / SCATTER_PAGE_SIZE;
+    if (!array_addr || !count)
+    {
+        ctx.r3.u32 = STATUS_INVALID_PARAMETER;
+        return;
+    }
+
+    // Pages become iovecs straight into guest memory; runs of adjacent
+    // pages are merged, which cuts the segment count for linear buffers
+    static thread_local std::vector<HostIoSegment> segments;
+    segments.clear();
+    uint32_t first_page = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t page = ppc_read_u32(base, array_addr + i * SCATTER_ELEMENT_SIZE + 4);
+        if (!page)
+        {
+            fprintf(stderr, "[FILE] NtReadFileScatter: segment %u is null\n", i);
+            ctx.r3.u32 = STATUS_INVALID_PARAMETER;
+            return;
+        }
+        if (i == 0)
+            first_page = page;
+        uint32_t size = std::min(SCATTER_PAGE_SIZE, length - i * SCATTER_PAGE_SIZE);
+        if (!segments.empty() && (uint8_t*)segments.back().dst + segments.back().size == base + page)
+            segments.back().size += size;
+        else
+            segments.push_back({base + page, size});
+    }
+    read_file(ctx, base, "NtReadFileScatter", segments.data(), (int)segments.size(), length, first_page);
 }
 
 PPC_FUNC(__imp__NtWriteFile)
@@ -1244,6 +1664,7 @@ PPC_FUNC(__imp__NtWriteFile)
         ppc_write_u32(base, iosb_addr + 4, length);
     }
     STUB_LOG_ONCE("NtWriteFile");
+    io_complete(base, scheduler_thread_object(), ctx.r4.u32, ctx.r5.u32, ctx.r6.u32, iosb_addr);
     ctx.r3.u32 = 0; // STATUS_SUCCESS
 }
 
@@ -1256,7 +1677,7 @@ PPC_FUNC(__imp__NtQueryInformationFile)
     uint32_t info_len = ctx.r6.u32;
     uint32_t info_class = ctx.r7.u32;
 
-    HandleEntry* entry = handle_lookup(handle_val);
+    HandleEntry* entry = file_reference(handle_val);
     if (!entry)
     {
         fprintf(stderr, "[FILE] NtQueryInformationFile: invalid handle 0x%X\n", handle_val);
@@ -1292,9 +1713,7 @@ PPC_FUNC(__imp__NtQueryInformationFile)
     case 14: // FilePositionInformation
     {
         // CurrentByteOffset(u64)
-        int64_t pos = 0;
-        if (entry->fp)
-            pos = _ftelli64(entry->fp);
+        int64_t pos = entry->position;
         if (info_len >= 8)
             ppc_write_u64(base, info_addr, (uint64_t)pos);
         if (iosb_addr)
@@ -1331,6 +1750,7 @@ PPC_FUNC(__imp__NtQueryInformationFile)
         ctx.r3.u32 = 0xC0000003; // STATUS_INVALID_INFO_CLASS
         break;
     }
+    ob_dereference(handle_val);
 }
 
 PPC_FUNC(__imp__NtSetInformationFile)
@@ -1347,15 +1767,6 @@ PPC_FUNC(__imp__NtQueryVolumeInformationFile)
 
 PPC_FUNC(__imp__NtQueryDirectoryFile)
 {
-    // Xbox 360 NtQueryDirectoryFile parameter layout (determined by register probing):
-    // r3=FileHandle, r4=Event(NULL), r5=ApcRoutine(NULL), r6=ApcContext(NULL),
-    // r7=IoStatusBlock*, r8=FileInformation*, r9=Length,
-    // r10=pointer whose first u32 is FileInformationClass
-    uint32_t handle_val = ctx.r3.u32;
-    uint32_t iosb_addr = ctx.r7.u32;
-    uint32_t info_buf = ctx.r8.u32;
-    uint32_t info_len = ctx.r9.u32;
-
     // Xbox 360 NtQueryDirectoryFile parameter layout (from PPC code analysis):
     //   r3=FileHandle, r4=Event(0), r5=ApcRoutine(0), r6=ApcContext(0),
     //   r7=IoStatusBlock*, r8=FileInformation*, r9=Length,
@@ -1364,102 +1775,78 @@ PPC_FUNC(__imp__NtQueryDirectoryFile)
     // Xbox 360 always uses FileDirectoryInformation (class 1) with 0x40 header.
     // r10 is the filename filter, NOT the FileInformationClass.
     // (Confirmed: Xenia only implements X_FILE_DIRECTORY_INFORMATION for class 1)
-    uint32_t info_class = 1; // Always class 1 on Xbox 360
+    uint32_t handle_val = ctx.r3.u32;
+    uint32_t iosb_addr = ctx.r7.u32;
+    uint32_t info_buf = ctx.r8.u32;
+    uint32_t info_len = ctx.r9.u32;
+    uint32_t filter_addr = ctx.r10.u32;
 
-    HandleEntry* entry = handle_lookup(handle_val);
+    HandleEntry* entry = file_reference(handle_val);
     if (!entry || entry->type != HANDLE_DIRECTORY)
     {
         fprintf(stderr, "[FILE] NtQueryDirectoryFile: invalid dir handle 0x%X\n", handle_val);
+        if (entry)
+            ob_dereference(handle_val);
         ctx.r3.u32 = 0xC0000008; // STATUS_INVALID_HANDLE
         return;
     }
+    std::lock_guard<std::mutex> file_lock(g_file_lock);
+    const DirListing& listing = *entry->listing;
 
-    if (entry->dir_index >= entry->dir_entries.size())
+    // The first query's filter holds for the rest of the scan, as on NT
+    uint32_t status = 0; // STATUS_SUCCESS
+    if (filter_addr && entry->dir_index == 0 && !entry->filtered)
     {
-        if (iosb_addr)
+        uint16_t filter_len = ppc_read_u16(base, filter_addr);
+        uint32_t filter_buf = ppc_read_u32(base, filter_addr + 4);
+        if (filter_len && filter_buf)
         {
-            ppc_write_u32(base, iosb_addr, 0x80000006);
-            ppc_write_u32(base, iosb_addr + 4, 0);
+            const char* filter = reinterpret_cast<const char*>(base + filter_buf);
+            dir_listing_match(listing, filter, filter_len, &entry->matches);
+            entry->filtered = true;
+            fprintf(stderr, "[FILE] NtQueryDirectoryFile: handle=0x%X, filter \"%.*s\": %zu of %zu\n",
+                    handle_val, (int)filter_len, filter, entry->matches.size(), dir_listing_count(listing));
+            if (entry->matches.empty())
+                status = 0xC000000F; // STATUS_NO_SUCH_FILE
         }
-        ctx.r3.u32 = 0x80000006; // STATUS_NO_MORE_FILES
-        return;
     }
+    const uint32_t* order = entry->filtered ? entry->matches.data() : nullptr;
+    size_t count = entry->filtered ? entry->matches.size() : dir_listing_count(listing);
 
-    // FileDirectoryInformation (class 1): 0x40 header, then ANSI filename
-    uint32_t header_size = 0x40;
-
-    // Pack as many entries as fit in the output buffer
-    uint32_t offset = 0;
-    uint32_t prev_entry_offset_pos = 0; // position of last NextEntryOffset field
-    bool first = true;
-    uint32_t entries_written = 0;
-
-    while (entry->dir_index < entry->dir_entries.size())
+    if (status == 0 && entry->dir_index >= count)
+        status = 0x80000006; // STATUS_NO_MORE_FILES
+    if (status)
     {
-        const DirEntry& de = entry->dir_entries[entry->dir_index];
-        uint32_t name_len = (uint32_t)de.name.size();
-        uint32_t entry_size = header_size + name_len;
-        // Align to 8 bytes for next entry
-        uint32_t aligned_size = (entry_size + 7) & ~7u;
-
-        if (offset + entry_size > info_len)
+        if (iosb_addr)
         {
-            if (first)
-            {
-                // Buffer too small for even one entry
-                ctx.r3.u32 = 0x80000005; // STATUS_BUFFER_OVERFLOW
-                return;
-            }
-            break; // no room for more entries
+            ppc_write_u32(base, iosb_addr, status);
+            ppc_write_u32(base, iosb_addr + 4, 0);
         }
+        ob_dereference(handle_val);
+        ctx.r3.u32 = status;
+        return;
+    }
 
-        uint32_t entry_addr = info_buf + offset;
-        // Zero the entry area
-        memset(base + entry_addr, 0, (offset + aligned_size <= info_len) ? aligned_size : entry_size);
-
-        // Link previous entry to this one
-        if (!first)
-            ppc_write_u32(base, prev_entry_offset_pos, offset - (prev_entry_offset_pos - info_buf));
-
-        prev_entry_offset_pos = entry_addr; // NextEntryOffset is at +0x00
-
-        // X_FILE_DIRECTORY_INFORMATION (class 1, Xbox 360 layout):
-        // +0x00 NextEntryOffset (u32) - filled later or 0
-        ppc_write_u32(base, entry_addr + 0x00, 0);
-        // +0x04 FileIndex (u32)
-        ppc_write_u32(base, entry_addr + 0x04, (uint32_t)entry->dir_index);
-        // +0x08 CreationTime (u64) - zeroed
-        // +0x10 LastAccessTime (u64) - zeroed
-        // +0x18 LastWriteTime (u64) - zeroed
-        // +0x20 ChangeTime (u64) - zeroed
-        // +0x28 EndOfFile (u64)
-        ppc_write_u64(base, entry_addr + 0x28, (uint64_t)de.size);
-        // +0x30 AllocationSize (u64)
-        ppc_write_u64(base, entry_addr + 0x30, (uint64_t)de.size);
-        // +0x38 FileAttributes (u32)
-        ppc_write_u32(base, entry_addr + 0x38, de.is_directory ? 0x10 : 0x80);
-        // +0x3C FileNameLength (u32)
-        ppc_write_u32(base, entry_addr + 0x3C, name_len);
-        // +0x40 FileName (ANSI, not null-terminated)
-        memcpy(base + entry_addr + 0x40, de.name.c_str(), name_len);
-
-        entry->dir_index++;
-        entries_written++;
-        first = false;
-        offset += aligned_size;
-    }
-
-    // Last entry has NextEntryOffset = 0 (already written)
+    // Records are stored ready to copy (dir_listing.h)
+    size_t first = entry->dir_index;
+    uint32_t bytes = dir_listing_copy(listing, order, count, &entry->dir_index, base + info_buf, info_len);
+    if (!bytes)
+    {
+        // Buffer too small for even one entry
+        ob_dereference(handle_val);
+        ctx.r3.u32 = 0x80000005; // STATUS_BUFFER_OVERFLOW
+        return;
+    }
 
     if (iosb_addr)
     {
         ppc_write_u32(base, iosb_addr, 0); // STATUS_SUCCESS
-        ppc_write_u32(base, iosb_addr + 4, offset); // bytes written
+        ppc_write_u32(base, iosb_addr + 4, bytes); // bytes written
     }
 
-    fprintf(stderr, "[FILE] NtQueryDirectoryFile: handle=0x%X, %u entries returned (%u/%zu)\n",
-            handle_val, entries_written,
-            (uint32_t)entry->dir_index, entry->dir_entries.size());
+    fprintf(stderr, "[FILE] NtQueryDirectoryFile: handle=0x%X, %zu entries returned (%zu/%zu)\n",
+            handle_val, entry->dir_index - first, entry->dir_index, count);
+    ob_dereference(handle_val);
     ctx.r3.u32 = 0; // STATUS_SUCCESS
 }
 
@@ -1471,16 +1858,20 @@ PPC_FUNC(__imp__NtFlushBuffersFile)
 
 PPC_FUNC(__imp__NtClose)
 {
+    // Drops the handle's reference; the object goes with the last one
     uint32_t handle_val = ctx.r3.u32;
-    HandleEntry* entry = handle_lookup(handle_val);
+    HandleEntry* entry = file_reference(handle_val);
     if (entry)
     {
         fprintf(stderr, "[FILE] NtClose: handle=0x%X (\"%s\")\n", handle_val, entry->host_path.c_str());
-        if (entry->fp)
-            fclose(entry->fp);
-        handle_free(handle_val);
+        ob_dereference(handle_val);
+    }
+    if (!ob_dereference(handle_val))
+    {
+        fprintf(stderr, "[OBJ] NtClose: invalid handle 0x%X\n", handle_val);
+        ctx.r3.u32 = 0xC0000008; // STATUS_INVALID_HANDLE
+        return;
     }
-    // Silently succeed for non-file handles (events, threads, etc.)
     ctx.r3.u32 = 0;
 }
 
@@ -1489,67 +1880,151 @@ PPC_FUNC(__imp__NtClose)
 // NT Kernel - Events, Timers, Threads, Objects
 // ============================================================================
 
-static uint32_t g_next_handle = 0x100;
+// Event, timer and thread handles name their kernel object (kernel_objects.h)
+// directly; it goes when the handle's last reference does.
+static void dispatcher_destroy(void*, uint32_t handle)
+{
+    kobj_close(handle);
+}
+
+static uint32_t dispatcher_handle_create(ObType type)
+{
+    uint32_t handle = ob_create(type, nullptr, dispatcher_destroy);
+    if (!handle)
+        fprintf(stderr, "[OBJ] handle table full (%d handles)\n", ob_count());
+    return handle;
+}
+
+// Pseudo-handles for the current process and thread: not in the table
+static bool is_pseudo_handle(uint32_t handle)
+{
+    return handle == 0xFFFFFFFE || handle == 0xFFFFFFFF;
+}
 
 PPC_FUNC(__imp__NtCreateEvent)
 {
     // r3 = EventHandle* (out), r4 = ObjectAttributes*, r5 = EventType, r6 = InitialState
+    // EventType: 0 = NotificationEvent (manual reset), 1 = SynchronizationEvent
     STUB_LOG_ONCE("NtCreateEvent");
     uint32_t handle_ptr = ctx.r3.u32;
-    ppc_write_u32(base, handle_ptr, g_next_handle++);
+    uint32_t handle = dispatcher_handle_create(OB_TYPE_EVENT);
+    if (!handle)
+    {
+        ctx.r3.u32 = 0xC000009A; // STATUS_INSUFFICIENT_RESOURCES
+        return;
+    }
+    kobj_create_event(handle, ctx.r5.u32 == 0, ctx.r6.u32 != 0);
+    ppc_write_u32(base, handle_ptr, handle);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtSetEvent)
 {
+    // r3 = EventHandle, r4 = PreviousState* (optional)
     STUB_LOG_ONCE("NtSetEvent");
+    int32_t prev = kobj_set_event(base, ctx.r3.u32);
+    if (ctx.r4.u32)
+        ppc_write_u32(base, ctx.r4.u32, (uint32_t)prev);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtClearEvent)
 {
+    // r3 = EventHandle
     STUB_LOG_ONCE("NtClearEvent");
+    kobj_reset_event(base, ctx.r3.u32);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtCreateTimer)
 {
+    // r3 = TimerHandle* (out), r4 = ObjectAttributes*, r5 = TimerType
+    // TimerType: 0 = NotificationTimer (manual reset), 1 = SynchronizationTimer
     STUB_LOG_ONCE("NtCreateTimer");
     uint32_t handle_ptr = ctx.r3.u32;
-    ppc_write_u32(base, handle_ptr, g_next_handle++);
+    uint32_t handle = dispatcher_handle_create(OB_TYPE_TIMER);
+    if (!handle)
+    {
+        ctx.r3.u32 = 0xC000009A; // STATUS_INSUFFICIENT_RESOURCES
+        return;
+    }
+    kobj_create_timer(handle, ctx.r5.u32 == 1);
+    ppc_write_u32(base, handle_ptr, handle);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtSetTimerEx)
 {
+    // r3 = TimerHandle, r4 = DueTime* (LARGE_INTEGER), r5 = ApcRoutine,
+    // r6 = ApcMode, r7 = ApcArgument, r8 = Resume, r9 = Period (ms),
+    // r10 = PreviousState* (optional). The APC routine is queued to this
+    // thread on every signal.
     STUB_LOG_ONCE("NtSetTimerEx");
+    int64_t due_time;
+    const int64_t* due = kobj_read_timeout(base, ctx.r4.u32, &due_time);
+    int32_t prev = kobj_set_timer(ctx.r3.u32, due ? *due : 0, (int32_t)ctx.r9.u32,
+                                  ctx.r5.u32, ctx.r7.u32);
+    if (ctx.r10.u32)
+        ppc_write_u32(base, ctx.r10.u32, (uint32_t)prev);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtCancelTimer)
 {
+    // r3 = TimerHandle, r4 = CurrentState* (optional)
     STUB_LOG_ONCE("NtCancelTimer");
+    int32_t state = kobj_cancel_timer(ctx.r3.u32);
+    if (ctx.r4.u32)
+        ppc_write_u32(base, ctx.r4.u32, (uint32_t)state);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtDuplicateObject)
 {
-    STUB_LOG("NtDuplicateObject");
+    // r3 = SourceHandle, r4 = TargetHandle* (out), r5 = Options
+    // (DUPLICATE_CLOSE_SOURCE = 1). The duplicate is the same handle value
+    // with one more reference, so each copy is closed once.
+    STUB_LOG_ONCE("NtDuplicateObject");
+    uint32_t handle = ctx.r3.u32;
+    if (!is_pseudo_handle(handle))
+    {
+        if (!ob_reference(handle))
+        {
+            fprintf(stderr, "[OBJ] NtDuplicateObject: invalid handle 0x%X\n", handle);
+            ctx.r3.u32 = 0xC0000008; // STATUS_INVALID_HANDLE
+            return;
+        }
+        if (ctx.r5.u32 & 1)
+            ob_dereference(handle);
+    }
+    if (ctx.r4.u32)
+        ppc_write_u32(base, ctx.r4.u32, handle);
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__NtWaitForSingleObjectEx)
 {
+    // r3 = Handle, r4 = WaitMode, r5 = Alertable, r6 = Timeout*
     STUB_LOG_ONCE("NtWaitForSingleObjectEx");
-    if (g_current_thread) thread_yield();
-    ctx.r3.u32 = 0;
+    uint32_t key = ctx.r3.u32;
+    ctx.r3.u32 = wait_objects(ctx, base, &key, 1, false, ctx.r5.u32 != 0, ctx.r6.u32);
 }
 
 PPC_FUNC(__imp__NtWaitForMultipleObjectsEx)
 {
+    // r3 = Count, r4 = Handles*, r5 = WaitType (0 = all, 1 = any), r6 = WaitMode,
+    // r7 = Alertable, r8 = Timeout*
     STUB_LOG_ONCE("NtWaitForMultipleObjectsEx");
-    if (g_current_thread) thread_yield();
-    ctx.r3.u32 = 0;
+    if (ctx.r3.u32 == 0 || ctx.r3.u32 > (uint32_t)MAX_WAIT_OBJECTS)
+    {
+        ctx.r3.u32 = 0xC000000D; // STATUS_INVALID_PARAMETER
+        return;
+    }
+    uint32_t keys[MAX_WAIT_OBJECTS];
+    int count = (int)ctx.r3.u32;
+    for (int i = 0; i < count; i++)
+        keys[i] = ppc_read_u32(base, ctx.r4.u32 + i * 4);
+    ctx.r3.u32 = wait_objects(ctx, base, keys, count, ctx.r5.u32 == 0, ctx.r7.u32 != 0, ctx.r8.u32);
 }
 
 PPC_FUNC(__imp__NtResumeThread)
@@ -1560,22 +2035,12 @@ PPC_FUNC(__imp__NtResumeThread)
     uint32_t prev_count_ptr = ctx.r4.u32;
     fprintf(stderr, "[THREAD] NtResumeThread: handle=0x%08X\n", thread_handle);
 
-    for (int i = 0; i < g_pending_thread_count; i++)
+    if (scheduler_resume_thread(thread_handle))
     {
-        PendingThread& pt = g_pending_threads[i];
-        if (pt.handle == thread_handle && pt.suspended && !pt.finished)
-        {
-            fprintf(stderr, "[THREAD] Resuming thread %d (handle=0x%X) — giving immediate timeslice\n", i, pt.handle);
-            pt.suspended = false;
-            if (prev_count_ptr)
-                ppc_write_u32(base, prev_count_ptr, 1);
-            // Give the thread an immediate timeslice via fiber
-            // It will run until it yields (KeDelayExecutionThread etc.)
-            if (g_main_fiber)
-                thread_give_timeslice(pt, i);
-            ctx.r3.u32 = 0; // STATUS_SUCCESS
-            return;
-        }
+        if (prev_count_ptr)
+            ppc_write_u32(base, prev_count_ptr, 1);
+        ctx.r3.u32 = 0; // STATUS_SUCCESS
+        return;
     }
 
     fprintf(stderr, "[THREAD] NtResumeThread: no matching suspended thread for handle=0x%08X\n", thread_handle);
@@ -1601,38 +2066,25 @@ PPC_FUNC(__imp__ExCreateThread)
     uint32_t suspended = ctx.r9.u32;
     fprintf(stderr, "[THREAD] ExCreateThread: routine=0x%08X, context=0x%08X, suspended=%u\n",
             start_routine, start_context, suspended);
-    uint32_t thread_handle = g_next_handle++;
+    uint32_t thread_handle = dispatcher_handle_create(OB_TYPE_THREAD);
+    if (!thread_handle)
+    {
+        ctx.r3.u32 = 0xC000009A; // STATUS_INSUFFICIENT_RESOURCES
+        return;
+    }
     if (handle_ptr)
         ppc_write_u32(base, handle_ptr, thread_handle);
 
-    // Queue the thread for later execution
-    if (start_routine && g_pending_thread_count < MAX_PENDING_THREADS)
-    {
-        PendingThread& pt = g_pending_threads[g_pending_thread_count];
-        pt.handle = thread_handle;
-        pt.start_routine = start_routine;
-        pt.start_context = start_context;
-        pt.api_startup = api_startup;
-        pt.suspended = (suspended != 0);
-        pt.finished = false;
-        pt.started = false;
-        pt.fiber = nullptr;
-        pt.base = base;
-        // Initialize thread PPC context from main context
-        pt.ppc_stack_top = alloc_thread_stack();
-        init_thread_ctx(pt, ctx);
-        int idx = g_pending_thread_count;
-        fprintf(stderr, "[THREAD]   -> thread %d, PPC stack=0x%08X\n",
-                idx, pt.ppc_stack_top);
-        g_pending_thread_count++;
-
-        // Non-suspended threads start immediately on Xbox 360.
-        // Give them a fiber timeslice right away.
-        if (!pt.suspended && g_main_fiber)
-        {
-            fprintf(stderr, "[THREAD] Non-suspended thread %d — giving immediate timeslice\n", idx);
-            thread_give_timeslice(pt, idx);
-        }
+    // Queue the thread; the scheduler starts it now unless suspended.
+    // The handle is waitable and signaled when the thread ends.
+    if (start_routine)
+        kobj_create_thread(thread_handle);
+    if (start_routine &&
+        !scheduler_create_thread(ctx, base, thread_handle, start_routine, start_context,
+                                 api_startup, suspended != 0))
+    {
+        fprintf(stderr, "[THREAD] ExCreateThread: no guest stack left, routine=0x%08X dropped\n",
+                start_routine);
     }
     ctx.r3.u32 = 0;
 }
@@ -1640,55 +2092,35 @@ PPC_FUNC(__imp__ExCreateThread)
 PPC_FUNC(__imp__ExTerminateThread)
 {
     STUB_LOG("ExTerminateThread");
-    // If called from a fiber thread, mark finished and switch back to main
-    if (g_current_thread)
-    {
-        g_current_thread->finished = true;
-        SwitchToFiber(g_main_fiber);
-    }
+    // From a guest thread: mark finished and never return to it
+    scheduler_exit_thread();
     ctx.r3.u32 = 0;
 }
 
 PPC_FUNC(__imp__ExAllocatePoolWithTag)
 {
-    // r3 = pool type, r4 = size, r5 = tag
-    uint32_t size = ctx.r4.u32;
-    size = (size + 0xF) & ~0xFu; // 16-byte align
-    if (g_heap_next + size <= g_heap_end)
-    {
-        uint32_t addr = g_heap_next;
-        g_heap_next += size;
-        memset(base + addr, 0, size);
-        ctx.r3.u32 = addr;
-    }
-    else
-    {
-        ctx.r3.u32 = 0;
-    }
+    // r3 = size, r4 = tag
+    uint32_t size = ctx.r3.u32;
+    ctx.r3.u32 = pool_alloc(size, ctx.r4.u32);
+    alloc_tracker_add(ctx.r3.u32, size, (uint32_t)ctx.lr, ALLOC_SOURCE_POOL);
 }
 
 PPC_FUNC(__imp__ExAllocatePoolTypeWithTag)
 {
-    // Same as above with different argument order
-    uint32_t size = ctx.r4.u32;
-    size = (size + 0xF) & ~0xFu;
-    if (g_heap_next + size <= g_heap_end)
-    {
-        uint32_t addr = g_heap_next;
-        g_heap_next += size;
-        memset(base + addr, 0, size);
-        ctx.r3.u32 = addr;
-    }
-    else
-    {
-        ctx.r3.u32 = 0;
-    }
+    // r3 = size, r4 = tag, r5 = pool type
+    uint32_t size = ctx.r3.u32;
+    ctx.r3.u32 = pool_alloc(size, ctx.r4.u32);
+    alloc_tracker_add(ctx.r3.u32, size, (uint32_t)ctx.lr, ALLOC_SOURCE_POOL);
 }
 
 PPC_FUNC(__imp__ExFreePool)
 {
+    // r3 = pointer
     STUB_LOG_ONCE("ExFreePool");
-    // Can't reclaim from bump allocator
+    if (pool_free(ctx.r3.u32))
+        alloc_tracker_free(ctx.r3.u32, 0);
+    else
+        fprintf(stderr, "[MEM] ExFreePool: 0x%08X isn't a pool block\n", ctx.r3.u32);
 }
 
 PPC_FUNC(__imp__ExRegisterTitleTerminateNotification)
@@ -1737,24 +2169,29 @@ PPC_FUNC(__imp__ExGetXConfigSetting)
     ctx.r3.u32 = 0xC0000225; // STATUS_NOT_FOUND
 }
 
+// Read/write locks: see rw_lock.cpp
 PPC_FUNC(__imp__ExInitializeReadWriteLock)
 {
-    STUB_LOG_ONCE("ExInitializeReadWriteLock");
+    // r3 = lock addr
+    rw_init(base, ctx.r3.u32);
 }
 
 PPC_FUNC(__imp__ExAcquireReadWriteLockShared)
 {
-    // No-op in single-threaded mode
+    // r3 = lock addr
+    rw_acquire_shared(base, ctx.r3.u32);
 }
 
 PPC_FUNC(__imp__ExAcquireReadWriteLockExclusive)
 {
-    // No-op in single-threaded mode
+    // r3 = lock addr
+    rw_acquire_exclusive(base, ctx.r3.u32);
 }
 
 PPC_FUNC(__imp__ExReleaseReadWriteLock)
 {
-    // No-op in single-threaded mode
+    // r3 = lock addr
+    rw_release(base, ctx.r3.u32);
 }
 
 
@@ -1762,14 +2199,22 @@ PPC_FUNC(__imp__ExReleaseReadWriteLock)
 // Object Manager (Ob*)
 // ============================================================================
 
+// Object "pointers" handed to the guest are the handle values themselves
+// (see ObReferenceObjectByHandle), so these count on the handle's slot.
+// Anything else (guest addresses, pseudo-handles) isn't counted.
+
 PPC_FUNC(__imp__ObReferenceObject)
 {
+    // r3 = Object
     STUB_LOG_ONCE("ObReferenceObject");
+    ob_reference(ctx.r3.u32);
 }
 
 PPC_FUNC(__imp__ObDereferenceObject)
 {
+    // r3 = Object
     STUB_LOG_ONCE("ObDereferenceObject");
+    ob_dereference(ctx.r3.u32);
 }
 
 PPC_FUNC(__imp__ObReferenceObjectByHandle)
@@ -1779,6 +2224,13 @@ PPC_FUNC(__imp__ObReferenceObjectByHandle)
     uint32_t out_ptr = ctx.r5.u32;
     fprintf(stderr, "[OBJ] ObReferenceObjectByHandle: handle=0x%X, out=0x%08X\n", handle, out_ptr);
 
+    if (!is_pseudo_handle(handle) && !ob_reference(handle))
+    {
+        fprintf(stderr, "[OBJ]   -> invalid handle\n");
+        ctx.r3.u32 = 0xC0000008; // STATUS_INVALID_HANDLE
+        return;
+    }
+
     // Write the handle value as the "object pointer" so KeResumeThread can match it
     if (out_ptr)
         ppc_write_u32(base, out_ptr, handle);
@@ -1860,9 +2312,7 @@ PPC_FUNC(__imp__VdGetSystemCommandBuffer)
     static uint32_t s_cmd_size = 0x10000; // 64KB
     if (!s_cmd_buf)
     {
-        s_cmd_buf = g_heap_next;
-        g_heap_next += s_cmd_size;
-        memset(base + s_cmd_buf, 0, s_cmd_size);
+        s_cmd_buf = heap_alloc_block(s_cmd_size);
         fprintf(stderr, "[MEM] VdGetSystemCommandBuffer: allocated 0x%08X (%u bytes)\n",
                 s_cmd_buf, s_cmd_size);
     }
@@ -1879,29 +2329,49 @@ static uint32_t g_gpu_rptr_wb_phys = 0;    // Physical addr for read pointer wri
 static uint32_t g_gpu_rptr_wb_virt = 0;    // Virtual addr for read pointer writeback
 static volatile bool g_gpu_thread_running = false;
 
+static void gpu_write_rptr(uint32_t rptr, uint32_t)
+{
+    ppc_write_u32(g_gpu_base, g_gpu_rptr_wb_virt, rptr);
+    if (g_gpu_rptr_wb_phys && g_gpu_rptr_wb_phys != g_gpu_rptr_wb_virt)
+        ppc_write_u32(g_gpu_base, g_gpu_rptr_wb_phys, rptr);
+}
+
 // Background thread: sync GPU read pointer to write pointer
 // This makes the game think the GPU instantly processes all commands
+#ifdef _WIN32
 static DWORD WINAPI gpu_sync_thread(LPVOID param)
+#else
+static void gpu_sync_thread(void* param)
+#endif
 {
     (void)param;
     fprintf(stderr, "[GPU] Ring buffer sync thread started\n");
     fprintf(stderr, "[GPU]   wptr_addr=0x%08X, rptr_wb_virt=0x%08X, rptr_wb_phys=0x%08X\n",
             g_gpu_wptr_addr, g_gpu_rptr_wb_virt, g_gpu_rptr_wb_phys);
     fflush(stderr);
+    uint32_t posted = 0;
     while (g_gpu_thread_running)
     {
         if (g_gpu_base && g_gpu_wptr_addr && g_gpu_rptr_wb_virt)
         {
             // Read current write pointer (big-endian)
             uint32_t wptr = ppc_read_u32(g_gpu_base, g_gpu_wptr_addr);
-            // Write it to read pointer writeback (both virtual and physical addresses)
-            ppc_write_u32(g_gpu_base, g_gpu_rptr_wb_virt, wptr);
-            if (g_gpu_rptr_wb_phys && g_gpu_rptr_wb_phys != g_gpu_rptr_wb_virt)
-                ppc_write_u32(g_gpu_base, g_gpu_rptr_wb_phys, wptr);
+            // Write it to read pointer writeback (both virtual and physical
+            // addresses). While recording, the main thread does it at its
+            // next sync point; only changes are worth a log record.
+            if (replay_mode() == ReplayMode::Off)
+                gpu_write_rptr(wptr, 0);
+            else if (wptr != posted && replay_post(REPLAY_EVENT_GPU_RPTR, wptr, 0))
+                posted = wptr;
         }
+#ifdef _WIN32
         Sleep(1); // 1ms sync interval
     }
     return 0;
+#else
+        usleep(1000); // 1ms sync interval
+    }
+#endif
 }
 
 PPC_FUNC(__imp__VdInitializeRingBuffer)
@@ -1939,8 +2409,13 @@ PPC_FUNC(__imp__VdEnableRingBufferRPtrWriteBack)
     // Start background sync thread
     if (!g_gpu_thread_running)
     {
+        replay_set_handler(REPLAY_EVENT_GPU_RPTR, gpu_write_rptr);
         g_gpu_thread_running = true;
+#ifdef _WIN32
         CreateThread(nullptr, 0, gpu_sync_thread, nullptr, 0, nullptr);
+#else
+        std::thread(gpu_sync_thread, nullptr).detach();
+#endif
     }
 }
 
@@ -1949,9 +2424,17 @@ PPC_FUNC(__imp__VdSetSystemCommandBufferGpuIdentifierAddress)
     STUB_LOG("VdSetSystemCommandBufferGpuIdentifierAddress");
 }
 
+// Called as callback(source, context) at each VdSwap, through the DPC queue
+static uint32_t g_graphics_interrupt_callback = 0;
+static uint32_t g_graphics_interrupt_context = 0;
+static constexpr uint32_t GRAPHICS_INTERRUPT_VBLANK = 0;
+
 PPC_FUNC(__imp__VdSetGraphicsInterruptCallback)
 {
+    // r3 = Callback, r4 = Context
     STUB_LOG("VdSetGraphicsInterruptCallback");
+    g_graphics_interrupt_callback = ctx.r3.u32;
+    g_graphics_interrupt_context = ctx.r4.u32;
 }
 
 PPC_FUNC(__imp__VdInitializeScalerCommandBuffer)
@@ -1975,13 +2458,16 @@ PPC_FUNC(__imp__VdSwap)
     // Frame swap - this is where we'd present the frame.
     STUB_LOG_ONCE("VdSwap");
 
-    // Give each ready thread a time slice via fibers
-    for (int i = 0; i < g_pending_thread_count; i++)
-    {
-        PendingThread& pt = g_pending_threads[i];
-        if (!pt.suspended && !pt.finished)
-            thread_give_timeslice(pt, i);
-    }
+    // Frame boundary: vblank interrupt and other deferred work
+    if (g_graphics_interrupt_callback)
+        dpc_queue(g_graphics_interrupt_callback, GRAPHICS_INTERRUPT_VBLANK, g_graphics_interrupt_context);
+    dpc_run(ctx, base);
+    alloc_tracker_frame();
+    file_io_frame();
+    read_ahead_frame();
+
+    // Give each ready thread a time slice via fibers (Fiber mode)
+    scheduler_frame_begin();
 
     // Frame limiter: target ~60 FPS (16.67ms per frame).
     // Windows Sleep(16) actually sleeps ~31ms due to 15.6ms timer granularity.
@@ -2005,7 +2491,8 @@ PPC_FUNC(__imp__VdSwap)
             }
             QueryPerformanceCounter(&now);
             int64_t elapsed_us = (now.QuadPart - s_last.QuadPart) * 1000000 / s_freq.QuadPart;
-            if (elapsed_us >= target_us) break;
+            // Replays run flat out
+            if (elapsed_us >= target_us || replay_mode() == ReplayMode::Replay) break;
             // Coarse sleep if >2ms remain, otherwise spin
             if (elapsed_us < target_us - 2000)
                 Sleep(1);
@@ -2013,8 +2500,10 @@ PPC_FUNC(__imp__VdSwap)
         QueryPerformanceCounter(&s_last);
     }
 #else
-    std::this_thread::sleep_for(std::chrono::microseconds(16667));
+    if (replay_mode() != ReplayMode::Replay)
+        std::this_thread::sleep_for(std::chrono::microseconds(16667));
 #endif
+    scheduler_frame_end();
 }
 
 PPC_FUNC(__imp__VdEnableDisableClockGating)
@@ -2095,14 +2584,11 @@ PPC_FUNC(__imp__XMAReleaseContext)
 PPC_FUNC(__imp__XamAlloc)
 {
     // r3 = flags, r4 = size, r5 = ptr* (out)
-    uint32_t size = ctx.r4.u32;
     uint32_t out_ptr = ctx.r5.u32;
-    size = (size + 0xF) & ~0xFu;
-    if (g_heap_next + size <= g_heap_end)
+    uint32_t addr = pool_alloc(ctx.r4.u32, POOL_TAG_XAM);
+    if (addr)
     {
-        uint32_t addr = g_heap_next;
-        g_heap_next += size;
-        memset(base + addr, 0, size);
+        alloc_tracker_add(addr, ctx.r4.u32, (uint32_t)ctx.lr, ALLOC_SOURCE_XAM);
         ppc_write_u32(base, out_ptr, addr);
         ctx.r3.u32 = 0;
     }
@@ -2114,7 +2600,11 @@ PPC_FUNC(__imp__XamAlloc)
 
 PPC_FUNC(__imp__XamFree)
 {
-    // Can't reclaim from bump allocator
+    // r3 = pointer
+    if (pool_free(ctx.r3.u32))
+        alloc_tracker_free(ctx.r3.u32, 0);
+    else
+        fprintf(stderr, "[MEM] XamFree: 0x%08X isn't a pool block\n", ctx.r3.u32);
     ctx.r3.u32 = 0;
 }
 
@@ -2122,11 +2612,9 @@ PPC_FUNC(__imp__XamGetExecutionId)
 {
     STUB_LOG("XamGetExecutionId");
     // r3 = EXECUTION_ID** (out)
-    // Allocate a fake execution ID struct
-    uint32_t exec_id = g_heap_next;
-    g_heap_next += 0x18;
-    memset(base + exec_id, 0, 0x18);
-    ppc_write_u32(base, ctx.r3.u32, exec_id);
+    // A fake execution ID struct, allocated once
+    static uint32_t s_exec_id = heap_alloc_block(0x18);
+    ppc_write_u32(base, ctx.r3.u32, s_exec_id);
     ctx.r3.u32 = 0;
 }
 
@@ -2212,8 +2700,12 @@ PPC_FUNC(__imp__XamUserCreateStatsEnumerator)
 PPC_FUNC(__imp__XamInputGetState)
 {
     // r3 = user index, r4 = flags, r5 = XINPUT_STATE*
-    // Return ERROR_DEVICE_NOT_CONNECTED for now
-    ctx.r3.u32 = 0x48F; // ERROR_DEVICE_NOT_CONNECTED
+    // Return ERROR_DEVICE_NOT_CONNECTED for now. The result and the state
+    // go through the replay log.
+    uint32_t result = replay_u32(0x48F); // ERROR_DEVICE_NOT_CONNECTED
+    if (result == 0 && ctx.r5.u32)
+        replay_bytes(base + ctx.r5.u32, 16); // dwPacketNumber + XINPUT_GAMEPAD
+    ctx.r3.u32 = result;
 }
 
 PPC_FUNC(__imp__XamInputSetState)
@@ -2377,7 +2869,7 @@ PPC_FUNC(__imp__XNotifyGetNext)
 PPC_FUNC(__imp__XamNotifyCreateListener)
 {
     STUB_LOG_ONCE("XamNotifyCreateListener");
-    ctx.r3.u32 = g_next_handle++; // Return a fake handle
+    ctx.r3.u32 = ob_create(OB_TYPE_NOTIFY, nullptr, nullptr); // nothing is ever posted to it
 }
 
 PPC_FUNC(__imp__XamSessionRefObjByHandle)
@@ -2459,6 +2951,7 @@ PPC_FUNC(__imp__NetDll_XNetRandom)
     }
     for (uint32_t i = 0; i < len; i++)
         base[buf + i] = (uint8_t)(rand() & 0xFF);
+    replay_bytes(base + buf, len);
     check_watchpoint(base, "NetDll_XNetRandom:exit");
     ctx.r3.u32 = 0;
 }
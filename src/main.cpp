@@ -2,8 +2,20 @@
 #include "ppc_context.h"
 #include "memory.h"
 #include "xex_loader.h"
+#include "scheduler.h"
+#include "kernel_objects.h"
+#include "replay.h"
+#include "guest_heap.h"
+#include "guest_pool.h"
+#include "alloc_tracker.h"
+#include "vm_regions.h"
+#include "host_file.h"
+#include "file_io.h"
+#include "read_ahead.h"
+#include "path_index.h"
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cfenv>
 #include <xmmintrin.h>
@@ -14,12 +26,14 @@
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <windows.h>
+#endif
 
 static uint8_t* g_ppc_base = nullptr;
 
 // Counter for NULL indirect calls (COM vtable entries on uninitialized objects)
 uint64_t g_null_icall_count = 0;
 
+#ifdef _WIN32
 // Global window handle
 HWND g_hwnd = nullptr;
 
@@ -93,9 +107,110 @@ int main(int argc, char* argv[])
     setvbuf(stdout, nullptr, _IONBF, 0);
     printf("=== The Simpsons Arcade - Static Recompilation ===\n\n");
 
+    // Usage: simpsons [--threads=fiber|host|pool[:N]] [--waits=queue|yield]
+    //                 [--sched-csv=path] [--record=log | --replay=log]
+    //                 [--pool-trace=path] [--alloc-track=path]
+    //                 [--file-reads=pread|mmap] [--io-workers=N]
+    //                 [--read-ahead=path [--prefetch=off]] [--pack=path] [pe_image.bin]
     const char* pe_path = "extracted/pe_image.bin";
-    if (argc > 1)
-        pe_path = argv[1];
+    ThreadMode thread_mode = ThreadMode::Fiber;
+    int pool_workers = 0;
+    int io_workers = 2;
+    ReplayMode replay = ReplayMode::Off;
+    const char* replay_path = nullptr;
+    const char* pool_trace_path = nullptr;
+    const char* pack_path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            if (!scheduler_parse_mode(argv[i] + 10, &thread_mode, &pool_workers))
+            {
+                fprintf(stderr, "FATAL: unknown thread mode '%s' (expected fiber, host or pool[:1-6])\n", argv[i] + 10);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--waits=yield") == 0 || strcmp(argv[i], "--waits=queue") == 0)
+        {
+            kobj_set_yield_waits(strcmp(argv[i], "--waits=yield") == 0);
+        }
+        else if (strncmp(argv[i], "--sched-csv=", 12) == 0)
+        {
+            // Per-frame, per-thread scheduler telemetry
+            if (!scheduler_open_csv(argv[i] + 12))
+                fprintf(stderr, "WARNING: could not open scheduler CSV '%s'\n", argv[i] + 12);
+        }
+        else if (strncmp(argv[i], "--pool-trace=", 13) == 0)
+        {
+            // Pool allocation trace for tools/pool_bench.cpp
+            pool_trace_path = argv[i] + 13;
+        }
+        else if (strcmp(argv[i], "--file-reads=mmap") == 0)
+        {
+            // Large reads copy out of a mapping of the file instead of pread
+            host_file_set_mmap(true);
+        }
+        else if (strcmp(argv[i], "--file-reads=pread") == 0)
+        {
+            host_file_set_mmap(false);
+        }
+        else if (strncmp(argv[i], "--io-workers=", 13) == 0)
+        {
+            // Host threads for overlapped NtReadFile; 0 reads everything synchronously
+            io_workers = atoi(argv[i] + 13);
+            if (io_workers < 0 || io_workers > 16)
+            {
+                fprintf(stderr, "FATAL: --io-workers must be 0-16\n");
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "--read-ahead=", 13) == 0)
+        {
+            // Per-sequence read traces, prefetched on later runs
+            if (!read_ahead_open(argv[i] + 13))
+                fprintf(stderr, "WARNING: could not open read-ahead trace '%s'\n", argv[i] + 13);
+        }
+        else if (strcmp(argv[i], "--prefetch=off") == 0)
+        {
+            read_ahead_set_prefetch(false);
+        }
+        else if (strncmp(argv[i], "--pack=", 7) == 0)
+        {
+            // game: from an asset pack (tools/pack_assets.cpp) instead of extracted/
+            pack_path = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "--alloc-track=", 14) == 0)
+        {
+            // Allocations by call site; dumps on SIGUSR1 (Ctrl+Break on Windows) and at exit
+            if (!alloc_tracker_open(argv[i] + 14))
+                fprintf(stderr, "WARNING: could not open allocation dump '%s'\n", argv[i] + 14);
+        }
+        else if (strncmp(argv[i], "--record=", 9) == 0)
+        {
+            replay = ReplayMode::Record;
+            replay_path = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--replay=", 9) == 0)
+        {
+            replay = ReplayMode::Replay;
+            replay_path = argv[i] + 9;
+        }
+        else
+        {
+            pe_path = argv[i];
+        }
+    }
+    if (replay != ReplayMode::Off)
+    {
+        // Only Fiber mode runs every guest thread on this one host thread
+        if (thread_mode != ThreadMode::Fiber)
+        {
+            fprintf(stderr, "FATAL: --record / --replay need --threads=fiber\n");
+            return 1;
+        }
+        if (!replay_open(replay, replay_path))
+            return 1;
+    }
 
     // Step 1: Allocate PPC memory space (4 GB committed)
     printf("[1/4] Allocating PPC memory space...\n");
@@ -106,6 +221,21 @@ int main(int argc, char* argv[])
         fprintf(stderr, "FATAL: Failed to allocate PPC memory\n");
         return 1;
     }
+    vm_region_init(base);
+    vm_region_map((uint32_t)PPC_MEM_IMAGE_BASE, (uint32_t)PPC_MEM_IMAGE_SIZE, X_PAGE_EXECUTE_READWRITE, X_MEM_TYPE_IMAGE);
+    vm_region_map(PPC_STACK_BASE - PPC_STACK_SIZE, PPC_STACK_SIZE, X_PAGE_READWRITE, X_MEM_TYPE_PRIVATE);
+    vm_region_map(PPC_THREAD_STACK_TOP - PPC_THREAD_STACK_AREA, PPC_THREAD_STACK_AREA, X_PAGE_READWRITE, X_MEM_TYPE_PRIVATE);
+    vm_region_map(PPC_KPCR_BASE, PPC_KPCR_SIZE + PPC_KTHREAD_SIZE, X_PAGE_READWRITE, X_MEM_TYPE_PRIVATE);
+    heap_init(base);
+    pool_init(base);
+    file_io_init(io_workers);
+    bool packed = pack_path && path_index_mount_pack("game:", pack_path);
+    if (pack_path && !packed)
+        fprintf(stderr, "WARNING: could not mount asset pack '%s', using extracted/\n", pack_path);
+    if (!packed && !path_index_mount("game:", "extracted"))
+        fprintf(stderr, "WARNING: game: has no extracted/ directory to index\n");
+    if (pool_trace_path && !pool_open_trace(pool_trace_path))
+        fprintf(stderr, "WARNING: could not open pool trace '%s'\n", pool_trace_path);
 
     // Step 2: Load PE data sections into memory
     printf("\n[2/4] Loading PE data sections...\n");
@@ -120,6 +250,7 @@ int main(int argc, char* argv[])
 
     // Step 4: Create Win32 window
     printf("\n[4/5] Creating window...\n");
+#ifdef _WIN32
     {
         WNDCLASSEXA wc = {};
         wc.cbSize = sizeof(wc);
@@ -152,6 +283,9 @@ int main(int argc, char* argv[])
         UpdateWindow(g_hwnd);
         printf("  Window created: 1280x720\n");
     }
+#else
+    printf("  No window on this platform (headless)\n");
+#endif
 
     // Step 5: Initialize PPC context and launch
     printf("\n[5/5] Initializing PPC context...\n");
@@ -181,23 +315,22 @@ int main(int argc, char* argv[])
 
     // Mask all floating-point exceptions
     {
+#ifdef _WIN32
         _controlfp(_MCW_EM, _MCW_EM);
+#endif
         unsigned int mxcsr = 0x1F80;
         _mm_setcsr(mxcsr);
         printf("  FP exceptions masked (x87 + SSE/MXCSR=0x%04X)\n", mxcsr);
     }
 
-    // Convert main thread to fiber for cooperative threading
-    extern LPVOID g_main_fiber;
-    g_main_fiber = ConvertThreadToFiber(nullptr);
-    if (!g_main_fiber)
+    // Set up the guest thread scheduler (converts the main thread to a fiber)
+    if (!scheduler_init(thread_mode, pool_workers))
     {
-        fprintf(stderr, "WARNING: ConvertThreadToFiber failed (error %lu), threads will not work\n",
-                GetLastError());
+        fprintf(stderr, "WARNING: fiber setup failed, threads will not work\n");
     }
     else
     {
-        printf("  Main thread converted to fiber\n");
+        printf("  Guest threads: %s mode\n", scheduler_mode_name(thread_mode));
     }
 
     printf("=== Launching _xstart ===\n");
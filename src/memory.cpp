@@ -46,6 +46,8 @@ uint8_t* ppc_memory_alloc()
         (unsigned long long)(PPC_MEM_IMAGE_BASE + PPC_MEM_IMAGE_SIZE));
     printf("  Stack:   0x%08X - 0x%08X\n",
         PPC_STACK_BASE - PPC_STACK_SIZE, PPC_STACK_BASE);
+    printf("  Threads: 0x%08X - 0x%08X\n",
+        PPC_THREAD_STACK_TOP - PPC_THREAD_STACK_AREA, PPC_THREAD_STACK_TOP);
     printf("  Heap:    0x%08X - 0x%08X\n",
         PPC_HEAP_BASE, PPC_HEAP_BASE + PPC_HEAP_SIZE);
 
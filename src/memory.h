@@ -17,6 +17,10 @@ constexpr uint32_t PPC_ENTRY_POINT = 0x8214DB50;
 constexpr uint32_t PPC_STACK_SIZE = 1 * 1024 * 1024;  // 1 MB stack
 constexpr uint32_t PPC_STACK_BASE = 0x90000000;         // Stack top (grows down)
 
+// Guest thread stacks (ExCreateThread), carved downward from the top
+constexpr uint32_t PPC_THREAD_STACK_TOP  = 0x8E000000;
+constexpr uint32_t PPC_THREAD_STACK_AREA = 0x06000000;  // 96 MB
+
 // Heap region for kernel stub allocations
 constexpr uint32_t PPC_HEAP_BASE = 0xA0000000;
 constexpr uint32_t PPC_HEAP_SIZE = 0x10000000;          // 256 MB
@@ -26,6 +30,7 @@ constexpr uint32_t PPC_KPCR_BASE    = 0x92000000;
 constexpr uint32_t PPC_KPCR_SIZE    = 0x1000;           // 4 KB
 constexpr uint32_t PPC_KTHREAD_BASE = 0x92001000;
 constexpr uint32_t PPC_KTHREAD_SIZE = 0x1000;           // 4 KB
+constexpr uint32_t PPC_KTHREAD_TLS_OFFSET = 0x800;      // KeTls* slot values (u32 each, ours)
 
 // Function lookup table
 constexpr uint64_t PPC_FUNC_TABLE_OFFSET = PPC_MEM_IMAGE_BASE + PPC_MEM_IMAGE_SIZE;
@@ -0,0 +1,146 @@
+#include "object_table.h"
+
+#include <atomic>
+#include <mutex>
+
+// Slot state word: generation (10 bits) << 32 | type << 24 | references.
+// Free slots keep the generation their next handle will carry.
+static constexpr int      OB_SLOT_SHIFT = 2;
+static constexpr int      OB_GEN_SHIFT  = 14;
+static constexpr uint32_t OB_GEN_MAX    = 1023;
+static constexpr uint64_t OB_REFS_MASK  = 0xFFFFFF;
+
+struct ObSlot
+{
+    std::atomic<uint64_t> state;
+    void* object;     // written before the state is published
+    ObDestroy destroy;
+};
+
+static ObSlot g_slots[OB_MAX_HANDLES];
+static std::atomic<int> g_live{0};
+
+static std::mutex g_free_lock; // the free list
+static uint16_t g_free[OB_MAX_HANDLES]; // ring, oldest first
+static int g_free_head = 0;
+static int g_free_count = 0;
+static int g_never_used = 0; // slots from here up haven't been handed out
+
+static uint32_t state_gen(uint64_t s)  { return (uint32_t)(s >> 32); }
+static ObType   state_type(uint64_t s) { return (ObType)((s >> 24) & 0xFF); }
+static uint32_t state_refs(uint64_t s) { return (uint32_t)(s & OB_REFS_MASK); }
+
+// Slot of a well-formed handle, or nullptr
+static ObSlot* handle_slot(uint32_t handle, uint32_t* gen)
+{
+    if (handle & ((1u << OB_SLOT_SHIFT) - 1))
+        return nullptr;
+    *gen = handle >> OB_GEN_SHIFT;
+    if (*gen == 0 || *gen > OB_GEN_MAX)
+        return nullptr;
+    return &g_slots[(handle >> OB_SLOT_SHIFT) & (OB_MAX_HANDLES - 1)];
+}
+
+uint32_t ob_create(ObType type, void* object, ObDestroy destroy)
+{
+    int index;
+    {
+        std::lock_guard<std::mutex> lock(g_free_lock);
+        // Every slot is used once before any is reused, so a freed handle
+        // comes back only after all the others have turned over
+        if (g_never_used < OB_MAX_HANDLES)
+        {
+            index = g_never_used++;
+        }
+        else if (g_free_count)
+        {
+            index = g_free[g_free_head];
+            g_free_head = (g_free_head + 1) % OB_MAX_HANDLES;
+            g_free_count--;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    ObSlot& slot = g_slots[index];
+    uint32_t gen = state_gen(slot.state.load(std::memory_order_relaxed));
+    if (gen == 0)
+        gen = 1;
+    slot.object = object;
+    slot.destroy = destroy;
+    slot.state.store((uint64_t)gen << 32 | (uint64_t)type << 24 | 1, std::memory_order_release);
+    g_live.fetch_add(1, std::memory_order_relaxed);
+    return gen << OB_GEN_SHIFT | (uint32_t)index << OB_SLOT_SHIFT;
+}
+
+bool ob_reference(uint32_t handle, ObType type, void** object)
+{
+    uint32_t gen;
+    ObSlot* slot = handle_slot(handle, &gen);
+    if (!slot)
+        return false;
+    uint64_t s = slot->state.load(std::memory_order_acquire);
+    do
+    {
+        if (state_gen(s) != gen || state_type(s) == OB_TYPE_NONE || state_refs(s) == 0)
+            return false;
+        if (type != OB_TYPE_NONE && state_type(s) != type)
+            return false;
+        if (state_refs(s) == OB_REFS_MASK)
+            return false;
+    } while (!slot->state.compare_exchange_weak(s, s + 1, std::memory_order_acquire));
+    if (object)
+        *object = slot->object;
+    return true;
+}
+
+bool ob_dereference(uint32_t handle)
+{
+    uint32_t gen;
+    ObSlot* slot = handle_slot(handle, &gen);
+    if (!slot)
+        return false;
+    uint64_t s = slot->state.load(std::memory_order_acquire);
+    uint64_t next;
+    do
+    {
+        if (state_gen(s) != gen || state_type(s) == OB_TYPE_NONE || state_refs(s) == 0)
+            return false;
+        // The last reference retires the handle: the slot is free under
+        // the next generation, but stays off the free list until destroyed
+        next = state_refs(s) > 1 ? s - 1 : (uint64_t)(gen % OB_GEN_MAX + 1) << 32;
+    } while (!slot->state.compare_exchange_weak(s, next, std::memory_order_acq_rel));
+    if (state_refs(s) > 1)
+        return true;
+
+    void* object = slot->object;
+    ObDestroy destroy = slot->destroy;
+    slot->object = nullptr;
+    slot->destroy = nullptr;
+    g_live.fetch_sub(1, std::memory_order_relaxed);
+    if (destroy)
+        destroy(object, handle);
+
+    std::lock_guard<std::mutex> lock(g_free_lock);
+    g_free[(g_free_head + g_free_count) % OB_MAX_HANDLES] = (uint16_t)(slot - g_slots);
+    g_free_count++;
+    return true;
+}
+
+ObType ob_type_of(uint32_t handle)
+{
+    uint32_t gen;
+    ObSlot* slot = handle_slot(handle, &gen);
+    if (!slot)
+        return OB_TYPE_NONE;
+    uint64_t s = slot->state.load(std::memory_order_acquire);
+    if (state_gen(s) != gen || state_refs(s) == 0)
+        return OB_TYPE_NONE;
+    return state_type(s);
+}
+
+int ob_count()
+{
+    return g_live.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+// The handle table: every handle the kernel stubs give the guest (files and
+// directories, events, timers, threads, notification listeners) names a
+// slot here.
+//
+// A handle is (generation << 14) | (slot << 2). Freeing a slot bumps its
+// generation, so a stale handle from a closed object fails lookups instead
+// of reaching whatever reused the slot. Values stay below 0x01000000
+// (KOBJ_MIN_GUEST_ADDR), apart from guest addresses, and are never 0 or
+// the pseudo-handles 0xFFFFFFFE / 0xFFFFFFFF.
+//
+// Slots are reference counted. ob_create returns the handle holding one
+// reference, which NtClose drops; ObReferenceObject* and in-flight I/O take
+// more. The object's destroy callback runs when the last one goes, on
+// whichever thread drops it. ob_reference / ob_dereference never lock: the
+// generation, type and count share one atomic word. Only creating and
+// freeing take the free list lock; free slots are reused oldest first.
+
+enum ObType : uint8_t
+{
+    OB_TYPE_NONE = 0, // any type, for lookups
+    OB_TYPE_FILE,     // files and directories
+    OB_TYPE_EVENT,
+    OB_TYPE_TIMER,
+    OB_TYPE_THREAD,
+    OB_TYPE_NOTIFY,   // XamNotifyCreateListener
+};
+
+constexpr int OB_MAX_HANDLES = 4096;
+
+// Called with the object and its (now dead) handle.
+typedef void (*ObDestroy)(void* object, uint32_t handle);
+
+// New handle for `object`, holding one reference. Returns 0 if the table is
+// full.
+uint32_t ob_create(ObType type, void* object, ObDestroy destroy);
+
+// Take a reference if `handle` is live and of `type` (OB_TYPE_NONE = any).
+// `object` (optional) receives the pointer given to ob_create.
+bool ob_reference(uint32_t handle, ObType type = OB_TYPE_NONE, void** object = nullptr);
+
+// Drop a reference; the last one destroys the object and frees the handle.
+// Returns false if `handle` isn't live.
+bool ob_dereference(uint32_t handle);
+
+// Type of a live handle, OB_TYPE_NONE otherwise.
+ObType ob_type_of(uint32_t handle);
+
+// Live handles, for the log.
+int ob_count();
@@ -0,0 +1,379 @@
+#include "path_index.h"
+#include "asset_pack.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+static constexpr size_t PATH_INDEX_MAX_KEY = 512;
+
+struct PathIndex
+{
+    std::string device;             // folded, e.g. "game:"
+    std::string host_root;
+    std::vector<PathEntry> entries; // [0] is the root; packs: in pack order
+    std::vector<std::string> keys;  // folded guest paths, by entry
+    std::vector<uint32_t> table;    // entry index + 1, 0 = empty; power of two
+};
+
+static std::mutex g_index_lock; // the index, and results until the next lookup
+static PathIndex g_index;
+static bool g_mounted = false;
+static uint32_t g_generation = 0; // builds so far
+static std::atomic<bool> g_stale{false};
+static int g_watch_fd = -1; // inotify, Linux only
+static std::atomic<bool> g_watching{false}; // every directory of the last build is watched
+static AssetPack g_pack;
+static bool g_packed = false; // g_index came from g_pack
+
+static char fold_char(char c)
+{
+    if (c == '\\')
+        return '/';
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static uint64_t hash_key(const char* key, size_t length)
+{
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (size_t i = 0; i < length; i++)
+        h = (h ^ (uint8_t)key[i]) * 1099511628211ull;
+    return h;
+}
+
+// Guest path to its key in `out`: past the device prefix, folded, single '/'
+// separators, none leading or trailing. Returns the key length, or -1 if the
+// path isn't on the device or is too long.
+static int fold_path(const char* path, size_t length, char* out)
+{
+    const std::string& device = g_index.device;
+    if (length < device.size())
+        return -1;
+    for (size_t i = 0; i < device.size(); i++)
+    {
+        if (fold_char(path[i]) != device[i])
+            return -1;
+    }
+    int n = 0;
+    for (size_t i = device.size(); i < length; i++)
+    {
+        char c = fold_char(path[i]);
+        if (c == '/' && (n == 0 || out[n - 1] == '/'))
+            continue;
+        if (n + 1 >= (int)PATH_INDEX_MAX_KEY)
+            return -1;
+        out[n++] = c;
+    }
+    while (n > 0 && out[n - 1] == '/')
+        n--;
+    out[n] = 0;
+    return n;
+}
+
+// ============================================================================
+// Build
+// ============================================================================
+
+static void table_insert(PathIndex& index, uint32_t entry)
+{
+    const std::string& key = index.keys[entry];
+    size_t mask = index.table.size() - 1;
+    for (size_t slot = hash_key(key.data(), key.size()) & mask;; slot = (slot + 1) & mask)
+    {
+        uint32_t other = index.table[slot];
+        if (!other)
+        {
+            index.table[slot] = entry + 1;
+            return;
+        }
+        if (index.keys[other - 1] == key)
+        {
+            // Names that differ only in case: the first one wins, as on the Xbox
+            fprintf(stderr, "[FILE] path index: %s hidden by %s\n", index.entries[entry].host_path.c_str(),
+                    index.entries[other - 1].host_path.c_str());
+            return;
+        }
+    }
+}
+
+// Add the children of directory entry `dir`, recursively
+static void walk(PathIndex& index, uint32_t dir)
+{
+    std::vector<PathEntry> found;
+    std::string dir_path = index.entries[dir].host_path;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE find = FindFirstFileA((dir_path + "/*").c_str(), &fd);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+            continue;
+        PathEntry e;
+        e.name = fd.cFileName;
+        e.host_path = dir_path + "/" + e.name;
+        e.size = ((int64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+        e.is_directory = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        found.push_back(std::move(e));
+    } while (FindNextFileA(find, &fd));
+    FindClose(find);
+#else
+    DIR* d = opendir(dir_path.c_str());
+    if (!d)
+    {
+        g_watching = false; // its contents aren't indexed either
+        return;
+    }
+    while (struct dirent* ent = readdir(d))
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        PathEntry e;
+        e.name = ent->d_name;
+        e.host_path = dir_path + "/" + e.name;
+        struct stat st;
+        if (stat(e.host_path.c_str(), &st) != 0)
+            continue;
+        e.size = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+        e.is_directory = S_ISDIR(st.st_mode);
+        found.push_back(std::move(e));
+    }
+    closedir(d);
+#endif
+#ifdef __linux__
+    // One unwatched directory (ENOSPC at max_user_watches, EACCES) and misses
+    // can't be trusted anywhere
+    if (g_watch_fd >= 0 &&
+        inotify_add_watch(g_watch_fd, dir_path.c_str(),
+                          IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                          IN_DELETE_SELF | IN_MOVE_SELF) < 0 &&
+        g_watching.exchange(false))
+        fprintf(stderr, "[FILE] path index: can't watch %s (%s), misses go to the host\n", dir_path.c_str(),
+                strerror(errno));
+#endif
+
+    std::string prefix = index.keys[dir].empty() ? "" : index.keys[dir] + "/";
+    for (PathEntry& e : found)
+    {
+        uint32_t idx = (uint32_t)index.entries.size();
+        std::string key = prefix;
+        for (char c : e.name)
+            key += fold_char(c);
+        index.entries[dir].children.push_back(idx);
+        index.keys.push_back(std::move(key));
+        index.entries.push_back(std::move(e));
+        if (index.entries[idx].is_directory)
+            walk(index, idx);
+    }
+}
+
+// Caller holds g_index_lock
+static void build()
+{
+    PathIndex& index = g_index;
+    index.entries.clear();
+    index.keys.clear();
+    index.entries.push_back({index.host_root, "", 0, true, {}});
+    index.keys.push_back("");
+    g_watching = g_watch_fd >= 0;
+    walk(index, 0);
+
+    size_t slots = 16;
+    while (slots < index.entries.size() * 2)
+        slots *= 2;
+    index.table.assign(slots, 0);
+    for (uint32_t i = 0; i < index.entries.size(); i++)
+        table_insert(index, i);
+    g_generation++;
+    fprintf(stderr, "[FILE] path index: %s -> %s, %zu entries\n", index.device.c_str(),
+            index.host_root.c_str(), index.entries.size());
+}
+
+// The pack's entries as they are, so entry i is pack entry i. Caller holds
+// g_index_lock.
+static void build_from_pack(const AssetPack& pack)
+{
+    PathIndex& index = g_index;
+    const AssetPackHeader& h = *pack.header;
+    index.entries.assign(h.entry_count, PathEntry{});
+    index.keys.clear();
+    index.table.clear();
+    for (uint32_t i = 0; i < h.entry_count; i++)
+    {
+        const AssetPackEntry& pe = pack.entries[i];
+        PathEntry& e = index.entries[i];
+        e.name.assign(pack.strings + pe.name_offset, pe.name_length);
+        e.is_directory = (pe.flags & ASSET_PACK_DIRECTORY) != 0;
+        e.size = e.is_directory ? 0 : (int64_t)pe.size;
+        if (e.is_directory)
+            e.children.assign(pack.children + pe.first_child, pack.children + pe.first_child + pe.child_count);
+        else
+            e.data = pack.base + pe.data_offset;
+    }
+
+    // Host paths name the file the pack was made from, under the pack:
+    // "game.pak/Data/x.bin". Only logs and read-ahead traces see them.
+    int64_t root = asset_pack_find(pack, "", 0);
+    if (root >= 0)
+    {
+        std::vector<uint32_t> pending = {(uint32_t)root};
+        index.entries[root].host_path = index.host_root;
+        while (!pending.empty())
+        {
+            uint32_t dir = pending.back();
+            pending.pop_back();
+            for (uint32_t child : index.entries[dir].children)
+            {
+                PathEntry& e = index.entries[child];
+                if (!e.host_path.empty())
+                    continue; // listed twice: a damaged pack
+                e.host_path = index.entries[dir].host_path + "/" + e.name;
+                if (e.is_directory)
+                    pending.push_back(child);
+            }
+        }
+    }
+    g_generation++;
+    fprintf(stderr, "[FILE] path index: %s -> pack %s, %zu entries\n", index.device.c_str(),
+            index.host_root.c_str(), index.entries.size());
+}
+
+#ifdef __linux__
+// Any change under the root marks the index stale; the next lookup rebuilds
+static void watch_thread(int fd)
+{
+    char buf[4096];
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        g_stale = true;
+    }
+}
+#endif
+
+// ============================================================================
+// API
+// ============================================================================
+
+bool path_index_mount(const char* device, const char* host_root)
+{
+#ifdef _WIN32
+    DWORD attrs = GetFileAttributesA(host_root);
+    if (attrs == INVALID_FILE_ATTRIBUTES || !(attrs & FILE_ATTRIBUTE_DIRECTORY))
+        return false;
+#else
+    struct stat st;
+    if (stat(host_root, &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+#endif
+    std::lock_guard<std::mutex> lock(g_index_lock);
+    g_index.device.clear();
+    for (const char* c = device; *c; c++)
+        g_index.device += fold_char(*c);
+    g_index.host_root = host_root;
+#ifdef __linux__
+    if (g_watch_fd < 0)
+    {
+        g_watch_fd = inotify_init1(IN_CLOEXEC);
+        if (g_watch_fd >= 0)
+            std::thread(watch_thread, g_watch_fd).detach();
+    }
+#endif
+    build();
+    g_packed = false;
+    g_mounted = true;
+    return true;
+}
+
+bool path_index_mount_pack(const char* device, const char* pack_path)
+{
+    AssetPack pack;
+    if (!asset_pack_open(pack_path, &pack))
+        return false;
+    std::lock_guard<std::mutex> lock(g_index_lock);
+    g_index.device.clear();
+    for (const char* c = device; *c; c++)
+        g_index.device += fold_char(*c);
+    g_index.host_root = pack_path;
+    // A pack mounted before stays mapped: files opened from it still read it
+    g_pack = pack;
+    build_from_pack(g_pack);
+    g_packed = true;
+    g_mounted = true;
+    return true;
+}
+
+const PathEntry* path_index_lookup(const char* guest_path, size_t length)
+{
+    std::lock_guard<std::mutex> lock(g_index_lock);
+    if (!g_mounted)
+        return nullptr;
+    char key[PATH_INDEX_MAX_KEY];
+    int n = fold_path(guest_path, length, key);
+    if (n < 0)
+        return nullptr;
+    if (g_packed)
+    {
+        int64_t entry = asset_pack_find(g_pack, key, n);
+        return entry < 0 ? nullptr : &g_index.entries[entry];
+    }
+    if (g_stale.exchange(false))
+        build();
+
+    const PathIndex& index = g_index;
+    size_t mask = index.table.size() - 1;
+    for (size_t slot = hash_key(key, n) & mask;; slot = (slot + 1) & mask)
+    {
+        uint32_t entry = index.table[slot];
+        if (!entry)
+            return nullptr;
+        const std::string& k = index.keys[entry - 1];
+        if (k.size() == (size_t)n && memcmp(k.data(), key, n) == 0)
+            return &index.entries[entry - 1];
+    }
+}
+
+const PathEntry* path_index_entry(uint32_t index)
+{
+    return index < g_index.entries.size() ? &g_index.entries[index] : nullptr;
+}
+
+bool path_index_covers(const char* guest_path, size_t length)
+{
+    std::lock_guard<std::mutex> lock(g_index_lock);
+    char key[PATH_INDEX_MAX_KEY];
+    return g_mounted && fold_path(guest_path, length, key) >= 0;
+}
+
+uint32_t path_index_generation()
+{
+    std::lock_guard<std::mutex> lock(g_index_lock);
+    return g_generation;
+}
+
+bool path_index_authoritative()
+{
+    return g_mounted && (g_packed || g_watching);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Case-insensitive index of the game: device, for NtOpenFile / NtCreateFile.
+//
+// The host directory behind the device is walked once at mount time. Every
+// file and directory goes into an open-addressing hash table keyed by its
+// guest path relative to the device, case folded, with '/' separators and no
+// leading or trailing separator ("" is the root). An entry holds the host
+// path, the size, whether it's a directory and its children. Resolving a
+// guest path then needs no allocation and no syscalls: the name is folded
+// into a stack buffer and hashed, and only the final open touches the host.
+// Lookups ignore case as the Xbox does, on case-sensitive hosts too.
+//
+// On Linux an inotify watch on every directory marks the index stale when
+// anything under it changes; the next lookup rebuilds it. Without a watcher
+// (other hosts, or a directory the watch couldn't be added to) a miss isn't
+// trusted and callers fall back to the host.
+//
+// The device can be an asset pack instead (asset_pack.h, --pack=path). Its
+// table of contents is the index: lookups binary search it, entries point
+// at their payloads in the mapping, and nothing is watched or rebuilt.
+
+struct PathEntry
+{
+    std::string host_path;
+    std::string name;              // as on the host
+    int64_t size;
+    bool is_directory;
+    std::vector<uint32_t> children; // directories: entry indices, in host order
+    const uint8_t* data = nullptr;  // packed files: the contents, `size` bytes
+};
+
+// Index `host_root` as `device` ("game:"). Returns false if it isn't a
+// directory.
+bool path_index_mount(const char* device, const char* host_root);
+
+// Serve `device` from the asset pack at `pack_path` instead. Returns false
+// if it can't be mapped or isn't a pack. The pack stays mapped for the rest
+// of the run.
+bool path_index_mount_pack(const char* device, const char* pack_path);
+
+// Resolve a guest path ("game:\\Data\\x.bin", any case, either separator).
+// Returns nullptr if the path isn't on the device or doesn't exist. The entry
+// stays valid until the next lookup; the file stubs serialize them.
+const PathEntry* path_index_lookup(const char* guest_path, size_t length);
+
+// Entry by index (PathEntry::children), valid like a lookup result.
+const PathEntry* path_index_entry(uint32_t index);
+
+// True if `guest_path` is on the mounted device.
+bool path_index_covers(const char* guest_path, size_t length);
+
+// Changes whenever the index is rebuilt, so callers can drop anything they
+// derived from its entries.
+uint32_t path_index_generation();
+
+// True if a miss means the path doesn't exist (the index is being watched).
+bool path_index_authoritative();
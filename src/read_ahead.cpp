@@ -0,0 +1,300 @@
+#include "read_ahead.h"
+#include "host_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+struct ReadRange
+{
+    std::string path;
+    int64_t offset;
+    uint32_t length;
+};
+
+struct ActiveSequence
+{
+    bool active;
+    std::string first;
+    std::vector<ReadRange> ranges;
+    size_t prefetched; // ranges handed to the prefetch thread, 0 if unknown
+    uint64_t reads;
+    uint64_t bytes;
+    double stall_us;
+    Clock::time_point start;
+    Clock::time_point last; // last open or read
+};
+
+static std::atomic<bool> g_ra_enabled{false};
+static bool g_ra_prefetch = true;
+static std::mutex g_ra_lock; // everything below
+static std::string g_ra_path;
+static std::map<std::string, std::vector<ReadRange>> g_ra_traces; // by first path
+static ActiveSequence g_ra_seq;
+
+// Prefetch thread queue: the ranges of the sequence being predicted
+static std::mutex g_pf_lock;
+// Never destroyed: the prefetch thread is still waiting on it at exit
+static std::condition_variable& g_pf_cv = *new std::condition_variable;
+static std::vector<ReadRange> g_pf_queue;
+static size_t g_pf_next = 0;
+static uint32_t g_pf_generation = 0;
+static bool g_pf_started = false;
+
+// ============================================================================
+// Trace file
+// ============================================================================
+
+static void load_traces(FILE* fp)
+{
+    char line[1024];
+    std::vector<ReadRange>* ranges = nullptr;
+    while (fgets(line, sizeof(line), fp))
+    {
+        size_t len = strlen(line);
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = 0;
+        long long offset;
+        unsigned int length;
+        int consumed = 0;
+        if (line[0] == 'S' && line[1] == ' ')
+        {
+            ranges = &g_ra_traces[line + 2];
+            ranges->clear();
+        }
+        else if (ranges && sscanf(line, "R %lld %u %n", &offset, &length, &consumed) == 2 && consumed)
+        {
+            ranges->push_back({line + consumed, offset, length});
+        }
+    }
+}
+
+// Caller holds g_ra_lock
+static void save_traces()
+{
+    FILE* fp = fopen(g_ra_path.c_str(), "w");
+    if (!fp)
+        return;
+    for (auto& [first, ranges] : g_ra_traces)
+    {
+        fprintf(fp, "S %s\n", first.c_str());
+        for (const ReadRange& r : ranges)
+            fprintf(fp, "R %lld %u %s\n", (long long)r.offset, r.length, r.path.c_str());
+    }
+    fclose(fp);
+}
+
+// ============================================================================
+// Prefetch thread
+// ============================================================================
+
+static void prefetch_range(HostFile* file, const ReadRange& r)
+{
+#ifdef __linux__
+    posix_fadvise(file->fd, r.offset, r.length, POSIX_FADV_WILLNEED);
+#else
+    // No page cache hint to give: read it once so the guest's read hits the cache
+    static std::vector<uint8_t> scratch(1 << 20);
+    for (uint32_t done = 0; done < r.length;)
+    {
+        uint32_t n = std::min<uint32_t>(r.length - done, (uint32_t)scratch.size());
+        if (host_file_read(file, scratch.data(), n, r.offset + done) <= 0)
+            break;
+        done += n;
+    }
+#endif
+}
+
+static void prefetch_thread()
+{
+    std::unordered_map<std::string, HostFile> files; // of the current generation
+    uint32_t generation = 0;
+    std::unique_lock<std::mutex> lock(g_pf_lock);
+    for (;;)
+    {
+        g_pf_cv.wait(lock, [] { return g_pf_next < g_pf_queue.size(); });
+        ReadRange r = g_pf_queue[g_pf_next++];
+        bool new_sequence = generation != g_pf_generation;
+        generation = g_pf_generation;
+        lock.unlock();
+
+        if (new_sequence)
+        {
+            for (auto& [path, file] : files)
+                host_file_close(&file);
+            files.clear();
+        }
+        auto it = files.find(r.path);
+        if (it == files.end())
+        {
+            HostFile file;
+            if (!host_file_open(r.path.c_str(), &file))
+                file = HostFile{};
+            it = files.emplace(r.path, file).first;
+        }
+        if (it->second.size)
+            prefetch_range(&it->second, r);
+
+        lock.lock();
+    }
+}
+
+// Caller holds g_ra_lock
+static void prefetch_start(const std::vector<ReadRange>& ranges)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_pf_lock);
+        g_pf_queue = ranges;
+        g_pf_next = 0;
+        g_pf_generation++;
+        if (!g_pf_started)
+        {
+            g_pf_started = true;
+            std::thread(prefetch_thread).detach();
+        }
+    }
+    g_pf_cv.notify_one();
+}
+
+// ============================================================================
+// Sequences
+// ============================================================================
+
+// Caller holds g_ra_lock
+static void sequence_end()
+{
+    ActiveSequence& seq = g_ra_seq;
+    if (!seq.active)
+        return;
+    seq.active = false;
+    double span_ms = std::chrono::duration<double, std::milli>(seq.last - seq.start).count();
+    fprintf(stderr, "[FILE] read-ahead: sequence from %s: %llu reads, %.1f MB in %zu ranges, "
+                    "%.2f ms stalled over %.0f ms, %s\n",
+            seq.first.c_str(), (unsigned long long)seq.reads, seq.bytes / (1024.0 * 1024.0),
+            seq.ranges.size(), seq.stall_us / 1000.0, span_ms,
+            seq.prefetched ? "prefetched" : g_ra_traces.count(seq.first) ? "known, not prefetched" : "new");
+    if (seq.ranges.empty())
+        return;
+    g_ra_traces[seq.first] = std::move(seq.ranges);
+    save_traces();
+}
+
+// Caller holds g_ra_lock
+static void sequence_begin(const char* first, Clock::time_point now)
+{
+    ActiveSequence& seq = g_ra_seq;
+    seq = ActiveSequence{};
+    seq.active = true;
+    seq.first = first;
+    seq.start = seq.last = now;
+    auto it = g_ra_traces.find(seq.first);
+    if (g_ra_prefetch && it != g_ra_traces.end() && !it->second.empty())
+    {
+        prefetch_start(it->second);
+        seq.prefetched = it->second.size();
+    }
+}
+
+// Caller holds g_ra_lock. Starts a sequence at `path` after an idle gap.
+static void sequence_touch(const char* path, Clock::time_point now)
+{
+    ActiveSequence& seq = g_ra_seq;
+    if (seq.active && now - seq.last > std::chrono::milliseconds(READ_AHEAD_IDLE_MS))
+        sequence_end();
+    if (!seq.active)
+        sequence_begin(path, now);
+    seq.last = now;
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+bool read_ahead_open(const char* path)
+{
+    std::lock_guard<std::mutex> lock(g_ra_lock);
+    g_ra_path = path;
+    if (FILE* fp = fopen(path, "r"))
+    {
+        load_traces(fp);
+        fclose(fp);
+        fprintf(stderr, "[FILE] read-ahead: %zu sequences in %s\n", g_ra_traces.size(), path);
+    }
+    FILE* fp = fopen(path, "a");
+    if (!fp)
+        return false;
+    fclose(fp);
+    g_ra_enabled = true;
+    return true;
+}
+
+void read_ahead_set_prefetch(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(g_ra_lock);
+    g_ra_prefetch = enabled;
+}
+
+void read_ahead_note_open(const char* host_path)
+{
+    if (!g_ra_enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(g_ra_lock);
+    sequence_touch(host_path, Clock::now());
+}
+
+void read_ahead_note_read(const char* host_path, int64_t offset, uint32_t length)
+{
+    if (!g_ra_enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(g_ra_lock);
+    sequence_touch(host_path, Clock::now());
+    ActiveSequence& seq = g_ra_seq;
+    seq.reads++;
+    seq.bytes += length;
+    if (!seq.ranges.empty())
+    {
+        // Sequential reads of one file become one range
+        ReadRange& prev = seq.ranges.back();
+        if (prev.path == host_path && prev.offset + prev.length == offset &&
+            (uint64_t)prev.length + length <= UINT32_MAX)
+        {
+            prev.length += length;
+            return;
+        }
+    }
+    if (seq.ranges.size() < READ_AHEAD_MAX_RANGES)
+        seq.ranges.push_back({host_path, offset, length});
+}
+
+void read_ahead_note_stall(double us)
+{
+    if (!g_ra_enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(g_ra_lock);
+    if (g_ra_seq.active)
+        g_ra_seq.stall_us += us;
+}
+
+void read_ahead_frame()
+{
+    if (!g_ra_enabled.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> lock(g_ra_lock);
+    if (g_ra_seq.active && Clock::now() - g_ra_seq.last > std::chrono::milliseconds(READ_AHEAD_IDLE_MS))
+        sequence_end();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// Trace-driven read-ahead for the game: file stubs (--read-ahead=path).
+//
+// Stage transitions open and read the same files in the same order every
+// run. File activity is split into sequences: one starts with the first open
+// after READ_AHEAD_IDLE_MS without any opens or reads, and ends at the next
+// such gap. Each sequence's reads are recorded as (host path, offset,
+// length), with back-to-back reads of a file merged, and the traces are
+// saved to the path keyed by the sequence's first file.
+//
+// When a later run opens the first file of a known sequence, a background
+// thread walks that sequence's recorded ranges and asks the kernel to read
+// them into the page cache (posix_fadvise WILLNEED; on Windows the ranges are
+// read into a scratch buffer), so the guest's own reads find them there.
+//
+// At the end of each sequence a [FILE] line gives its reads, bytes and the
+// time guest threads stalled on them (synchronous read time plus overlapped
+// read latency), and whether it was prefetched. Compare against a run with
+// --prefetch=off, which records but doesn't prefetch.
+//
+// Text format, one line each: "S <first path>" starts a sequence, then
+// "R <offset> <length> <path>" per range (decimal).
+
+constexpr uint32_t READ_AHEAD_IDLE_MS = 1500;
+constexpr uint32_t READ_AHEAD_MAX_RANGES = 8192; // per sequence
+
+// Load the traces in `path` (if it exists) and save new ones there. Returns
+// false if it can't be written.
+bool read_ahead_open(const char* path);
+
+// Record and report only (--prefetch=off).
+void read_ahead_set_prefetch(bool enabled);
+
+// NtOpenFile / NtCreateFile opened a regular file.
+void read_ahead_note_open(const char* host_path);
+
+// NtReadFile asked for `length` bytes at `offset`.
+void read_ahead_note_read(const char* host_path, int64_t offset, uint32_t length);
+
+// A guest thread waited `us` for a read (overlapped reads: their latency, once
+// they complete).
+void read_ahead_note_stall(double us);
+
+// End of a frame (VdSwap): ends a sequence that has gone idle.
+void read_ahead_frame();
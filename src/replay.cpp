@@ -0,0 +1,352 @@
+#include "replay.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// ============================================================================
+// Log records
+// ============================================================================
+
+static constexpr char REPLAY_MAGIC[8] = {'S', 'I', 'M', 'R', 'P', 'L', 'Y', '1'};
+
+enum ReplayTag : uint8_t
+{
+    TAG_EVENT = 1, // syncs since the previous event record, type, a, b
+    TAG_CLOCK,     // clock, zigzag delta
+    TAG_U32,       // value
+    TAG_BYTES,     // size, data
+    TAG_FRAME,     // syncs since the previous frame record
+};
+
+static const char* tag_name(int tag)
+{
+    switch (tag)
+    {
+    case TAG_EVENT: return "event";
+    case TAG_CLOCK: return "clock read";
+    case TAG_U32:   return "input value";
+    case TAG_BYTES: return "input bytes";
+    case TAG_FRAME: return "end of frame";
+    case EOF:       return "end of log";
+    default:        return "unknown record";
+    }
+}
+
+struct PostedEvent
+{
+    uint32_t type;
+    uint32_t a;
+    uint32_t b;
+};
+
+static ReplayMode g_mode = ReplayMode::Off;
+static FILE* g_log = nullptr;
+static ReplayHandler g_handlers[REPLAY_EVENT_COUNT];
+
+// Main thread only
+static thread_local bool t_main = false;
+static uint64_t g_syncs = 0;
+static uint64_t g_last_event_sync = 0;
+static uint64_t g_last_frame_sync = 0;
+static uint64_t g_frames = 0;
+static uint64_t g_records = 0;
+static uint64_t g_last_clock[REPLAY_CLOCK_COUNT];
+static std::chrono::steady_clock::time_point g_start;
+
+// Recording: events posted since the last sync point
+static std::mutex g_post_lock;
+static std::vector<PostedEvent> g_posted;
+static std::atomic<bool> g_posted_any{false};
+
+// Replaying: an event record read ahead of the sync point it belongs to
+static bool g_held = false;
+static uint64_t g_held_sync = 0;
+static PostedEvent g_held_event;
+
+static void put_varint(uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        putc((int)(v & 0x7F) | 0x80, g_log);
+        v >>= 7;
+    }
+    putc((int)v, g_log);
+}
+
+static void put_tag(ReplayTag tag)
+{
+    putc(tag, g_log);
+    g_records++;
+}
+
+// ============================================================================
+// Replay: reading and checking
+// ============================================================================
+
+[[noreturn]] static void replay_stop(int status)
+{
+    fflush(stdout);
+    fflush(stderr);
+    std::_Exit(status);
+}
+
+[[noreturn]] static void replay_end()
+{
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - g_start).count();
+    fprintf(stderr, "[REPLAY] End of log: %llu frames, %llu records in %.3f s (%.3f ms/frame)\n",
+            (unsigned long long)g_frames, (unsigned long long)g_records, secs,
+            g_frames ? secs * 1000.0 / g_frames : 0.0);
+    replay_stop(0);
+}
+
+[[noreturn]] static void replay_diverged(const char* wanted, int found)
+{
+    fprintf(stderr, "[REPLAY] Diverged at record %llu (frame %llu, sync point %llu): "
+                    "the guest wants %s, the log has %s\n",
+            (unsigned long long)g_records, (unsigned long long)g_frames, (unsigned long long)g_syncs,
+            wanted, tag_name(found));
+    replay_stop(1);
+}
+
+static uint64_t get_varint()
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int c = getc(g_log);
+        if (c == EOF)
+            replay_end();
+        v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            break;
+    }
+    return v;
+}
+
+// The next record must be `tag`; anything else means the run diverged
+static void expect_tag(ReplayTag tag)
+{
+    int c = g_held ? TAG_EVENT : getc(g_log);
+    if (c == EOF)
+        replay_end();
+    if (c != tag)
+        replay_diverged(tag_name(tag), c);
+    g_records++;
+}
+
+static int64_t zigzag_decode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint64_t zigzag_encode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static void apply_event(const PostedEvent& event)
+{
+    if (event.type < REPLAY_EVENT_COUNT && g_handlers[event.type])
+        g_handlers[event.type](event.a, event.b);
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+bool replay_open(ReplayMode mode, const char* path)
+{
+    if (mode == ReplayMode::Off)
+        return true;
+    g_log = fopen(path, mode == ReplayMode::Record ? "wb" : "rb");
+    if (!g_log)
+    {
+        fprintf(stderr, "[REPLAY] Can't open %s\n", path);
+        return false;
+    }
+    setvbuf(g_log, nullptr, _IOFBF, 1 << 20);
+    if (mode == ReplayMode::Record)
+    {
+        fwrite(REPLAY_MAGIC, 1, sizeof(REPLAY_MAGIC), g_log);
+    }
+    else
+    {
+        char magic[sizeof(REPLAY_MAGIC)];
+        if (fread(magic, 1, sizeof(magic), g_log) != sizeof(magic) ||
+            memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0)
+        {
+            fprintf(stderr, "[REPLAY] %s is not a replay log\n", path);
+            fclose(g_log);
+            g_log = nullptr;
+            return false;
+        }
+    }
+    g_mode = mode;
+    t_main = true;
+    g_start = std::chrono::steady_clock::now();
+    fprintf(stderr, "[REPLAY] %s %s\n", mode == ReplayMode::Record ? "Recording to" : "Replaying", path);
+    return true;
+}
+
+ReplayMode replay_mode()
+{
+    return g_mode;
+}
+
+void replay_set_handler(ReplayEvent event, ReplayHandler handler)
+{
+    g_handlers[event] = handler;
+}
+
+bool replay_post(ReplayEvent event, uint32_t a, uint32_t b)
+{
+    if (g_mode == ReplayMode::Off)
+        return false;
+    if (g_mode == ReplayMode::Replay)
+        return true;
+    {
+        std::lock_guard<std::mutex> lock(g_post_lock);
+        g_posted.push_back({(uint32_t)event, a, b});
+        g_posted_any = true;
+    }
+    scheduler_wake_main();
+    return true;
+}
+
+bool replay_pending()
+{
+    return g_posted_any.load();
+}
+
+void replay_sync()
+{
+    if (g_mode == ReplayMode::Off)
+        return;
+    g_syncs++;
+
+    if (g_mode == ReplayMode::Record)
+    {
+        if (!g_posted_any.load())
+            return;
+        std::vector<PostedEvent> events;
+        {
+            std::lock_guard<std::mutex> lock(g_post_lock);
+            events.swap(g_posted);
+            g_posted_any = false;
+        }
+        for (const PostedEvent& event : events)
+        {
+            put_tag(TAG_EVENT);
+            put_varint(g_syncs - g_last_event_sync);
+            put_varint(event.type);
+            put_varint(event.a);
+            put_varint(event.b);
+            g_last_event_sync = g_syncs;
+            apply_event(event);
+        }
+        return;
+    }
+
+    for (;;)
+    {
+        if (!g_held)
+        {
+            int c = getc(g_log);
+            if (c != TAG_EVENT)
+            {
+                if (c != EOF)
+                    ungetc(c, g_log);
+                return;
+            }
+            g_held_sync = g_last_event_sync + get_varint();
+            g_held_event.type = (uint32_t)get_varint();
+            g_held_event.a = (uint32_t)get_varint();
+            g_held_event.b = (uint32_t)get_varint();
+            g_held = true;
+        }
+        if (g_held_sync > g_syncs)
+            return;
+        if (g_held_sync < g_syncs)
+            replay_diverged("a sync point", TAG_EVENT);
+        g_held = false;
+        g_records++;
+        g_last_event_sync = g_held_sync;
+        apply_event(g_held_event);
+    }
+}
+
+uint64_t replay_clock(ReplayClock clock, uint64_t live)
+{
+    if (g_mode == ReplayMode::Off || !t_main)
+        return live;
+    if (g_mode == ReplayMode::Record)
+    {
+        put_tag(TAG_CLOCK);
+        put_varint(clock);
+        put_varint(zigzag_encode((int64_t)(live - g_last_clock[clock])));
+        g_last_clock[clock] = live;
+        return live;
+    }
+    expect_tag(TAG_CLOCK);
+    if (get_varint() != (uint64_t)clock)
+        replay_diverged(clock == REPLAY_CLOCK_NS ? "the scheduler clock" : "the timebase", TAG_CLOCK);
+    g_last_clock[clock] += (uint64_t)zigzag_decode(get_varint());
+    return g_last_clock[clock];
+}
+
+uint32_t replay_u32(uint32_t live)
+{
+    if (g_mode == ReplayMode::Off || !t_main)
+        return live;
+    if (g_mode == ReplayMode::Record)
+    {
+        put_tag(TAG_U32);
+        put_varint(live);
+        return live;
+    }
+    expect_tag(TAG_U32);
+    return (uint32_t)get_varint();
+}
+
+void replay_bytes(void* data, size_t size)
+{
+    if (g_mode == ReplayMode::Off || !t_main)
+        return;
+    if (g_mode == ReplayMode::Record)
+    {
+        put_tag(TAG_BYTES);
+        put_varint(size);
+        fwrite(data, 1, size, g_log);
+        return;
+    }
+    expect_tag(TAG_BYTES);
+    if (get_varint() != size)
+        replay_diverged("input bytes of another size", TAG_BYTES);
+    if (fread(data, 1, size, g_log) != size)
+        replay_end();
+}
+
+void replay_frame()
+{
+    if (g_mode == ReplayMode::Off)
+        return;
+    uint64_t syncs = g_syncs - g_last_frame_sync;
+    g_last_frame_sync = g_syncs;
+    g_frames++;
+    if (g_mode == ReplayMode::Record)
+    {
+        put_tag(TAG_FRAME);
+        put_varint(syncs);
+        fflush(g_log);
+        return;
+    }
+    expect_tag(TAG_FRAME);
+    if (get_varint() != syncs)
+        replay_diverged("an end of frame after another number of sync points", TAG_FRAME);
+}
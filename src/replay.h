@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Deterministic record / replay (--record=log, --replay=log), Fiber mode only.
+//
+// In Fiber mode all guest threads run on the main host thread, so where they
+// switch is decided by the guest itself, except for what other host threads
+// do to it: the timer thread firing park deadlines and kernel timers, the
+// GPU thread advancing the ring buffer read pointer, and the file I/O
+// workers completing overlapped reads. While recording or
+// replaying those threads post their work here instead of applying it, and
+// the main thread applies it at the next sync point (the start of each
+// scheduling round). That leaves the clock and outside inputs as the only
+// other ways a run can differ, so those are logged too.
+//
+// The log holds, in the order the main thread consumed them: the posted
+// events each sync point applied, every guest-visible clock read, every
+// outside input (XNetRandom, controller state) and a marker per frame.
+// Replaying feeds them back in the same order and drops the live events, so
+// the guest sees the same run. Any mismatch between what the guest asks for
+// and what the log holds next is reported as a divergence and stops the
+// replay; so does the end of the log, with the time the replay took.
+//
+// Format: "SIMRPLY1", then records of one tag byte and LEB128 fields. Clock
+// values are stored as zigzag deltas from the previous read of that clock.
+
+enum class ReplayMode
+{
+    Off,
+    Record,
+    Replay,
+};
+
+enum ReplayClock
+{
+    REPLAY_CLOCK_NS,       // scheduler_now_ns: wait and delay deadlines
+    REPLAY_CLOCK_TIMEBASE, // mftb
+    REPLAY_CLOCK_COUNT,
+};
+
+// Work another host thread hands to the main thread, with two arguments
+enum ReplayEvent
+{
+    REPLAY_EVENT_PARK_TIMER, // thread slot, park sequence
+    REPLAY_EVENT_KTIMER,     // timer key, sequence
+    REPLAY_EVENT_GPU_RPTR,   // read pointer
+    REPLAY_EVENT_FILE_READ,  // overlapped NtReadFile id
+    REPLAY_EVENT_COUNT,
+};
+
+typedef void (*ReplayHandler)(uint32_t a, uint32_t b);
+
+// Call on the main thread before scheduler_init. Returns false if the log
+// can't be created, or can't be read as one.
+bool replay_open(ReplayMode mode, const char* path);
+
+ReplayMode replay_mode();
+
+// The owner of each event type applies it
+void replay_set_handler(ReplayEvent event, ReplayHandler handler);
+
+// Any host thread. Returns false when neither recording nor replaying (the
+// caller applies the event itself); otherwise the event is queued for the
+// next sync point (recording) or dropped (replaying, the log has it).
+bool replay_post(ReplayEvent event, uint32_t a, uint32_t b);
+
+// Events are queued for the next sync point
+bool replay_pending();
+
+// Sync point (main thread): apply the events due here.
+void replay_sync();
+
+// Guest-visible inputs. Recording logs the live value, replaying returns the
+// logged one instead. Reads from other host threads aren't logged.
+uint64_t replay_clock(ReplayClock clock, uint64_t live);
+uint32_t replay_u32(uint32_t live);
+void replay_bytes(void* data, size_t size);
+
+// End of a frame (VdSwap). Recording flushes the log here.
+void replay_frame();
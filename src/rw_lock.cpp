@@ -0,0 +1,169 @@
+#include "ppc_config.h"
+#include "ppc_context.h"
+#include "rw_lock.h"
+#include "guest_atomic.h"
+#include "kernel_objects.h"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+// ============================================================================
+// Guest layout and state word
+// ============================================================================
+
+static constexpr uint32_t RW_STATE        = 0x00;
+static constexpr uint32_t RW_WRITER_EVENT = 0x10;
+static constexpr uint32_t RW_READER_SEM   = 0x20;
+static constexpr uint32_t RW_SPIN_LOCK    = 0x34;
+
+static constexpr uint8_t RW_EVENT_TYPE     = 1; // synchronization event
+static constexpr uint8_t RW_SEMAPHORE_TYPE = 5;
+
+// Active readers, readers waiting, writers waiting, writer holding
+static constexpr uint32_t RW_READER         = 1u << 0;
+static constexpr uint32_t RW_READERS_MASK   = 0xFFFu << 0;
+static constexpr uint32_t RW_READER_WAITING = 1u << 12;
+static constexpr uint32_t RW_READERS_WAITING_MASK = 0x3FFu << 12;
+static constexpr int      RW_READERS_WAITING_SHIFT = 12;
+static constexpr uint32_t RW_WRITER_WAITING = 1u << 22;
+static constexpr uint32_t RW_WRITERS_WAITING_MASK = 0x1FFu << 22;
+static constexpr uint32_t RW_WRITER         = 1u << 31;
+
+static std::mutex g_rw_init_lock;
+
+static void rw_write_objects(uint8_t* base, uint32_t lock)
+{
+    uint32_t event = lock + RW_WRITER_EVENT;
+    PPC_STORE_U32(event + 4, 0);
+    PPC_STORE_U32(event + 8, event + 8);
+    PPC_STORE_U32(event + 0xC, event + 8);
+    base[event] = RW_EVENT_TYPE;
+    kobj_create_event(event, false, false);
+
+    uint32_t sem = lock + RW_READER_SEM;
+    PPC_STORE_U32(sem + 8, sem + 8);
+    PPC_STORE_U32(sem + 0xC, sem + 8);
+    PPC_STORE_U32(sem + 0x10, 0x7FFFFFFF); // limit
+    kobj_init_semaphore(base, sem, 0, 0x7FFFFFFF);
+    // Last: marks the objects as set up
+    std::atomic_ref<uint8_t>(base[sem]).store(RW_SEMAPHORE_TYPE, std::memory_order_release);
+}
+
+// Before the first wait or wake on a lock that may never have been initialized
+static void rw_ensure_objects(uint8_t* base, uint32_t lock)
+{
+    if (std::atomic_ref<uint8_t>(base[lock + RW_READER_SEM]).load(std::memory_order_acquire) == RW_SEMAPHORE_TYPE)
+        return;
+    std::lock_guard<std::mutex> guard(g_rw_init_lock);
+    if (base[lock + RW_READER_SEM] != RW_SEMAPHORE_TYPE)
+        rw_write_objects(base, lock);
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+void rw_init(uint8_t* base, uint32_t lock)
+{
+    std::lock_guard<std::mutex> guard(g_rw_init_lock);
+    PPC_STORE_U32(lock + RW_STATE, 0);
+    PPC_STORE_U32(lock + 0x04, 0);
+    PPC_STORE_U32(lock + 0x08, 0);
+    PPC_STORE_U32(lock + 0x0C, 0);
+    PPC_STORE_U32(lock + RW_SPIN_LOCK, 0);
+    rw_write_objects(base, lock);
+}
+
+void rw_acquire_shared(uint8_t* base, uint32_t lock)
+{
+    uint32_t state = 0; // guess free: the first CAS is the only atomic then
+    for (;;)
+    {
+        if (!(state & (RW_WRITER | RW_WRITERS_WAITING_MASK)))
+        {
+            if (guest_atomic_cas(base, lock + RW_STATE, state, state + RW_READER))
+                return;
+        }
+        else if (guest_atomic_cas(base, lock + RW_STATE, state, state + RW_READER_WAITING))
+        {
+            // The release that wakes us has already counted us as a reader
+            rw_ensure_objects(base, lock);
+            uint32_t key = lock + RW_READER_SEM;
+            kobj_wait(base, &key, 1, false, nullptr);
+            return;
+        }
+    }
+}
+
+void rw_acquire_exclusive(uint8_t* base, uint32_t lock)
+{
+    uint32_t state = 0;
+    for (;;)
+    {
+        if (!(state & (RW_WRITER | RW_READERS_MASK)))
+        {
+            if (guest_atomic_cas(base, lock + RW_STATE, state, state | RW_WRITER))
+                return;
+        }
+        else if (guest_atomic_cas(base, lock + RW_STATE, state, state + RW_WRITER_WAITING))
+        {
+            // The release that wakes us has already set the writer bit for us
+            rw_ensure_objects(base, lock);
+            uint32_t key = lock + RW_WRITER_EVENT;
+            kobj_wait(base, &key, 1, false, nullptr);
+            return;
+        }
+    }
+}
+
+void rw_release(uint8_t* base, uint32_t lock)
+{
+    uint32_t state = guest_atomic_load(base, lock + RW_STATE);
+    uint32_t next;
+    uint32_t wake_readers;
+    bool wake_writer;
+    do
+    {
+        wake_readers = 0;
+        wake_writer = false;
+        if (state & RW_WRITER)
+        {
+            next = state & ~RW_WRITER;
+            uint32_t waiting = (next & RW_READERS_WAITING_MASK) >> RW_READERS_WAITING_SHIFT;
+            if (waiting)
+            {
+                next = (next & ~RW_READERS_WAITING_MASK) + waiting * RW_READER;
+                wake_readers = waiting;
+            }
+            else if (next & RW_WRITERS_WAITING_MASK)
+            {
+                next = next - RW_WRITER_WAITING + RW_WRITER;
+                wake_writer = true;
+            }
+        }
+        else
+        {
+            if (!(state & RW_READERS_MASK))
+            {
+                static std::atomic<bool> logged{false};
+                if (!logged.exchange(true))
+                    fprintf(stderr, "[LOCK] Release of read/write lock 0x%08X that isn't held (ignored)\n", lock);
+                return;
+            }
+            next = state - RW_READER;
+            if (!(next & RW_READERS_MASK) && (next & RW_WRITERS_WAITING_MASK))
+            {
+                next = next - RW_WRITER_WAITING + RW_WRITER;
+                wake_writer = true;
+            }
+        }
+    } while (!guest_atomic_cas(base, lock + RW_STATE, state, next));
+
+    if (wake_readers || wake_writer)
+        rw_ensure_objects(base, lock);
+    if (wake_readers)
+        kobj_release_semaphore(base, lock + RW_READER_SEM, (int32_t)wake_readers);
+    if (wake_writer)
+        kobj_set_event(base, lock + RW_WRITER_EVENT);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+// EX_READ_WRITE_LOCK (ExInitializeReadWriteLock and friends), in guest
+// memory:
+//
+//   +0x00  LockCount      the whole lock state, see below
+//   +0x04  WritersWaitingCount, +0x08 ReadersWaitingCount,
+//          +0x0C ReadersEntryCount (not maintained)
+//   +0x10  KEVENT         writers park here (synchronization event)
+//   +0x20  KSEMAPHORE     readers park here
+//   +0x34  SpinLock       unused
+//
+// The state word packs active readers, a writer bit, and the number of
+// waiting readers and writers, so every transition is one CAS on it: an
+// uncontended shared or exclusive acquire is a single atomic, and a release
+// without waiters is one more. 0 = free.
+//
+// Writer-preferring: a reader that arrives while a writer holds the lock or
+// waits for it queues behind them. A release that lets waiters in grants
+// them the lock in the same CAS and then wakes them (the semaphore released
+// once per admitted reader, the event set for one writer), so they never
+// retry or spin. The last reader out admits a writer; a writer's release
+// admits all the readers that queued up behind it if there are any, and the
+// next writer otherwise, so a stream of writers can't starve readers.
+//
+// A lock that was never initialized (zeroed) is free; its event and
+// semaphore are set up the first time someone has to wait.
+
+void rw_init(uint8_t* base, uint32_t lock);
+void rw_acquire_shared(uint8_t* base, uint32_t lock);
+void rw_acquire_exclusive(uint8_t* base, uint32_t lock);
+
+// Releases whichever kind of hold the lock is in.
+void rw_release(uint8_t* base, uint32_t lock);
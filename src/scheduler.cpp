@@ -0,0 +1,1519 @@
+#include "ppc_config.h"
+#include "ppc_context.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "kernel_objects.h"
+#include "fiber.h"
+#include "timer_wheel.h"
+#include "critical_section.h"
+#include "replay.h"
+#include "apc.h"
+#include "guest_heap.h"
+#include "guest_pool.h"
+#include "file_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+// ============================================================================
+// Thread table
+// ============================================================================
+
+// What the scheduler does with a fiber once it has switched out
+enum SwitchAction
+{
+    SWITCH_YIELD, // ready again at once
+    SWITCH_PARK,  // not run until unparked or park_deadline passes
+    SWITCH_EXIT,  // finished, never runs again
+};
+
+// park_state: a wake that arrives before the thread has finished parking is
+// left as PARK_NOTIFIED, and the park then returns at once.
+enum ParkState
+{
+    PARK_EMPTY,    // running, no wake pending
+    PARK_NOTIFIED, // wake pending
+    PARK_PARKED,   // switched out, waiting for a wake (fibers only)
+};
+
+// PPC thread state — each thread has its own PPCContext and PPC stack
+struct GuestThread
+{
+    uint32_t handle;        // handle assigned to this thread
+    uint32_t start_routine; // PPC address
+    uint32_t start_context; // PPC address passed as r3
+    uint32_t api_startup;   // PPC address of ApiThreadStartup wrapper
+    bool     suspended;     // created in suspended state (Host: guarded by lock)
+    std::atomic<bool> finished; // thread function has returned
+    bool     started;       // fiber / host thread has been created
+    bool     in_use;        // slot holds a live thread (guarded by g_thread_table_lock)
+    uint32_t ppc_stack_top; // PPC stack address for this thread
+    int      idx;           // thread table slot, -1 for host threads' waiters
+    Fiber*   fiber;         // Fiber / Pool mode: host fiber
+    PPCContext ctx;         // thread's own PPC register state
+    uint8_t* base;          // shared PPC memory base
+    int32_t  priority;      // KeSetBasePriorityThread hint
+    uint32_t affinity;      // KeSetAffinityThread hint (hardware thread mask)
+    uint32_t tls[SCHEDULER_TLS_SLOTS]; // KeTls* values
+    uint32_t tls_mirror;    // guest address the values are mirrored to, 0 = none
+    uint32_t kthread;       // guest KTHREAD address, 0 = none
+
+    // Host threads wait on `cv` until resumed or unparked
+    std::mutex lock;
+    std::condition_variable cv;
+
+    // Parking (all modes)
+    std::atomic<int> park_state{PARK_EMPTY};
+    std::atomic<uint32_t> park_seq{0}; // tag of the current park_timer arming
+    int64_t  park_deadline; // steady_ns(), INT64_MAX = none
+    WheelTimer park_timer;  // fibers: unparks at park_deadline
+
+    // Fiber / Pool mode
+    int      switch_action; // SwitchAction
+    std::atomic<bool> ready{false}; // Fiber mode: gets a slice next round
+    int64_t  enqueue_ns;    // Pool mode: when it was put on a run queue
+
+    // Telemetry (see scheduler_telemetry): written by the thread itself
+    std::atomic<uint64_t> run_ns{0};
+    std::atomic<uint64_t> slices{0};
+    std::atomic<uint64_t> stops[SCHED_STOP_COUNT] = {};
+    std::atomic<uint64_t> blocked_ns{0};
+    std::atomic<int64_t> run_start{0}; // steady_ns() the current slice began, 0 = stopped
+    int64_t  stopped_at;
+    int      stop_reason;   // SchedStop
+    // Totals at the last frame report / CSV row (frame thread, under
+    // g_thread_table_lock)
+    ThreadTelemetry report_last;
+    ThreadTelemetry csv_last;
+};
+
+// Slots live in fixed-size chunks that are allocated as the table grows and
+// never moved or freed: waiters, timers and run queues hold GuestThread
+// pointers, and exit mustn't destroy the condition variables that parked host
+// threads are still waiting on. Finished threads' slots are reused.
+static constexpr int THREAD_CHUNK_SIZE = 16;
+static constexpr int THREAD_CHUNKS_MAX = 64;
+static std::atomic<GuestThread*> g_thread_chunks[THREAD_CHUNKS_MAX];
+static std::atomic<int> g_thread_slots{0};   // slots handed out so far
+static std::mutex g_thread_table_lock;       // slot allocation, handle lookups
+static std::vector<int> g_free_slots;        // released slots, reused LIFO
+static std::vector<GuestThread*> g_host_waiters; // see scheduler_current_waiter
+
+// Lifetime counters for the frame report
+static std::atomic<uint64_t> g_threads_created{0};
+static std::atomic<int> g_threads_live{0};
+static std::atomic<int> g_threads_peak{0};
+
+static GuestThread& thread_slot(int idx)
+{
+    return g_thread_chunks[idx / THREAD_CHUNK_SIZE].load(std::memory_order_acquire)[idx % THREAD_CHUNK_SIZE];
+}
+
+static ThreadMode g_mode = ThreadMode::Fiber;
+
+// Fiber globals
+Fiber* g_main_fiber = nullptr;          // main thread's fiber (set in scheduler_init)
+
+// Guest thread running on this host thread (nullptr = main). In Fiber and
+// Pool mode this is the fiber currently switched in.
+static thread_local GuestThread* t_current_thread = nullptr;
+
+// Waiter for a host thread that isn't a guest thread (main, GPU); never freed
+static thread_local GuestThread* t_host_waiter = nullptr;
+
+// In Pool mode a fiber can switch out on one worker and resume on another,
+// but the compiler may keep a thread_local's address across the switch
+// call. Code that runs on guest fibers reads thread_locals through these.
+static __attribute__((noinline)) GuestThread* current_thread()
+{
+    return t_current_thread;
+}
+
+// Slice accounting for the frame report. A wasted slice resumed a fiber in
+// a wait that still wasn't satisfied (kobj_wait reports those).
+static std::atomic<uint64_t> g_slices{0};
+static std::atomic<uint64_t> g_wasted_slices{0};
+
+// Initialize a thread's PPCContext from the creating thread's context
+static void init_thread_ctx(GuestThread& gt, PPCContext& parent)
+{
+    // The thread's own KPCR / KTHREAD sit right above its stack: the KPCR is
+    // a copy of the creator's, pointing at the fresh KTHREAD
+    uint8_t* base = gt.base;
+    uint32_t kpcr = gt.ppc_stack_top;
+    uint32_t kthread = kpcr + PPC_KPCR_SIZE;
+    if (parent.r13.u32)
+        memcpy(base + kpcr, base + parent.r13.u32, PPC_KPCR_SIZE);
+    else
+        memset(base + kpcr, 0, PPC_KPCR_SIZE);
+    memset(base + kthread, 0, PPC_KTHREAD_SIZE);
+    PPC_STORE_U32(kpcr + 0x100, kthread);
+    memset(gt.tls, 0, sizeof(gt.tls));
+    gt.kthread = kthread;
+    gt.tls_mirror = kthread + PPC_KTHREAD_TLS_OFFSET;
+
+    memset(&gt.ctx, 0, sizeof(PPCContext));
+    // Copy key registers from main context
+    gt.ctx.r13.u32 = kpcr;     // KPCR pointer
+    gt.ctx.r2 = parent.r2;     // TOC (unused but copy anyway)
+    gt.ctx.fpscr.csr = 0x1F80; // mask FP exceptions
+    // Set thread-specific registers
+    gt.ctx.r1.u32 = gt.ppc_stack_top - 16; // stack pointer with headroom
+    gt.ctx.r3.u32 = gt.start_context;       // first argument
+}
+
+static int64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================================
+// Telemetry
+// ============================================================================
+
+// Only the thread itself writes its counters: no read-modify-write needed
+static void counter_add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// A slice begins
+static void telemetry_run(GuestThread& gt)
+{
+    int64_t now = steady_ns();
+    if (gt.stopped_at && (gt.stop_reason == SCHED_STOP_DELAY || gt.stop_reason == SCHED_STOP_WAIT))
+        counter_add(gt.blocked_ns, (uint64_t)(now - gt.stopped_at));
+    gt.stopped_at = 0;
+    gt.run_start.store(now, std::memory_order_relaxed);
+    counter_add(gt.slices, 1);
+}
+
+// The slice ends
+static void telemetry_stop(GuestThread& gt, SchedStop reason)
+{
+    int64_t now = steady_ns();
+    int64_t start = gt.run_start.exchange(0, std::memory_order_relaxed);
+    if (start)
+        counter_add(gt.run_ns, (uint64_t)(now - start));
+    gt.stopped_at = now;
+    gt.stop_reason = reason;
+    counter_add(gt.stops[reason], 1);
+}
+
+static void telemetry_reset(GuestThread& gt)
+{
+    gt.run_ns = 0;
+    gt.slices = 0;
+    for (auto& stop : gt.stops)
+        stop = 0;
+    gt.blocked_ns = 0;
+    gt.run_start = 0;
+    gt.stopped_at = 0;
+    gt.report_last = {};
+    gt.csv_last = {};
+}
+
+static void telemetry_read(const GuestThread& gt, ThreadTelemetry& t)
+{
+    t.idx = gt.idx;
+    t.handle = gt.idx >= 0 ? gt.handle : 0;
+    t.main = false;
+    t.run_ns = gt.run_ns.load(std::memory_order_relaxed);
+    int64_t start = gt.run_start.load(std::memory_order_relaxed);
+    if (start)
+    {
+        int64_t running = steady_ns() - start;
+        if (running > 0)
+            t.run_ns += (uint64_t)running;
+    }
+    t.slices = gt.slices.load(std::memory_order_relaxed);
+    for (int i = 0; i < SCHED_STOP_COUNT; i++)
+        t.stops[i] = gt.stops[i].load(std::memory_order_relaxed);
+    t.blocked_ns = gt.blocked_ns.load(std::memory_order_relaxed);
+}
+
+// Counters since `last` (a new thread in a reused slot starts from zero)
+static ThreadTelemetry telemetry_delta(const ThreadTelemetry& now, const ThreadTelemetry& last)
+{
+    ThreadTelemetry d = now;
+    d.run_ns = now.run_ns > last.run_ns ? now.run_ns - last.run_ns : 0;
+    d.slices = now.slices - last.slices;
+    for (int i = 0; i < SCHED_STOP_COUNT; i++)
+        d.stops[i] = now.stops[i] - last.stops[i];
+    d.blocked_ns = now.blocked_ns - last.blocked_ns;
+    return d;
+}
+
+// The guest thread switches to fibers in Fiber / Pool mode
+static bool is_fiber_thread(const GuestThread& gt)
+{
+    return g_mode != ThreadMode::Host && gt.idx >= 0;
+}
+
+static Fiber* scheduler_fiber();
+
+// Thread objects are signaled when the thread ends
+static void thread_finish(GuestThread& gt)
+{
+    gt.finished = true;
+    apc_thread_exit(gt.base, gt.kthread);
+    kobj_signal_thread(gt.handle);
+}
+
+// Run the guest start routine on the current fiber / host thread
+static void run_guest_thread(GuestThread& gt)
+{
+    PPCContext& ctx = gt.ctx;
+    uint8_t* base = gt.base;
+    telemetry_run(gt);
+
+    uint32_t func_addr = gt.start_routine;
+    typedef void (*PPCFuncPtr)(PPCContext& __restrict, uint8_t*);
+    PPCFuncPtr fn = PPC_LOOKUP_FUNC(base, func_addr);
+    if (fn)
+    {
+        fprintf(stderr, "[THREAD] Thread %d starting: routine=0x%08X, context=0x%08X, r1=0x%08X\n",
+                gt.idx, func_addr, gt.start_context, ctx.r1.u32);
+        fn(ctx, base);
+        fprintf(stderr, "[THREAD] Thread %d returned normally\n", gt.idx);
+    }
+    else
+    {
+        fprintf(stderr, "[THREAD] Thread %d: no function at 0x%08X\n", gt.idx, func_addr);
+    }
+    thread_finish(gt);
+}
+
+// ============================================================================
+// Guest stacks and slot recycling
+// ============================================================================
+
+// PPC stacks for child threads, carved downward from PPC_THREAD_STACK_TOP.
+// Each stack sits above a no-access guard gap, so an overflow faults instead
+// of running into the next thread's stack, and below the thread's KPCR /
+// KTHREAD block. Stacks of finished threads go back on a free list and are
+// handed out again most recently freed first.
+static constexpr uint32_t THREAD_STACK_SIZE = 256 * 1024; // 256 KB per thread
+static constexpr uint32_t THREAD_STACK_GUARD = 64 * 1024; // below each stack
+static constexpr uint32_t THREAD_BLOCK_SIZE = PPC_KPCR_SIZE + PPC_KTHREAD_SIZE; // above it
+static constexpr uint32_t THREAD_STACK_SLOT = THREAD_STACK_GUARD + THREAD_STACK_SIZE + THREAD_BLOCK_SIZE;
+static_assert(PPC_THREAD_STACK_AREA / THREAD_STACK_SLOT <= THREAD_CHUNKS_MAX * THREAD_CHUNK_SIZE,
+              "thread table smaller than the stack area");
+
+static std::mutex g_stack_lock;
+static uint32_t g_stack_carved = 0;           // slots taken from the area so far
+static std::vector<uint32_t> g_free_stacks;   // tops of released stacks
+static std::atomic<uint64_t> g_stacks_reused{0};
+static std::atomic<uint32_t> g_stack_high_water{0}; // deepest use seen, bytes
+
+static void stack_protect_guard(uint8_t* base, uint32_t guard)
+{
+#ifdef _WIN32
+    DWORD old_protect;
+    if (!VirtualProtect(base + guard, THREAD_STACK_GUARD, PAGE_NOACCESS, &old_protect))
+#else
+    if (mprotect(base + guard, THREAD_STACK_GUARD, PROT_NONE) != 0)
+#endif
+        fprintf(stderr, "[THREAD] Failed to protect stack guard at 0x%08X\n", guard);
+}
+
+// Top of a free stack, or 0 if the stack area is exhausted. Stacks come back
+// zeroed, so stack_release can find how deep the last thread went.
+static uint32_t stack_acquire(uint8_t* base)
+{
+    std::lock_guard<std::mutex> lock(g_stack_lock);
+    if (!g_free_stacks.empty())
+    {
+        uint32_t top = g_free_stacks.back();
+        g_free_stacks.pop_back();
+        g_stacks_reused++;
+        return top;
+    }
+    if ((g_stack_carved + 1) * (uint64_t)THREAD_STACK_SLOT > PPC_THREAD_STACK_AREA)
+        return 0;
+    uint32_t slot_end = PPC_THREAD_STACK_TOP - g_stack_carved * THREAD_STACK_SLOT;
+    g_stack_carved++;
+    stack_protect_guard(base, slot_end - THREAD_STACK_SLOT);
+    return slot_end - THREAD_BLOCK_SIZE;
+}
+
+// Give a stack back. Returns how many bytes of it the thread used: the stack
+// is scanned up from its limit for the deepest nonzero word, and that much is
+// cleared again for the next thread.
+static uint32_t stack_release(uint8_t* base, uint32_t top)
+{
+    uint32_t limit = top - THREAD_STACK_SIZE;
+    const uint64_t* p = (const uint64_t*)(base + limit);
+    const uint64_t* end = (const uint64_t*)(base + top);
+    while (p < end && *p == 0)
+        p++;
+    uint32_t used = (uint32_t)((const uint8_t*)end - (const uint8_t*)p);
+    memset((void*)p, 0, used);
+
+    uint32_t max = g_stack_high_water.load(std::memory_order_relaxed);
+    while (used > max && !g_stack_high_water.compare_exchange_weak(max, used))
+        ;
+    std::lock_guard<std::mutex> lock(g_stack_lock);
+    g_free_stacks.push_back(top);
+    return used;
+}
+
+// A finished thread will never run again (its fiber has switched out for the
+// last time, or its host thread is done with it): give back its fiber, stack
+// and slot
+static void thread_release(GuestThread& gt)
+{
+    if (gt.fiber)
+    {
+        fiber_delete(gt.fiber);
+        gt.fiber = nullptr;
+    }
+    uint32_t used = stack_release(gt.base, gt.ppc_stack_top);
+    fprintf(stderr, "[THREAD] Thread %d released (handle=0x%X, stack used %u of %u KB)\n",
+            gt.idx, gt.handle, used / 1024, THREAD_STACK_SIZE / 1024);
+    g_threads_live--;
+    std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+    gt.in_use = false;
+    g_free_slots.push_back(gt.idx);
+}
+
+// ============================================================================
+// Parking and timers (shared by all modes)
+// ============================================================================
+
+static void pool_enqueue(GuestThread& gt);
+
+// Fiber mode: the main thread's waiter, and whether it is asleep in
+// fiber_main_park. Fibers made ready by other host threads (timer, GPU) wake it.
+static GuestThread* g_main_waiter = nullptr;
+static std::atomic<bool> g_main_sleeping{false};
+static std::atomic<bool> g_fibers_ready{false}; // set with any gt.ready
+
+void scheduler_wake_main()
+{
+    if (g_main_sleeping)
+    {
+        {
+            // Pairs with the predicate check in fiber_main_park
+            std::lock_guard<std::mutex> lock(g_main_waiter->lock);
+        }
+        g_main_waiter->cv.notify_one();
+    }
+}
+
+// Make a fiber runnable: Fiber mode gives it a slice next round, Pool mode
+// puts it on a run queue
+static void thread_make_ready(GuestThread& gt)
+{
+    if (g_mode == ThreadMode::Pool)
+    {
+        pool_enqueue(gt);
+        return;
+    }
+    gt.ready = true;
+    g_fibers_ready = true;
+    scheduler_wake_main();
+}
+
+// A parked fiber's deadline passed (timer thread). The timer isn't always
+// cancelled in time when the fiber is woken early; park_seq tells stale
+// fires apart.
+static void park_timer_fire(void* param, uint32_t seq)
+{
+    GuestThread* gt = (GuestThread*)param;
+    if (replay_post(REPLAY_EVENT_PARK_TIMER, (uint32_t)gt->idx, seq))
+        return;
+    if (gt->park_seq.load() == seq)
+        scheduler_unpark(gt);
+}
+
+// The same, applied at a replay sync point
+static void park_timer_replay(uint32_t idx, uint32_t seq)
+{
+    GuestThread& gt = thread_slot((int)idx);
+    if (gt.park_seq.load() == seq)
+        scheduler_unpark(&gt);
+}
+
+// Called on a guest fiber: hand it back to the main fiber / its worker
+static void thread_switch_out(GuestThread& gt, SwitchAction action, SchedStop reason)
+{
+    telemetry_stop(gt, reason);
+    gt.switch_action = action;
+    fiber_switch(scheduler_fiber());
+    telemetry_run(gt);
+}
+
+// Called by the main fiber / a worker once `gt` has switched out. Runs after
+// the switch so nothing can resume a fiber whose context isn't saved yet.
+static void thread_switched_out(GuestThread& gt)
+{
+    switch (gt.switch_action)
+    {
+    case SWITCH_YIELD:
+        thread_make_ready(gt);
+        break;
+    case SWITCH_PARK:
+    {
+        if (gt.park_deadline != INT64_MAX)
+            timer_arm(&gt.park_timer, timer_from_ns(gt.park_deadline), ++gt.park_seq);
+        int expected = PARK_EMPTY;
+        if (!gt.park_state.compare_exchange_strong(expected, PARK_PARKED))
+        {
+            // Woken while switching out
+            gt.park_state = PARK_EMPTY;
+            thread_make_ready(gt);
+        }
+        break;
+    }
+    case SWITCH_EXIT:
+        thread_release(gt);
+        break;
+    }
+}
+
+// Host thread (Host mode guest thread, or a host thread waiting in Host /
+// Pool mode): block on the thread's own condition variable
+static void host_park(GuestThread& self, int64_t deadline_ns)
+{
+    std::unique_lock<std::mutex> lock(self.lock);
+    auto woken = [&self] { return self.park_state.load() == PARK_NOTIFIED; };
+    if (deadline_ns == INT64_MAX)
+        self.cv.wait(lock, woken);
+    else
+        self.cv.wait_until(lock, std::chrono::steady_clock::time_point(
+                                     std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                         std::chrono::nanoseconds(deadline_ns))),
+                           woken);
+    self.park_state = PARK_EMPTY;
+}
+
+static int fiber_run_ready();
+
+// Main thread waiting in Fiber mode: no other thread runs guest code, so run
+// the ready fibers until woken, and sleep only when none are ready. The sleep
+// lasts until the deadline, a wake, or a fiber becoming ready.
+static void fiber_main_park(GuestThread& self, int64_t deadline_ns)
+{
+    for (;;)
+    {
+        if (self.park_state.exchange(PARK_EMPTY) == PARK_NOTIFIED)
+            return;
+        if (deadline_ns != INT64_MAX && scheduler_now_ns() >= deadline_ns)
+            return;
+        if (fiber_run_ready() > 0)
+            continue;
+        // What woke the recorded run is in the log
+        if (replay_mode() == ReplayMode::Replay)
+            continue;
+
+        std::unique_lock<std::mutex> lock(self.lock);
+        g_main_sleeping = true;
+        auto woken = [&self] {
+            return self.park_state.load() == PARK_NOTIFIED || g_fibers_ready.load() || replay_pending();
+        };
+        if (deadline_ns == INT64_MAX)
+            self.cv.wait(lock, woken);
+        else
+            self.cv.wait_until(lock, std::chrono::steady_clock::time_point(
+                                         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                             std::chrono::nanoseconds(deadline_ns))),
+                               woken);
+        g_main_sleeping = false;
+    }
+}
+
+// ============================================================================
+// Fiber mode
+// ============================================================================
+
+// Fiber entry point for PPC threads (Fiber and Pool mode)
+static void ppc_thread_fiber_proc(void* param)
+{
+    GuestThread& gt = *(GuestThread*)param;
+    run_guest_thread(gt);
+    // Switch back to main fiber / the worker (thread is done)
+    thread_switch_out(gt, SWITCH_EXIT, SCHED_STOP_TERMINATE);
+}
+
+// Create the fiber for a thread. Returns false (and marks it finished) on failure.
+static bool thread_create_fiber(GuestThread& gt)
+{
+    gt.fiber = fiber_create(0, ppc_thread_fiber_proc, &gt);
+    if (!gt.fiber)
+    {
+        fprintf(stderr, "[THREAD] Failed to create fiber for thread %d\n", gt.idx);
+        thread_finish(gt);
+        thread_release(gt);
+        return false;
+    }
+    gt.started = true;
+    fprintf(stderr, "[THREAD] Created fiber for thread %d (handle=0x%X, stack=0x%08X)\n",
+            gt.idx, gt.handle, gt.ppc_stack_top);
+    return true;
+}
+
+// Give a thread a time slice by switching to its fiber
+static void thread_give_timeslice(GuestThread& gt)
+{
+    if (gt.finished || gt.suspended) return;
+
+    // First run: create the fiber (context already initialized in scheduler_create_thread)
+    if (!gt.started && !thread_create_fiber(gt))
+        return;
+
+    g_slices++;
+    t_current_thread = &gt;
+    fiber_switch(gt.fiber);
+    t_current_thread = nullptr;
+    thread_switched_out(gt);
+}
+
+// One slice for every ready fiber. Returns how many ran.
+static int fiber_run_ready()
+{
+    replay_sync();
+    g_fibers_ready = false;
+    int ran = 0;
+    int count = g_thread_slots.load();
+    for (int i = 0; i < count; i++)
+    {
+        GuestThread& gt = thread_slot(i);
+        if (gt.ready.exchange(false))
+        {
+            thread_give_timeslice(gt);
+            ran++;
+        }
+    }
+    return ran;
+}
+
+// ============================================================================
+// Host mode
+// ============================================================================
+
+// The guest thread is done: give back its slot and end the host thread
+static void host_thread_end(GuestThread& gt)
+{
+    telemetry_stop(gt, SCHED_STOP_TERMINATE);
+    thread_release(gt);
+}
+
+static void host_thread_proc(GuestThread* gt)
+{
+    t_current_thread = gt;
+    {
+        std::unique_lock<std::mutex> lock(gt->lock);
+        gt->cv.wait(lock, [gt] { return !gt->suspended; });
+    }
+    run_guest_thread(*gt);
+    host_thread_end(*gt);
+}
+
+static void host_thread_start(GuestThread& gt)
+{
+    gt.started = true;
+    std::thread(host_thread_proc, &gt).detach();
+    fprintf(stderr, "[THREAD] Created host thread for thread %d (handle=0x%X, stack=0x%08X)\n",
+            gt.idx, gt.handle, gt.ppc_stack_top);
+}
+
+// ============================================================================
+// Pool mode: M:N work-stealing scheduler
+// ============================================================================
+
+// Each worker is a host thread converted to a fiber. It pops a guest fiber
+// from its own run queue (or steals one from another worker), switches to it,
+// and when the fiber switches back, hands it to thread_switched_out.
+
+// Run queue bands by priority: > 0, 0, < 0
+static constexpr int POOL_PRIORITY_BANDS = 3;
+// Xbox 360 has 6 hardware threads; more workers than that can't be used
+static constexpr int POOL_MAX_WORKERS = 6;
+// A thread pinned by affinity may be stolen once it has waited this long
+static constexpr int64_t POOL_PINNED_STEAL_NS = 2 * 1000 * 1000;
+
+struct PoolWorker
+{
+    int      id;
+    Fiber*   fiber;              // the worker's own fiber (runs the loop below)
+    std::mutex lock;             // guards queues
+    std::deque<GuestThread*> queues[POOL_PRIORITY_BANDS];
+    std::atomic<int> queued{0};  // total across bands; read by thieves without the lock
+
+    // Metrics, reset at each report
+    std::atomic<uint64_t> slices{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> latency_ns_sum{0};
+    std::atomic<uint64_t> latency_ns_max{0};
+};
+
+static PoolWorker* g_workers = nullptr; // never freed (see g_thread_chunks)
+static int g_worker_count = 0;
+static std::atomic<uint32_t> g_pool_next_worker{0}; // round robin for non-worker enqueues
+static thread_local PoolWorker* t_worker = nullptr;
+
+static __attribute__((noinline)) PoolWorker* current_worker()
+{
+    return t_worker;
+}
+
+// Idle workers wait here for work (parked fibers are made ready by whoever
+// unparks them, including the timer thread)
+static std::mutex g_pool_idle_lock;
+static std::condition_variable& g_pool_idle_cv = *new std::condition_variable;
+static std::atomic<int> g_pool_ready{0}; // fibers on any run queue
+
+static int pool_band(const GuestThread& gt)
+{
+    return gt.priority > 0 ? 0 : (gt.priority == 0 ? 1 : 2);
+}
+
+// Worker a thread is pinned to by its affinity hint, or -1. Only an affinity
+// naming exactly one hardware thread pins; hardware thread N maps to worker
+// N mod the worker count.
+static int pool_pinned_worker(const GuestThread& gt)
+{
+    uint32_t mask = gt.affinity & 0x3F;
+    if (mask == 0 || (mask & (mask - 1)) != 0)
+        return -1;
+    int hw_thread = 0;
+    while (!(mask & (1u << hw_thread)))
+        hw_thread++;
+    return hw_thread % g_worker_count;
+}
+
+static void pool_enqueue(GuestThread& gt)
+{
+    int target = pool_pinned_worker(gt);
+    if (target < 0)
+    {
+        // Unpinned: keep it on the current worker for cache locality
+        PoolWorker* self = current_worker();
+        target = self ? self->id : (int)(g_pool_next_worker++ % (uint32_t)g_worker_count);
+    }
+    PoolWorker& w = g_workers[target];
+    gt.enqueue_ns = steady_ns();
+    {
+        std::lock_guard<std::mutex> lock(w.lock);
+        w.queues[pool_band(gt)].push_back(&gt);
+        w.queued++;
+    }
+    g_pool_ready++;
+    {
+        // Pairs with the predicate check in pool_idle_wait
+        std::lock_guard<std::mutex> idle_lock(g_pool_idle_lock);
+    }
+    g_pool_idle_cv.notify_one();
+}
+
+// Own queue: oldest first, highest band first
+static GuestThread* pool_pop(PoolWorker& w)
+{
+    if (w.queued.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> lock(w.lock);
+    for (auto& q : w.queues)
+    {
+        if (!q.empty())
+        {
+            GuestThread* gt = q.front();
+            q.pop_front();
+            w.queued--;
+            return gt;
+        }
+    }
+    return nullptr;
+}
+
+// Steal from the back of another worker's highest non-empty band, skipping
+// threads pinned to their worker until they have waited too long
+static GuestThread* pool_steal(PoolWorker& self, int64_t now)
+{
+    for (int i = 1; i < g_worker_count; i++)
+    {
+        PoolWorker& victim = g_workers[(self.id + i) % g_worker_count];
+        if (victim.queued.load(std::memory_order_relaxed) == 0)
+            continue;
+        std::lock_guard<std::mutex> lock(victim.lock);
+        for (auto& q : victim.queues)
+        {
+            for (auto it = q.rbegin(); it != q.rend(); ++it)
+            {
+                GuestThread* gt = *it;
+                if (pool_pinned_worker(*gt) == victim.id && now - gt->enqueue_ns < POOL_PINNED_STEAL_NS)
+                    continue;
+                q.erase(std::next(it).base());
+                victim.queued--;
+                self.steals++;
+                return gt;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static void pool_idle_wait()
+{
+    std::unique_lock<std::mutex> lock(g_pool_idle_lock);
+    g_pool_idle_cv.wait(lock, [] { return g_pool_ready.load() > 0; });
+}
+
+static void pool_worker_proc(PoolWorker* w)
+{
+    t_worker = w;
+    w->fiber = fiber_convert_thread();
+    if (!w->fiber)
+    {
+        fprintf(stderr, "[SCHED] Worker %d: fiber conversion failed\n", w->id);
+        return;
+    }
+
+    for (;;)
+    {
+        GuestThread* gt = pool_pop(*w);
+        if (!gt)
+            gt = pool_steal(*w, steady_ns());
+        if (!gt)
+        {
+            pool_idle_wait();
+            continue;
+        }
+        g_pool_ready--;
+
+        uint64_t latency = (uint64_t)(steady_ns() - gt->enqueue_ns);
+        w->slices++;
+        g_slices++;
+        w->latency_ns_sum += latency;
+        uint64_t max = w->latency_ns_max.load(std::memory_order_relaxed);
+        while (latency > max && !w->latency_ns_max.compare_exchange_weak(max, latency))
+            ;
+
+        t_current_thread = gt;
+        fiber_switch(gt->fiber);
+        t_current_thread = nullptr;
+        thread_switched_out(*gt);
+    }
+}
+
+static void pool_start(int workers)
+{
+    if (workers <= 0)
+    {
+        int cores = (int)std::thread::hardware_concurrency();
+        workers = cores > 1 ? cores - 1 : 1;
+    }
+    if (workers > POOL_MAX_WORKERS)
+        workers = POOL_MAX_WORKERS;
+    g_worker_count = workers;
+    g_workers = new PoolWorker[workers];
+    for (int i = 0; i < workers; i++)
+    {
+        g_workers[i].id = i;
+        std::thread(pool_worker_proc, &g_workers[i]).detach();
+    }
+    fprintf(stderr, "[SCHED] Pool mode: %d worker threads\n", workers);
+}
+
+static Fiber* scheduler_fiber()
+{
+    return g_mode == ThreadMode::Pool ? current_worker()->fiber : g_main_fiber;
+}
+
+static void pool_stats_report()
+{
+    uint64_t slices = 0, steals = 0, latency_sum = 0, latency_max = 0;
+    char per_worker[128];
+    int len = 0;
+    for (int i = 0; i < g_worker_count; i++)
+    {
+        PoolWorker& w = g_workers[i];
+        uint64_t n = w.slices.exchange(0);
+        uint64_t max = w.latency_ns_max.exchange(0);
+        slices += n;
+        steals += w.steals.exchange(0);
+        latency_sum += w.latency_ns_sum.exchange(0);
+        if (max > latency_max)
+            latency_max = max;
+        if (len < (int)sizeof(per_worker))
+            len += snprintf(per_worker + len, sizeof(per_worker) - len, "%s%llu",
+                            i ? "/" : "", (unsigned long long)n);
+    }
+    fprintf(stderr, "[SCHED] pool: %d workers, %llu slices (%s), %llu steals (%.1f%%), "
+                    "run-queue latency %.1f us avg / %.1f us max\n",
+            g_worker_count, (unsigned long long)slices, per_worker, (unsigned long long)steals,
+            slices ? 100.0 * steals / slices : 0.0,
+            slices ? latency_sum / 1000.0 / slices : 0.0, latency_max / 1000.0);
+}
+
+// ============================================================================
+// Frame accounting: frame time, work time (frame minus limiter wait) and
+// process CPU time, so the two modes can be compared on the same scene.
+// ============================================================================
+
+static double process_cpu_seconds()
+{
+#ifdef _WIN32
+    FILETIME create_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(GetCurrentProcess(), &create_time, &exit_time, &kernel_time, &user_time))
+        return 0.0;
+    auto to_100ns = [](const FILETIME& ft) {
+        return (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    };
+    return double(to_100ns(kernel_time) + to_100ns(user_time)) * 1e-7;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0.0;
+    return double(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+           double(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+static constexpr int SCHED_REPORT_FRAMES = 300; // ~5 s at 60 Hz
+
+struct FrameStats
+{
+    std::chrono::steady_clock::time_point frame_start;
+    double   cpu_start;
+    bool     valid;
+    int      frames;
+    double   frame_ms_sum;
+    double   work_ms_sum;
+    double   work_ms_max;
+    double   cpu_s_sum;
+    double   wall_s_sum;
+};
+
+static FrameStats g_frame_stats = {};
+
+static void thread_stats_report()
+{
+    FiberStackStats fiber_stats;
+    fiber_stack_stats(&fiber_stats);
+    uint32_t carved;
+    size_t free_stacks;
+    {
+        std::lock_guard<std::mutex> lock(g_stack_lock);
+        carved = g_stack_carved;
+        free_stacks = g_free_stacks.size();
+    }
+    fprintf(stderr, "[SCHED] threads: %d live (peak %d), %llu created, %d slots; "
+                    "guest stacks: %u carved, %zu free, %llu reused, deepest %u of %u KB; "
+                    "host stacks: %llu created, %llu reused, %zu pooled\n",
+            g_threads_live.load(), g_threads_peak.load(), (unsigned long long)g_threads_created.load(),
+            g_thread_slots.load(), carved, free_stacks, (unsigned long long)g_stacks_reused.load(),
+            g_stack_high_water.load() / 1024, THREAD_STACK_SIZE / 1024,
+            (unsigned long long)fiber_stats.created, (unsigned long long)fiber_stats.reused,
+            fiber_stats.pooled);
+}
+
+// Visit every live thread's waiter, in scheduler_telemetry order. Caller
+// holds g_thread_table_lock.
+template <typename Fn>
+static void for_each_live_thread(Fn fn)
+{
+    for (GuestThread* waiter : g_host_waiters)
+        fn(*waiter);
+    int count = g_thread_slots.load();
+    for (int i = 0; i < count; i++)
+    {
+        GuestThread& gt = thread_slot(i);
+        if (gt.in_use)
+            fn(gt);
+    }
+}
+
+static void telemetry_label(const ThreadTelemetry& t, char* buf, size_t size)
+{
+    if (t.main)
+        snprintf(buf, size, "main");
+    else if (t.idx < 0)
+        snprintf(buf, size, "host");
+    else
+        snprintf(buf, size, "%d", t.idx);
+}
+
+static constexpr int TELEMETRY_REPORT_TOP = 8;
+
+// Busiest threads over the report interval
+static void telemetry_report(int frames)
+{
+    std::vector<ThreadTelemetry> rows;
+    {
+        std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+        for_each_live_thread([&rows](GuestThread& gt) {
+            ThreadTelemetry now;
+            telemetry_read(gt, now);
+            now.main = &gt == g_main_waiter;
+            ThreadTelemetry d = telemetry_delta(now, gt.report_last);
+            gt.report_last = now;
+            if (d.slices || d.run_ns)
+                rows.push_back(d);
+        });
+    }
+    std::sort(rows.begin(), rows.end(),
+              [](const ThreadTelemetry& a, const ThreadTelemetry& b) { return a.run_ns > b.run_ns; });
+    if (rows.size() > TELEMETRY_REPORT_TOP)
+        rows.resize(TELEMETRY_REPORT_TOP);
+    for (const ThreadTelemetry& t : rows)
+    {
+        char label[16];
+        telemetry_label(t, label, sizeof(label));
+        double f = (double)frames;
+        fprintf(stderr, "[SCHED]   thread %-4s (0x%08X): %6.2f ms/frame in %5.1f slices, blocked %6.2f ms/frame; "
+                        "ends: %.1f yield, %.1f delay, %.1f wait, %.1f vdswap, %llu terminate\n",
+                label, t.handle, t.run_ns / 1e6 / f, t.slices / f, t.blocked_ns / 1e6 / f,
+                t.stops[SCHED_STOP_YIELD] / f, t.stops[SCHED_STOP_DELAY] / f, t.stops[SCHED_STOP_WAIT] / f,
+                t.stops[SCHED_STOP_VDSWAP] / f, (unsigned long long)t.stops[SCHED_STOP_TERMINATE]);
+    }
+}
+
+static FILE* g_csv = nullptr;
+static uint64_t g_frame_number = 0;
+
+// One row per live thread: this frame's share of its counters
+static void telemetry_csv_frame()
+{
+    std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+    for_each_live_thread([](GuestThread& gt) {
+        ThreadTelemetry now;
+        telemetry_read(gt, now);
+        now.main = &gt == g_main_waiter;
+        ThreadTelemetry d = telemetry_delta(now, gt.csv_last);
+        gt.csv_last = now;
+        char label[16];
+        telemetry_label(d, label, sizeof(label));
+        fprintf(g_csv, "%llu,%s,0x%08X,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%.1f\n",
+                (unsigned long long)g_frame_number, label, d.handle, d.run_ns / 1e3,
+                (unsigned long long)d.slices,
+                (unsigned long long)d.stops[SCHED_STOP_YIELD], (unsigned long long)d.stops[SCHED_STOP_DELAY],
+                (unsigned long long)d.stops[SCHED_STOP_WAIT], (unsigned long long)d.stops[SCHED_STOP_VDSWAP],
+                (unsigned long long)d.stops[SCHED_STOP_TERMINATE], d.blocked_ns / 1e3);
+    });
+}
+
+static void frame_stats_report(FrameStats& fs)
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    double cpu_cores = fs.wall_s_sum > 0.0 ? fs.cpu_s_sum / fs.wall_s_sum : 0.0;
+    fprintf(stderr, "[SCHED] %s mode, %d frames: frame %.2f ms, work %.2f ms avg / %.2f ms max, "
+                    "CPU %.2f cores (%.1f%% of %u)\n",
+            scheduler_mode_name(g_mode), fs.frames,
+            fs.frame_ms_sum / fs.frames, fs.work_ms_sum / fs.frames, fs.work_ms_max,
+            cpu_cores, cores ? 100.0 * cpu_cores / cores : 0.0, cores);
+    fprintf(stderr, "[SCHED] %s waits: %.1f slices/frame, %.1f wasted/frame\n",
+            kobj_yield_waits() ? "yield" : "queue",
+            (double)g_slices.exchange(0) / fs.frames,
+            (double)g_wasted_slices.exchange(0) / fs.frames);
+    timer_stats_report();
+    thread_stats_report();
+    telemetry_report(fs.frames);
+    cs_stats_report();
+    heap_stats_report();
+    pool_alloc_stats_report();
+    file_io_stats_report();
+    fs.frames = 0;
+    fs.frame_ms_sum = fs.work_ms_sum = fs.work_ms_max = 0.0;
+    fs.cpu_s_sum = fs.wall_s_sum = 0.0;
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+bool scheduler_init(ThreadMode mode, int pool_workers)
+{
+    g_mode = mode;
+    // The main thread is a fiber in every mode so Fiber-only paths stay valid
+    g_main_fiber = fiber_convert_thread();
+    if (!g_main_fiber && mode != ThreadMode::Host)
+        return false;
+    g_main_waiter = scheduler_current_waiter();
+    g_main_waiter->kthread = PPC_KTHREAD_BASE;
+    g_main_waiter->tls_mirror = PPC_KTHREAD_BASE + PPC_KTHREAD_TLS_OFFSET;
+    telemetry_run(*g_main_waiter);
+    replay_set_handler(REPLAY_EVENT_PARK_TIMER, park_timer_replay);
+    if (mode == ThreadMode::Pool)
+        pool_start(pool_workers);
+    return true;
+}
+
+ThreadMode scheduler_mode()
+{
+    return g_mode;
+}
+
+const char* scheduler_mode_name(ThreadMode mode)
+{
+    switch (mode)
+    {
+    case ThreadMode::Fiber: return "fiber";
+    case ThreadMode::Host:  return "host";
+    case ThreadMode::Pool:  return "pool";
+    }
+    return "?";
+}
+
+bool scheduler_parse_mode(const char* name, ThreadMode* mode, int* pool_workers)
+{
+    *pool_workers = 0;
+    if (strcmp(name, "fiber") == 0) { *mode = ThreadMode::Fiber; return true; }
+    if (strcmp(name, "host") == 0)  { *mode = ThreadMode::Host;  return true; }
+    if (strcmp(name, "pool") == 0)  { *mode = ThreadMode::Pool;  return true; }
+    if (strncmp(name, "pool:", 5) == 0)
+    {
+        char* end;
+        long n = strtol(name + 5, &end, 10);
+        if (*end || n < 1 || n > POOL_MAX_WORKERS)
+            return false;
+        *mode = ThreadMode::Pool;
+        *pool_workers = (int)n;
+        return true;
+    }
+    return false;
+}
+
+bool scheduler_create_thread(PPCContext& parent, uint8_t* base, uint32_t handle,
+                             uint32_t start_routine, uint32_t start_context,
+                             uint32_t api_startup, bool suspended)
+{
+    uint32_t stack_top = stack_acquire(base);
+    if (!stack_top)
+    {
+        fprintf(stderr, "[THREAD] Out of guest stack space\n");
+        return false;
+    }
+
+    GuestThread* gt;
+    {
+        std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+        int idx;
+        if (!g_free_slots.empty())
+        {
+            idx = g_free_slots.back();
+            g_free_slots.pop_back();
+        }
+        else
+        {
+            // Live threads are bounded by the stacks, so the chunks can't run out
+            idx = g_thread_slots.load();
+            if (idx % THREAD_CHUNK_SIZE == 0)
+                g_thread_chunks[idx / THREAD_CHUNK_SIZE].store(new GuestThread[THREAD_CHUNK_SIZE],
+                                                               std::memory_order_release);
+            g_thread_slots.store(idx + 1);
+        }
+        gt = &thread_slot(idx);
+        gt->in_use = true;
+        gt->handle = handle;
+        gt->start_routine = start_routine;
+        gt->start_context = start_context;
+        gt->api_startup = api_startup;
+        gt->suspended = suspended;
+        gt->finished = false;
+        gt->started = false;
+        gt->idx = idx;
+        gt->fiber = nullptr;
+        gt->base = base;
+        gt->priority = 0;
+        gt->affinity = 0x3F; // all six hardware threads
+        gt->park_state = PARK_EMPTY;
+        gt->park_deadline = INT64_MAX;
+        timer_init(&gt->park_timer, park_timer_fire, gt);
+        gt->switch_action = SWITCH_YIELD;
+        gt->ready = false;
+        telemetry_reset(*gt);
+        // Initialize thread PPC context from the creator's context
+        gt->ppc_stack_top = stack_top;
+        init_thread_ctx(*gt, parent);
+        fprintf(stderr, "[THREAD]   -> thread %d, PPC stack=0x%08X\n", idx, gt->ppc_stack_top);
+    }
+    g_threads_created++;
+    int live = ++g_threads_live;
+    int peak = g_threads_peak.load();
+    while (live > peak && !g_threads_peak.compare_exchange_weak(peak, live))
+        ;
+
+    if (g_mode == ThreadMode::Host)
+    {
+        // Suspended threads get their host thread now and wait for the resume
+        host_thread_start(*gt);
+    }
+    else if (g_mode == ThreadMode::Pool)
+    {
+        // Runs as soon as a worker picks it up; suspended ones wait for the resume
+        if (thread_create_fiber(*gt) && !suspended)
+            pool_enqueue(*gt);
+    }
+    else if (!suspended && g_main_fiber)
+    {
+        // Non-suspended threads start immediately on Xbox 360. The main
+        // thread gives them a fiber timeslice right away; a creating fiber
+        // can't, since the new fiber would switch back to main, not to it.
+        gt->ready = true;
+        if (!current_thread())
+        {
+            fprintf(stderr, "[THREAD] Non-suspended thread %d — giving immediate timeslice\n", gt->idx);
+            gt->ready = false;
+            thread_give_timeslice(*gt);
+        }
+    }
+    return true;
+}
+
+bool scheduler_resume_thread(uint32_t handle)
+{
+    GuestThread* gt = nullptr;
+    {
+        std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+        int count = g_thread_slots.load();
+        for (int i = 0; i < count; i++)
+        {
+            GuestThread& t = thread_slot(i);
+            if (t.in_use && t.handle == handle && t.suspended && !t.finished)
+            {
+                gt = &t;
+                break;
+            }
+        }
+    }
+    if (!gt)
+        return false;
+
+    fprintf(stderr, "[THREAD] Resuming thread %d (handle=0x%X)\n", gt->idx, gt->handle);
+    if (g_mode == ThreadMode::Host)
+    {
+        {
+            std::lock_guard<std::mutex> lock(gt->lock);
+            gt->suspended = false;
+        }
+        gt->cv.notify_one();
+    }
+    else if (g_mode == ThreadMode::Pool)
+    {
+        gt->suspended = false;
+        pool_enqueue(*gt);
+    }
+    else
+    {
+        gt->suspended = false;
+        // Give the thread an immediate timeslice via fiber (from main only,
+        // as in scheduler_create_thread). It runs until it yields or parks.
+        gt->ready = true;
+        if (g_main_fiber && !current_thread())
+        {
+            gt->ready = false;
+            thread_give_timeslice(*gt);
+        }
+    }
+    return true;
+}
+
+void scheduler_exit_thread()
+{
+    GuestThread* gt = current_thread();
+    if (!gt)
+        return;
+    thread_finish(*gt);
+    if (g_mode == ThreadMode::Host)
+    {
+        // End the host thread right here instead of returning (or throwing)
+        // through the guest frames above us: nothing in them is needed again,
+        // and the guest stack goes back to the free list with the slot
+        host_thread_end(*gt);
+        t_current_thread = nullptr;
+#ifdef _WIN32
+        ExitThread(0);
+#else
+        pthread_exit(nullptr);
+#endif
+    }
+    thread_switch_out(*gt, SWITCH_EXIT, SCHED_STOP_TERMINATE);
+}
+
+bool scheduler_in_guest_thread()
+{
+    return current_thread() != nullptr;
+}
+
+uint32_t scheduler_thread_id()
+{
+    if (GuestThread* gt = current_thread())
+        return (uint32_t)gt->idx + 1;
+    // Not a guest thread: ids above any guest thread index
+    static std::atomic<uint32_t> next_host_id{0x10000};
+    static thread_local uint32_t host_id = next_host_id++;
+    return host_id;
+}
+
+uint32_t scheduler_thread_object()
+{
+    GuestThread* self = scheduler_current_waiter();
+    return self->kthread ? self->kthread : scheduler_thread_id();
+}
+
+static GuestThread* find_thread(uint32_t handle)
+{
+    std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+    int count = g_thread_slots.load();
+    for (int i = 0; i < count; i++)
+    {
+        GuestThread& gt = thread_slot(i);
+        if (gt.in_use && gt.handle == handle)
+            return &gt;
+    }
+    return nullptr;
+}
+
+int32_t scheduler_set_priority(uint32_t handle, int32_t priority)
+{
+    GuestThread* gt = find_thread(handle);
+    if (!gt)
+        return 0;
+    fprintf(stderr, "[THREAD] Thread %d priority %d -> %d\n", gt->idx, gt->priority, priority);
+    // Takes effect the next time the thread is queued
+    int32_t prev = gt->priority;
+    gt->priority = priority;
+    return prev;
+}
+
+uint32_t scheduler_set_affinity(uint32_t handle, uint32_t affinity)
+{
+    GuestThread* gt = find_thread(handle);
+    if (!gt)
+        return 0;
+    fprintf(stderr, "[THREAD] Thread %d affinity 0x%02X -> 0x%02X\n", gt->idx, gt->affinity, affinity);
+    uint32_t prev = gt->affinity;
+    gt->affinity = affinity;
+    return prev;
+}
+
+uint32_t scheduler_tls_get(uint32_t index)
+{
+    return scheduler_current_waiter()->tls[index];
+}
+
+static void tls_store(uint8_t* base, GuestThread& gt, uint32_t index, uint32_t value)
+{
+    gt.tls[index] = value;
+    if (gt.tls_mirror)
+        PPC_STORE_U32(gt.tls_mirror + index * 4, value);
+}
+
+void scheduler_tls_set(uint8_t* base, uint32_t index, uint32_t value)
+{
+    tls_store(base, *scheduler_current_waiter(), index, value);
+}
+
+void scheduler_tls_reset(uint8_t* base, uint32_t index)
+{
+    std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+    int count = g_thread_slots.load();
+    for (int i = 0; i < count; i++)
+    {
+        GuestThread& gt = thread_slot(i);
+        if (gt.in_use)
+            tls_store(base, gt, index, 0);
+    }
+    for (GuestThread* waiter : g_host_waiters)
+        tls_store(base, *waiter, index, 0);
+}
+
+static void yield_for(SchedStop reason)
+{
+    GuestThread* gt = current_thread();
+    if (gt && is_fiber_thread(*gt))
+    {
+        thread_switch_out(*gt, SWITCH_YIELD, reason);
+    }
+    else if (g_mode != ThreadMode::Fiber)
+    {
+        GuestThread* self = scheduler_current_waiter();
+        telemetry_stop(*self, reason);
+        std::this_thread::yield();
+        telemetry_run(*self);
+    }
+}
+
+void scheduler_yield()
+{
+    yield_for(SCHED_STOP_YIELD);
+}
+
+GuestThread* scheduler_current_waiter()
+{
+    if (GuestThread* gt = current_thread())
+        return gt;
+    if (!t_host_waiter)
+    {
+        t_host_waiter = new GuestThread(); // zeroed TLS, no mirror
+        t_host_waiter->idx = -1;
+        std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+        g_host_waiters.push_back(t_host_waiter);
+    }
+    return t_host_waiter;
+}
+
+int64_t scheduler_now_ns()
+{
+    return (int64_t)replay_clock(REPLAY_CLOCK_NS, (uint64_t)steady_ns());
+}
+
+static void park(GuestThread* self, int64_t deadline_ns, SchedStop reason)
+{
+    if (is_fiber_thread(*self))
+    {
+        if (self->park_state.exchange(PARK_EMPTY) == PARK_NOTIFIED)
+            return;
+        self->park_deadline = deadline_ns;
+        thread_switch_out(*self, SWITCH_PARK, reason);
+        if (deadline_ns != INT64_MAX)
+            timer_cancel(&self->park_timer);
+        return;
+    }
+    telemetry_stop(*self, reason);
+    if (g_mode == ThreadMode::Fiber)
+        fiber_main_park(*self, deadline_ns);
+    else
+        host_park(*self, deadline_ns);
+    telemetry_run(*self);
+}
+
+void scheduler_park(GuestThread* self, int64_t deadline_ns)
+{
+    park(self, deadline_ns, SCHED_STOP_WAIT);
+}
+
+void scheduler_unpark(GuestThread* gt)
+{
+    if (is_fiber_thread(*gt))
+    {
+        if (gt->park_state.exchange(PARK_NOTIFIED) == PARK_PARKED)
+        {
+            gt->park_state = PARK_EMPTY;
+            thread_make_ready(*gt);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(gt->lock);
+        gt->park_state = PARK_NOTIFIED;
+    }
+    gt->cv.notify_one();
+}
+
+void scheduler_note_wasted_slice()
+{
+    g_wasted_slices++;
+}
+
+void scheduler_delay(int64_t interval)
+{
+    // Zero and absolute times (positive, not tracked) just yield
+    if (interval >= 0)
+    {
+        yield_for(SCHED_STOP_DELAY);
+        return;
+    }
+
+    // Park until the deadline: fibers on the timer wheel, the Fiber mode main
+    // thread running fibers meanwhile, host threads on their condition
+    // variable. Wakes left over from earlier waits just park again.
+    GuestThread* self = scheduler_current_waiter();
+    int64_t deadline = scheduler_now_ns() + -interval * 100;
+    while (scheduler_now_ns() < deadline)
+        park(self, deadline, SCHED_STOP_DELAY);
+}
+
+void scheduler_frame_begin()
+{
+    telemetry_stop(*scheduler_current_waiter(), SCHED_STOP_VDSWAP);
+
+    // Give each ready thread a time slice via fibers
+    if (g_mode == ThreadMode::Fiber)
+        fiber_run_ready();
+
+    FrameStats& fs = g_frame_stats;
+    if (fs.valid)
+    {
+        double work_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - fs.frame_start).count();
+        fs.work_ms_sum += work_ms;
+        if (work_ms > fs.work_ms_max)
+            fs.work_ms_max = work_ms;
+    }
+}
+
+void scheduler_frame_end()
+{
+    FrameStats& fs = g_frame_stats;
+    auto now = std::chrono::steady_clock::now();
+    double cpu = process_cpu_seconds();
+    if (fs.valid)
+    {
+        double frame_s = std::chrono::duration<double>(now - fs.frame_start).count();
+        fs.frames++;
+        fs.frame_ms_sum += frame_s * 1000.0;
+        fs.wall_s_sum += frame_s;
+        fs.cpu_s_sum += cpu - fs.cpu_start;
+        if (fs.frames >= SCHED_REPORT_FRAMES)
+        {
+            frame_stats_report(fs);
+            if (g_mode == ThreadMode::Pool)
+                pool_stats_report();
+        }
+    }
+    fs.frame_start = now;
+    fs.cpu_start = cpu;
+    fs.valid = true;
+
+    g_frame_number++;
+    if (g_csv)
+        telemetry_csv_frame();
+    replay_frame();
+    telemetry_run(*scheduler_current_waiter());
+}
+
+int scheduler_telemetry(ThreadTelemetry* out, int max)
+{
+    std::lock_guard<std::mutex> table_lock(g_thread_table_lock);
+    int n = 0;
+    for_each_live_thread([out, max, &n](GuestThread& gt) {
+        if (n < max)
+        {
+            telemetry_read(gt, out[n]);
+            out[n].main = &gt == g_main_waiter;
+        }
+        n++;
+    });
+    return n;
+}
+
+bool scheduler_open_csv(const char* path)
+{
+    g_csv = fopen(path, "w");
+    if (!g_csv)
+        return false;
+    fprintf(g_csv, "frame,thread,handle,run_us,slices,yield,delay,wait,vdswap,terminate,blocked_us\n");
+    return true;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+
+struct PPCContext;
+struct GuestThread;
+
+// Guest thread scheduler used by the Ex*/Ke*/Nt* thread stubs and VdSwap.
+//
+// Modes:
+//   Fiber - cooperative: every guest thread is a fiber on the main host thread
+//           and only runs when the main thread yields (VdSwap, resume, create).
+//   Host  - preemptive: every guest thread runs on its own host thread, so
+//           worker threads use other cores. Kernel stubs synchronize for real.
+//   Pool  - M:N: guest threads are fibers multiplexed onto a small pool of
+//           host worker threads, each with its own run queue. Idle workers
+//           steal from busy ones. Priority and affinity are scheduling hints.
+//           The main thread keeps its own host thread.
+enum class ThreadMode
+{
+    Fiber,
+    Host,
+    Pool,
+};
+
+// Pick the mode before the first ExCreateThread. Also converts the calling
+// (main) thread to a fiber. pool_workers is the Pool mode worker count
+// (0 = one per host core minus main, at most one per Xbox 360 hardware thread).
+// Returns false if fiber setup fails in Fiber / Pool mode.
+bool scheduler_init(ThreadMode mode, int pool_workers = 0);
+ThreadMode scheduler_mode();
+const char* scheduler_mode_name(ThreadMode mode);
+
+// Parse "fiber" / "host" / "pool[:N]" (from --threads=). *pool_workers is set
+// to N, or 0 if not given. Returns false if unknown.
+bool scheduler_parse_mode(const char* name, ThreadMode* mode, int* pool_workers);
+
+// ExCreateThread: register a thread and start it unless suspended. The new
+// thread inherits r2 from `parent` and gets a (possibly reused) 256 KB stack,
+// with its own KPCR / KTHREAD pair above it: the KPCR is copied from the
+// parent's (r13) and points at the new, zeroed KTHREAD. Returns false if the
+// guest thread stack area is exhausted.
+bool scheduler_create_thread(PPCContext& parent, uint8_t* base, uint32_t handle,
+                             uint32_t start_routine, uint32_t start_context,
+                             uint32_t api_startup, bool suspended);
+
+// NtResumeThread / KeResumeThread: returns false if no suspended thread has
+// this handle.
+bool scheduler_resume_thread(uint32_t handle);
+
+// ExTerminateThread: never returns to the calling guest code when called
+// from a guest thread. Returns immediately on the main thread.
+void scheduler_exit_thread();
+
+// True when called from a thread created by ExCreateThread (not main).
+bool scheduler_in_guest_thread();
+
+// Nonzero id of the calling guest thread, stable across Pool mode worker
+// migrations. Host threads that aren't guest threads (main, GPU) get their
+// own ids. Used as the owner of guest locks.
+uint32_t scheduler_thread_id();
+
+// Guest KTHREAD address of the calling thread (what r13 + 0x100 points at),
+// for owner fields guest code may compare against. Host threads without one
+// (GPU) get their scheduler_thread_id(), which can't collide with an address.
+uint32_t scheduler_thread_object();
+
+// KeSetBasePriorityThread / KeSetAffinityThread. Stored for every mode but
+// only Pool mode acts on them: higher priorities are dequeued first, and an
+// affinity naming a single hardware thread keeps the thread on one worker
+// unless it has waited too long. Return the previous value (0 / 0 if the
+// handle isn't a guest thread).
+int32_t scheduler_set_priority(uint32_t handle, int32_t priority);
+uint32_t scheduler_set_affinity(uint32_t handle, uint32_t affinity);
+
+// KeTls* slot values. Every guest thread has its own set, reached through the
+// current thread pointer; host threads that aren't guest threads (main, GPU)
+// get one each too. New threads start with every slot 0. Values are mirrored
+// into the thread's KTHREAD at PPC_KTHREAD_TLS_OFFSET for guest code that
+// reads them directly (main: the KTHREAD at PPC_KTHREAD_BASE; other host
+// threads aren't mirrored). index must be below SCHEDULER_TLS_SLOTS.
+constexpr int SCHEDULER_TLS_SLOTS = 64;
+uint32_t scheduler_tls_get(uint32_t index);
+void scheduler_tls_set(uint8_t* base, uint32_t index, uint32_t value);
+// KeTlsAlloc / KeTlsFree: set the slot back to 0 in every thread.
+void scheduler_tls_reset(uint8_t* base, uint32_t index);
+
+// Give up the CPU: a guest fiber switches back to the main fiber (Fiber) or
+// its worker (Pool), a host thread yields its time slice.
+void scheduler_yield();
+
+// KeDelayExecutionThread. interval is in 100 ns units, negative = relative.
+// Every thread parks until the deadline (guest fibers on the timer wheel), so
+// sub-millisecond delays are honoured. Zero and absolute times yield.
+void scheduler_delay(int64_t interval);
+
+// Parking, for kernel object waits. A waiter is the calling guest thread, or
+// a per-host-thread stand-in for the main / GPU threads.
+//   Fiber / Pool mode fibers switch out and aren't run again until unparked.
+//   The Fiber mode main thread runs ready fibers until it is unparked.
+//   Host threads block.
+// A park can return early (a wake meant for an earlier park, or a stale
+// timer), so callers re-check their condition and park again.
+// deadline_ns is on the scheduler_now_ns() clock, INT64_MAX for none.
+GuestThread* scheduler_current_waiter();
+int64_t scheduler_now_ns();
+void scheduler_park(GuestThread* self, int64_t deadline_ns);
+// Safe from any thread, and before the waiter has finished parking.
+void scheduler_unpark(GuestThread* waiter);
+
+// Wake the Fiber mode main thread if it sleeps waiting for a fiber to become
+// ready, so it gets to a sync point (replay_post).
+void scheduler_wake_main();
+
+// A waiter was resumed but its wait still wasn't satisfied (frame report).
+void scheduler_note_wasted_slice();
+
+// VdSwap: give every ready (not parked) fiber a time slice (Fiber mode) and
+// account the frame's work time. scheduler_frame_end() is called after the
+// frame limiter.
+void scheduler_frame_begin();
+void scheduler_frame_end();
+
+// Telemetry. Every thread counts its slices (the stretches it runs between
+// being scheduled and stopping), the time spent in them, why each one ended,
+// and how long it then stayed blocked in a delay or wait. Host threads (main,
+// GPU) count the time between their stops the same way; the main thread's
+// slice ends at VdSwap.
+enum SchedStop
+{
+    SCHED_STOP_YIELD,     // scheduler_yield: spin-waits, --waits=yield
+    SCHED_STOP_DELAY,     // KeDelayExecutionThread
+    SCHED_STOP_WAIT,      // kernel object waits
+    SCHED_STOP_VDSWAP,    // VdSwap
+    SCHED_STOP_TERMINATE, // returned or ExTerminateThread
+    SCHED_STOP_COUNT,
+};
+
+struct ThreadTelemetry
+{
+    int      idx;        // thread table slot, -1 = host thread
+    uint32_t handle;     // 0 for host threads
+    bool     main;       // the thread that called scheduler_init
+    uint64_t run_ns;     // includes the slice in progress
+    uint64_t slices;
+    uint64_t stops[SCHED_STOP_COUNT];
+    uint64_t blocked_ns;
+};
+
+// Totals since each live thread started: host threads first (main first),
+// then guest threads by slot. Fills up to `max` and returns how many there are.
+int scheduler_telemetry(ThreadTelemetry* out, int max);
+
+// --sched-csv=: append one row per live thread per frame (the frame's share
+// of each counter) to `path`. Returns false if it can't be created.
+bool scheduler_open_csv(const char* path);
@@ -0,0 +1,342 @@
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+// ============================================================================
+// Wheel
+// ============================================================================
+
+static constexpr int WHEEL_LEVELS = 4;
+static constexpr int WHEEL_SLOT_BITS = 6;
+static constexpr int WHEEL_SLOTS = 1 << WHEEL_SLOT_BITS;
+static constexpr int WHEEL_TICK_SHIFT = 10; // timebase ticks per wheel tick = 1024 (~20 us)
+
+// Furthest a timer can be filed ahead of the current tick
+static constexpr uint64_t WHEEL_RANGE = 1ull << (WHEEL_SLOT_BITS * WHEEL_LEVELS);
+
+struct Wheel
+{
+    // Ticks before `tick` are fully expired, and the cascades for `tick` are done
+    uint64_t    tick;
+    WheelTimer* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t    occupied[WHEEL_LEVELS]; // bit per non-empty slot
+};
+
+static std::mutex g_wheel_lock;
+// Never destroyed: the timer thread is still waiting on it at exit
+static std::condition_variable& g_wheel_cv = *new std::condition_variable;
+static Wheel g_wheel;
+static bool g_wheel_started = false;
+static uint64_t g_wheel_sleep_until = UINT64_MAX; // timebase the timer thread sleeps until
+
+uint64_t timer_now()
+{
+    return timer_from_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static void wheel_link(WheelTimer* t, int level, int slot)
+{
+    WheelTimer*& head = g_wheel.slots[level][slot];
+    t->level = level;
+    t->slot = slot;
+    t->prev = nullptr;
+    t->next = head;
+    if (head)
+        head->prev = t;
+    head = t;
+    g_wheel.occupied[level] |= 1ull << slot;
+}
+
+static void wheel_unlink(WheelTimer* t)
+{
+    WheelTimer*& head = g_wheel.slots[t->level][t->slot];
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        head = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    if (!head)
+        g_wheel.occupied[t->level] &= ~(1ull << t->slot);
+    t->level = -1;
+}
+
+// File a timer by how far ahead of the current tick it expires
+static void wheel_insert(WheelTimer* t)
+{
+    uint64_t tick = t->expires >> WHEEL_TICK_SHIFT;
+    if (tick < g_wheel.tick)
+        tick = g_wheel.tick;
+    if (tick - g_wheel.tick >= WHEEL_RANGE)
+        tick = g_wheel.tick + WHEEL_RANGE - 1; // re-filed with its real expiry on cascade
+    uint64_t delta = tick - g_wheel.tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_SLOT_BITS * (level + 1))))
+        level++;
+    wheel_link(t, level, (int)((tick >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1)));
+}
+
+// g_wheel.tick has just entered a new level 0 block: re-file the level 1 slot
+// that now comes up, and higher levels whenever the one below wrapped
+static void wheel_cascade()
+{
+    for (int level = 1; level < WHEEL_LEVELS; level++)
+    {
+        int idx = (int)((g_wheel.tick >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1));
+        WheelTimer* t = g_wheel.slots[level][idx];
+        g_wheel.slots[level][idx] = nullptr;
+        g_wheel.occupied[level] &= ~(1ull << idx);
+        while (t)
+        {
+            WheelTimer* next = t->next;
+            wheel_insert(t);
+            t = next;
+        }
+        if (idx != 0)
+            break;
+    }
+}
+
+struct FiredTimer
+{
+    TimerCallback callback;
+    void*    param;
+    uint32_t tag;
+    uint64_t expires;
+};
+
+// Take the timers in a level 0 slot that expire at or before `now`
+static void wheel_expire_slot(int slot, uint64_t now, std::vector<FiredTimer>& fired)
+{
+    WheelTimer* t = g_wheel.slots[0][slot];
+    while (t)
+    {
+        WheelTimer* next = t->next;
+        if (t->expires <= now)
+        {
+            wheel_unlink(t);
+            fired.push_back({t->callback, t->param, t->tag, t->expires});
+        }
+        t = next;
+    }
+}
+
+static bool wheel_empty()
+{
+    for (uint64_t bits : g_wheel.occupied)
+    {
+        if (bits)
+            return false;
+    }
+    return true;
+}
+
+// Expire everything up to `now` (guest timebase)
+static void wheel_advance(uint64_t now, std::vector<FiredTimer>& fired)
+{
+    uint64_t now_tick = now >> WHEEL_TICK_SHIFT;
+    while (g_wheel.tick < now_tick)
+    {
+        if (wheel_empty())
+        {
+            g_wheel.tick = now_tick;
+            break;
+        }
+        wheel_expire_slot((int)(g_wheel.tick & (WHEEL_SLOTS - 1)), UINT64_MAX, fired);
+        g_wheel.tick++;
+        int idx = (int)(g_wheel.tick & (WHEEL_SLOTS - 1));
+        if (idx == 0)
+        {
+            wheel_cascade();
+        }
+        else if ((g_wheel.occupied[0] >> idx) == 0)
+        {
+            // Nothing left in this level 0 block: skip to its end
+            uint64_t block_end = (g_wheel.tick | (WHEEL_SLOTS - 1)) + 1;
+            if (block_end <= now_tick)
+            {
+                g_wheel.tick = block_end;
+                wheel_cascade();
+            }
+            else
+            {
+                g_wheel.tick = now_tick;
+            }
+        }
+    }
+    // The current tick may be partly due
+    wheel_expire_slot((int)(g_wheel.tick & (WHEEL_SLOTS - 1)), now, fired);
+}
+
+static int rotate_ctz(uint64_t bits, int from)
+{
+    uint64_t rotated = from ? (bits >> from) | (bits << (WHEEL_SLOTS - from)) : bits;
+    return __builtin_ctzll(rotated);
+}
+
+// Timebase at which the timer thread next has work: the nearest level 0
+// expiry, or the nearest cascade of a higher level
+static uint64_t wheel_next_event()
+{
+    uint64_t best = UINT64_MAX;
+    if (g_wheel.occupied[0])
+    {
+        int cur = (int)(g_wheel.tick & (WHEEL_SLOTS - 1));
+        int slot = (cur + rotate_ctz(g_wheel.occupied[0], cur)) & (WHEEL_SLOTS - 1);
+        for (WheelTimer* t = g_wheel.slots[0][slot]; t; t = t->next)
+        {
+            if (t->expires < best)
+                best = t->expires;
+        }
+    }
+    for (int level = 1; level < WHEEL_LEVELS; level++)
+    {
+        if (!g_wheel.occupied[level])
+            continue;
+        int shift = WHEEL_SLOT_BITS * level;
+        // The current slot of a level was cascaded on entry, so the nearest
+        // one is at least one block ahead
+        int cur = (int)((g_wheel.tick >> shift) & (WHEEL_SLOTS - 1));
+        int dist = rotate_ctz(g_wheel.occupied[level], (cur + 1) & (WHEEL_SLOTS - 1)) + 1;
+        uint64_t cascade_tick = ((g_wheel.tick >> shift) + dist) << shift;
+        uint64_t at = cascade_tick << WHEEL_TICK_SHIFT;
+        if (at < best)
+            best = at;
+    }
+    return best;
+}
+
+// ============================================================================
+// Jitter statistics: how late timers fire relative to their expiry
+// ============================================================================
+
+static constexpr int JITTER_BUCKETS = 5;
+static constexpr uint64_t JITTER_BUCKET_US[JITTER_BUCKETS - 1] = {20, 100, 500, 2000};
+
+static std::atomic<uint64_t> g_jitter_fired{0};
+static std::atomic<uint64_t> g_jitter_ns_sum{0};
+static std::atomic<uint64_t> g_jitter_ns_max{0};
+static std::atomic<uint64_t> g_jitter_buckets[JITTER_BUCKETS];
+
+static void jitter_record(uint64_t late_ns)
+{
+    g_jitter_fired++;
+    g_jitter_ns_sum += late_ns;
+    uint64_t max = g_jitter_ns_max.load(std::memory_order_relaxed);
+    while (late_ns > max && !g_jitter_ns_max.compare_exchange_weak(max, late_ns))
+        ;
+    int bucket = 0;
+    while (bucket < JITTER_BUCKETS - 1 && late_ns >= JITTER_BUCKET_US[bucket] * 1000)
+        bucket++;
+    g_jitter_buckets[bucket]++;
+}
+
+void timer_stats_report()
+{
+    uint64_t fired = g_jitter_fired.exchange(0);
+    uint64_t sum = g_jitter_ns_sum.exchange(0);
+    uint64_t max = g_jitter_ns_max.exchange(0);
+    uint64_t buckets[JITTER_BUCKETS];
+    for (int i = 0; i < JITTER_BUCKETS; i++)
+        buckets[i] = g_jitter_buckets[i].exchange(0);
+    if (!fired)
+        return;
+    auto pct = [fired](uint64_t n) { return 100.0 * n / fired; };
+    fprintf(stderr, "[SCHED] timers: %llu fired, late %.1f us avg / %.1f us max "
+                    "(<20us %.0f%%, <100us %.0f%%, <500us %.0f%%, <2ms %.0f%%, more %.0f%%)\n",
+            (unsigned long long)fired, sum / 1000.0 / fired, max / 1000.0,
+            pct(buckets[0]), pct(buckets[1]), pct(buckets[2]), pct(buckets[3]), pct(buckets[4]));
+}
+
+// ============================================================================
+// Timer thread
+// ============================================================================
+
+static void timer_thread_proc()
+{
+#ifdef __linux__
+    // Default timer slack (50 us) would dominate the jitter
+    prctl(PR_SET_TIMERSLACK, 1UL);
+#endif
+    std::vector<FiredTimer> fired;
+    std::unique_lock<std::mutex> lock(g_wheel_lock);
+    for (;;)
+    {
+        uint64_t now = timer_now();
+        wheel_advance(now, fired);
+        if (!fired.empty())
+        {
+            lock.unlock();
+            for (const FiredTimer& f : fired)
+            {
+                jitter_record(timer_to_ns(now - f.expires));
+                f.callback(f.param, f.tag);
+            }
+            fired.clear();
+            lock.lock();
+            continue;
+        }
+
+        g_wheel_sleep_until = wheel_next_event();
+        if (g_wheel_sleep_until == UINT64_MAX)
+            g_wheel_cv.wait(lock);
+        else
+            g_wheel_cv.wait_until(lock, std::chrono::steady_clock::time_point(
+                                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                std::chrono::nanoseconds(timer_to_ns(g_wheel_sleep_until)))));
+        g_wheel_sleep_until = UINT64_MAX;
+    }
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+void timer_init(WheelTimer* timer, TimerCallback callback, void* param)
+{
+    timer->callback = callback;
+    timer->param = param;
+    timer->tag = 0;
+    timer->expires = 0;
+    timer->prev = timer->next = nullptr;
+    timer->level = -1;
+    timer->slot = 0;
+}
+
+void timer_arm(WheelTimer* timer, uint64_t expires, uint32_t tag)
+{
+    std::lock_guard<std::mutex> lock(g_wheel_lock);
+    if (!g_wheel_started)
+    {
+        g_wheel.tick = timer_now() >> WHEEL_TICK_SHIFT;
+        g_wheel_started = true;
+        std::thread(timer_thread_proc).detach();
+    }
+    if (timer->level >= 0)
+        wheel_unlink(timer);
+    timer->expires = expires;
+    timer->tag = tag;
+    wheel_insert(timer);
+    if (expires < g_wheel_sleep_until)
+        g_wheel_cv.notify_one();
+}
+
+bool timer_cancel(WheelTimer* timer)
+{
+    std::lock_guard<std::mutex> lock(g_wheel_lock);
+    if (timer->level < 0)
+        return false;
+    wheel_unlink(timer);
+    return true;
+}
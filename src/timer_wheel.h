@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+// Hierarchical timer wheel on the guest timebase, serviced by one host thread.
+//
+// Four levels of 64 slots. A level 0 slot is one wheel tick (1024 timebase
+// ticks, ~20 us); each level above is 64 times coarser, so the wheel spans
+// ~5.7 minutes and later timers wait in level 3 until it cascades. Arming and
+// cancelling are O(1); a timer in a higher level is re-filed once per level
+// as its slot comes up. The service thread sleeps until the nearest expiry
+// (or the next cascade) rather than polling, and runs callbacks without the
+// wheel lock held, so a callback may re-arm its own timer.
+
+// Xbox 360 timebase frequency (what KeQueryPerformanceFrequency reports)
+constexpr uint64_t GUEST_TIMEBASE_HZ = 50000000;
+constexpr uint64_t TIMEBASE_NS_PER_TICK = 1000000000 / GUEST_TIMEBASE_HZ; // 20
+
+// Current guest timebase, derived from the host monotonic clock.
+uint64_t timer_now();
+
+// Conversions: NT intervals (100 ns units) and host nanoseconds
+constexpr uint64_t timer_from_100ns(uint64_t t) { return t * 100 / TIMEBASE_NS_PER_TICK; }
+constexpr uint64_t timer_from_ns(uint64_t ns)   { return (ns + TIMEBASE_NS_PER_TICK - 1) / TIMEBASE_NS_PER_TICK; }
+constexpr uint64_t timer_to_ns(uint64_t t)      { return t * TIMEBASE_NS_PER_TICK; }
+
+// Runs on the timer thread. `tag` is the value given to timer_arm, so the
+// owner can tell a fire that raced with a cancel or re-arm.
+typedef void (*TimerCallback)(void* param, uint32_t tag);
+
+struct WheelTimer
+{
+    TimerCallback callback;
+    void*    param;
+
+    // Owned by the wheel
+    uint32_t tag;
+    uint64_t expires;  // guest timebase
+    WheelTimer* prev;
+    WheelTimer* next;
+    int      level;    // -1 = not armed
+    int      slot;
+};
+
+void timer_init(WheelTimer* timer, TimerCallback callback, void* param);
+
+// Arm (or re-arm) to fire at `expires` (guest timebase). Times in the past
+// fire at once.
+void timer_arm(WheelTimer* timer, uint64_t expires, uint32_t tag);
+
+// Returns true if the timer was armed. The callback may still run once if it
+// was already being fired.
+bool timer_cancel(WheelTimer* timer);
+
+// Print and reset the wakeup jitter statistics ([SCHED] frame report).
+void timer_stats_report();
@@ -0,0 +1,309 @@
+#include "vm_regions.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// ============================================================================
+// Region map
+// ============================================================================
+
+static constexpr uint32_t VM_PAGE_SIZE = 0x1000;
+
+struct Region
+{
+    uint32_t end;
+    uint32_t alloc_base;
+    uint32_t alloc_protect;
+    uint32_t state;   // X_MEM_STATE_COMMIT or X_MEM_STATE_RESERVE
+    uint32_t protect; // 0 unless committed
+    uint32_t type;
+};
+
+// What the host mapping allows
+enum HostAccess
+{
+    HOST_NONE,
+    HOST_READ,
+    HOST_READ_WRITE,
+};
+
+static uint8_t* g_base = nullptr;
+static std::mutex g_region_lock;
+static std::map<uint32_t, Region> g_regions; // by start; guarded by g_region_lock
+
+static uint32_t page_down(uint32_t addr)
+{
+    return addr & ~(VM_PAGE_SIZE - 1);
+}
+
+static uint32_t page_up(uint64_t addr)
+{
+    return (uint32_t)std::min<uint64_t>((addr + VM_PAGE_SIZE - 1) & ~(uint64_t)(VM_PAGE_SIZE - 1),
+                                        0xFFFFF000u);
+}
+
+static HostAccess host_access(const Region& r)
+{
+    // Only committed pages are trapped
+    if (r.state != X_MEM_STATE_COMMIT)
+        return HOST_READ_WRITE;
+    switch (r.protect & 0xFF)
+    {
+    case X_PAGE_NOACCESS:
+        return HOST_NONE;
+    case X_PAGE_READONLY:
+    case X_PAGE_EXECUTE:
+    case X_PAGE_EXECUTE_READ:
+        return HOST_READ;
+    default:
+        return HOST_READ_WRITE;
+    }
+}
+
+static void host_protect(uint32_t start, uint32_t end, HostAccess access)
+{
+    if (!g_base)
+        return;
+#ifdef _WIN32
+    static const DWORD flags[] = {PAGE_NOACCESS, PAGE_READONLY, PAGE_READWRITE};
+    DWORD old;
+    bool ok = VirtualProtect(g_base + start, end - start, flags[access], &old) != 0;
+#else
+    static const uint32_t host_page = (uint32_t)sysconf(_SC_PAGESIZE);
+    if ((start | end) & (host_page - 1))
+    {
+        // Guest pages smaller than host pages can't be protected apart
+        static std::atomic<bool> logged{false};
+        if (!logged.exchange(true))
+            fprintf(stderr, "[MEM] Host pages are %u bytes, protection of smaller guest ranges is ignored\n",
+                    host_page);
+        return;
+    }
+    static const int flags[] = {PROT_NONE, PROT_READ, PROT_READ | PROT_WRITE};
+    bool ok = mprotect(g_base + start, end - start, flags[access]) == 0;
+#endif
+    if (!ok)
+        fprintf(stderr, "[MEM] Can't protect 0x%08X-0x%08X on the host\n", start, end);
+}
+
+// Make a region boundary fall at `addr`
+static void split_at(uint32_t addr)
+{
+    auto it = g_regions.upper_bound(addr);
+    if (it == g_regions.begin())
+        return;
+    --it;
+    if (it->first < addr && addr < it->second.end)
+    {
+        Region tail = it->second;
+        it->second.end = addr;
+        g_regions.emplace_hint(std::next(it), addr, tail);
+    }
+}
+
+static bool same_attributes(const Region& a, const Region& b)
+{
+    return a.alloc_base == b.alloc_base && a.alloc_protect == b.alloc_protect &&
+           a.state == b.state && a.protect == b.protect && a.type == b.type;
+}
+
+// Merge matching neighbours from the region before `start` to the one at `end`
+static void coalesce(uint32_t start, uint32_t end)
+{
+    auto it = g_regions.lower_bound(start);
+    if (it != g_regions.begin())
+        --it;
+    while (it != g_regions.end() && it->first <= end)
+    {
+        auto next = std::next(it);
+        if (next == g_regions.end())
+            break;
+        if (it->second.end == next->first && same_attributes(it->second, next->second))
+        {
+            it->second.end = next->second.end;
+            g_regions.erase(next);
+        }
+        else
+        {
+            it = next;
+        }
+    }
+}
+
+// Apply `update` to every stored region in [start, end), split to fit, and
+// keep the host mapping in step. `update` returns false to drop the region.
+template <typename Update>
+static void update_range(uint32_t start, uint32_t end, Update update)
+{
+    split_at(start);
+    split_at(end);
+    for (auto it = g_regions.lower_bound(start); it != g_regions.end() && it->first < end;)
+    {
+        HostAccess before = host_access(it->second);
+        Region region = it->second;
+        bool keep = update(region);
+        HostAccess after = keep ? host_access(region) : HOST_READ_WRITE;
+        if (before != after)
+            host_protect(it->first, region.end, after);
+        if (keep)
+        {
+            it->second = region;
+            ++it;
+        }
+        else
+        {
+            it = g_regions.erase(it);
+        }
+    }
+    coalesce(start, end);
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+void vm_region_init(uint8_t* base)
+{
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    g_base = base;
+    g_regions.clear();
+}
+
+void vm_region_map(uint32_t addr, uint32_t size, uint32_t protect, uint32_t type)
+{
+    uint32_t start = page_down(addr);
+    uint32_t end = page_up((uint64_t)addr + size);
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    update_range(start, end, [](Region&) { return false; });
+    g_regions[start] = {end, start, protect, X_MEM_STATE_COMMIT, protect, type};
+}
+
+void vm_region_reserve(uint32_t addr, uint32_t size, uint32_t protect)
+{
+    uint32_t start = page_down(addr);
+    uint32_t end = page_up((uint64_t)addr + size);
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    update_range(start, end, [](Region&) { return false; });
+    g_regions[start] = {end, start, protect, X_MEM_STATE_RESERVE, 0, X_MEM_TYPE_PRIVATE};
+}
+
+void vm_region_commit(uint32_t addr, uint32_t size, uint32_t protect)
+{
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    update_range(page_down(addr), page_up((uint64_t)addr + size), [protect](Region& r) {
+        r.state = X_MEM_STATE_COMMIT;
+        r.protect = protect;
+        return true;
+    });
+}
+
+void vm_region_decommit(uint32_t addr, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    update_range(page_down(addr), page_up((uint64_t)addr + size), [](Region& r) {
+        r.state = X_MEM_STATE_RESERVE;
+        r.protect = 0;
+        return true;
+    });
+}
+
+void vm_region_release(uint32_t addr, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    update_range(page_down(addr), page_up((uint64_t)addr + size), [](Region&) { return false; });
+}
+
+void vm_region_set_alloc_protect(uint32_t addr, uint32_t size, uint32_t protect)
+{
+    uint32_t start = page_down(addr);
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    update_range(start, page_up((uint64_t)addr + size), [start, protect](Region& r) {
+        if (r.alloc_base == start)
+            r.alloc_protect = protect;
+        return true;
+    });
+}
+
+bool vm_region_protect(uint32_t addr, uint32_t size, uint32_t protect, uint32_t* old)
+{
+    uint32_t start = page_down(addr);
+    uint32_t end = page_up((uint64_t)addr + std::max<uint32_t>(size, 1));
+    std::lock_guard<std::mutex> lock(g_region_lock);
+
+    // Every page has to be committed: walk the regions over the range
+    uint32_t covered = start;
+    auto it = g_regions.upper_bound(start);
+    if (it != g_regions.begin())
+        --it;
+    for (; it != g_regions.end() && covered < end; ++it)
+    {
+        if (it->second.end <= covered)
+            continue;
+        if (it->first > covered || it->second.state != X_MEM_STATE_COMMIT)
+            return false;
+        if (covered == start && old)
+            *old = it->second.protect;
+        covered = it->second.end;
+    }
+    if (covered < end)
+        return false;
+
+    if (protect & X_PAGE_GUARD)
+    {
+        static std::atomic<bool> logged{false};
+        if (!logged.exchange(true))
+            fprintf(stderr, "[MEM] PAGE_GUARD isn't emulated, guard pages are plain pages\n");
+    }
+    update_range(start, end, [protect](Region& r) {
+        r.protect = protect;
+        return true;
+    });
+    return true;
+}
+
+void vm_region_query(uint32_t addr, VmRegionInfo* info)
+{
+    uint32_t page = page_down(addr);
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    auto next = g_regions.upper_bound(page);
+    if (next != g_regions.begin())
+    {
+        auto it = std::prev(next);
+        const Region& r = it->second;
+        if (page < r.end)
+        {
+            *info = {page, r.alloc_base, r.alloc_protect, r.end - page, r.state, r.protect, r.type};
+            return;
+        }
+    }
+    // Free up to the next region, or the top of the address space
+    uint32_t end = next != g_regions.end() ? next->first : 0xFFFFF000u;
+    *info = {page, 0, 0, end > page ? end - page : VM_PAGE_SIZE, X_MEM_STATE_FREE, X_PAGE_NOACCESS, 0};
+}
+
+uint32_t vm_region_protect_of(uint32_t addr)
+{
+    VmRegionInfo info;
+    vm_region_query(addr, &info);
+    return info.state == X_MEM_STATE_COMMIT ? info.protect : 0;
+}
+
+size_t vm_region_count()
+{
+    std::lock_guard<std::mutex> lock(g_region_lock);
+    return g_regions.size();
+}
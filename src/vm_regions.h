@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Region map of the guest address space, for NtQueryVirtualMemory and
+// MmQueryAddressProtect.
+//
+// Regions are disjoint runs of pages with the same state, protection and
+// allocation, kept in an ordered map by start address (a red-black tree), so
+// finding the region holding an address is O(log n). Neighbours that match
+// are merged back together, so a region is as large as it can be. Unmapped
+// space isn't stored; a query there gets the free gap up to the next region.
+//
+// The guest heap (guest_heap.cpp) reports every reserve, commit, decommit and
+// release, with PAGE_READWRITE; the allocation stubs then apply the
+// protection the guest asked for. Protections that take access away
+// (PAGE_NOACCESS, read-only, execute-only) are applied to the host mapping
+// with mprotect / VirtualProtect, so a stray write faults instead of silently
+// landing. Reserved and free pages stay accessible on the host, as the
+// runtime doesn't trap them; decommitting or releasing a protected range
+// makes it accessible again before the heap reuses it.
+//
+// The image, stacks and kernel structures are mapped as fixed committed
+// regions at startup (vm_region_map).
+
+// Protect values (low bits) and flags
+constexpr uint32_t X_PAGE_NOACCESS          = 0x001;
+constexpr uint32_t X_PAGE_READONLY          = 0x002;
+constexpr uint32_t X_PAGE_READWRITE         = 0x004;
+constexpr uint32_t X_PAGE_WRITECOPY         = 0x008;
+constexpr uint32_t X_PAGE_EXECUTE           = 0x010;
+constexpr uint32_t X_PAGE_EXECUTE_READ      = 0x020;
+constexpr uint32_t X_PAGE_EXECUTE_READWRITE = 0x040;
+constexpr uint32_t X_PAGE_GUARD             = 0x100;
+constexpr uint32_t X_PAGE_NOCACHE           = 0x200;
+constexpr uint32_t X_PAGE_WRITECOMBINE      = 0x400;
+constexpr uint32_t X_PAGE_PROTECT_MASK      = 0x7FF;
+
+// MEMORY_BASIC_INFORMATION State / Type
+constexpr uint32_t X_MEM_STATE_COMMIT  = 0x00001000;
+constexpr uint32_t X_MEM_STATE_RESERVE = 0x00002000;
+constexpr uint32_t X_MEM_STATE_FREE    = 0x00010000;
+constexpr uint32_t X_MEM_TYPE_PRIVATE  = 0x00020000;
+constexpr uint32_t X_MEM_TYPE_IMAGE    = 0x01000000;
+
+// X_MEMORY_BASIC_INFORMATION, in guest order (seven u32s)
+struct VmRegionInfo
+{
+    uint32_t base;          // the queried address, page aligned
+    uint32_t alloc_base;
+    uint32_t alloc_protect;
+    uint32_t size;          // from base to the end of the region
+    uint32_t state;
+    uint32_t protect;
+    uint32_t type;
+};
+
+// Call once with the guest memory base, before anything is mapped.
+void vm_region_init(uint8_t* base);
+
+// A fixed committed region of its own (image, stacks).
+void vm_region_map(uint32_t addr, uint32_t size, uint32_t protect, uint32_t type);
+
+// Guest heap transitions, page aligned.
+void vm_region_reserve(uint32_t addr, uint32_t size, uint32_t protect);
+void vm_region_commit(uint32_t addr, uint32_t size, uint32_t protect);
+void vm_region_decommit(uint32_t addr, uint32_t size);
+void vm_region_release(uint32_t addr, uint32_t size);
+
+// The allocation at `addr` was asked for with `protect` (reported as its
+// AllocationProtect).
+void vm_region_set_alloc_protect(uint32_t addr, uint32_t size, uint32_t protect);
+
+// Change the protection of committed pages. Returns false, changing
+// nothing, if any page in the range isn't committed. `old` (optional) gets
+// the protection of the first page.
+bool vm_region_protect(uint32_t addr, uint32_t size, uint32_t protect, uint32_t* old = nullptr);
+
+// The region holding `addr` (or the free gap around it).
+void vm_region_query(uint32_t addr, VmRegionInfo* info);
+
+// Protection of the page holding `addr`, 0 if it isn't committed.
+uint32_t vm_region_protect_of(uint32_t addr);
+
+// Regions in the map (tools/vm_region_bench.cpp)
+size_t vm_region_count();
@@ -0,0 +1,205 @@
+// Directory scan benchmark for src/dir_listing.cpp. Lists one directory over
+// and over, the way the game rescans its data folders, two ways:
+//
+//   per open   what the stubs did before: readdir + stat every entry into a
+//              vector at open, then encode X_FILE_DIRECTORY_INFORMATION
+//              field by field into the query buffer
+//   listing    the cached listing: each query is a memcpy of the records
+//
+// and once more with a "*.bin" filter through the listing's index. Every
+// scan's output is decoded and counted; the filtered names are checked.
+//
+// Build:
+//   clang++ -std=c++20 -O2 -Isrc tools/dir_listing_bench.cpp src/dir_listing.cpp
+//           -o dir_listing_bench
+// Usage: dir_listing_bench [entries (default 500)] [query buffer bytes (default 4096)]
+
+#include "dir_listing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr int SCANS = 2000;
+static const char* ROOT = "dir_listing_bench.tmp";
+
+static double now_us()
+{
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void write_be32(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (24 - 8 * i));
+}
+
+static void write_be64(uint8_t* p, uint64_t v)
+{
+    write_be32(p, (uint32_t)(v >> 32));
+    write_be32(p + 4, (uint32_t)v);
+}
+
+static uint32_t read_be32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// The enumeration NtOpenFile did for every directory handle
+static void enumerate(std::vector<DirEntry>* entries)
+{
+    DIR* d = opendir(ROOT);
+    while (struct dirent* ent = readdir(d))
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        DirEntry de;
+        de.name = ent->d_name;
+        de.is_directory = ent->d_type == DT_DIR;
+        std::string full = std::string(ROOT) + "/" + de.name;
+        struct stat st;
+        de.size = stat(full.c_str(), &st) == 0 ? st.st_size : 0;
+        entries->push_back(de);
+    }
+    closedir(d);
+}
+
+// One NtQueryDirectoryFile the old way; returns bytes, 0 when nothing fits
+static uint32_t encode(const std::vector<DirEntry>& entries, size_t* index, uint8_t* dst, uint32_t capacity)
+{
+    uint32_t offset = 0, prev = 0;
+    bool first = true;
+    while (*index < entries.size())
+    {
+        const DirEntry& de = entries[*index];
+        uint32_t name_len = (uint32_t)de.name.size();
+        uint32_t entry_size = 0x40 + name_len;
+        uint32_t aligned = (entry_size + 7) & ~7u;
+        if (offset + entry_size > capacity)
+            break;
+        uint8_t* e = dst + offset;
+        memset(e, 0, offset + aligned <= capacity ? aligned : entry_size);
+        if (!first)
+            write_be32(dst + prev, offset - prev);
+        prev = offset;
+        write_be32(e + 0x04, (uint32_t)*index);
+        write_be64(e + 0x28, (uint64_t)de.size);
+        write_be64(e + 0x30, (uint64_t)de.size);
+        write_be32(e + 0x38, de.is_directory ? 0x10 : 0x80);
+        write_be32(e + 0x3C, name_len);
+        memcpy(e + 0x40, de.name.data(), name_len);
+        (*index)++;
+        first = false;
+        offset += aligned;
+    }
+    return std::min(offset, capacity);
+}
+
+// Names in one query's output
+static void decode(const uint8_t* buf, uint32_t bytes, std::vector<std::string>* names)
+{
+    for (uint32_t at = 0; at < bytes;)
+    {
+        uint32_t next = read_be32(buf + at);
+        names->emplace_back((const char*)buf + at + 0x40, read_be32(buf + at + 0x3C));
+        if (!next)
+            break;
+        at += next;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? std::max(1, atoi(argv[1])) : 500;
+    uint32_t capacity = argc > 2 ? (uint32_t)std::max(256, atoi(argv[2])) : 4096;
+
+    mkdir(ROOT, 0755);
+    std::vector<std::string> bins;
+    for (int i = 0; i < count; i++)
+    {
+        std::string name = "Asset_" + std::to_string(i) + (i % 3 ? ".BIN" : ".xpr");
+        FILE* fp = fopen((std::string(ROOT) + "/" + name).c_str(), "wb");
+        if (!fp)
+        {
+            fprintf(stderr, "could not write %s/%s\n", ROOT, name.c_str());
+            return 1;
+        }
+        fputs("asset", fp);
+        fclose(fp);
+        if (i % 3)
+            bins.push_back(name);
+    }
+
+    std::vector<uint8_t> buf(capacity);
+    std::vector<std::string> names;
+    uint64_t failures = 0;
+
+    double start = now_us();
+    for (int s = 0; s < SCANS; s++)
+    {
+        std::vector<DirEntry> entries;
+        enumerate(&entries);
+        names.clear();
+        size_t index = 0;
+        while (uint32_t bytes = encode(entries, &index, buf.data(), capacity))
+            decode(buf.data(), bytes, &names);
+        failures += names.size() != (size_t)count;
+    }
+    double per_open_us = (now_us() - start) / SCANS;
+
+    std::vector<DirEntry> entries;
+    enumerate(&entries);
+    DirListing listing;
+    dir_listing_build(entries, &listing);
+    start = now_us();
+    for (int s = 0; s < SCANS; s++)
+    {
+        names.clear();
+        size_t index = 0;
+        while (uint32_t bytes = dir_listing_copy(listing, nullptr, dir_listing_count(listing), &index,
+                                                 buf.data(), capacity))
+            decode(buf.data(), bytes, &names);
+        failures += names.size() != (size_t)count;
+    }
+    double listing_us = (now_us() - start) / SCANS;
+
+    std::vector<uint32_t> matches;
+    start = now_us();
+    for (int s = 0; s < SCANS; s++)
+    {
+        dir_listing_match(listing, "*.bin", 5, &matches);
+        names.clear();
+        size_t index = 0;
+        while (uint32_t bytes = dir_listing_copy(listing, matches.data(), matches.size(), &index,
+                                                 buf.data(), capacity))
+            decode(buf.data(), bytes, &names);
+        failures += names.size() != bins.size();
+    }
+    double filtered_us = (now_us() - start) / SCANS;
+    std::sort(names.begin(), names.end());
+    std::sort(bins.begin(), bins.end());
+    failures += names != bins;
+
+    printf("%d entries, %u byte query buffer\n", count, capacity);
+    printf("%-18s  %10s\n", "", "scan us");
+    printf("%-18s  %10.1f\n", "per open", per_open_us);
+    printf("%-18s  %10.1f\n", "listing", listing_us);
+    printf("%-18s  %10.1f\n", "listing, *.bin", filtered_us);
+    if (failures)
+        printf("%llu scans wrong\n", (unsigned long long)failures);
+
+    for (const DirEntry& de : entries)
+        remove((std::string(ROOT) + "/" + de.name).c_str());
+    rmdir(ROOT);
+    return failures ? 1 : 0;
+}
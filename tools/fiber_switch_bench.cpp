@@ -0,0 +1,172 @@
+// Context-switch microbenchmark for src/fiber.cpp.
+// Ping-pongs between the main fiber and one worker fiber and reports the cost
+// of a single switch for the runtime's fiber layer and for the native
+// alternatives on this platform: ucontext (swapcontext) on POSIX, Win32
+// SwitchToFiber on Windows. Also checks that MXCSR stays per-fiber, since the
+// guest threads run with different FPSCR flush modes.
+//
+// Build:
+//   clang++ -std=c++20 -O2 -Isrc tools/fiber_switch_bench.cpp src/fiber.cpp -o fiber_switch_bench
+// Usage: fiber_switch_bench [round_trips]
+
+#include "fiber.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <xmmintrin.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <ucontext.h>
+#endif
+
+static uint64_t g_round_trips = 10000000;
+static volatile uint64_t g_counter = 0;
+
+// ============================================================================
+// Runtime fiber layer
+// ============================================================================
+static Fiber* g_main = nullptr;
+static Fiber* g_worker = nullptr;
+
+static void layer_worker(void*)
+{
+    for (;;)
+    {
+        g_counter = g_counter + 1;
+        fiber_switch(g_main);
+    }
+}
+
+static double bench_layer()
+{
+    g_worker = fiber_create(0, layer_worker, nullptr);
+    if (!g_worker) return -1.0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < g_round_trips; i++)
+        fiber_switch(g_worker);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double)(g_round_trips * 2);
+}
+
+// Each fiber sets its own MXCSR; after a few round trips both must still see
+// their own value (the ABI makes MXCSR control bits callee-saved).
+static uint32_t g_worker_csr_seen = 0;
+static void csr_worker(void*)
+{
+    _mm_setcsr(0x9FC0); // FTZ | DAZ, like the guest's non-IEEE mode
+    for (;;)
+    {
+        g_worker_csr_seen = _mm_getcsr();
+        fiber_switch(g_main);
+    }
+}
+
+static bool check_mxcsr()
+{
+    Fiber* w = fiber_create(0, csr_worker, nullptr);
+    if (!w) return false;
+    _mm_setcsr(0x1F80);
+    bool ok = true;
+    for (int i = 0; i < 4; i++)
+    {
+        fiber_switch(w);
+        ok &= (_mm_getcsr() & 0xFFC0) == 0x1F80;
+        ok &= (g_worker_csr_seen & 0xFFC0) == 0x9FC0;
+    }
+    fiber_delete(w);
+    _mm_setcsr(0x1F80);
+    return ok;
+}
+
+// ============================================================================
+// Native baselines
+// ============================================================================
+#ifdef _WIN32
+static LPVOID g_win_main = nullptr;
+static LPVOID g_win_worker = nullptr;
+
+static void CALLBACK win32_worker(LPVOID)
+{
+    for (;;)
+    {
+        g_counter = g_counter + 1;
+        SwitchToFiber(g_win_main);
+    }
+}
+
+static double bench_native()
+{
+    // The layer already converted this thread; reuse that fiber.
+    g_win_main = GetCurrentFiber();
+    g_win_worker = CreateFiber(0, win32_worker, nullptr);
+    if (!g_win_worker) return -1.0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < g_round_trips; i++)
+        SwitchToFiber(g_win_worker);
+    auto end = std::chrono::steady_clock::now();
+    DeleteFiber(g_win_worker);
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double)(g_round_trips * 2);
+}
+static const char* kNativeName = "Win32 SwitchToFiber";
+#else
+static ucontext_t g_uc_main;
+static ucontext_t g_uc_worker;
+
+static void uc_worker()
+{
+    for (;;)
+    {
+        g_counter = g_counter + 1;
+        swapcontext(&g_uc_worker, &g_uc_main);
+    }
+}
+
+static double bench_native()
+{
+    static char stack[256 * 1024];
+    getcontext(&g_uc_worker);
+    g_uc_worker.uc_stack.ss_sp = stack;
+    g_uc_worker.uc_stack.ss_size = sizeof(stack);
+    g_uc_worker.uc_link = nullptr;
+    makecontext(&g_uc_worker, uc_worker, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < g_round_trips; i++)
+        swapcontext(&g_uc_main, &g_uc_worker);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double)(g_round_trips * 2);
+}
+static const char* kNativeName = "ucontext swapcontext";
+#endif
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        g_round_trips = strtoull(argv[1], nullptr, 10);
+
+    g_main = fiber_convert_thread();
+    if (!g_main)
+    {
+        fprintf(stderr, "fiber_convert_thread failed\n");
+        return 1;
+    }
+
+    printf("=== Fiber context switch (%llu round trips) ===\n", (unsigned long long)g_round_trips);
+    bool ok = check_mxcsr();
+    printf("  per-fiber MXCSR: %s\n", ok ? "preserved" : "FAIL");
+
+    double layer_ns = bench_layer();
+    double native_ns = bench_native();
+    printf("  %-24s %8.2f ns/switch\n", fiber_backend_name(), layer_ns);
+    printf("  %-24s %8.2f ns/switch\n", kNativeName, native_ns);
+    if (layer_ns > 0.0 && native_ns > 0.0)
+        printf("  speedup vs %s: %.2fx\n", kNativeName, native_ns / layer_ns);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+// Load-time and frame-hitch benchmark for overlapped NtReadFile
+// (src/file_io.cpp). Simulates a level load on the main thread: every frame
+// does a fixed slice of game work, and a loader streams a set of files in
+// 256 KB chunks, either reading them inline (how the stub behaved before:
+// the frame waits for the disk) or keeping a few reads queued on the I/O
+// workers and only collecting finished ones each frame. Prints the total
+// load time and the average and worst frame times for each.
+//
+// Runs cold (the files' cached pages dropped with posix_fadvise
+// DONTNEED first, Linux only) and warm.
+//
+// Build:
+//   clang++ -std=c++20 -O2 -Isrc tools/io_load_bench.cpp src/file_io.cpp src/host_file.cpp
+//           -o io_load_bench -lpthread
+// Usage: io_load_bench [workers (default 2)] [files... (default: 48 temporary 2 MB files)]
+
+#include "file_io.h"
+#include "host_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static constexpr uint32_t CHUNK = 256 * 1024;
+static constexpr double WORK_MS = 4.0;     // game work per frame
+static constexpr int SYNC_CHUNKS = 4;      // inline reads per frame
+static constexpr int QUEUE_DEPTH = 8;      // overlapped reads kept in flight
+
+struct Chunk
+{
+    HostFile* file;
+    int64_t offset;
+};
+
+struct LoadResult
+{
+    double load_ms;
+    int frames;
+    double frame_avg_ms;
+    double frame_max_ms;
+};
+
+static std::atomic<int> g_done_reads;
+
+static double now_ms()
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void spin_ms(double ms)
+{
+    double end = now_ms() + ms;
+    while (now_ms() < end)
+    {
+    }
+}
+
+static void read_done(void*, int64_t)
+{
+    g_done_reads++;
+}
+
+static void drop_cache(const std::vector<std::string>& paths)
+{
+#ifndef _WIN32
+    for (const std::string& path : paths)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)paths;
+#endif
+}
+
+static LoadResult run_load(const std::vector<Chunk>& chunks, bool async)
+{
+    std::vector<uint8_t> buf((size_t)CHUNK * QUEUE_DEPTH); // contents are thrown away
+    LoadResult r = {};
+    g_done_reads = 0;
+    size_t next = 0, submitted = 0;
+    double start = now_ms();
+    while ((size_t)g_done_reads < chunks.size())
+    {
+        double frame_start = now_ms();
+        spin_ms(WORK_MS);
+        if (async)
+        {
+            while (next < chunks.size() && submitted - (size_t)g_done_reads < QUEUE_DEPTH)
+            {
+                const Chunk& c = chunks[next];
+                file_io_submit(c.file, &buf[(next % QUEUE_DEPTH) * CHUNK], CHUNK, c.offset, read_done, nullptr);
+                next++;
+                submitted++;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < SYNC_CHUNKS && next < chunks.size(); i++, next++)
+            {
+                const Chunk& c = chunks[next];
+                host_file_read(c.file, buf.data(), CHUNK, c.offset);
+                g_done_reads++;
+            }
+        }
+        double frame_ms = now_ms() - frame_start;
+        r.frames++;
+        r.frame_avg_ms += frame_ms;
+        r.frame_max_ms = std::max(r.frame_max_ms, frame_ms);
+    }
+    r.load_ms = now_ms() - start;
+    r.frame_avg_ms /= r.frames;
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    int workers = argc > 1 ? std::max(1, atoi(argv[1])) : 2;
+    std::vector<std::string> paths;
+    bool temp = argc < 3;
+    if (temp)
+    {
+        std::vector<uint8_t> data(2 << 20);
+        std::mt19937 rng(7);
+        for (uint8_t& b : data)
+            b = (uint8_t)rng();
+        for (int i = 0; i < 48; i++)
+        {
+            std::string path = "io_load_bench." + std::to_string(i) + ".tmp";
+            FILE* fp = fopen(path.c_str(), "wb");
+            if (!fp)
+            {
+                fprintf(stderr, "could not write %s\n", path.c_str());
+                return 1;
+            }
+            fwrite(data.data(), 1, data.size(), fp);
+            fclose(fp);
+            paths.push_back(path);
+        }
+    }
+    else
+    {
+        paths.assign(argv + 2, argv + argc);
+    }
+
+    std::vector<HostFile> files(paths.size());
+    std::vector<Chunk> chunks;
+    int64_t total = 0;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        if (!host_file_open(paths[i].c_str(), &files[i]))
+        {
+            fprintf(stderr, "could not open %s\n", paths[i].c_str());
+            return 1;
+        }
+        for (int64_t off = 0; off < files[i].size; off += CHUNK)
+            chunks.push_back({&files[i], off});
+        total += files[i].size;
+    }
+    file_io_init(workers);
+
+    printf("%zu files, %.1f MB, %zu chunks; %.1f ms work per frame, %d I/O workers\n", paths.size(),
+           total / (1024.0 * 1024.0), chunks.size(), WORK_MS, workers);
+    printf("%-6s  %-10s  %10s  %7s  %12s  %12s\n", "cache", "reads", "load ms", "frames", "frame avg", "frame max");
+    for (int cold = 1; cold >= 0; cold--)
+    {
+        for (int async = 0; async < 2; async++)
+        {
+            if (cold)
+                drop_cache(paths);
+            LoadResult r = run_load(chunks, async != 0);
+            printf("%-6s  %-10s  %10.1f  %7d  %12.2f  %12.2f\n", cold ? "cold" : "warm",
+                   async ? "overlapped" : "inline", r.load_ms, r.frames, r.frame_avg_ms, r.frame_max_ms);
+        }
+    }
+
+    for (HostFile& f : files)
+        host_file_close(&f);
+    if (temp)
+    {
+        for (const std::string& path : paths)
+            remove(path.c_str());
+    }
+    return 0;
+}
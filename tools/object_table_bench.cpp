@@ -0,0 +1,191 @@
+// Handle table benchmark for src/object_table.cpp. Compares it with the file
+// handle table it replaced (a fixed array scanned for a free slot on open,
+// one mutex held around every lookup) on two loads:
+//
+//   churn   open / close with a number of handles already live, as during a
+//           level load (files, events and threads coming and going)
+//   lookup  every thread references and releases handles at random, as
+//           NtReadFile and the waits do from several guest threads at once
+//
+// Also checks that a closed handle no longer resolves once its slot is
+// reused.
+//
+// Build:
+//   clang++ -std=c++20 -O2 -Isrc tools/object_table_bench.cpp src/object_table.cpp
+//           -o object_table_bench -lpthread
+// Usage: object_table_bench [threads (default 4)] [live handles (default 100)]
+
+#include "object_table.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+static constexpr int CHURN = 2000000;
+static constexpr int LOOKUPS = 2000000; // per thread
+static constexpr int LEGACY_SLOTS = 128;
+static constexpr uint32_t LEGACY_BASE = 0x1000;
+
+static double now_us()
+{
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The previous file handle table
+struct LegacyTable
+{
+    struct Entry
+    {
+        bool used;
+        int64_t position;
+    };
+    Entry entries[LEGACY_SLOTS] = {};
+    std::mutex lock;
+
+    uint32_t alloc()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int i = 0; i < LEGACY_SLOTS; i++)
+        {
+            if (!entries[i].used)
+            {
+                entries[i].used = true;
+                return LEGACY_BASE + i;
+            }
+        }
+        return 0;
+    }
+
+    void free(uint32_t handle)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries[handle - LEGACY_BASE].used = false;
+    }
+
+    // Lookup and use, under the lock as the stubs held it
+    bool use(uint32_t handle)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        uint32_t i = handle - LEGACY_BASE;
+        if (handle < LEGACY_BASE || i >= LEGACY_SLOTS || !entries[i].used)
+            return false;
+        entries[i].position++;
+        return true;
+    }
+};
+
+struct Object
+{
+    std::atomic<int64_t> position{0};
+};
+
+static std::atomic<int> g_destroyed{0};
+
+static void destroy(void* object, uint32_t)
+{
+    delete (Object*)object;
+    g_destroyed++;
+}
+
+static bool use(uint32_t handle)
+{
+    void* object;
+    if (!ob_reference(handle, OB_TYPE_FILE, &object))
+        return false;
+    ((Object*)object)->position++;
+    ob_dereference(handle);
+    return true;
+}
+
+template <typename F>
+static double run_threads(int threads, F body)
+{
+    std::vector<std::thread> workers;
+    double start = now_us();
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back(body, t);
+    for (std::thread& w : workers)
+        w.join();
+    return now_us() - start;
+}
+
+int main(int argc, char** argv)
+{
+    int threads = argc > 1 ? std::max(1, atoi(argv[1])) : 4;
+    int live = argc > 2 ? std::clamp(atoi(argv[2]), 1, LEGACY_SLOTS - 1) : 100;
+    uint64_t failures = 0;
+
+    // Churn: `live` handles held, one more opened and closed repeatedly
+    LegacyTable legacy;
+    std::vector<uint32_t> legacy_live, table_live;
+    for (int i = 0; i < live; i++)
+    {
+        legacy_live.push_back(legacy.alloc());
+        table_live.push_back(ob_create(OB_TYPE_FILE, new Object, destroy));
+    }
+    double start = now_us();
+    for (int i = 0; i < CHURN; i++)
+    {
+        uint32_t h = legacy.alloc();
+        failures += !h;
+        legacy.free(h);
+    }
+    double legacy_churn_ns = (now_us() - start) * 1000.0 / CHURN;
+    start = now_us();
+    for (int i = 0; i < CHURN; i++)
+    {
+        uint32_t h = ob_create(OB_TYPE_FILE, new Object, destroy);
+        failures += !h;
+        ob_dereference(h);
+    }
+    double table_churn_ns = (now_us() - start) * 1000.0 / CHURN;
+
+    // Lookups from every thread over the live handles
+    double legacy_us = run_threads(threads, [&](int t) {
+        std::mt19937 rng(t);
+        for (int i = 0; i < LOOKUPS; i++)
+            if (!legacy.use(legacy_live[rng() % legacy_live.size()]))
+                abort();
+    });
+    double table_us = run_threads(threads, [&](int t) {
+        std::mt19937 rng(t);
+        for (int i = 0; i < LOOKUPS; i++)
+            if (!use(table_live[rng() % table_live.size()]))
+                abort();
+    });
+    double total = (double)LOOKUPS * threads;
+
+    // Stale handles: close one, churn its slot around, it must stay dead
+    uint32_t stale = table_live.back();
+    table_live.pop_back();
+    ob_dereference(stale);
+    for (int i = 0; i < OB_MAX_HANDLES * 2; i++)
+    {
+        uint32_t h = ob_create(OB_TYPE_FILE, new Object, destroy);
+        failures += h == stale || use(stale);
+        ob_dereference(h);
+    }
+    failures += ob_type_of(stale) != OB_TYPE_NONE;
+    failures += ob_reference(table_live[0], OB_TYPE_EVENT); // wrong type
+
+    for (uint32_t h : table_live)
+        ob_dereference(h);
+    failures += ob_count() != 0;
+    failures += g_destroyed != CHURN + live + OB_MAX_HANDLES * 2;
+
+    printf("%d live handles, %d threads\n", live, threads);
+    printf("%-14s  %14s  %14s\n", "", "open+close ns", "lookup ns");
+    printf("%-14s  %14.1f  %14.1f\n", "array + mutex", legacy_churn_ns, legacy_us * 1000.0 / total);
+    printf("%-14s  %14.1f  %14.1f\n", "object table", table_churn_ns, table_us * 1000.0 / total);
+    if (failures)
+        printf("%llu checks failed\n", (unsigned long long)failures);
+    return failures ? 1 : 0;
+}
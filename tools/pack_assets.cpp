@@ -0,0 +1,629 @@
+// Packs the extracted/ tree into one asset pack (src/asset_pack.h) for
+// --pack=path: a table of contents sorted by key hash, then every file's
+// contents at a page boundary. With a read-ahead trace (--read-ahead=path,
+// from a run on the loose files) the payloads go in the order the game first
+// opened or read them, so a stage load walks the pack front to back; files
+// the trace doesn't mention follow in path order. The pack is checked
+// against the tree after it's written.
+//
+// --bench builds a synthetic tree instead and loads every file of it, in a
+// shuffled "game" order, the way NtOpenFile / NtReadFile / NtClose do: from
+// the loose files through the path index (lookup, open, fstat, pread,
+// close), and from the pack (lookup in the mapping, one memcpy). Each is
+// timed warm and, with the page cache dropped by posix_fadvise DONTNEED
+// (Linux), cold. Every load is checked.
+//
+// Build:
+//   clang++ -std=c++20 -O2 -Isrc tools/pack_assets.cpp src/asset_pack.cpp src/path_index.cpp
+//           src/host_file.cpp -o pack_assets -lpthread
+// Usage: pack_assets <directory> <pack> [read-ahead trace]
+//        pack_assets --bench [files (default 2000)]
+
+#include "asset_pack.h"
+#include "host_file.h"
+#include "path_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#define rmdir(path) _rmdir(path)
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct Node
+{
+    std::string key;       // folded, as path_index.h makes them
+    std::string name;      // as on the host
+    std::string host_path;
+    bool is_directory;
+    uint64_t size;
+    std::vector<uint32_t> children; // nodes
+    uint32_t entry = 0;             // in the pack
+    uint64_t data_offset = 0;
+};
+
+static char fold_char(char c)
+{
+    if (c == '\\')
+        return '/';
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static std::string fold(const std::string& s)
+{
+    std::string out = s;
+    for (char& c : out)
+        c = fold_char(c);
+    return out;
+}
+
+static uint64_t align_up(uint64_t v)
+{
+    return (v + ASSET_PACK_ALIGN - 1) & ~(uint64_t)(ASSET_PACK_ALIGN - 1);
+}
+
+// ============================================================================
+// Tree
+// ============================================================================
+
+struct Tree
+{
+    std::vector<Node> nodes; // [0] is the root
+    std::unordered_map<std::string, uint32_t> by_key;
+};
+
+static void list_directory(const std::string& path, std::vector<Node>* found)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE find = FindFirstFileA((path + "/*").c_str(), &fd);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+            continue;
+        Node n;
+        n.name = fd.cFileName;
+        n.host_path = path + "/" + n.name;
+        n.is_directory = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        n.size = n.is_directory ? 0 : ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+        found->push_back(std::move(n));
+    } while (FindNextFileA(find, &fd));
+    FindClose(find);
+#else
+    DIR* d = opendir(path.c_str());
+    if (!d)
+        return;
+    while (struct dirent* ent = readdir(d))
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        Node n;
+        n.name = ent->d_name;
+        n.host_path = path + "/" + n.name;
+        struct stat st;
+        if (stat(n.host_path.c_str(), &st) != 0)
+            continue;
+        n.is_directory = S_ISDIR(st.st_mode);
+        n.size = n.is_directory ? 0 : (uint64_t)st.st_size;
+        found->push_back(std::move(n));
+    }
+    closedir(d);
+#endif
+}
+
+static void walk(Tree& tree, uint32_t dir)
+{
+    std::vector<Node> found;
+    list_directory(tree.nodes[dir].host_path, &found);
+    std::string prefix = tree.nodes[dir].key.empty() ? "" : tree.nodes[dir].key + "/";
+    for (Node& n : found)
+    {
+        n.key = prefix + fold(n.name);
+        auto [it, added] = tree.by_key.emplace(n.key, (uint32_t)tree.nodes.size());
+        if (!added)
+        {
+            // Names that differ only in case: the first one wins, as in the index
+            fprintf(stderr, "%s hidden by %s, not packed\n", n.host_path.c_str(),
+                    tree.nodes[it->second].host_path.c_str());
+            continue;
+        }
+        uint32_t idx = it->second;
+        tree.nodes[dir].children.push_back(idx);
+        tree.nodes.push_back(std::move(n));
+        if (tree.nodes[idx].is_directory)
+            walk(tree, idx);
+    }
+}
+
+static void scan(const char* root, Tree* tree)
+{
+    tree->nodes.clear();
+    tree->by_key.clear();
+    tree->nodes.push_back({"", "", root, true, 0, {}});
+    tree->by_key.emplace("", 0);
+    walk(*tree, 0);
+}
+
+// Node of a path in a read-ahead trace. Traces hold host paths
+// ("extracted/Data/x.bin", or "game.pak/Data/x.bin" from a packed run), so
+// leading components are dropped until the rest is a file in the tree.
+static int64_t trace_node(const Tree& tree, const std::string& path)
+{
+    std::string key = fold(path);
+    for (size_t at = 0; at < key.size();)
+    {
+        auto it = tree.by_key.find(key.substr(at));
+        if (it != tree.by_key.end() && !tree.nodes[it->second].is_directory)
+            return it->second;
+        size_t slash = key.find('/', at);
+        if (slash == std::string::npos)
+            break;
+        at = slash + 1;
+    }
+    return -1;
+}
+
+// Files in payload order: first use in the trace, then the rest by key
+static std::vector<uint32_t> payload_order(const Tree& tree, const char* trace_path)
+{
+    std::vector<uint32_t> order;
+    std::vector<bool> placed(tree.nodes.size(), false);
+    if (trace_path)
+    {
+        FILE* fp = fopen(trace_path, "r");
+        if (!fp)
+            fprintf(stderr, "could not read %s, packing in path order\n", trace_path);
+        char line[4096];
+        while (fp && fgets(line, sizeof(line), fp))
+        {
+            std::string s(line);
+            while (!s.empty() && (s.back() == '\n' || s.back() == '\r'))
+                s.pop_back();
+            // "S <path>" or "R <offset> <length> <path>"
+            size_t at = std::string::npos;
+            if (s.compare(0, 2, "S ") == 0)
+            {
+                at = 2;
+            }
+            else if (s.compare(0, 2, "R ") == 0)
+            {
+                size_t length_at = s.find(' ', 2);
+                if (length_at != std::string::npos)
+                    at = s.find(' ', length_at + 1);
+                if (at != std::string::npos)
+                    at++;
+            }
+            if (at == std::string::npos)
+                continue;
+            int64_t node = trace_node(tree, s.substr(at));
+            if (node >= 0 && !placed[node])
+            {
+                placed[node] = true;
+                order.push_back((uint32_t)node);
+            }
+        }
+        if (fp)
+            fclose(fp);
+    }
+    size_t traced = order.size();
+    std::vector<uint32_t> rest;
+    for (uint32_t i = 0; i < tree.nodes.size(); i++)
+    {
+        if (!tree.nodes[i].is_directory && !placed[i])
+            rest.push_back(i);
+    }
+    std::sort(rest.begin(), rest.end(),
+              [&tree](uint32_t a, uint32_t b) { return tree.nodes[a].key < tree.nodes[b].key; });
+    order.insert(order.end(), rest.begin(), rest.end());
+    if (trace_path)
+        printf("%zu files in trace order, %zu after them\n", traced, rest.size());
+    return order;
+}
+
+// ============================================================================
+// Writing
+// ============================================================================
+
+static bool copy_file(FILE* out, const Node& n, std::vector<uint8_t>& buf)
+{
+    FILE* in = fopen(n.host_path.c_str(), "rb");
+    if (!in)
+        return false;
+    uint64_t left = n.size;
+    while (left > 0)
+    {
+        size_t want = (size_t)std::min<uint64_t>(left, buf.size());
+        size_t got = fread(buf.data(), 1, want, in);
+        if (got != want || fwrite(buf.data(), 1, got, out) != got)
+        {
+            fclose(in);
+            return false;
+        }
+        left -= got;
+    }
+    fclose(in);
+    return true;
+}
+
+static bool write_pack(Tree& tree, const std::vector<uint32_t>& order, const char* pack_path)
+{
+    std::vector<Node>& nodes = tree.nodes;
+    uint32_t count = (uint32_t)nodes.size();
+
+    // Entries by (hash, key)
+    std::vector<uint64_t> hashes(count);
+    std::vector<uint32_t> by_hash(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        hashes[i] = asset_pack_hash(nodes[i].key.data(), nodes[i].key.size());
+        by_hash[i] = i;
+    }
+    std::sort(by_hash.begin(), by_hash.end(), [&](uint32_t a, uint32_t b) {
+        return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : nodes[a].key < nodes[b].key;
+    });
+    for (uint32_t e = 0; e < count; e++)
+        nodes[by_hash[e]].entry = e;
+
+    std::string strings;
+    std::vector<uint32_t> children;
+    std::vector<AssetPackEntry> entries(count);
+    for (uint32_t e = 0; e < count; e++)
+    {
+        Node& n = nodes[by_hash[e]];
+        AssetPackEntry& pe = entries[e];
+        memset(&pe, 0, sizeof(pe));
+        pe.hash = hashes[by_hash[e]];
+        pe.key_offset = (uint32_t)strings.size();
+        pe.key_length = (uint32_t)n.key.size();
+        strings += n.key;
+        pe.name_offset = (uint32_t)strings.size();
+        pe.name_length = (uint32_t)n.name.size();
+        strings += n.name;
+        if (n.is_directory)
+        {
+            pe.flags = ASSET_PACK_DIRECTORY;
+            std::sort(n.children.begin(), n.children.end(),
+                      [&nodes](uint32_t a, uint32_t b) { return nodes[a].key < nodes[b].key; });
+            pe.first_child = (uint32_t)children.size();
+            pe.child_count = (uint32_t)n.children.size();
+            for (uint32_t c : n.children)
+                children.push_back(nodes[c].entry);
+        }
+        pe.size = n.size;
+    }
+
+    AssetPackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ASSET_PACK_MAGIC, sizeof(header.magic));
+    header.version = ASSET_PACK_VERSION;
+    header.entry_count = count;
+    header.child_count = (uint32_t)children.size();
+    header.entries_offset = sizeof(AssetPackHeader);
+    header.children_offset = header.entries_offset + (uint64_t)count * sizeof(AssetPackEntry);
+    header.strings_offset = header.children_offset + children.size() * sizeof(uint32_t);
+    header.data_offset = align_up(header.strings_offset + strings.size());
+
+    uint64_t at = header.data_offset;
+    for (uint32_t i : order)
+    {
+        nodes[i].data_offset = at;
+        entries[nodes[i].entry].data_offset = at;
+        at = align_up(at + nodes[i].size);
+    }
+    header.total_size = at;
+
+    FILE* out = fopen(pack_path, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "could not write %s\n", pack_path);
+        return false;
+    }
+    std::vector<uint8_t> table(header.data_offset, 0);
+    memcpy(table.data(), &header, sizeof(header));
+    memcpy(table.data() + header.entries_offset, entries.data(), entries.size() * sizeof(AssetPackEntry));
+    memcpy(table.data() + header.children_offset, children.data(), children.size() * sizeof(uint32_t));
+    memcpy(table.data() + header.strings_offset, strings.data(), strings.size());
+    bool ok = fwrite(table.data(), 1, table.size(), out) == table.size();
+
+    std::vector<uint8_t> buf(1 << 20);
+    std::vector<uint8_t> zeros(ASSET_PACK_ALIGN, 0);
+    uint64_t pos = header.data_offset;
+    for (uint32_t i : order)
+    {
+        if (!ok)
+            break;
+        const Node& n = nodes[i];
+        if (!copy_file(out, n, buf))
+        {
+            fprintf(stderr, "could not read %s\n", n.host_path.c_str());
+            ok = false;
+            break;
+        }
+        uint64_t end = n.data_offset + n.size;
+        uint64_t pad = align_up(end) - end;
+        ok = fwrite(zeros.data(), 1, (size_t)pad, out) == pad;
+        pos = end + pad;
+    }
+    if (fclose(out) != 0 || pos != header.total_size)
+        ok = false;
+    if (!ok)
+    {
+        fprintf(stderr, "writing %s failed\n", pack_path);
+        remove(pack_path);
+    }
+    return ok;
+}
+
+// Every node through the runtime's reader, contents against the tree
+static bool verify_pack(const Tree& tree, const char* pack_path)
+{
+    AssetPack pack;
+    if (!asset_pack_open(pack_path, &pack))
+        return false;
+    uint64_t failures = 0;
+    std::vector<uint8_t> buf;
+    for (const Node& n : tree.nodes)
+    {
+        int64_t e = asset_pack_find(pack, n.key.data(), n.key.size());
+        if (e < 0 || e != n.entry)
+        {
+            failures++;
+            continue;
+        }
+        const AssetPackEntry& pe = pack.entries[e];
+        bool is_directory = (pe.flags & ASSET_PACK_DIRECTORY) != 0;
+        if (is_directory != n.is_directory || pe.size != n.size ||
+            std::string(pack.strings + pe.name_offset, pe.name_length) != n.name)
+        {
+            failures++;
+            continue;
+        }
+        if (is_directory)
+        {
+            failures += pe.child_count != n.children.size();
+            continue;
+        }
+        HostFile file;
+        buf.resize((size_t)n.size);
+        if (!host_file_open(n.host_path.c_str(), &file) ||
+            host_file_read(&file, buf.data(), (uint32_t)n.size, 0) != (int64_t)n.size ||
+            memcmp(buf.data(), pack.base + pe.data_offset, (size_t)n.size) != 0)
+            failures++;
+        host_file_close(&file);
+    }
+    asset_pack_close(&pack);
+    if (failures)
+        fprintf(stderr, "%s: %llu entries don't match the tree\n", pack_path, (unsigned long long)failures);
+    return failures == 0;
+}
+
+static bool pack(const char* root, const char* pack_path, const char* trace_path)
+{
+    Tree tree;
+    scan(root, &tree);
+    std::vector<uint32_t> order = payload_order(tree, trace_path);
+    if (!write_pack(tree, order, pack_path) || !verify_pack(tree, pack_path))
+        return false;
+    uint64_t bytes = 0;
+    for (const Node& n : tree.nodes)
+        bytes += n.size;
+    printf("%s: %zu entries, %zu files, %.1f MB of contents\n", pack_path, tree.nodes.size(), order.size(),
+           bytes / 1048576.0);
+    return true;
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+static const char* BENCH_ROOT = "pack_assets_bench.tmp";
+static const char* BENCH_PACK = "pack_assets_bench.pak.tmp";
+static const char* BENCH_TRACE = "pack_assets_bench.trace.tmp";
+
+static double now_us()
+{
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void drop_cache(const std::vector<std::string>& paths)
+{
+#ifndef _WIN32
+    for (const std::string& path : paths)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)paths;
+#endif
+}
+
+// Contents of bench file `i`, so every load can be checked
+static uint8_t bench_byte(uint32_t i, uint64_t at)
+{
+    return (uint8_t)(i * 131 + at * 7 + (at >> 9));
+}
+
+static bool check(const uint8_t* data, uint32_t i, uint64_t size)
+{
+    return size == 0 ||
+           (data[0] == bench_byte(i, 0) && data[size / 2] == bench_byte(i, size / 2) &&
+            data[size - 1] == bench_byte(i, size - 1));
+}
+
+// Every file in `order` the way the file stubs load it; returns failures
+static uint64_t load_loose(const std::vector<std::string>& guest, const std::vector<uint32_t>& order,
+                           std::vector<uint8_t>& buf)
+{
+    uint64_t failures = 0;
+    for (uint32_t i : order)
+    {
+        const PathEntry* pe = path_index_lookup(guest[i].data(), guest[i].size());
+        HostFile file;
+        if (!pe || !host_file_open(pe->host_path.c_str(), &file))
+        {
+            failures++;
+            continue;
+        }
+        int64_t n = host_file_read(&file, buf.data(), (uint32_t)file.size, 0);
+        failures += n != file.size || !check(buf.data(), i, (uint64_t)n);
+        host_file_close(&file);
+    }
+    return failures;
+}
+
+static uint64_t load_packed(const std::vector<std::string>& keys, const std::vector<uint32_t>& order,
+                            std::vector<uint8_t>& buf)
+{
+    AssetPack pack;
+    if (!asset_pack_open(BENCH_PACK, &pack))
+        return order.size();
+    uint64_t failures = 0;
+    for (uint32_t i : order)
+    {
+        int64_t e = asset_pack_find(pack, keys[i].data(), keys[i].size());
+        if (e < 0)
+        {
+            failures++;
+            continue;
+        }
+        HostFile file;
+        host_file_open_memory(pack.base + pack.entries[e].data_offset, (int64_t)pack.entries[e].size, &file);
+        int64_t n = host_file_read(&file, buf.data(), (uint32_t)file.size, 0);
+        failures += n != file.size || !check(buf.data(), i, (uint64_t)n);
+        host_file_close(&file);
+    }
+    asset_pack_close(&pack);
+    return failures;
+}
+
+static int bench(uint32_t files)
+{
+    // Mostly small files with a tail of large ones, 20 per directory
+    std::mt19937 rng(7);
+    std::vector<std::string> paths, guest, keys;
+    std::vector<uint64_t> sizes;
+    uint64_t total = 0, largest = 0;
+    mkdir(BENCH_ROOT, 0755);
+    for (uint32_t i = 0; i < files; i++)
+    {
+        std::string dir = "Stage" + std::to_string(i / 20);
+        if (i % 20 == 0)
+            mkdir((std::string(BENCH_ROOT) + "/" + dir).c_str(), 0755);
+        std::string rel = dir + "/Asset_" + std::to_string(i) + (i % 4 ? ".BIN" : ".xpr");
+        uint64_t size = rng() % 8 == 0 ? 64 * 1024 + rng() % (448 * 1024) : 512 + rng() % (15 * 1024);
+        paths.push_back(std::string(BENCH_ROOT) + "/" + rel);
+        guest.push_back("game:\\" + rel);
+        keys.push_back(fold(rel));
+        sizes.push_back(size);
+        total += size;
+        largest = std::max(largest, size);
+
+        std::vector<uint8_t> data((size_t)size);
+        for (uint64_t at = 0; at < size; at++)
+            data[at] = bench_byte(i, at);
+        FILE* fp = fopen(paths.back().c_str(), "wb");
+        if (!fp)
+        {
+            fprintf(stderr, "could not write %s\n", paths.back().c_str());
+            return 1;
+        }
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+    }
+
+    // The game's load order, as a read-ahead trace of one loose run
+    std::vector<uint32_t> order(files);
+    for (uint32_t i = 0; i < files; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    FILE* trace = fopen(BENCH_TRACE, "w");
+    if (!trace)
+    {
+        fprintf(stderr, "could not write %s\n", BENCH_TRACE);
+        return 1;
+    }
+    fprintf(trace, "S %s\n", paths[order[0]].c_str());
+    for (uint32_t i : order)
+        fprintf(trace, "R 0 %llu %s\n", (unsigned long long)sizes[i], paths[i].c_str());
+    fclose(trace);
+    if (!pack(BENCH_ROOT, BENCH_PACK, BENCH_TRACE))
+        return 1;
+    if (!path_index_mount("game:", BENCH_ROOT))
+        return 1;
+
+    std::vector<std::string> all = paths;
+    all.push_back(BENCH_PACK);
+    std::vector<uint8_t> buf((size_t)largest);
+    uint64_t failures = 0;
+    double ms[2][2]; // [loose, pack][cold, warm]
+    for (int packed = 0; packed < 2; packed++)
+    {
+        for (int warm = 0; warm < 2; warm++)
+        {
+            if (!warm)
+                drop_cache(all);
+            double start = now_us();
+            failures += packed ? load_packed(keys, order, buf) : load_loose(guest, order, buf);
+            ms[packed][warm] = (now_us() - start) / 1000.0;
+        }
+    }
+
+    printf("%u files, %.1f MB, loaded in a shuffled order\n", files, total / 1048576.0);
+    printf("%-8s  %10s  %10s\n", "", "cold ms", "warm ms");
+    printf("%-8s  %10.1f  %10.1f\n", "loose", ms[0][0], ms[0][1]);
+    printf("%-8s  %10.1f  %10.1f\n", "pack", ms[1][0], ms[1][1]);
+#ifdef _WIN32
+    printf("(no cache drop on Windows: cold runs are warm)\n");
+#endif
+    if (failures)
+        printf("%llu loads wrong\n", (unsigned long long)failures);
+
+    for (const std::string& path : paths)
+        remove(path.c_str());
+    for (uint32_t d = 0; d * 20 < files; d++)
+        rmdir((std::string(BENCH_ROOT) + "/Stage" + std::to_string(d)).c_str());
+    rmdir(BENCH_ROOT);
+    remove(BENCH_PACK);
+    remove(BENCH_TRACE);
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return bench(argc > 2 ? (uint32_t)std::max(1, atoi(argv[2])) : 2000);
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <directory> <pack> [read-ahead trace]\n"
+                        "       %s --bench [files]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return pack(argv[1], argv[2], argc > 3 ? argv[3] : nullptr) ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Open-latency benchmark for the game: path index in src/path_index.cpp.
+// Builds a tree of directories and files, then times resolving guest paths
+// and resolving + opening + closing them two ways: the way NtOpenFile did it
+// before (copy the name, map it to a host path, stat), and through the index
+// (fold and hash in place, no syscalls). Every lookup is checked.
+//
+// Build:
+//   clang++ -std=c++20 -O2 -Isrc tools/path_index_bench.cpp src/path_index.cpp src/asset_pack.cpp
+//           src/host_file.cpp -o path_index_bench -lpthread
+// Usage: path_index_bench [directories (default 40)] [files per directory (default 50)]
+
+#include "path_index.h"
+#include "host_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <unistd.h>
+#endif
+
+static constexpr int LOOKUPS = 200000;
+static constexpr int OPENS = 20000;
+static const char* ROOT = "path_index_bench.tmp";
+
+static double now_us()
+{
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What NtOpenFile did before: xbox_path_to_host + stat
+static bool resolve_stat(const char* name, size_t length, std::string* host_path)
+{
+    std::string path(name, length);
+    for (auto& c : path)
+        if (c == '\\') c = '/';
+    if (path.size() >= 5 && (path.substr(0, 5) == "game:" || path.substr(0, 5) == "GAME:"))
+    {
+        path = path.substr(5);
+        if (!path.empty() && path[0] == '/')
+            path = path.substr(1);
+        path = std::string(ROOT) + "/" + path;
+    }
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    *host_path = std::move(path);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int dirs = argc > 1 ? std::max(1, atoi(argv[1])) : 40;
+    int files = argc > 2 ? std::max(1, atoi(argv[2])) : 50;
+
+    std::vector<std::string> guest, host;
+    mkdir(ROOT, 0755);
+    for (int d = 0; d < dirs; d++)
+    {
+        std::string dir = "Stage" + std::to_string(d);
+        mkdir((std::string(ROOT) + "/" + dir).c_str(), 0755);
+        for (int f = 0; f < files; f++)
+        {
+            std::string name = "Asset_" + std::to_string(f) + ".BIN";
+            std::string path = std::string(ROOT) + "/" + dir + "/" + name;
+            FILE* fp = fopen(path.c_str(), "wb");
+            if (!fp)
+            {
+                fprintf(stderr, "could not write %s\n", path.c_str());
+                return 1;
+            }
+            fputs("asset", fp);
+            fclose(fp);
+            guest.push_back("game:\\" + dir + "\\" + name);
+            host.push_back(path);
+        }
+    }
+
+    double start = now_us();
+    if (!path_index_mount("game:", ROOT))
+    {
+        fprintf(stderr, "could not index %s\n", ROOT);
+        return 1;
+    }
+    double mount_ms = (now_us() - start) / 1000.0;
+
+    std::mt19937 rng(7);
+    std::vector<int> order(LOOKUPS);
+    for (int& i : order)
+        i = (int)(rng() % guest.size());
+
+    uint64_t misses = 0;
+    std::string resolved;
+    start = now_us();
+    for (int i : order)
+        misses += !resolve_stat(guest[i].data(), guest[i].size(), &resolved);
+    double stat_us = (now_us() - start) / LOOKUPS;
+
+    start = now_us();
+    for (int i : order)
+    {
+        const PathEntry* e = path_index_lookup(guest[i].data(), guest[i].size());
+        misses += !e;
+    }
+    double index_us = (now_us() - start) / LOOKUPS;
+
+    // Lower case still resolves through the index
+    for (int i = 0; i < 1000; i++)
+    {
+        std::string lower = guest[order[i]];
+        for (char& c : lower)
+            c = (char)tolower((unsigned char)c);
+        const PathEntry* e = path_index_lookup(lower.data(), lower.size());
+        misses += !e || e->host_path != host[order[i]];
+    }
+
+    HostFile file;
+    start = now_us();
+    for (int n = 0; n < OPENS; n++)
+    {
+        const std::string& g = guest[order[n]];
+        if (resolve_stat(g.data(), g.size(), &resolved) && host_file_open(resolved.c_str(), &file))
+            host_file_close(&file);
+        else
+            misses++;
+    }
+    double stat_open_us = (now_us() - start) / OPENS;
+
+    start = now_us();
+    for (int n = 0; n < OPENS; n++)
+    {
+        const std::string& g = guest[order[n]];
+        const PathEntry* e = path_index_lookup(g.data(), g.size());
+        if (e && host_file_open(e->host_path.c_str(), &file))
+            host_file_close(&file);
+        else
+            misses++;
+    }
+    double index_open_us = (now_us() - start) / OPENS;
+
+    printf("%zu files in %d directories, indexed in %.2f ms\n", guest.size(), dirs, mount_ms);
+    printf("%-14s  %12s  %12s\n", "", "resolve us", "open us");
+    printf("%-14s  %12.3f  %12.3f\n", "string + stat", stat_us, stat_open_us);
+    printf("%-14s  %12.3f  %12.3f\n", "index", index_us, index_open_us);
+    if (misses)
+        printf("%llu lookups failed\n", (unsigned long long)misses);
+
+    for (const std::string& path : host)
+        remove(path.c_str());
+    for (int d = 0; d < dirs; d++)
+        rmdir((std::string(ROOT) + "/Stage" + std::to_string(d)).c_str());
+    rmdir(ROOT);
+    return misses ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""
+Profile VMX/VMX128 usage in the XenonRecomp-generated sources.
+
+XenonRecomp writes the disassembly of every PPC instruction as a comment
+("// vperm128 v3,v1,v2,v0") right before the C++ it emits for it. This script
+uses those comments to find which vector ops the game uses and how each one
+is lowered (SIMDE intrinsics, ppc_context.h helpers or scalar per-lane code).
+
+Modes:
+  census (default)        Static count of VMX sites per mnemonic.
+  --instrument OUTDIR     Copy ppc/ into OUTDIR with PPC_VMX_COUNT(id) inserted
+                          after each VMX instruction, and write the matching
+                          ppc_vmx_profile_ids.h. Build that copy with
+                          -DPPC_VMX_PROFILE=1 and run the game; it writes
+                          vmx_profile.csv at exit.
+  --report CSV            Rank ops by executed count from vmx_profile.csv and
+                          show how each is currently lowered.
+
+Usage: py profile_vmx_ops.py [--ppc-dir ppc] [--instrument OUTDIR | --report CSV] [--top N]
+"""
+
+import argparse
+import csv
+import glob
+import os
+import re
+import shutil
+import sys
+from collections import defaultdict
+
+# "// vmsum3fp128 v0,v1,v2" — mnemonic may carry a record bit suffix (".")
+VMX_COMMENT_RE = re.compile(r'^(\s*)//\s+(v[a-z0-9]+\.?)\s')
+ANY_COMMENT_RE = re.compile(r'^\s*//\s+\S')
+INTRINSIC_RE = re.compile(r'\b(simde_mm_[a-z0-9_]+)\s*\(')
+
+
+# ============================================================================
+# Scanning
+# ============================================================================
+
+def recomp_sources(ppc_dir):
+    return sorted(glob.glob(os.path.join(ppc_dir, 'ppc_recomp.*.cpp')))
+
+
+def scan_file(path, sites, lowering):
+    """Record every VMX site in one generated file.
+
+    sites:    mnemonic -> static count
+    lowering: mnemonic -> set of intrinsics used (or "scalar")
+    """
+    with open(path, 'r', encoding='utf-8', errors='replace') as f:
+        lines = f.readlines()
+
+    current = None
+    used = set()
+    for line in lines:
+        m = VMX_COMMENT_RE.match(line)
+        if m or ANY_COMMENT_RE.match(line):
+            if current:
+                lowering[current].update(used or {'scalar'})
+            current = m.group(2).rstrip('.') if m else None
+            used = set()
+            if current:
+                sites[current] += 1
+            continue
+        if current:
+            used.update(INTRINSIC_RE.findall(line))
+    if current:
+        lowering[current].update(used or {'scalar'})
+
+
+def census(ppc_dir):
+    sites = defaultdict(int)
+    lowering = defaultdict(set)
+    files = recomp_sources(ppc_dir)
+    if not files:
+        print(f"No ppc_recomp.*.cpp files in {ppc_dir}. Run XenonRecomp first.")
+        sys.exit(1)
+    for path in files:
+        scan_file(path, sites, lowering)
+    return sites, lowering
+
+
+def describe(lower):
+    if lower == {'scalar'}:
+        return 'scalar per-lane code'
+    return ', '.join(sorted(lower))
+
+
+# ============================================================================
+# Instrumentation
+# ============================================================================
+
+def instrument(ppc_dir, out_dir, sites):
+    names = sorted(sites)
+    ids = {name: i for i, name in enumerate(names)}
+    os.makedirs(out_dir, exist_ok=True)
+
+    # Headers and non-recomp sources are copied unchanged
+    for path in glob.glob(os.path.join(ppc_dir, '*')):
+        if os.path.isfile(path):
+            shutil.copy2(path, out_dir)
+
+    for path in recomp_sources(ppc_dir):
+        with open(path, 'r', encoding='utf-8', errors='replace') as f:
+            lines = f.readlines()
+        out = []
+        for line in lines:
+            out.append(line)
+            m = VMX_COMMENT_RE.match(line)
+            if m:
+                name = m.group(2).rstrip('.')
+                out.append(f"{m.group(1)}PPC_VMX_COUNT({ids[name]});\n")
+        with open(os.path.join(out_dir, os.path.basename(path)), 'w', encoding='utf-8') as f:
+            f.writelines(out)
+
+    with open(os.path.join(out_dir, 'ppc_vmx_profile_ids.h'), 'w', encoding='utf-8') as f:
+        f.write("#pragma once\n")
+        f.write("// Generated by tools/profile_vmx_ops.py --instrument. Do not edit.\n\n")
+        f.write(f"#define PPC_VMX_OP_COUNT {len(names)}\n\n")
+        f.write("static const char* const kPpcVmxOpNames[PPC_VMX_OP_COUNT] = {\n")
+        for name in names:
+            f.write(f'    "{name}",\n')
+        f.write("};\n")
+
+    print(f"Instrumented {sum(sites.values())} VMX sites ({len(names)} ops) into {out_dir}")
+    print("Build with -DPPC_VMX_PROFILE=1 -DPPC_VMX_OVERRIDES and run to produce vmx_profile.csv")
+
+
+# ============================================================================
+# Main
+# ============================================================================
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--ppc-dir', default='ppc')
+    parser.add_argument('--instrument', metavar='OUTDIR')
+    parser.add_argument('--report', metavar='CSV')
+    parser.add_argument('--top', type=int, default=30)
+    args = parser.parse_args()
+
+    sites, lowering = census(args.ppc_dir)
+
+    if args.instrument:
+        instrument(args.ppc_dir, args.instrument, sites)
+        return
+
+    if args.report:
+        counts = {}
+        with open(args.report, newline='') as f:
+            for row in csv.DictReader(f):
+                counts[row['op']] = int(row['count'])
+        total = sum(counts.values()) or 1
+        ranked = sorted(counts.items(), key=lambda kv: kv[1], reverse=True)
+        print(f"{'op':<16} {'executed':>14} {'share':>7} {'sites':>6}  lowering")
+        for name, count in ranked[:args.top]:
+            print(f"{name:<16} {count:>14} {100.0 * count / total:>6.2f}% {sites.get(name, 0):>6}  "
+                  f"{describe(lowering.get(name, set()))}")
+        return
+
+    total = sum(sites.values())
+    ranked = sorted(sites.items(), key=lambda kv: kv[1], reverse=True)
+    print(f"{total} VMX sites, {len(sites)} distinct ops")
+    print(f"{'op':<16} {'sites':>6}  lowering")
+    for name, count in ranked[:args.top]:
+        print(f"{name:<16} {count:>6}  {describe(lowering[name])}")
+
+
+if __name__ == '__main__':
+    main()
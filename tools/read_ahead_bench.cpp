@@ -0,0 +1,150 @@
+// Benchmark for the trace-driven read-ahead in src/read_ahead.cpp. Plays a
+// few "stage transitions" against a cold page cache: each opens its own set
+// of files and reads them through in 64 KB chunks, with a little decode work
+// per chunk, the way the game streams a stage in. The first pass records the
+// traces; later passes replay the same transitions with prefetching off and
+// on, and print the time spent waiting in reads per transition.
+//
+// The cache is dropped with posix_fadvise DONTNEED, so this is Linux only,
+// and the files must not be dirty (they're synced first).
+//
+// Build:
+//   clang++ -std=c++20 -O2 -Isrc tools/read_ahead_bench.cpp src/read_ahead.cpp src/host_file.cpp
+//           -o read_ahead_bench -lpthread
+// Usage: read_ahead_bench [stages (default 3)] [files per stage (default 24)]
+
+#include "read_ahead.h"
+#include "host_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static constexpr uint32_t FILE_SIZE = 2 << 20;
+static constexpr uint32_t CHUNK = 64 * 1024;
+static constexpr double DECODE_US = 150.0; // per chunk
+
+static double now_us()
+{
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void spin_us(double us)
+{
+    double end = now_us() + us;
+    while (now_us() < end)
+    {
+    }
+}
+
+static void drop_cache(const std::vector<std::string>& paths)
+{
+    for (const std::string& path : paths)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// One transition; returns the microseconds spent in reads
+static double run_stage(const std::vector<std::string>& paths)
+{
+    std::vector<uint8_t> buf(CHUNK);
+    double stall = 0.0;
+    for (const std::string& path : paths)
+    {
+        HostFile file;
+        if (!host_file_open(path.c_str(), &file))
+            continue;
+        read_ahead_note_open(path.c_str());
+        for (int64_t off = 0; off < file.size; off += CHUNK)
+        {
+            double start = now_us();
+            host_file_read(&file, buf.data(), CHUNK, off);
+            double us = now_us() - start;
+            read_ahead_note_read(path.c_str(), off, CHUNK);
+            read_ahead_note_stall(us);
+            stall += us;
+            spin_us(DECODE_US);
+        }
+        host_file_close(&file);
+    }
+    return stall;
+}
+
+int main(int argc, char** argv)
+{
+    int stages = argc > 1 ? std::max(1, atoi(argv[1])) : 3;
+    int per_stage = argc > 2 ? std::max(1, atoi(argv[2])) : 24;
+
+    std::vector<std::vector<std::string>> stage_files(stages);
+    std::vector<std::string> all;
+    std::vector<uint8_t> data(FILE_SIZE);
+    std::mt19937 rng(7);
+    for (uint8_t& b : data)
+        b = (uint8_t)rng();
+    for (int s = 0; s < stages; s++)
+    {
+        for (int i = 0; i < per_stage; i++)
+        {
+            std::string path = "read_ahead_bench." + std::to_string(s) + "." + std::to_string(i) + ".tmp";
+            FILE* fp = fopen(path.c_str(), "wb");
+            if (!fp)
+            {
+                fprintf(stderr, "could not write %s\n", path.c_str());
+                return 1;
+            }
+            fwrite(data.data(), 1, data.size(), fp);
+            fclose(fp);
+            stage_files[s].push_back(path);
+            all.push_back(path);
+        }
+    }
+    const char* trace = "read_ahead_bench.trace.tmp";
+    remove(trace);
+    if (!read_ahead_open(trace))
+    {
+        fprintf(stderr, "could not write %s\n", trace);
+        return 1;
+    }
+
+    std::vector<std::vector<double>> stall(3, std::vector<double>(stages));
+    for (int pass = 0; pass < 3; pass++)
+    {
+        read_ahead_set_prefetch(pass == 2);
+        for (int s = 0; s < stages; s++)
+        {
+            drop_cache(all);
+            stall[pass][s] = run_stage(stage_files[s]);
+            // Idle long enough to end the sequence
+            std::this_thread::sleep_for(std::chrono::milliseconds(READ_AHEAD_IDLE_MS + 100));
+            read_ahead_frame();
+        }
+    }
+
+    printf("%d stages of %d x %u KB files, %u KB reads, %.0f us decode per read\n", stages, per_stage,
+           FILE_SIZE / 1024, CHUNK / 1024, DECODE_US);
+    printf("%-6s  %14s  %14s  %14s\n", "stage", "record ms", "no prefetch ms", "prefetch ms");
+    for (int s = 0; s < stages; s++)
+        printf("%-6d  %14.1f  %14.1f  %14.1f\n", s, stall[0][s] / 1000.0, stall[1][s] / 1000.0,
+               stall[2][s] / 1000.0);
+
+    for (const std::string& path : all)
+        remove(path.c_str());
+    remove(trace);
+    return 0;
+}
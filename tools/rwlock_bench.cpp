@@ -0,0 +1,184 @@
+// Stress benchmark for the ExAcquireReadWriteLock* implementation in
+// src/rw_lock.cpp. Scales reader threads from 1 up to the host core count
+// against one writer that updates the guarded record every 100 us, and
+// reports read throughput next to the same load with every acquire taken
+// exclusive (what the stubs did before, in Host mode). Readers check that
+// they never see a half-written record; the writer's wait times show
+// whether readers can starve it.
+//
+// Build (ppc_context.h is generated by XenonRecomp into ppc/):
+//   clang++ -std=c++20 -O2 -Isrc -Ippc -Itools/XenonRecomp/thirdparty/simde
+//           tools/rwlock_bench.cpp src/rw_lock.cpp src/scheduler.cpp
+//           src/kernel_objects.cpp src/critical_section.cpp
+//           src/timer_wheel.cpp src/fiber.cpp src/replay.cpp src/apc.cpp
+//           src/guest_heap.cpp src/guest_pool.cpp src/vm_regions.cpp
+//           src/file_io.cpp src/host_file.cpp -o rwlock_bench -lpthread
+// Usage: rwlock_bench [duration_ms] [max_readers (default: core count)]
+
+#include "ppc_config.h"
+#include "ppc_context.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "rw_lock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static constexpr uint32_t LOCK_ADDR = 0x70000000;
+static constexpr uint32_t DATA_ADDR = 0x70000100; // guarded record
+static constexpr int DATA_WORDS = 8;
+static constexpr int WRITE_INTERVAL_US = 100;
+
+static uint8_t* g_base = nullptr;
+static int g_duration_ms = 300;
+
+static std::atomic<bool> g_stop{false};
+static std::atomic<uint64_t> g_torn_reads{0};
+
+static double now_us()
+{
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct RunResult
+{
+    uint64_t reads;
+    uint64_t writes;
+    double   writer_wait_avg_us;
+    double   writer_wait_max_us;
+};
+
+static void reader_proc(bool exclusive, uint64_t* reads)
+{
+    uint8_t* base = g_base;
+    uint64_t n = 0;
+    while (!g_stop.load(std::memory_order_relaxed))
+    {
+        if (exclusive)
+            rw_acquire_exclusive(base, LOCK_ADDR);
+        else
+            rw_acquire_shared(base, LOCK_ADDR);
+        uint32_t first = PPC_LOAD_U32(DATA_ADDR);
+        for (int i = 1; i < DATA_WORDS; i++)
+        {
+            if (PPC_LOAD_U32(DATA_ADDR + i * 4) != first)
+                g_torn_reads++;
+        }
+        rw_release(base, LOCK_ADDR);
+        n++;
+    }
+    *reads = n;
+}
+
+static void writer_proc(RunResult* result)
+{
+    uint8_t* base = g_base;
+    uint64_t writes = 0;
+    double wait_sum = 0.0, wait_max = 0.0;
+    uint32_t value = 0;
+    while (!g_stop.load(std::memory_order_relaxed))
+    {
+        double t0 = now_us();
+        rw_acquire_exclusive(base, LOCK_ADDR);
+        double waited = now_us() - t0;
+        value++;
+        for (int i = 0; i < DATA_WORDS; i++)
+            PPC_STORE_U32(DATA_ADDR + i * 4, value);
+        rw_release(base, LOCK_ADDR);
+        writes++;
+        wait_sum += waited;
+        wait_max = std::max(wait_max, waited);
+        std::this_thread::sleep_for(std::chrono::microseconds(WRITE_INTERVAL_US));
+    }
+    result->writes = writes;
+    result->writer_wait_avg_us = writes ? wait_sum / writes : 0.0;
+    result->writer_wait_max_us = wait_max;
+}
+
+static RunResult run(int readers, bool exclusive)
+{
+    rw_init(g_base, LOCK_ADDR);
+    g_stop = false;
+    RunResult result = {};
+    std::vector<uint64_t> reads(readers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; i++)
+        threads.emplace_back(reader_proc, exclusive, &reads[i]);
+    threads.emplace_back(writer_proc, &result);
+    std::this_thread::sleep_for(std::chrono::milliseconds(g_duration_ms));
+    g_stop = true;
+    for (std::thread& t : threads)
+        t.join();
+    for (uint64_t n : reads)
+        result.reads += n;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+    int max_readers = cores;
+    if (argc > 1)
+        g_duration_ms = atoi(argv[1]);
+    if (argc > 2)
+        max_readers = std::max(1, atoi(argv[2]));
+
+#ifdef _WIN32
+    g_base = (uint8_t*)VirtualAlloc(nullptr, PPC_MEM_TOTAL_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    g_base = (uint8_t*)mmap(nullptr, PPC_MEM_TOTAL_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (g_base == MAP_FAILED)
+        g_base = nullptr;
+#endif
+    if (!g_base)
+    {
+        fprintf(stderr, "Failed to allocate guest memory\n");
+        return 1;
+    }
+    // Host mode: waiters park on their own host thread
+    if (!scheduler_init(ThreadMode::Host))
+    {
+        fprintf(stderr, "scheduler_init failed\n");
+        return 1;
+    }
+
+    std::vector<int> counts;
+    for (int n = 1; n < max_readers; n *= 2)
+        counts.push_back(n);
+    counts.push_back(max_readers);
+
+    printf("Read/write lock, %d ms per run, 1 writer every %d us, %d cores\n",
+           g_duration_ms, WRITE_INTERVAL_US, cores);
+    printf("  readers   shared Mreads/s   exclusive Mreads/s   speedup   writes   writer wait avg / max us\n");
+    for (int n : counts)
+    {
+        RunResult shared = run(n, false);
+        RunResult exclusive = run(n, true);
+        double secs = g_duration_ms / 1000.0;
+        double shared_rate = shared.reads / secs / 1e6;
+        double exclusive_rate = exclusive.reads / secs / 1e6;
+        printf("  %7d   %17.2f   %18.2f   %6.2fx   %6llu   %10.1f / %.1f\n",
+               n, shared_rate, exclusive_rate, exclusive_rate > 0 ? shared_rate / exclusive_rate : 0.0,
+               (unsigned long long)shared.writes, shared.writer_wait_avg_us, shared.writer_wait_max_us);
+    }
+    printf("Torn reads: %llu (%s)\n", (unsigned long long)g_torn_reads.load(),
+           g_torn_reads.load() ? "FAILED" : "ok");
+    return g_torn_reads.load() ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+// KeTls* microbenchmark for the per-thread TLS slots in src/scheduler.cpp.
+// Times scheduler_tls_get / scheduler_tls_set from the main thread (host
+// waiter) and from a guest thread running as a fiber, next to the single
+// thread_local array the stubs used before. Also checks that guest
+// threads sharing a slot each see their own value, and that each value is
+// mirrored into the thread's KTHREAD.
+//
+// Build (ppc_context.h is generated by XenonRecomp into ppc/):
+//   clang++ -std=c++20 -O2 -Isrc -Ippc -Itools/XenonRecomp/thirdparty/simde
+//           tools/tls_bench.cpp src/scheduler.cpp src/kernel_objects.cpp
+//           src/timer_wheel.cpp src/fiber.cpp src/critical_section.cpp
+//           src/replay.cpp src/apc.cpp src/guest_heap.cpp src/guest_pool.cpp
+//           src/vm_regions.cpp src/file_io.cpp src/host_file.cpp
+//           -o tls_bench -lpthread
+// Usage: tls_bench [iterations]
+
+#include "ppc_config.h"
+#include "ppc_context.h"
+#include "memory.h"
+#include "scheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static uint64_t g_iterations = 50000000;
+static uint8_t* g_base = nullptr;
+static volatile uint32_t g_sink = 0;
+
+static double now_ns()
+{
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================================
+// Baseline: one thread_local array for every guest thread on a host thread
+// ============================================================================
+static thread_local uint32_t t_old_slots[SCHEDULER_TLS_SLOTS];
+
+// Volatile so the loops below can't be folded away
+static __attribute__((noinline)) uint32_t old_get(uint32_t index)
+{
+    return *(volatile uint32_t*)&t_old_slots[index];
+}
+static __attribute__((noinline)) void old_set(uint32_t index, uint32_t value)
+{
+    *(volatile uint32_t*)&t_old_slots[index] = value;
+}
+
+static void bench(const char* label)
+{
+    uint32_t index = 5;
+    uint32_t acc = 0;
+
+    double t0 = now_ns();
+    for (uint64_t i = 0; i < g_iterations; i++)
+        scheduler_tls_set(g_base, index, (uint32_t)i);
+    double t1 = now_ns();
+    for (uint64_t i = 0; i < g_iterations; i++)
+        acc += scheduler_tls_get(index);
+    double t2 = now_ns();
+    for (uint64_t i = 0; i < g_iterations; i++)
+        old_set(index, (uint32_t)i);
+    double t3 = now_ns();
+    for (uint64_t i = 0; i < g_iterations; i++)
+        acc += old_get(index);
+    double t4 = now_ns();
+    g_sink = acc;
+
+    double n = (double)g_iterations;
+    printf("  %-12s set %5.2f ns  get %5.2f ns   (thread_local array: set %5.2f ns  get %5.2f ns)\n",
+           label, (t1 - t0) / n, (t2 - t1) / n, (t3 - t2) / n, (t4 - t3) / n);
+}
+
+// ============================================================================
+// Guest threads
+// ============================================================================
+static constexpr uint32_t BENCH_FUNC = 0x820A0100;
+static constexpr uint32_t CHECK_FUNC = 0x820A0200;
+static constexpr uint32_t CHECK_SLOT = 7;
+static int g_check_failures = 0;
+
+static void bench_thread(PPCContext& __restrict ctx, uint8_t* base)
+{
+    bench("guest fiber");
+}
+
+// Each instance stores its own value, lets the others run, then checks it.
+static void check_thread(PPCContext& __restrict ctx, uint8_t* base)
+{
+    uint32_t value = 0x1000 + ctx.r3.u32;
+    scheduler_tls_set(base, CHECK_SLOT, value);
+    for (int i = 0; i < 10; i++)
+    {
+        scheduler_yield();
+        if (scheduler_tls_get(CHECK_SLOT) != value)
+            g_check_failures++;
+    }
+    uint32_t kthread = PPC_LOAD_U32(ctx.r13.u32 + 0x100);
+    if (PPC_LOAD_U32(kthread + PPC_KTHREAD_TLS_OFFSET + CHECK_SLOT * 4) != value)
+        g_check_failures++;
+}
+
+static void run_thread(PPCContext& ctx, uint32_t func, uint32_t context)
+{
+    static uint32_t next_handle = 0x100;
+    scheduler_create_thread(ctx, g_base, next_handle++, func, context, 0, false);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+        g_iterations = strtoull(argv[1], nullptr, 10);
+
+#ifdef _WIN32
+    g_base = (uint8_t*)VirtualAlloc(nullptr, PPC_MEM_TOTAL_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    g_base = (uint8_t*)mmap(nullptr, PPC_MEM_TOTAL_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (g_base == MAP_FAILED)
+        g_base = nullptr;
+#endif
+    if (!g_base)
+    {
+        fprintf(stderr, "Failed to allocate guest memory\n");
+        return 1;
+    }
+    uint8_t* base = g_base;
+    PPC_LOOKUP_FUNC(base, BENCH_FUNC) = bench_thread;
+    PPC_LOOKUP_FUNC(base, CHECK_FUNC) = check_thread;
+
+    if (!scheduler_init(ThreadMode::Fiber))
+    {
+        fprintf(stderr, "scheduler_init failed\n");
+        return 1;
+    }
+    PPCContext ctx{};
+    ctx.r1.u32 = PPC_STACK_BASE - 16;
+    ctx.r13.u32 = PPC_KPCR_BASE;
+    PPC_STORE_U32(PPC_KPCR_BASE + 0x100, PPC_KTHREAD_BASE);
+
+    printf("KeTls* get/set, %llu iterations each\n", (unsigned long long)g_iterations);
+    bench("main thread");
+    run_thread(ctx, BENCH_FUNC, 0); // runs at once (Fiber mode, created from main)
+
+    // Isolation: four fibers share a slot; main keeps its own value
+    scheduler_tls_set(base, CHECK_SLOT, 0xAAAA);
+    for (uint32_t i = 0; i < 4; i++)
+        run_thread(ctx, CHECK_FUNC, i);
+    for (int i = 0; i < 20; i++)
+        scheduler_frame_begin();
+    if (scheduler_tls_get(CHECK_SLOT) != 0xAAAA ||
+        PPC_LOAD_U32(PPC_KTHREAD_BASE + PPC_KTHREAD_TLS_OFFSET + CHECK_SLOT * 4) != 0xAAAA)
+        g_check_failures++;
+    printf("Isolation check: %s\n", g_check_failures ? "FAILED" : "ok");
+    return g_check_failures ? 1 : 0;
+}
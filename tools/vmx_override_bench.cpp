@@ -0,0 +1,166 @@
+// Bit-exactness check and microbenchmark for ppc/ppc_vmx_overrides.h.
+// Each override is compared against two references, over random bit patterns
+// plus NaN/Inf/denormal/signed-zero edge cases, with MXCSR in both the
+// default and the flush-to-zero mode the generated code switches to:
+//
+//   native    the SIMDE path it replaces, compiled with the same flags
+//             (-msse4.1: DPPS). Must match; the override relies on it.
+//   portable  SIMDE as the default build runs it (PPC_VMX_OVERRIDES=OFF, no
+//             -msse4.1), from tools/vmx_override_bench_portable.cpp. A
+//             mismatch means turning the option on changes results against
+//             a default build, e.g. through a different summation order.
+//
+// Then each op is timed in a dependent chain against both; the portable
+// column is what enabling the option actually replaces.
+//
+// Build (needs the XenonRecomp SIMDE headers; the portable reference gets
+// the ppc_recomp flags, without -msse4.1):
+//   clang++ -std=c++20 -O2 -fno-strict-aliasing -Itools/XenonRecomp/thirdparty/simde
+//           -c tools/vmx_override_bench_portable.cpp -o vmx_override_bench_portable.o
+//   clang++ -std=c++20 -O2 -msse4.1 -Itools/XenonRecomp/thirdparty/simde -Ippc
+//           tools/vmx_override_bench.cpp vmx_override_bench_portable.o -o vmx_override_bench
+// Usage: vmx_override_bench [iterations]
+
+#include <x86/avx.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+// Reference implementations: plain SIMDE, captured before the overrides
+// header redirects the intrinsics.
+static simde__m128 ref_dp_ps_ef(simde__m128 a, simde__m128 b) { return simde_mm_dp_ps(a, b, 0xEF); }
+static simde__m128 ref_dp_ps_ff(simde__m128 a, simde__m128 b) { return simde_mm_dp_ps(a, b, 0xFF); }
+
+// Default build (vmx_override_bench_portable.cpp)
+simde__m128 portable_dp_ps_ef(simde__m128 a, simde__m128 b);
+simde__m128 portable_dp_ps_ff(simde__m128 a, simde__m128 b);
+
+#include "ppc_vmx_overrides.h"
+
+#if !defined(SIMDE_X86_SSE4_1_NATIVE)
+#error "Build with -msse4.1 (or -mavx2): the overrides are only active on native SSE4.1 targets"
+#endif
+
+static simde__m128 ovr_dp_ps_ef(simde__m128 a, simde__m128 b) { return simde_mm_dp_ps(a, b, 0xEF); }
+static simde__m128 ovr_dp_ps_ff(simde__m128 a, simde__m128 b) { return simde_mm_dp_ps(a, b, 0xFF); }
+
+typedef simde__m128 (*BinaryPs)(simde__m128, simde__m128);
+
+struct OpCase
+{
+    const char* name;   // VMX instruction that emits this pattern
+    BinaryPs    ref;      // native SIMDE, same flags
+    BinaryPs    portable; // SIMDE in the default build
+    BinaryPs    ovr;
+};
+
+static const OpCase kOps[] = {
+    { "vmsum3fp128 (dp_ps 0xEF)", ref_dp_ps_ef, portable_dp_ps_ef, ovr_dp_ps_ef },
+    { "vmsum4fp128 (dp_ps 0xFF)", ref_dp_ps_ff, portable_dp_ps_ff, ovr_dp_ps_ff },
+};
+
+static const uint32_t kSpecialBits[] = {
+    0x00000000, 0x80000000, // +0, -0
+    0x7F800000, 0xFF800000, // +Inf, -Inf
+    0x7FC00000, 0xFFC00001, // quiet NaNs (different payloads)
+    0x7F800001,             // signaling NaN
+    0x00000001, 0x807FFFFF, // denormals
+    0x7F7FFFFF, 0xFF7FFFFF, // +/- FLT_MAX
+    0x3F800000, 0xBF800000, // +/- 1
+};
+
+static simde__m128 make_vec(std::mt19937& rng, bool specials)
+{
+    uint32_t bits[4];
+    for (int i = 0; i < 4; i++)
+    {
+        if (specials && (rng() & 3) == 0)
+            bits[i] = kSpecialBits[rng() % (sizeof(kSpecialBits) / sizeof(kSpecialBits[0]))];
+        else
+            bits[i] = rng();
+    }
+    simde__m128 v;
+    memcpy(&v, bits, sizeof(v));
+    return v;
+}
+
+// The override against one reference; returns the mismatches
+static uint64_t check_op(const OpCase& op, BinaryPs ref, const char* ref_name, uint64_t samples)
+{
+    static const unsigned int kModes[] = { 0x1F80, 0x9FC0 }; // default, FTZ|DAZ
+    std::mt19937 rng(12345);
+    uint64_t mismatches = 0;
+    for (unsigned int mode : kModes)
+    {
+        _mm_setcsr(mode);
+        for (uint64_t i = 0; i < samples; i++)
+        {
+            simde__m128 a = make_vec(rng, (i & 1) != 0);
+            simde__m128 b = make_vec(rng, (i & 2) != 0);
+            simde__m128 r = ref(a, b);
+            simde__m128 o = op.ovr(a, b);
+            if (memcmp(&r, &o, sizeof(r)) != 0)
+            {
+                if (++mismatches <= 5)
+                {
+                    uint32_t ra[4], oa[4];
+                    memcpy(ra, &r, sizeof(ra));
+                    memcpy(oa, &o, sizeof(oa));
+                    fprintf(stderr, "  MISMATCH %s vs %s (mxcsr=0x%04X): ref=%08X %08X %08X %08X ovr=%08X %08X %08X %08X\n",
+                            op.name, ref_name, mode, ra[0], ra[1], ra[2], ra[3], oa[0], oa[1], oa[2], oa[3]);
+                }
+            }
+        }
+    }
+    _mm_setcsr(0x1F80);
+    const size_t modes = sizeof(kModes) / sizeof(kModes[0]);
+    printf("  %-28s vs %-8s %s (%llu of %llu differ: %llu samples x %zu MXCSR modes)\n", op.name, ref_name,
+           mismatches ? "FAIL" : "bit-exact", (unsigned long long)mismatches,
+           (unsigned long long)(samples * modes), (unsigned long long)samples, modes);
+    return mismatches;
+}
+
+static double time_op(BinaryPs fn, uint64_t iterations)
+{
+    simde__m128 a = simde_mm_set_ps(0.25f, 0.5f, 0.75f, 1.0f);
+    simde__m128 b = simde_mm_set_ps(1.0f, 0.5f, 0.25f, 0.125f);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++)
+        a = fn(a, b); // dependent chain: measures latency as the recompiled code sees it
+    auto end = std::chrono::steady_clock::now();
+    volatile float sink = simde_mm_cvtss_f32(a);
+    (void)sink;
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double)iterations;
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t iterations = 50000000;
+    if (argc > 1)
+        iterations = strtoull(argv[1], nullptr, 10);
+
+    printf("=== VMX override bit-exactness ===\n");
+    bool ok = true;
+    for (const OpCase& op : kOps)
+    {
+        ok &= check_op(op, op.ref, "native", 1000000) == 0;
+        ok &= check_op(op, op.portable, "portable", 1000000) == 0;
+    }
+
+    printf("\n=== VMX override microbenchmark (%llu iterations) ===\n", (unsigned long long)iterations);
+    printf("  %-28s %12s %10s %12s %12s %12s\n", "op", "portable ns", "dpps ns", "override ns",
+           "vs portable", "vs dpps");
+    for (const OpCase& op : kOps)
+    {
+        double portable_ns = time_op(op.portable, iterations);
+        double ref_ns = time_op(op.ref, iterations);
+        double ovr_ns = time_op(op.ovr, iterations);
+        printf("  %-28s %12.3f %10.3f %12.3f %11.2fx %11.2fx\n", op.name, portable_ns, ref_ns, ovr_ns,
+               portable_ns / ovr_ns, ref_ns / ovr_ns);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+// Second reference for tools/vmx_override_bench.cpp: the SIMDE ops as the
+// default build runs them (PPC_VMX_OVERRIDES=OFF, no -msse4.1), i.e. SIMDE's
+// portable fallback instead of native DPPS. Compiled on its own with the
+// ppc_recomp flags; see the build lines in vmx_override_bench.cpp.
+
+#include <x86/avx.h>
+
+#if defined(SIMDE_X86_SSE4_1_NATIVE)
+#error "Build this file without -msse4.1: it stands in for the default build"
+#endif
+
+simde__m128 portable_dp_ps_ef(simde__m128 a, simde__m128 b) { return simde_mm_dp_ps(a, b, 0xEF); }
+simde__m128 portable_dp_ps_ff(simde__m128 a, simde__m128 b) { return simde_mm_dp_ps(a, b, 0xFF); }